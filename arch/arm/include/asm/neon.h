@@ -0,0 +1,27 @@
+/*
+ * linux/arch/arm/include/asm/neon.h
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __ASM_ARM_NEON_H
+#define __ASM_ARM_NEON_H
+
+#include <asm/hwcap.h>
+
+#define cpu_has_neon()		(!!(elf_hwcap & HWCAP_NEON))
+
+/*
+ * Kernel code may only touch the NEON registers between these calls.
+ * Preemption is disabled in between, so keep such sections short; they
+ * must not be used from interrupt context. The kernel is built soft-float,
+ * so NEON code has to live in assembly and the compiler never keeps any
+ * of its own values in those registers.
+ */
+#ifdef CONFIG_KERNEL_MODE_NEON
+void kernel_neon_begin(void);
+void kernel_neon_end(void);
+#endif
+
+#endif /* __ASM_ARM_NEON_H */
@@ -202,6 +202,24 @@ void flush_cpu_dcache(void *vaddr, u32 paddr, u32 length, bool inner_only,
 	}
 }
 
+u32 get_dcache_clean_all_breakpoint(bool inner_only)
+{
+	if (inner_only)
+		return inner_clean_breakpoint;
+
+	/* Outer clean is done as a flush, see clean_cpu_dcache() */
+	return max(inner_clean_breakpoint, outer_flush_breakpoint);
+}
+
+u32 get_dcache_flush_all_breakpoint(bool inner_only)
+{
+	if (inner_only)
+		return inner_flush_breakpoint;
+
+	return max3(inner_clean_breakpoint, inner_flush_breakpoint,
+						outer_flush_breakpoint);
+}
+
 bool speculative_data_prefetch(void)
 {
 	return true;
@@ -19,6 +19,12 @@ void clean_cpu_dcache(void *vaddr, u32 paddr, u32 length, bool inner_only,
 						bool *cleaned_everything);
 void flush_cpu_dcache(void *vaddr, u32 paddr, u32 length, bool inner_only,
 						bool *flushed_everything);
+/*
+ * Total length of range operations from which a single whole cache operation
+ * is cheaper.
+ */
+u32 get_dcache_clean_all_breakpoint(bool inner_only);
+u32 get_dcache_flush_all_breakpoint(bool inner_only);
 bool speculative_data_prefetch(void);
 /* Returns 1 if no cache is present */
 u32 get_dcache_granularity(void);
@@ -19,6 +19,7 @@
 #include <linux/init.h>
 
 #include <asm/cputype.h>
+#include <asm/neon.h>
 #include <asm/thread_notify.h>
 #include <asm/vfp.h>
 
@@ -508,6 +509,50 @@ void vfp_flush_hwstate(struct thread_info *thread)
 	put_cpu();
 }
 
+#ifdef CONFIG_KERNEL_MODE_NEON
+
+/*
+ * Save whatever state the hardware holds into its owner and forget the
+ * owner, so that the next user space VFP/NEON access reloads it, then
+ * enable the unit for the kernel.
+ */
+void kernel_neon_begin(void)
+{
+	struct thread_info *thread = current_thread_info();
+	unsigned int cpu;
+	u32 fpexc;
+
+	BUG_ON(in_interrupt());
+	cpu = get_cpu();
+
+	fpexc = fmrx(FPEXC) | FPEXC_EN;
+	fmxr(FPEXC, fpexc);
+
+	/*
+	 * Under UP the owner of the hardware state may be a task other
+	 * than current; under SMP it was saved at the last context switch
+	 * unless it is ours.
+	 */
+	if (vfp_current_hw_state[cpu] == &thread->vfpstate)
+		vfp_save_state(&thread->vfpstate, fpexc);
+#ifndef CONFIG_SMP
+	else if (vfp_current_hw_state[cpu] != NULL)
+		vfp_save_state(vfp_current_hw_state[cpu], fpexc);
+#endif
+	vfp_current_hw_state[cpu] = NULL;
+}
+EXPORT_SYMBOL(kernel_neon_begin);
+
+void kernel_neon_end(void)
+{
+	/* Disable the unit again, so the next user access traps and reloads */
+	fmxr(FPEXC, fmrx(FPEXC) & ~FPEXC_EN);
+	put_cpu();
+}
+EXPORT_SYMBOL(kernel_neon_end);
+
+#endif /* CONFIG_KERNEL_MODE_NEON */
+
 /*
  * VFP hardware can lose all context when a CPU goes offline.
  * As we will be running in SMP mode with CPU hotplug, we will save the
@@ -469,6 +469,13 @@ static int enter_sleep(struct cpuidle_device *dev,
 		/* "target" will be last_state in the cpuidle framework */
 		goto exit_fast;
 
+	/*
+	 * The governor picked its state for this cpu alone; the state
+	 * really entered also depends on the other cpu, and is what
+	 * wakeup placement should weigh.
+	 */
+	sched_idle_set_state(&dev->states[target]);
+
 	/* Only one CPU should master the sleeping sequence */
 	if (cstates[target].ARM != ARM_ON) {
 		smp_mb();
@@ -100,8 +100,14 @@ static void cpuidle_idle_call(void)
 	trace_power_start(POWER_CSTATE, next_state, dev->cpu);
 	trace_cpu_idle(next_state, dev->cpu);
 
+	/* Tell the scheduler that the idle state is entered */
+	sched_idle_set_state(target_state);
+
 	dev->last_residency = target_state->enter(dev, target_state);
 
+	/* The cpu is no longer idle or about to enter idle */
+	sched_idle_set_state(NULL);
+
 	trace_power_end(dev->cpu);
 	trace_cpu_idle(PWR_EVENT_EXIT, dev->cpu);
 
@@ -136,6 +142,11 @@ void cpuidle_uninstall_idle_handler(void)
 	if (enabled_devices && pm_idle_old && (pm_idle != pm_idle_old)) {
 		pm_idle = pm_idle_old;
 		cpuidle_kick_cpus();
+		/*
+		 * Make sure nobody looks at the idle states of the device
+		 * any more: sched_idle_set_state() users run under RCU.
+		 */
+		synchronize_rcu();
 	}
 }
 
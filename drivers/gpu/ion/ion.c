@@ -140,6 +140,7 @@ static struct ion_buffer *ion_buffer_create(struct ion_heap *heap,
 				     unsigned long flags)
 {
 	struct ion_buffer *buffer;
+	ktime_t start;
 	int ret;
 
 	buffer = kzalloc(sizeof(struct ion_buffer), GFP_KERNEL);
@@ -147,9 +148,12 @@ static struct ion_buffer *ion_buffer_create(struct ion_heap *heap,
 		return ERR_PTR(-ENOMEM);
 
 	buffer->heap = heap;
+	buffer->flags = flags;
 	kref_init(&buffer->ref);
 
+	start = ktime_get();
 	ret = heap->ops->allocate(heap, buffer, len, align, flags);
+	ion_heap_latency_record(&heap->alloc_latency, start);
 	if (ret) {
 		kfree(buffer);
 		return ERR_PTR(ret);
@@ -161,16 +165,32 @@ static struct ion_buffer *ion_buffer_create(struct ion_heap *heap,
 	return buffer;
 }
 
-static void ion_buffer_destroy(struct kref *kref)
+/* frees a buffer that is referenced by nobody and known to nobody */
+void ion_buffer_destroy(struct ion_buffer *buffer)
+{
+	/* heaps may have set up mappings that die with the buffer */
+	if (WARN_ON(buffer->kmap_cnt > 0))
+		buffer->heap->ops->unmap_kernel(buffer->heap, buffer);
+	if (WARN_ON(buffer->dmap_cnt > 0))
+		buffer->heap->ops->unmap_dma(buffer->heap, buffer);
+	buffer->heap->ops->free(buffer);
+	kfree(buffer);
+}
+
+static void _ion_buffer_destroy(struct kref *kref)
 {
 	struct ion_buffer *buffer = container_of(kref, struct ion_buffer, ref);
+	struct ion_heap *heap = buffer->heap;
 	struct ion_device *dev = buffer->dev;
+	ktime_t start = ktime_get();
 
-	buffer->heap->ops->free(buffer);
 	mutex_lock(&dev->lock);
 	rb_erase(&buffer->node, &dev->buffers);
 	mutex_unlock(&dev->lock);
-	kfree(buffer);
+
+	if (!ion_heap_freelist_add(heap, buffer))
+		ion_buffer_destroy(buffer);
+	ion_heap_latency_record(&heap->free_latency, start);
 }
 
 static void ion_buffer_get(struct ion_buffer *buffer)
@@ -180,7 +200,7 @@ static void ion_buffer_get(struct ion_buffer *buffer)
 
 static int ion_buffer_put(struct ion_buffer *buffer)
 {
-	return kref_put(&buffer->ref, ion_buffer_destroy);
+	return kref_put(&buffer->ref, _ion_buffer_destroy);
 }
 
 static struct ion_handle *ion_handle_create(struct ion_client *client,
@@ -306,6 +326,14 @@ struct ion_handle *ion_alloc(struct ion_client *client, size_t len,
 		if (!((1 << heap->id) & flags))
 			continue;
 		buffer = ion_buffer_create(heap, dev, len, align, flags);
+		/*
+		 * The memory may only be waiting for the idle priority
+		 * deferred free thread, give it back now and try again.
+		 */
+		if (IS_ERR_OR_NULL(buffer) && heap->task &&
+		    ion_heap_freelist_drain(heap))
+			buffer = ion_buffer_create(heap, dev, len, align,
+						   flags);
 		if (!IS_ERR_OR_NULL(buffer))
 			break;
 	}
@@ -1118,6 +1146,7 @@ static int ion_debug_heap_show(struct seq_file *s, void *unused)
 	struct ion_heap *heap = s->private;
 	struct ion_device *dev = heap->dev;
 	struct rb_node *n;
+	int i;
 
 	seq_printf(s, "%16.s %16.s %16.s\n", "client", "pid", "size");
 	for (n = rb_first(&dev->user_clients); n; n = rb_next(n)) {
@@ -1142,6 +1171,28 @@ static int ion_debug_heap_show(struct seq_file *s, void *unused)
 		seq_printf(s, "%16.s %16u %16u\n", client->name, client->pid,
 			   size);
 	}
+
+	if (heap->task)
+		seq_printf(s, "\ndeferred free: %zu of %zu bytes waiting\n",
+			   ion_heap_freelist_size(heap), heap->free_list_max);
+
+	seq_printf(s, "\n%16s %16s %16s %16s\n", "latency (us)", "alloc",
+		   "free", "deferred free");
+	for (i = 0; i < ION_LATENCY_BUCKETS; i++) {
+		char range[16];
+
+		if (i == 0)
+			snprintf(range, sizeof(range), "0");
+		else if (i == ION_LATENCY_BUCKETS - 1)
+			snprintf(range, sizeof(range), ">= %u", 1U << (i - 1));
+		else
+			snprintf(range, sizeof(range), "%u - %u",
+				 1U << (i - 1), (1U << i) - 1);
+		seq_printf(s, "%16s %16d %16d %16d\n", range,
+			   atomic_read(&heap->alloc_latency.count[i]),
+			   atomic_read(&heap->free_latency.count[i]),
+			   atomic_read(&heap->deferred_latency.count[i]));
+	}
 	return 0;
 }
 
@@ -15,9 +15,140 @@
  */
 
 #include <linux/err.h>
+#include <linux/freezer.h>
 #include <linux/ion.h>
+#include <linux/kthread.h>
+#include <linux/list.h>
+#include <linux/sched.h>
+#include <linux/spinlock.h>
 #include "ion_priv.h"
 
+void ion_heap_latency_record(struct ion_heap_latency *latency, ktime_t start)
+{
+	s64 us = ktime_to_us(ktime_sub(ktime_get(), start));
+	int bucket = 0;
+
+	if (us > 0)
+		bucket = min(fls64(us), ION_LATENCY_BUCKETS - 1);
+	atomic_inc(&latency->count[bucket]);
+}
+
+bool ion_heap_freelist_add(struct ion_heap *heap, struct ion_buffer *buffer)
+{
+	if (!heap->task)
+		return false;
+
+	spin_lock(&heap->free_lock);
+	if (heap->free_list_size + buffer->size > heap->free_list_max) {
+		spin_unlock(&heap->free_lock);
+		return false;
+	}
+	list_add_tail(&buffer->list, &heap->free_list);
+	heap->free_list_size += buffer->size;
+	spin_unlock(&heap->free_lock);
+
+	wake_up(&heap->waitqueue);
+	return true;
+}
+
+size_t ion_heap_freelist_size(struct ion_heap *heap)
+{
+	size_t size;
+
+	spin_lock(&heap->free_lock);
+	size = heap->free_list_size;
+	spin_unlock(&heap->free_lock);
+
+	return size;
+}
+
+size_t ion_heap_freelist_drain(struct ion_heap *heap)
+{
+	struct ion_buffer *buffer;
+	size_t size, total = 0;
+
+	spin_lock(&heap->free_lock);
+	while (!list_empty(&heap->free_list)) {
+		buffer = list_first_entry(&heap->free_list, struct ion_buffer,
+					  list);
+		list_del(&buffer->list);
+		spin_unlock(&heap->free_lock);
+
+		size = buffer->size;
+		ion_buffer_destroy(buffer);
+		total += size;
+
+		spin_lock(&heap->free_lock);
+		heap->free_list_size -= size;
+	}
+	spin_unlock(&heap->free_lock);
+
+	return total;
+}
+
+static int ion_heap_deferred_free(void *data)
+{
+	struct ion_heap *heap = data;
+	struct ion_buffer *buffer;
+	size_t size;
+	ktime_t start;
+
+	set_freezable();
+
+	for (;;) {
+		wait_event_freezable(heap->waitqueue,
+				     !list_empty(&heap->free_list) ||
+				     kthread_should_stop());
+
+		spin_lock(&heap->free_lock);
+		if (list_empty(&heap->free_list)) {
+			spin_unlock(&heap->free_lock);
+			/* only stop once everything queued is freed */
+			if (kthread_should_stop())
+				break;
+			continue;
+		}
+		buffer = list_first_entry(&heap->free_list, struct ion_buffer,
+					  list);
+		list_del(&buffer->list);
+		spin_unlock(&heap->free_lock);
+
+		/* the buffer counts against the limit until it is gone */
+		size = buffer->size;
+		start = ktime_get();
+		ion_buffer_destroy(buffer);
+		ion_heap_latency_record(&heap->deferred_latency, start);
+
+		spin_lock(&heap->free_lock);
+		heap->free_list_size -= size;
+		spin_unlock(&heap->free_lock);
+	}
+
+	return 0;
+}
+
+int ion_heap_init_deferred_free(struct ion_heap *heap, size_t max)
+{
+	struct sched_param param = { .sched_priority = 0 };
+
+	INIT_LIST_HEAD(&heap->free_list);
+	heap->free_list_size = 0;
+	spin_lock_init(&heap->free_lock);
+	init_waitqueue_head(&heap->waitqueue);
+	heap->free_list_max = max;
+
+	heap->task = kthread_run(ion_heap_deferred_free, heap,
+				 "ion_%s", heap->name);
+	if (IS_ERR(heap->task)) {
+		pr_err("%s: creating thread for deferred free failed\n",
+		       __func__);
+		heap->task = NULL;
+		return -ENOMEM;
+	}
+	sched_setscheduler(heap->task, SCHED_IDLE, &param);
+	return 0;
+}
+
 struct ion_heap *ion_heap_create(struct ion_platform_heap *heap_data)
 {
 	struct ion_heap *heap = NULL;
@@ -47,6 +178,11 @@ struct ion_heap *ion_heap_create(struct ion_platform_heap *heap_data)
 
 	heap->name = heap_data->name;
 	heap->id = heap_data->id;
+
+	/* without the thread, buffers are simply freed synchronously */
+	if (heap_data->deferred_free_max)
+		ion_heap_init_deferred_free(heap, heap_data->deferred_free_max);
+
 	return heap;
 }
 
@@ -55,6 +191,9 @@ void ion_heap_destroy(struct ion_heap *heap)
 	if (!heap)
 		return;
 
+	if (heap->task)
+		kthread_stop(heap->task);
+
 	switch (heap->type) {
 	case ION_HEAP_TYPE_SYSTEM_CONTIG:
 		ion_system_contig_heap_destroy(heap);
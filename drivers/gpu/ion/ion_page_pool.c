@@ -0,0 +1,244 @@
+/*
+ * drivers/gpu/ion/ion_page_pool.c
+ *
+ * Copyright (C) 2011 Google, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <linux/dma-mapping.h>
+#include <linux/err.h>
+#include <linux/highmem.h>
+#include <linux/jiffies.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include "ion_priv.h"
+
+/*
+ * Pages the background refill takes must be free for the asking: it does
+ * not sleep, reclaim, compact or wake kswapd, and stays off the reserves.
+ */
+#define ION_PAGE_POOL_REFILL_GFP	(__GFP_NOWARN | __GFP_NORETRY | \
+					 __GFP_NO_KSWAPD | __GFP_NOMEMALLOC)
+
+/* Leave the pools alone for this long after the shrinker took from them */
+#define ION_PAGE_POOL_REFILL_BACKOFF	HZ
+
+static struct page *ion_page_pool_alloc_pages(struct ion_page_pool *pool,
+					      gfp_t gfp_mask)
+{
+	struct page *page = alloc_pages(gfp_mask, pool->order);
+
+	if (!page)
+		return NULL;
+	/*
+	 * The page was zeroed through the cached kernel mapping; write
+	 * the zeroes back before anyone maps it uncached. This is only
+	 * being used to flush the page for dma, there is no better way
+	 * to do that from a driver at this time.
+	 */
+	if (!pool->cached)
+		__dma_page_cpu_to_dev(page, 0, PAGE_SIZE << pool->order,
+				      DMA_BIDIRECTIONAL);
+	return page;
+}
+
+static void ion_page_pool_add(struct ion_page_pool *pool, struct page *page)
+{
+	mutex_lock(&pool->mutex);
+	if (PageHighMem(page)) {
+		list_add_tail(&page->lru, &pool->high_items);
+		pool->high_count++;
+	} else {
+		list_add_tail(&page->lru, &pool->low_items);
+		pool->low_count++;
+	}
+	mutex_unlock(&pool->mutex);
+}
+
+static struct page *ion_page_pool_remove(struct ion_page_pool *pool, bool high)
+{
+	struct page *page;
+
+	if (high) {
+		BUG_ON(!pool->high_count);
+		page = list_first_entry(&pool->high_items, struct page, lru);
+		pool->high_count--;
+	} else {
+		BUG_ON(!pool->low_count);
+		page = list_first_entry(&pool->low_items, struct page, lru);
+		pool->low_count--;
+	}
+
+	list_del(&page->lru);
+	return page;
+}
+
+static int ion_page_pool_count(struct ion_page_pool *pool)
+{
+	return pool->high_count + pool->low_count;
+}
+
+static void ion_page_pool_refill(struct work_struct *work)
+{
+	struct ion_page_pool *pool = container_of(work, struct ion_page_pool,
+						  refill_work);
+	gfp_t gfp_mask = (pool->gfp_mask & ~__GFP_WAIT) |
+			 ION_PAGE_POOL_REFILL_GFP;
+	struct page *page;
+
+	while (ion_page_pool_count(pool) < pool->fill_target) {
+		if (time_before(jiffies, pool->shrink_stamp +
+				ION_PAGE_POOL_REFILL_BACKOFF))
+			break;
+		page = ion_page_pool_alloc_pages(pool, gfp_mask);
+		if (!page)
+			break;
+		ion_page_pool_add(pool, page);
+	}
+}
+
+/**
+ * ion_page_pool_alloc - take a chunk of 2^order pages from a pool
+ * @pool:		the pool
+ *
+ * Returns zeroed pages, from the pool if it has any and freshly
+ * allocated otherwise, or NULL. Falling below the fill target of the
+ * pool starts a background refill.
+ */
+struct page *ion_page_pool_alloc(struct ion_page_pool *pool)
+{
+	struct page *page = NULL;
+	int count;
+
+	mutex_lock(&pool->mutex);
+	if (pool->high_count)
+		page = ion_page_pool_remove(pool, true);
+	else if (pool->low_count)
+		page = ion_page_pool_remove(pool, false);
+	count = ion_page_pool_count(pool);
+	mutex_unlock(&pool->mutex);
+
+	if (count < pool->fill_target)
+		schedule_work(&pool->refill_work);
+
+	if (!page)
+		page = ion_page_pool_alloc_pages(pool, pool->gfp_mask);
+
+	return page;
+}
+
+/**
+ * ion_page_pool_free - give a chunk of 2^order pages back to a pool
+ * @pool:		the pool
+ * @page:		the first page of the chunk, which must be zeroed
+ *			and, for an uncached pool, written back to memory
+ */
+void ion_page_pool_free(struct ion_page_pool *pool, struct page *page)
+{
+	ion_page_pool_add(pool, page);
+}
+
+/**
+ * ion_page_pool_shrink - release pooled pages to the page allocator
+ * @pool:		the pool
+ * @gfp_mask:		allocation context of the caller
+ * @nr_to_scan:		number of pages to release, or 0 to only count
+ *
+ * Returns the number of pages, in units of PAGE_SIZE, left in the pool
+ * when counting, and the number released otherwise. Highmem pages are
+ * only released to callers that could use them.
+ */
+int ion_page_pool_shrink(struct ion_page_pool *pool, gfp_t gfp_mask,
+			 int nr_to_scan)
+{
+	bool high = !!(gfp_mask & __GFP_HIGHMEM);
+	struct page *page;
+	int freed = 0;
+
+	if (!nr_to_scan) {
+		mutex_lock(&pool->mutex);
+		freed = pool->low_count + (high ? pool->high_count : 0);
+		mutex_unlock(&pool->mutex);
+		return freed << pool->order;
+	}
+
+	pool->shrink_stamp = jiffies;
+
+	while (freed < nr_to_scan) {
+		mutex_lock(&pool->mutex);
+		if (pool->low_count) {
+			page = ion_page_pool_remove(pool, false);
+		} else if (high && pool->high_count) {
+			page = ion_page_pool_remove(pool, true);
+		} else {
+			mutex_unlock(&pool->mutex);
+			break;
+		}
+		mutex_unlock(&pool->mutex);
+		__free_pages(page, pool->order);
+		freed += 1 << pool->order;
+	}
+
+	return freed;
+}
+
+/**
+ * ion_page_pool_create - create a pool of 2^order page chunks
+ * @gfp_mask:		flags to allocate new chunks with, __GFP_ZERO
+ *			included
+ * @order:		order of the chunks
+ * @cached:		whether the chunks will be mapped cached
+ * @fill_target:	number of chunks the background refill keeps in
+ *			the pool, 0 for none
+ */
+struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order,
+					   bool cached, int fill_target)
+{
+	struct ion_page_pool *pool = kzalloc(sizeof(struct ion_page_pool),
+					     GFP_KERNEL);
+	if (!pool)
+		return NULL;
+	INIT_LIST_HEAD(&pool->low_items);
+	INIT_LIST_HEAD(&pool->high_items);
+	mutex_init(&pool->mutex);
+	INIT_WORK(&pool->refill_work, ion_page_pool_refill);
+	pool->gfp_mask = gfp_mask;
+	pool->order = order;
+	pool->cached = cached;
+	pool->fill_target = fill_target;
+	pool->shrink_stamp = jiffies - ION_PAGE_POOL_REFILL_BACKOFF;
+	return pool;
+}
+
+/**
+ * ion_page_pool_destroy - release a pool and all pages in it
+ * @pool:		the pool
+ */
+void ion_page_pool_destroy(struct ion_page_pool *pool)
+{
+	struct page *page;
+
+	cancel_work_sync(&pool->refill_work);
+
+	while (pool->low_count) {
+		page = ion_page_pool_remove(pool, false);
+		__free_pages(page, pool->order);
+	}
+	while (pool->high_count) {
+		page = ion_page_pool_remove(pool, true);
+		__free_pages(page, pool->order);
+	}
+	kfree(pool);
+}
@@ -18,9 +18,13 @@
 #define _ION_PRIV_H
 
 #include <linux/kref.h>
+#include <linux/ktime.h>
 #include <linux/mm_types.h>
 #include <linux/mutex.h>
 #include <linux/rbtree.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 #include <linux/ion.h>
 
 struct ion_mapping;
@@ -43,7 +47,7 @@ struct ion_buffer *ion_handle_buffer(struct ion_handle *handle);
  * @node:		node in the ion_device buffers tree
  * @dev:		back pointer to the ion_device
  * @heap:		back pointer to the heap the buffer came from
- * @flags:		buffer specific flags
+ * @flags:		buffer specific flags, as passed to ion_alloc()
  * @size:		size of the buffer
  * @priv_virt:		private data to the buffer representable as
  *			a void *
@@ -54,6 +58,7 @@ struct ion_buffer *ion_handle_buffer(struct ion_handle *handle);
  * @vaddr:		the kenrel mapping if kmap_cnt is not zero
  * @dmap_cnt:		number of times the buffer is mapped for dma
  * @sglist:		the scatterlist for the buffer is dmap_cnt is not zero
+ * @list:		node on the heap's deferred free list
 */
 struct ion_buffer {
 	struct kref ref;
@@ -71,8 +76,11 @@ struct ion_buffer {
 	void *vaddr;
 	int dmap_cnt;
 	struct scatterlist *sglist;
+	struct list_head list;
 };
 
+void ion_buffer_destroy(struct ion_buffer *buffer);
+
 /**
  * struct ion_heap_ops - ops to operate on a given heap
  * @allocate:		allocate memory
@@ -101,6 +109,17 @@ struct ion_heap_ops {
 			 struct vm_area_struct *vma);
 };
 
+/*
+ * Latency histogram, in log2 buckets of microseconds: bucket 0 counts
+ * operations under 1us, bucket n those of 2^(n-1) up to 2^n us, and the
+ * last bucket everything longer.
+ */
+#define ION_LATENCY_BUCKETS	16
+
+struct ion_heap_latency {
+	atomic_t count[ION_LATENCY_BUCKETS];
+};
+
 /**
  * struct ion_heap - represents a heap in the system
  * @node:		rb node to put the heap on the device's tree of heaps
@@ -111,6 +130,17 @@ struct ion_heap_ops {
  *			allocating.  These are specified by platform data and
  *			MUST be unique
  * @name:		used for debugging
+ * @free_list_max:	bytes that may wait on the free list, 0 when buffers
+ *			are freed synchronously
+ * @free_list:		buffers waiting to be freed by @task
+ * @free_list_size:	bytes on @free_list and being freed by @task
+ * @free_lock:		protects @free_list and @free_list_size
+ * @waitqueue:		@task waits here for buffers to free
+ * @task:		deferred free thread
+ * @alloc_latency:	time taken by ops->allocate
+ * @free_latency:	time taken to release a buffer in the context that
+ *			dropped the last reference
+ * @deferred_latency:	time taken by @task to free a buffer
  *
  * Represents a pool of memory from which buffers can be made.  In some
  * systems the only heap is regular system memory allocated via vmalloc.
@@ -124,6 +154,15 @@ struct ion_heap {
 	struct ion_heap_ops *ops;
 	int id;
 	const char *name;
+	size_t free_list_max;
+	struct list_head free_list;
+	size_t free_list_size;
+	spinlock_t free_lock;
+	wait_queue_head_t waitqueue;
+	struct task_struct *task;
+	struct ion_heap_latency alloc_latency;
+	struct ion_heap_latency free_latency;
+	struct ion_heap_latency deferred_latency;
 };
 
 /**
@@ -159,6 +198,50 @@ void ion_device_add_heap(struct ion_device *dev, struct ion_heap *heap);
 struct ion_heap *ion_heap_create(struct ion_platform_heap *);
 void ion_heap_destroy(struct ion_heap *);
 
+/**
+ * ion_heap_init_deferred_free - free buffers of a heap in the background
+ * @heap:		the heap
+ * @max:		bytes that may wait to be freed; buffers that do
+ *			not fit are freed synchronously
+ *
+ * Starts a SCHED_IDLE thread that frees the buffers queued by
+ * ion_heap_freelist_add(), so that dropping the last reference to a
+ * large buffer does not make the caller wait for it to be cleared.
+ */
+int ion_heap_init_deferred_free(struct ion_heap *heap, size_t max);
+
+/**
+ * ion_heap_freelist_add - queue a buffer for the deferred free thread
+ * @heap:		the heap
+ * @buffer:		the buffer, no longer referenced by anyone
+ *
+ * Returns false, leaving the buffer alone, if deferred free is off for
+ * the heap or the buffer would take the free list over its limit.
+ */
+bool ion_heap_freelist_add(struct ion_heap *heap, struct ion_buffer *buffer);
+
+/**
+ * ion_heap_freelist_size - bytes waiting for the deferred free thread
+ * @heap:		the heap
+ */
+size_t ion_heap_freelist_size(struct ion_heap *heap);
+
+/**
+ * ion_heap_freelist_drain - free the queued buffers of a heap right away
+ * @heap:		the heap
+ *
+ * Frees, in the calling context, whatever the deferred free thread has
+ * not picked up yet. Returns the number of bytes freed.
+ */
+size_t ion_heap_freelist_drain(struct ion_heap *heap);
+
+/**
+ * ion_heap_latency_record - add an operation to a latency histogram
+ * @latency:		the histogram
+ * @start:		when the operation started
+ */
+void ion_heap_latency_record(struct ion_heap_latency *latency, ktime_t start);
+
 struct ion_heap *ion_system_heap_create(struct ion_platform_heap *);
 void ion_system_heap_destroy(struct ion_heap *);
 
@@ -181,4 +264,50 @@ void ion_carveout_free(struct ion_heap *heap, ion_phys_addr_t addr,
  */
 #define ION_CARVEOUT_ALLOCATE_FAIL -1
 
+/**
+ * struct ion_page_pool - pagepool struct
+ * @high_count:		number of highmem chunks in the pool
+ * @low_count:		number of lowmem chunks in the pool
+ * @cached:		chunks are mapped cached, so they need no cache
+ *			maintenance on the way in or out of the pool
+ * @fill_target:	number of chunks the background refill tops the
+ *			pool up to
+ * @shrink_stamp:	jiffies of the last shrink, refills back off
+ *			for a while after it
+ * @high_items:		list of highmem chunks
+ * @low_items:		list of lowmem chunks
+ * @mutex:		lock protecting this struct and especially the counts
+ *			and item lists
+ * @refill_work:	background refill
+ * @gfp_mask:		gfp_mask to use from alloc
+ * @order:		order of pages in the pool
+ *
+ * Allows you to keep a pool of pre-zeroed chunks of 2^order pages around
+ * so that buffer allocation does not go back to the page allocator, and
+ * in particular does not have to find high order pages there, every time.
+ * The pool is refilled in the background when allocations take it below
+ * its fill target, and drained by the owning heap's shrinker.
+ */
+struct ion_page_pool {
+	int high_count;
+	int low_count;
+	bool cached;
+	int fill_target;
+	unsigned long shrink_stamp;
+	struct list_head high_items;
+	struct list_head low_items;
+	struct mutex mutex;
+	struct work_struct refill_work;
+	gfp_t gfp_mask;
+	unsigned int order;
+};
+
+struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order,
+					   bool cached, int fill_target);
+void ion_page_pool_destroy(struct ion_page_pool *);
+struct page *ion_page_pool_alloc(struct ion_page_pool *);
+void ion_page_pool_free(struct ion_page_pool *, struct page *);
+int ion_page_pool_shrink(struct ion_page_pool *pool, gfp_t gfp_mask,
+			 int nr_to_scan);
+
 #endif /* _ION_PRIV_H */
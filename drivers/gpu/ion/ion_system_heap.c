@@ -14,84 +14,315 @@
  *
  */
 
+#include <linux/dma-mapping.h>
 #include <linux/err.h>
+#include <linux/highmem.h>
 #include <linux/ion.h>
 #include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/scatterlist.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
 #include "ion_priv.h"
 
+/*
+ * Buffers are made of chunks of these orders, largest first. Every 64KiB
+ * chunk is one scatterlist entry where order 0 pages would need sixteen.
+ */
+static const unsigned int orders[] = {4, 2, 0};
+#define NUM_ORDERS ARRAY_SIZE(orders)
+
+/*
+ * High order chunks are a bonus, not worth reclaim or compaction: if the
+ * pool and the free lists have none, the next order down is used.
+ */
+static const gfp_t high_order_gfp_flags = (GFP_HIGHUSER | __GFP_ZERO |
+					   __GFP_NOWARN | __GFP_NORETRY |
+					   __GFP_NO_KSWAPD) & ~__GFP_WAIT;
+static const gfp_t low_order_gfp_flags  = GFP_HIGHUSER | __GFP_ZERO |
+					  __GFP_NOWARN;
+
+/* Memory the background refill keeps in each high order pool */
+static int pool_fill_kb = 1024;
+module_param(pool_fill_kb, int, 0444);
+MODULE_PARM_DESC(pool_fill_kb,
+		 "Memory kept ready in each high order page pool, in KiB");
+
+struct ion_system_heap {
+	struct ion_heap heap;
+	struct shrinker shrinker;
+	struct ion_page_pool *uncached_pools[NUM_ORDERS];
+	struct ion_page_pool *cached_pools[NUM_ORDERS];
+};
+
+static inline bool ion_buffer_cached(struct ion_buffer *buffer)
+{
+	return !(buffer->flags & ION_FLAG_UNCACHED);
+}
+
+static int order_to_index(unsigned int order)
+{
+	int i;
+
+	for (i = 0; i < NUM_ORDERS; i++)
+		if (order == orders[i])
+			return i;
+	BUG();
+	return -1;
+}
+
+static struct ion_page_pool *buffer_pool(struct ion_system_heap *heap,
+					 struct ion_buffer *buffer,
+					 unsigned int order)
+{
+	int index = order_to_index(order);
+
+	if (ion_buffer_cached(buffer))
+		return heap->cached_pools[index];
+	return heap->uncached_pools[index];
+}
+
+/*
+ * Chunks go back to their pool zeroed, so that allocation from the pool
+ * never has to. Uncached chunks are also written back to memory, as the
+ * next owner will not look at them through the cache.
+ */
+static void ion_system_heap_zero_chunk(struct page *page, unsigned int order,
+				       bool cached)
+{
+	int i;
+
+	for (i = 0; i < (1 << order); i++)
+		clear_highpage(page + i);
+	if (!cached)
+		__dma_page_cpu_to_dev(page, 0, PAGE_SIZE << order,
+				      DMA_BIDIRECTIONAL);
+}
+
+static struct page *alloc_largest_available(struct ion_system_heap *heap,
+					    struct ion_buffer *buffer,
+					    unsigned long size,
+					    unsigned int max_order,
+					    unsigned int *order)
+{
+	struct page *page;
+	int i;
+
+	for (i = 0; i < NUM_ORDERS; i++) {
+		if (size < (PAGE_SIZE << orders[i]))
+			continue;
+		if (max_order < orders[i])
+			continue;
+
+		page = ion_page_pool_alloc(buffer_pool(heap, buffer, orders[i]));
+		if (!page)
+			continue;
+
+		*order = orders[i];
+		return page;
+	}
+
+	return NULL;
+}
+
+static void free_buffer_chunk(struct ion_system_heap *heap,
+			      struct ion_buffer *buffer, struct page *page,
+			      unsigned int order)
+{
+	ion_system_heap_zero_chunk(page, order, ion_buffer_cached(buffer));
+	ion_page_pool_free(buffer_pool(heap, buffer, order), page);
+}
+
+struct ion_system_chunk {
+	struct list_head list;
+	struct page *page;
+	unsigned int order;
+};
+
 static int ion_system_heap_allocate(struct ion_heap *heap,
 				     struct ion_buffer *buffer,
 				     unsigned long size, unsigned long align,
 				     unsigned long flags)
 {
-	buffer->priv_virt = vmalloc_user(size);
-	if (!buffer->priv_virt)
-		return -ENOMEM;
+	struct ion_system_heap *sys_heap = container_of(heap,
+							struct ion_system_heap,
+							heap);
+	struct ion_system_chunk *chunk, *tmp;
+	struct sg_table *table;
+	struct scatterlist *sg;
+	struct list_head chunks;
+	unsigned long size_remaining = PAGE_ALIGN(size);
+	unsigned int max_order = orders[0];
+	unsigned int order;
+	struct page *page;
+	int nents = 0;
+	int ret;
+
+	if (align > PAGE_SIZE)
+		return -EINVAL;
+
+	INIT_LIST_HEAD(&chunks);
+	while (size_remaining > 0) {
+		chunk = kmalloc(sizeof(*chunk), GFP_KERNEL);
+		if (!chunk)
+			goto err;
+		page = alloc_largest_available(sys_heap, buffer, size_remaining,
+					       max_order, &order);
+		if (!page) {
+			kfree(chunk);
+			goto err;
+		}
+		chunk->page = page;
+		chunk->order = order;
+		list_add_tail(&chunk->list, &chunks);
+		size_remaining -= PAGE_SIZE << order;
+		/* once an order has run dry, don't try it again */
+		max_order = order;
+		nents++;
+	}
+
+	table = kmalloc(sizeof(struct sg_table), GFP_KERNEL);
+	if (!table)
+		goto err;
+
+	ret = sg_alloc_table(table, nents, GFP_KERNEL);
+	if (ret)
+		goto err_table;
+
+	sg = table->sgl;
+	list_for_each_entry_safe(chunk, tmp, &chunks, list) {
+		sg_set_page(sg, chunk->page, PAGE_SIZE << chunk->order, 0);
+		sg = sg_next(sg);
+		list_del(&chunk->list);
+		kfree(chunk);
+	}
+
+	buffer->priv_virt = table;
 	return 0;
+
+err_table:
+	kfree(table);
+err:
+	list_for_each_entry_safe(chunk, tmp, &chunks, list) {
+		free_buffer_chunk(sys_heap, buffer, chunk->page, chunk->order);
+		list_del(&chunk->list);
+		kfree(chunk);
+	}
+	return -ENOMEM;
 }
 
 void ion_system_heap_free(struct ion_buffer *buffer)
 {
-	vfree(buffer->priv_virt);
+	struct ion_system_heap *sys_heap = container_of(buffer->heap,
+							struct ion_system_heap,
+							heap);
+	struct sg_table *table = buffer->priv_virt;
+	struct scatterlist *sg;
+	int i;
+
+	for_each_sg(table->sgl, sg, table->nents, i)
+		free_buffer_chunk(sys_heap, buffer, sg_page(sg),
+				  get_order(sg->length));
+	sg_free_table(table);
+	kfree(table);
 }
 
 struct scatterlist *ion_system_heap_map_dma(struct ion_heap *heap,
 					    struct ion_buffer *buffer)
 {
-	struct scatterlist *sglist;
-	struct page *page;
-	int i;
-	int npages = PAGE_ALIGN(buffer->size) / PAGE_SIZE;
-	void *vaddr = buffer->priv_virt;
+	struct sg_table *table = buffer->priv_virt;
 
-	sglist = vmalloc(npages * sizeof(struct scatterlist));
-	if (!sglist)
-		return ERR_PTR(-ENOMEM);
-	memset(sglist, 0, npages * sizeof(struct scatterlist));
-	sg_init_table(sglist, npages);
-	for (i = 0; i < npages; i++) {
-		page = vmalloc_to_page(vaddr);
-		if (!page)
-			goto end;
-		sg_set_page(&sglist[i], page, PAGE_SIZE, 0);
-		vaddr += PAGE_SIZE;
-	}
 	/* XXX do cache maintenance for dma? */
-	return sglist;
-end:
-	vfree(sglist);
-	return NULL;
+	return table->sgl;
 }
 
 void ion_system_heap_unmap_dma(struct ion_heap *heap,
 			       struct ion_buffer *buffer)
 {
-	/* XXX undo cache maintenance for dma? */
-	if (buffer->sglist)
-		vfree(buffer->sglist);
+	/* the scatterlist lives as long as the buffer */
 }
 
 void *ion_system_heap_map_kernel(struct ion_heap *heap,
 				 struct ion_buffer *buffer)
 {
-	return buffer->priv_virt;
+	struct sg_table *table = buffer->priv_virt;
+	int npages = PAGE_ALIGN(buffer->size) / PAGE_SIZE;
+	struct page **pages, **tmp;
+	struct scatterlist *sg;
+	pgprot_t pgprot;
+	void *vaddr;
+	int i, j;
+
+	if (ion_buffer_cached(buffer))
+		pgprot = PAGE_KERNEL;
+	else
+		pgprot = pgprot_writecombine(PAGE_KERNEL);
+
+	pages = vmalloc(sizeof(struct page *) * npages);
+	if (!pages)
+		return ERR_PTR(-ENOMEM);
+
+	tmp = pages;
+	for_each_sg(table->sgl, sg, table->nents, i) {
+		int npages_this_entry = PAGE_ALIGN(sg->length) / PAGE_SIZE;
+		struct page *page = sg_page(sg);
+
+		BUG_ON(i >= npages);
+		for (j = 0; j < npages_this_entry; j++)
+			*(tmp++) = page++;
+	}
+	vaddr = vmap(pages, npages, VM_MAP, pgprot);
+	vfree(pages);
+
+	return vaddr ? vaddr : ERR_PTR(-ENOMEM);
 }
 
 void ion_system_heap_unmap_kernel(struct ion_heap *heap,
 				  struct ion_buffer *buffer)
 {
+	vunmap(buffer->vaddr);
 }
 
 int ion_system_heap_map_user(struct ion_heap *heap, struct ion_buffer *buffer,
 			     struct vm_area_struct *vma)
 {
-	return remap_vmalloc_range(vma, buffer->priv_virt, vma->vm_pgoff);
+	struct sg_table *table = buffer->priv_virt;
+	unsigned long addr = vma->vm_start;
+	unsigned long offset = vma->vm_pgoff * PAGE_SIZE;
+	struct scatterlist *sg;
+	int i;
+	int ret;
+
+	if (!ion_buffer_cached(buffer))
+		vma->vm_page_prot = pgprot_writecombine(vma->vm_page_prot);
+
+	for_each_sg(table->sgl, sg, table->nents, i) {
+		struct page *page = sg_page(sg);
+		unsigned long remainder = vma->vm_end - addr;
+		unsigned long len = sg->length;
+
+		if (offset >= sg->length) {
+			offset -= sg->length;
+			continue;
+		} else if (offset) {
+			page += offset / PAGE_SIZE;
+			len = sg->length - offset;
+			offset = 0;
+		}
+		len = min(len, remainder);
+		ret = remap_pfn_range(vma, addr, page_to_pfn(page), len,
+				      vma->vm_page_prot);
+		if (ret)
+			return ret;
+		addr += len;
+		if (addr >= vma->vm_end)
+			return 0;
+	}
+	return 0;
 }
 
-static struct ion_heap_ops vmalloc_ops = {
+static struct ion_heap_ops system_heap_ops = {
 	.allocate = ion_system_heap_allocate,
 	.free = ion_system_heap_free,
 	.map_dma = ion_system_heap_map_dma,
@@ -101,21 +332,109 @@ static struct ion_heap_ops vmalloc_ops = {
 	.map_user = ion_system_heap_map_user,
 };
 
+static int ion_system_heap_shrink(struct shrinker *shrinker,
+				  struct shrink_control *sc)
+{
+	struct ion_system_heap *sys_heap = container_of(shrinker,
+							struct ion_system_heap,
+							shrinker);
+	int nr_to_scan = sc->nr_to_scan;
+	int nr_total = 0;
+	int nr_freed;
+	int i;
+
+	/* uncached chunks are dearer to replace, give up cached ones first */
+	for (i = 0; i < NUM_ORDERS && nr_to_scan > 0; i++) {
+		nr_freed = ion_page_pool_shrink(sys_heap->cached_pools[i],
+						sc->gfp_mask, nr_to_scan);
+		nr_to_scan -= nr_freed;
+	}
+	for (i = 0; i < NUM_ORDERS && nr_to_scan > 0; i++) {
+		nr_freed = ion_page_pool_shrink(sys_heap->uncached_pools[i],
+						sc->gfp_mask, nr_to_scan);
+		nr_to_scan -= nr_freed;
+	}
+
+	for (i = 0; i < NUM_ORDERS; i++) {
+		nr_total += ion_page_pool_shrink(sys_heap->cached_pools[i],
+						 sc->gfp_mask, 0);
+		nr_total += ion_page_pool_shrink(sys_heap->uncached_pools[i],
+						 sc->gfp_mask, 0);
+	}
+	return nr_total;
+}
+
+static void ion_system_heap_destroy_pools(struct ion_page_pool **pools)
+{
+	int i;
+
+	for (i = 0; i < NUM_ORDERS; i++)
+		if (pools[i])
+			ion_page_pool_destroy(pools[i]);
+}
+
+static int ion_system_heap_create_pools(struct ion_page_pool **pools,
+					bool cached)
+{
+	struct ion_page_pool *pool;
+	gfp_t gfp_flags;
+	int fill_target;
+	int i;
+
+	for (i = 0; i < NUM_ORDERS; i++) {
+		gfp_flags = orders[i] ? high_order_gfp_flags :
+					low_order_gfp_flags;
+		/* order 0 pages are cheap enough to leave to frees alone */
+		fill_target = orders[i] ?
+			(pool_fill_kb >> (PAGE_SHIFT - 10)) >> orders[i] : 0;
+		pool = ion_page_pool_create(gfp_flags, orders[i], cached,
+					    fill_target);
+		if (!pool) {
+			ion_system_heap_destroy_pools(pools);
+			return -ENOMEM;
+		}
+		pools[i] = pool;
+	}
+	return 0;
+}
+
 struct ion_heap *ion_system_heap_create(struct ion_platform_heap *unused)
 {
-	struct ion_heap *heap;
+	struct ion_system_heap *heap;
 
-	heap = kzalloc(sizeof(struct ion_heap), GFP_KERNEL);
+	heap = kzalloc(sizeof(struct ion_system_heap), GFP_KERNEL);
 	if (!heap)
 		return ERR_PTR(-ENOMEM);
-	heap->ops = &vmalloc_ops;
-	heap->type = ION_HEAP_TYPE_SYSTEM;
-	return heap;
+	heap->heap.ops = &system_heap_ops;
+	heap->heap.type = ION_HEAP_TYPE_SYSTEM;
+
+	if (ion_system_heap_create_pools(heap->uncached_pools, false))
+		goto err_uncached;
+	if (ion_system_heap_create_pools(heap->cached_pools, true))
+		goto err_cached;
+
+	heap->shrinker.shrink = ion_system_heap_shrink;
+	heap->shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&heap->shrinker);
+	return &heap->heap;
+
+err_cached:
+	ion_system_heap_destroy_pools(heap->uncached_pools);
+err_uncached:
+	kfree(heap);
+	return ERR_PTR(-ENOMEM);
 }
 
 void ion_system_heap_destroy(struct ion_heap *heap)
 {
-	kfree(heap);
+	struct ion_system_heap *sys_heap = container_of(heap,
+							struct ion_system_heap,
+							heap);
+
+	unregister_shrinker(&sys_heap->shrinker);
+	ion_system_heap_destroy_pools(sys_heap->uncached_pools);
+	ion_system_heap_destroy_pools(sys_heap->cached_pools);
+	kfree(sys_heap);
 }
 
 static int ion_system_contig_heap_allocate(struct ion_heap *heap,
@@ -157,6 +476,24 @@ struct scatterlist *ion_system_contig_heap_map_dma(struct ion_heap *heap,
 	return sglist;
 }
 
+void ion_system_contig_heap_unmap_dma(struct ion_heap *heap,
+				      struct ion_buffer *buffer)
+{
+	if (buffer->sglist)
+		vfree(buffer->sglist);
+}
+
+void *ion_system_contig_heap_map_kernel(struct ion_heap *heap,
+					struct ion_buffer *buffer)
+{
+	return buffer->priv_virt;
+}
+
+void ion_system_contig_heap_unmap_kernel(struct ion_heap *heap,
+					 struct ion_buffer *buffer)
+{
+}
+
 int ion_system_contig_heap_map_user(struct ion_heap *heap,
 				    struct ion_buffer *buffer,
 				    struct vm_area_struct *vma)
@@ -173,9 +510,9 @@ static struct ion_heap_ops kmalloc_ops = {
 	.free = ion_system_contig_heap_free,
 	.phys = ion_system_contig_heap_phys,
 	.map_dma = ion_system_contig_heap_map_dma,
-	.unmap_dma = ion_system_heap_unmap_dma,
-	.map_kernel = ion_system_heap_map_kernel,
-	.unmap_kernel = ion_system_heap_unmap_kernel,
+	.unmap_dma = ion_system_contig_heap_unmap_dma,
+	.map_kernel = ion_system_contig_heap_map_kernel,
+	.unmap_kernel = ion_system_contig_heap_unmap_kernel,
 	.map_user = ion_system_contig_heap_map_user,
 };
 
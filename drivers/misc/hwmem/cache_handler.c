@@ -10,6 +10,7 @@
  */
 
 #include <linux/hwmem.h>
+#include <linux/string.h>
 
 #include <asm/pgtable.h>
 
@@ -36,6 +37,11 @@ static void clean_cpu_cache(struct cach_buf *buf,
 static void flush_cpu_cache(struct cach_buf *buf,
 					struct cach_range *range_2b_used);
 
+static void clean_range(struct cach_buf *buf, struct cach_range *range,
+						bool *cleaned_everything);
+static void flush_range(struct cach_buf *buf, struct cach_range *range,
+						bool *flushed_everything);
+
 static void null_range(struct cach_range *range);
 static void expand_range(struct cach_range *range,
 					struct cach_range *range_2_add);
@@ -58,6 +64,20 @@ static u32 range_length(struct cach_range *range);
 static void region_2_range(struct hwmem_region *region, u32 buffer_size,
 						struct cach_range *range);
 
+static void null_range_set(struct cach_range_set *set);
+static void add_range_2_set(struct cach_range_set *set,
+						struct cach_range *range_2_add);
+static void remove_range_from_set(struct cach_range_set *set,
+						struct cach_range *range_2_remove);
+/*
+ * Stores the non empty intersections of set's ranges with range in
+ * intersections, returns the number of intersections and sets total to their
+ * combined length and bounds to the smallest range enclosing them.
+ */
+static int intersect_range_set(struct cach_range_set *set,
+		struct cach_range *range, struct cach_range *intersections,
+				u32 *total, struct cach_range *bounds);
+
 static void *offset_2_vaddr(struct cach_buf *buf, u32 offset);
 static u32 offset_2_paddr(struct cach_buf *buf, u32 offset);
 
@@ -77,6 +97,7 @@ void cach_init_buf(struct cach_buf *buf,
 	buf->pstart = 0;
 	buf->size = size;
 	buf->mem_type = mem_type;
+	memset(&buf->stats, 0, sizeof(buf->stats));
 
 	buf->cache_settings = cachi_get_cache_settings(cache_settings);
 }
@@ -97,19 +118,18 @@ void cach_set_buf_addrs(struct cach_buf *buf, void* vaddr, u32 paddr)
 		buf->range_in_cpu_cache.end = buf->size;
 		align_range_up(&buf->range_in_cpu_cache,
 						get_dcache_granularity());
-		buf->range_dirty_in_cpu_cache.start = 0;
-		buf->range_dirty_in_cpu_cache.end = buf->size;
-		align_range_up(&buf->range_dirty_in_cpu_cache,
-						get_dcache_granularity());
+		null_range_set(&buf->dirty_in_cpu_cache);
+		add_range_2_set(&buf->dirty_in_cpu_cache,
+						&buf->range_in_cpu_cache);
 	} else {
 		flush_cpu_dcache(buf->vstart, buf->pstart, buf->size, false,
 									&tmp);
 		drain_cpu_write_buf();
 
 		null_range(&buf->range_in_cpu_cache);
-		null_range(&buf->range_dirty_in_cpu_cache);
+		null_range_set(&buf->dirty_in_cpu_cache);
 	}
-	null_range(&buf->range_invalid_in_cpu_cache);
+	null_range_set(&buf->invalid_in_cpu_cache);
 }
 
 void cach_set_pgprot_cache_options(struct cach_buf *buf, pgprot_t *pgprot)
@@ -229,7 +249,7 @@ static void sync_buf_pre_cpu(struct cach_buf *buf, enum hwmem_access access,
 				intersect_range(&buf->range_in_cpu_cache,
 					&region_range, &dirty_range_addition);
 
-			expand_range(&buf->range_dirty_in_cpu_cache,
+			add_range_2_set(&buf->dirty_in_cpu_cache,
 							&dirty_range_addition);
 		}
 	}
@@ -259,7 +279,7 @@ static void sync_buf_post_cpu(struct cach_buf *buf,
 			intersect_range(&buf->range_in_cpu_cache,
 						&region_range, &intersection);
 
-			expand_range(&buf->range_invalid_in_cpu_cache,
+			add_range_2_set(&buf->invalid_in_cpu_cache,
 								&intersection);
 
 			clean_cpu_cache(buf, &region_range);
@@ -277,74 +297,94 @@ static void sync_buf_post_cpu(struct cach_buf *buf,
 	}
 }
 
+/*
+ * The parts of range that need maintenance are handled one by one, or as one
+ * range covering all of them once their combined length is large enough for
+ * a whole cache operation to be cheaper. The deferred invalidates of several
+ * consecutive sync domain calls are thereby coalesced into one operation.
+ */
 static void invalidate_cpu_cache(struct cach_buf *buf, struct cach_range *range)
 {
-	struct cach_range intersection;
-
-	intersect_range(&buf->range_invalid_in_cpu_cache, range,
-								&intersection);
-	if (is_non_empty_range(&intersection)) {
-		bool flushed_everything;
-
-		expand_range_2_edge(&intersection,
-					&buf->range_invalid_in_cpu_cache);
+	struct cach_range intersections[CACH_MAX_RANGES];
+	struct cach_range bounds;
+	bool flushed_everything = false;
+	u32 total;
+	int nr;
+	int i;
+
+	nr = intersect_range_set(&buf->invalid_in_cpu_cache, range,
+						intersections, &total, &bounds);
+	if (nr == 0)
+		return;
 
-		/*
-		 * Cache handler never uses invalidate to discard data in the
-		 * cache so we can use flush instead which is considerably
-		 * faster for large buffers.
-		 */
-		flush_cpu_dcache(
-				offset_2_vaddr(buf, intersection.start),
-				offset_2_paddr(buf, intersection.start),
-				range_length(&intersection),
-				buf->cache_settings &
-					HWMEM_ALLOC_HINT_INNER_CACHE_ONLY,
+	/*
+	 * Cache handler never uses invalidate to discard data in the
+	 * cache so we can use flush instead which is considerably
+	 * faster for large buffers.
+	 */
+	if (nr > 1 && total >= get_dcache_flush_all_breakpoint(
+			buf->cache_settings & HWMEM_ALLOC_HINT_INNER_CACHE_ONLY)) {
+		flush_range(buf, &bounds, &flushed_everything);
+		if (!flushed_everything)
+			remove_range_from_set(&buf->invalid_in_cpu_cache,
+								&bounds);
+	} else {
+		for (i = 0; i < nr && !flushed_everything; i++) {
+			flush_range(buf, &intersections[i],
 							&flushed_everything);
-
-		if (flushed_everything) {
-			null_range(&buf->range_invalid_in_cpu_cache);
-			null_range(&buf->range_dirty_in_cpu_cache);
-		} else {
 			/*
 			 * No need to shrink range_in_cpu_cache as invalidate
 			 * is only used when we can't keep track of what's in
 			 * the CPU cache.
 			 */
-			shrink_range(&buf->range_invalid_in_cpu_cache,
-								&intersection);
+			if (!flushed_everything)
+				remove_range_from_set(
+						&buf->invalid_in_cpu_cache,
+							&intersections[i]);
 		}
 	}
+
+	if (flushed_everything) {
+		null_range_set(&buf->invalid_in_cpu_cache);
+		null_range_set(&buf->dirty_in_cpu_cache);
+	}
 }
 
 static void clean_cpu_cache(struct cach_buf *buf, struct cach_range *range)
 {
-	struct cach_range intersection;
-
-	intersect_range(&buf->range_dirty_in_cpu_cache, range, &intersection);
-	if (is_non_empty_range(&intersection)) {
-		bool cleaned_everything;
-
-		expand_range_2_edge(&intersection,
-					&buf->range_dirty_in_cpu_cache);
+	struct cach_range intersections[CACH_MAX_RANGES];
+	struct cach_range bounds;
+	bool cleaned_everything = false;
+	u32 total;
+	int nr;
+	int i;
+
+	nr = intersect_range_set(&buf->dirty_in_cpu_cache, range,
+						intersections, &total, &bounds);
+	if (nr == 0)
+		return;
 
-		clean_cpu_dcache(
-				offset_2_vaddr(buf, intersection.start),
-				offset_2_paddr(buf, intersection.start),
-				range_length(&intersection),
-				buf->cache_settings &
-					HWMEM_ALLOC_HINT_INNER_CACHE_ONLY,
+	if (nr > 1 && total >= get_dcache_clean_all_breakpoint(
+			buf->cache_settings & HWMEM_ALLOC_HINT_INNER_CACHE_ONLY)) {
+		clean_range(buf, &bounds, &cleaned_everything);
+		if (!cleaned_everything)
+			remove_range_from_set(&buf->dirty_in_cpu_cache,
+								&bounds);
+	} else {
+		for (i = 0; i < nr && !cleaned_everything; i++) {
+			clean_range(buf, &intersections[i],
 							&cleaned_everything);
+			if (!cleaned_everything)
+				remove_range_from_set(&buf->dirty_in_cpu_cache,
+							&intersections[i]);
+		}
+	}
 
-		if (cleaned_everything)
-			null_range(&buf->range_dirty_in_cpu_cache);
-		else
-			shrink_range(&buf->range_dirty_in_cpu_cache,
-								&intersection);
+	if (cleaned_everything)
+		null_range_set(&buf->dirty_in_cpu_cache);
 
-		if (buf->mem_type == HWMEM_MEM_SCATTERED_SYS)
-			outer_flush_all();
-	}
+	if (buf->mem_type == HWMEM_MEM_SCATTERED_SYS)
+		outer_flush_all();
 }
 
 static void flush_cpu_cache(struct cach_buf *buf, struct cach_range *range)
@@ -357,31 +397,57 @@ static void flush_cpu_cache(struct cach_buf *buf, struct cach_range *range)
 
 		expand_range_2_edge(&intersection, &buf->range_in_cpu_cache);
 
-		flush_cpu_dcache(
-				offset_2_vaddr(buf, intersection.start),
-				offset_2_paddr(buf, intersection.start),
-				range_length(&intersection),
-				buf->cache_settings &
-					HWMEM_ALLOC_HINT_INNER_CACHE_ONLY,
-							&flushed_everything);
+		flush_range(buf, &intersection, &flushed_everything);
 
 		if (flushed_everything) {
 			if (!speculative_data_prefetch())
 				null_range(&buf->range_in_cpu_cache);
-			null_range(&buf->range_dirty_in_cpu_cache);
-			null_range(&buf->range_invalid_in_cpu_cache);
+			null_range_set(&buf->dirty_in_cpu_cache);
+			null_range_set(&buf->invalid_in_cpu_cache);
 		} else {
 			if (!speculative_data_prefetch())
 				shrink_range(&buf->range_in_cpu_cache,
 							 &intersection);
-			shrink_range(&buf->range_dirty_in_cpu_cache,
+			remove_range_from_set(&buf->dirty_in_cpu_cache,
 								&intersection);
-			shrink_range(&buf->range_invalid_in_cpu_cache,
+			remove_range_from_set(&buf->invalid_in_cpu_cache,
 								&intersection);
 		}
 	}
 }
 
+static void clean_range(struct cach_buf *buf, struct cach_range *range,
+						bool *cleaned_everything)
+{
+	clean_cpu_dcache(offset_2_vaddr(buf, range->start),
+				offset_2_paddr(buf, range->start),
+				range_length(range),
+				buf->cache_settings &
+					HWMEM_ALLOC_HINT_INNER_CACHE_ONLY,
+							cleaned_everything);
+
+	buf->stats.bytes_cleaned += range_length(range);
+	buf->stats.nr_cleans++;
+	if (*cleaned_everything)
+		buf->stats.nr_whole_cache++;
+}
+
+static void flush_range(struct cach_buf *buf, struct cach_range *range,
+						bool *flushed_everything)
+{
+	flush_cpu_dcache(offset_2_vaddr(buf, range->start),
+				offset_2_paddr(buf, range->start),
+				range_length(range),
+				buf->cache_settings &
+					HWMEM_ALLOC_HINT_INNER_CACHE_ONLY,
+							flushed_everything);
+
+	buf->stats.bytes_flushed += range_length(range);
+	buf->stats.nr_flushes++;
+	if (*flushed_everything)
+		buf->stats.nr_whole_cache++;
+}
+
 static void null_range(struct cach_range *range)
 {
 	range->start = U32_MAX;
@@ -478,6 +544,126 @@ static void region_2_range(struct hwmem_region *region, u32 buffer_size,
 	align_range_up(range, get_dcache_granularity());
 }
 
+static void null_range_set(struct cach_range_set *set)
+{
+	set->count = 0;
+}
+
+static void add_range_2_set(struct cach_range_set *set,
+						struct cach_range *range_2_add)
+{
+	struct cach_range ranges[CACH_MAX_RANGES + 1];
+	struct cach_range new_range = *range_2_add;
+	bool inserted = false;
+	int nr = 0;
+	int i;
+
+	if (!is_non_empty_range(&new_range))
+		return;
+
+	/* Absorb the ranges new_range overlaps or touches */
+	for (i = 0; i < set->count; i++) {
+		struct cach_range *curr = &set->range[i];
+
+		if (curr->end >= new_range.start &&
+					curr->start <= new_range.end)
+			expand_range(&new_range, curr);
+	}
+
+	for (i = 0; i < set->count; i++) {
+		struct cach_range *curr = &set->range[i];
+
+		if (curr->end >= new_range.start &&
+					curr->start <= new_range.end)
+			continue;
+		if (!inserted && new_range.start < curr->start) {
+			ranges[nr++] = new_range;
+			inserted = true;
+		}
+		ranges[nr++] = *curr;
+	}
+	if (!inserted)
+		ranges[nr++] = new_range;
+
+	if (nr > CACH_MAX_RANGES) {
+		int closest = 0;
+
+		for (i = 1; i < nr - 1; i++) {
+			if (ranges[i + 1].start - ranges[i].end <
+				ranges[closest + 1].start - ranges[closest].end)
+				closest = i;
+		}
+		ranges[closest].end = ranges[closest + 1].end;
+		memmove(&ranges[closest + 1], &ranges[closest + 2],
+			(nr - closest - 2) * sizeof(struct cach_range));
+		nr--;
+	}
+
+	memcpy(set->range, ranges, nr * sizeof(struct cach_range));
+	set->count = nr;
+}
+
+static void remove_range_from_set(struct cach_range_set *set,
+						struct cach_range *range_2_remove)
+{
+	struct cach_range ranges[CACH_MAX_RANGES];
+	int nr = 0;
+	int i;
+
+	for (i = 0; i < set->count; i++) {
+		struct cach_range *curr = &set->range[i];
+		struct cach_range low = *curr;
+		struct cach_range high = *curr;
+		int nr_needed;
+
+		low.end = min(curr->end, range_2_remove->start);
+		high.start = max(curr->start, range_2_remove->end);
+		nr_needed = is_non_empty_range(&low) +
+						is_non_empty_range(&high);
+
+		/*
+		 * Splitting a range when the set is full would need one slot
+		 * too many, keep it whole instead. That is safe, only the
+		 * maintenance of the removed part is redone later.
+		 */
+		if (nr + nr_needed + (set->count - i - 1) > CACH_MAX_RANGES) {
+			ranges[nr++] = *curr;
+			continue;
+		}
+
+		if (is_non_empty_range(&low))
+			ranges[nr++] = low;
+		if (is_non_empty_range(&high))
+			ranges[nr++] = high;
+	}
+
+	memcpy(set->range, ranges, nr * sizeof(struct cach_range));
+	set->count = nr;
+}
+
+static int intersect_range_set(struct cach_range_set *set,
+		struct cach_range *range, struct cach_range *intersections,
+				u32 *total, struct cach_range *bounds)
+{
+	int nr = 0;
+	int i;
+
+	*total = 0;
+	null_range(bounds);
+
+	for (i = 0; i < set->count; i++) {
+		intersect_range(&set->range[i], range, &intersections[nr]);
+		if (!is_non_empty_range(&intersections[nr]))
+			continue;
+
+		*total += range_length(&intersections[nr]);
+		expand_range(bounds, &intersections[nr]);
+		nr++;
+	}
+
+	return nr;
+}
+
 static void *offset_2_vaddr(struct cach_buf *buf, u32 offset)
 {
 	return (void *)((u32)buf->vstart + offset);
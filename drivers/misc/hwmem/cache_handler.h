@@ -31,6 +31,30 @@ struct cach_range {
 	u32 end; /* Exclusive */
 };
 
+/*
+ * Maximum number of disjoint ranges tracked per kind of cache content. When
+ * a range is added to a full set the two ranges closest to each other are
+ * merged, which only ever makes us do more maintenance, never less.
+ */
+#define CACH_MAX_RANGES 4
+
+struct cach_range_set {
+	int count;
+	struct cach_range range[CACH_MAX_RANGES]; /* Sorted and disjoint */
+};
+
+/*
+ * Cache maintenance done on behalf of a buffer. Byte counts are the lengths
+ * of the ranges requested, whole cache operations included.
+ */
+struct cach_stats {
+	u64 bytes_cleaned;
+	u64 bytes_flushed;
+	u32 nr_cleans;
+	u32 nr_flushes;
+	u32 nr_whole_cache;
+};
+
 /*
  * Internal, do not touch!
  */
@@ -45,8 +69,11 @@ struct cach_buf {
 	enum hwmem_mem_type mem_type;
 	bool in_cpu_write_buf;
 	struct cach_range range_in_cpu_cache;
-	struct cach_range range_dirty_in_cpu_cache;
-	struct cach_range range_invalid_in_cpu_cache;
+	struct cach_range_set dirty_in_cpu_cache;
+	struct cach_range_set invalid_in_cpu_cache;
+
+	/* Read only outside cache handler */
+	struct cach_stats stats;
 };
 
 void cach_init_buf(struct cach_buf *buf, enum hwmem_mem_type,
@@ -12,6 +12,7 @@
 #include <linux/kernel.h>
 #include <linux/err.h>
 #include <linux/list.h>
+#include <linux/rbtree.h>
 #include <linux/slab.h>
 #include <linux/mm.h>
 #include <linux/debugfs.h>
@@ -23,8 +24,15 @@
 
 #define MAX_INSTANCE_NAME_LENGTH 31
 
+/*
+ * Allocs cover the whole region and are kept on alloc_list in address order,
+ * so the neighbours a freed alloc can merge with are next to it on the list.
+ * Free allocs are in addition kept in free_tree, sorted by size and then by
+ * address, so the best fit is the leftmost free alloc that is large enough.
+ */
 struct alloc {
 	struct list_head list;
+	struct rb_node free_node;
 
 	bool in_use;
 	phys_addr_t paddr;
@@ -40,7 +48,10 @@ struct instance {
 	void *region_kaddr;
 	size_t region_size;
 
+	/* Protects alloc_list, free_tree and the debugfs status */
+	struct mutex lock;
 	struct list_head alloc_list;
+	struct rb_root free_tree;
 
 #ifdef CONFIG_DEBUG_FS
 	struct inode *debugfs_inode;
@@ -49,12 +60,14 @@ struct instance {
 	int cona_status_max_cont;
 	int cona_status_max_check;
 	int cona_status_biggest_free;
+	int cona_status_free_blocks;
 	int cona_status_printed;
 #endif /* #ifdef CONFIG_DEBUG_FS */
 };
 
 static LIST_HEAD(instance_list);
 
+/* Protects instance_list */
 static DEFINE_MUTEX(lock);
 
 void *cona_create(const char *name, phys_addr_t region_paddr,
@@ -69,8 +82,10 @@ static int init_alloc_list(struct instance *instance);
 static void clean_alloc_list(struct instance *instance);
 static struct alloc *find_free_alloc_bestfit(struct instance *instance,
 								size_t size);
-static struct alloc *split_allocation(struct alloc *alloc,
-							size_t new_alloc_size);
+static struct alloc *split_allocation(struct instance *instance,
+				struct alloc *alloc, size_t new_alloc_size);
+static void insert_free_alloc(struct instance *instance, struct alloc *alloc);
+static void remove_free_alloc(struct instance *instance, struct alloc *alloc);
 static phys_addr_t get_alloc_offset(struct instance *instance,
 							struct alloc *alloc);
 
@@ -134,7 +149,9 @@ void *cona_create(const char *name, phys_addr_t region_paddr,
 	 */
 	pasr_put(instance->region_paddr, instance->region_size);
 
+	mutex_init(&instance->lock);
 	INIT_LIST_HEAD(&instance->alloc_list);
+	instance->free_tree = RB_ROOT;
 	ret = init_alloc_list(instance);
 	if (ret < 0)
 		goto init_alloc_list_failed;
@@ -167,16 +184,17 @@ void *cona_alloc(void *instance, size_t size)
 	if (size == 0)
 		return ERR_PTR(-EINVAL);
 
-	mutex_lock(&lock);
+	mutex_lock(&instance_l->lock);
 
 	alloc = find_free_alloc_bestfit(instance_l, size);
 	if (IS_ERR(alloc))
 		goto out;
 	if (size < alloc->size) {
-		alloc = split_allocation(alloc, size);
+		alloc = split_allocation(instance_l, alloc, size);
 		if (IS_ERR(alloc))
 			goto out;
 	} else {
+		remove_free_alloc(instance_l, alloc);
 		alloc->in_use = true;
 	}
 
@@ -190,7 +208,7 @@ void *cona_alloc(void *instance, size_t size)
 #endif /* #ifdef CONFIG_DEBUG_FS */
 
 out:
-	mutex_unlock(&lock);
+	mutex_unlock(&instance_l->lock);
 
 	return alloc;
 }
@@ -201,7 +219,7 @@ void cona_free(void *instance, void *alloc)
 	struct alloc *alloc_l = (struct alloc *)alloc;
 	struct alloc *other;
 
-	mutex_lock(&lock);
+	mutex_lock(&instance_l->lock);
 
 	alloc_l->in_use = false;
 
@@ -214,6 +232,7 @@ void cona_free(void *instance, void *alloc)
 	other = list_entry(alloc_l->list.prev, struct alloc, list);
 	if ((alloc_l->list.prev != &instance_l->alloc_list) &&
 							!other->in_use) {
+		remove_free_alloc(instance_l, other);
 		other->size += alloc_l->size;
 		list_del(&alloc_l->list);
 		kfree(alloc_l);
@@ -222,12 +241,14 @@ void cona_free(void *instance, void *alloc)
 	other = list_entry(alloc_l->list.next, struct alloc, list);
 	if ((alloc_l->list.next != &instance_l->alloc_list) &&
 							!other->in_use) {
+		remove_free_alloc(instance_l, other);
 		alloc_l->size += other->size;
 		list_del(&other->list);
 		kfree(other);
 	}
+	insert_free_alloc(instance_l, alloc_l);
 
-	mutex_unlock(&lock);
+	mutex_unlock(&instance_l->lock);
 }
 
 phys_addr_t cona_get_alloc_paddr(void *alloc)
@@ -277,6 +298,7 @@ static int init_alloc_list(struct instance *instance)
 								PAGE_SIZE;
 			alloc->in_use = false;
 			list_add_tail(&alloc->list, &instance->alloc_list);
+			insert_free_alloc(instance, alloc);
 			curr_pos = alloc->paddr + alloc->size;
 		}
 
@@ -307,6 +329,7 @@ static int init_alloc_list(struct instance *instance)
 	alloc->size = region_end - curr_pos;
 	alloc->in_use = false;
 	list_add_tail(&alloc->list, &instance->alloc_list);
+	insert_free_alloc(instance, alloc);
 
 	return 0;
 
@@ -326,29 +349,31 @@ static void clean_alloc_list(struct instance *instance)
 
 		kfree(i);
 	}
+	instance->free_tree = RB_ROOT;
 }
 
 static struct alloc *find_free_alloc_bestfit(struct instance *instance,
 								size_t size)
 {
-	size_t best_diff = ~(size_t)0;
-	struct alloc *alloc = NULL, *i;
+	struct rb_node *node = instance->free_tree.rb_node;
+	struct alloc *alloc = NULL;
 
-	list_for_each_entry(i, &instance->alloc_list, list) {
-		size_t diff = i->size - size;
-		if (i->in_use || i->size < size)
-			continue;
-		if (diff < best_diff) {
+	while (node != NULL) {
+		struct alloc *i = rb_entry(node, struct alloc, free_node);
+
+		if (i->size >= size) {
 			alloc = i;
-			best_diff = diff;
+			node = node->rb_left;
+		} else {
+			node = node->rb_right;
 		}
 	}
 
 	return alloc != NULL ? alloc : ERR_PTR(-ENOMEM);
 }
 
-static struct alloc *split_allocation(struct alloc *alloc,
-							size_t new_alloc_size)
+static struct alloc *split_allocation(struct instance *instance,
+				struct alloc *alloc, size_t new_alloc_size)
 {
 	struct alloc *new_alloc;
 
@@ -359,14 +384,43 @@ static struct alloc *split_allocation(struct alloc *alloc,
 	new_alloc->in_use = true;
 	new_alloc->paddr = alloc->paddr;
 	new_alloc->size = new_alloc_size;
+
+	/* The remainder changes size and so its place in free_tree */
+	remove_free_alloc(instance, alloc);
 	alloc->size -= new_alloc_size;
 	alloc->paddr += new_alloc_size;
+	insert_free_alloc(instance, alloc);
 
 	list_add_tail(&new_alloc->list, &alloc->list);
 
 	return new_alloc;
 }
 
+static void insert_free_alloc(struct instance *instance, struct alloc *alloc)
+{
+	struct rb_node **new = &instance->free_tree.rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*new != NULL) {
+		struct alloc *i = rb_entry(*new, struct alloc, free_node);
+
+		parent = *new;
+		if (alloc->size < i->size ||
+		    (alloc->size == i->size && alloc->paddr < i->paddr))
+			new = &parent->rb_left;
+		else
+			new = &parent->rb_right;
+	}
+
+	rb_link_node(&alloc->free_node, parent, new);
+	rb_insert_color(&alloc->free_node, &instance->free_tree);
+}
+
+static void remove_free_alloc(struct instance *instance, struct alloc *alloc)
+{
+	rb_erase(&alloc->free_node, &instance->free_tree);
+}
+
 static phys_addr_t get_alloc_offset(struct instance *instance,
 							struct alloc *alloc)
 {
@@ -404,10 +458,12 @@ static int print_alloc(struct instance *instance, struct alloc *alloc,
 			buf_size_l = buf_size;
 
 		if (i == 1) {
-			if (alloc->in_use)
+			if (alloc->in_use) {
 				instance->cona_status_used += alloc->size;
-			else
+			} else {
 				instance->cona_status_free += alloc->size;
+				instance->cona_status_free_blocks++;
+			}
 		}
 
 		if (!alloc->in_use) {
@@ -453,13 +509,18 @@ static int print_alloc_status(struct instance *instance, char **buf,
 
 		ret = snprintf(*buf, buf_size_l, "Overall peak usage:\t%10u "
 				"(%dMB)\nCurrent max usage:\t%10u (%dMB)\n"
-				"Current biggest free:\t%10d (%dMB)\n",
+				"Current biggest free:\t%10d (%dMB)\n"
+				"Current free:\t\t%10d (%dMB)\n"
+				"Current free blocks:\t%10d\n",
 				instance->cona_status_max_check,
 				instance->cona_status_max_check/1024/1024,
 				instance->cona_status_max_cont,
 				instance->cona_status_max_cont/1024/1024,
 				instance->cona_status_biggest_free,
-				instance->cona_status_biggest_free/1024/1024);
+				instance->cona_status_biggest_free/1024/1024,
+				instance->cona_status_free,
+				instance->cona_status_free/1024/1024,
+				instance->cona_status_free_blocks);
 
 		if (ret < 0)
 			return -ENOMSG;
@@ -507,13 +568,17 @@ static int debugfs_allocs_read(struct file *file, char __user *buf,
 	if (local_buf == NULL)
 		return -ENOMEM;
 
+	/* Instances are never destroyed, only the lookup needs the list lock */
 	mutex_lock(&lock);
 	instance = get_instance_from_file(file);
+	mutex_unlock(&lock);
 	if (IS_ERR(instance)) {
-		ret = PTR_ERR(instance);
-		goto out;
+		kfree(local_buf);
+		return PTR_ERR(instance);
 	}
 
+	mutex_lock(&instance->lock);
+
 	list_for_each_entry(curr_alloc, &instance->alloc_list, list) {
 		phys_addr_t alloc_offset = get_alloc_offset(instance,
 								curr_alloc);
@@ -560,6 +625,7 @@ static int debugfs_allocs_read(struct file *file, char __user *buf,
 		instance->cona_status_free = 0;
 		instance->cona_status_used = 0;
 		instance->cona_status_biggest_free = 0;
+		instance->cona_status_free_blocks = 0;
 	}
 
 	bytes_read = (size_t)(local_buf_pos - local_buf);
@@ -572,7 +638,7 @@ static int debugfs_allocs_read(struct file *file, char __user *buf,
 
 out:
 	kfree(local_buf);
-	mutex_unlock(&lock);
+	mutex_unlock(&instance->lock);
 
 	return ret;
 }
@@ -697,13 +697,21 @@ static int print_alloc(struct hwmem_alloc *alloc, char **buf, size_t buf_size)
 				"\tPhysical address: %#x\n"
 				"\tKernel virtual address: %#x\n"
 				"\tCreator: %s\n"
-				"\tCreator thread group id: %u\n",
+				"\tCreator thread group id: %u\n"
+				"\t$ cleaned: %llu bytes in %u operations\n"
+				"\t$ flushed: %llu bytes in %u operations\n"
+				"\t$ whole cache operations: %u\n",
 			(unsigned int)alloc, alloc->size, alloc->mem_type->id,
 			alloc->name, atomic_read(&alloc->ref_cnt),
 			alloc->flags, alloc->cach_buf.cache_settings,
 			alloc->default_access, alloc->paddr,
 			(unsigned int)alloc->kaddr, creator,
-			alloc->creator_tgid);
+			alloc->creator_tgid,
+			alloc->cach_buf.stats.bytes_cleaned,
+			alloc->cach_buf.stats.nr_cleans,
+			alloc->cach_buf.stats.bytes_flushed,
+			alloc->cach_buf.stats.nr_flushes,
+			alloc->cach_buf.stats.nr_whole_cache);
 		if (ret < 0)
 			return -ENOMSG;
 		else if (ret + 1 > buf_size)
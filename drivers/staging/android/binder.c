@@ -19,6 +19,7 @@
 #include <linux/fdtable.h>
 #include <linux/file.h>
 #include <linux/fs.h>
+#include <linux/ktime.h>
 #include <linux/list.h>
 #include <linux/miscdevice.h>
 #include <linux/mm.h>
@@ -28,26 +29,57 @@
 #include <linux/poll.h>
 #include <linux/debugfs.h>
 #include <linux/rbtree.h>
+#include <linux/rwsem.h>
 #include <linux/sched.h>
 #include <linux/seq_file.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
 #include <linux/uaccess.h>
 #include <linux/vmalloc.h>
 
 #include "binder.h"
 
-static DEFINE_MUTEX(binder_lock);
+/*
+ * Locking
+ *
+ * binder_global_rwsem is held for reading by every ioctl, poll and
+ * transaction, so that no binder_proc or binder_thread can be freed under
+ * them. It is held for writing by anything that tears down threads or
+ * processes, sets up the context manager, or otherwise walks state that
+ * belongs to several processes at once (deferred work, debugfs dumps).
+ *
+ * Below it, each binder_proc has:
+ *   proc->lock       mutex; the thread, node and ref trees, the buffer
+ *                    allocator, per-thread state (looper, transaction
+ *                    stack, return errors), the thread counters and
+ *                    the list of threads waiting for process work.
+ *   proc->todo_lock  spinlock; proc->todo, the todo lists of its threads,
+ *                    proc->delivered_death and the async_todo lists and
+ *                    work entries of the nodes it owns.
+ * and each binder_node has:
+ *   node->lock       spinlock; the reference counts, the has_ and
+ *                    pending_ bits, has_async_transaction and node->refs.
+ *
+ * Lock order is binder_global_rwsem -> proc->lock -> node->lock ->
+ * proc->todo_lock. At most two proc->locks are held at once, the sender's
+ * and the target's of a transaction, and they are taken in address order
+ * (see binder_lock_target_proc()). Transactions between unrelated
+ * processes therefore never contend with each other.
+ */
+static DECLARE_RWSEM(binder_global_rwsem);
 static DEFINE_MUTEX(binder_deferred_lock);
+static DEFINE_SPINLOCK(binder_dead_nodes_lock);
 
 static HLIST_HEAD(binder_procs);
 static HLIST_HEAD(binder_deferred_list);
 static HLIST_HEAD(binder_dead_nodes);
+static LIST_HEAD(binder_deferred_replies);
 
 static struct dentry *binder_debugfs_dir_entry_root;
 static struct dentry *binder_debugfs_dir_entry_proc;
 static struct binder_node *binder_context_mgr_node;
 static uid_t binder_context_mgr_uid = -1;
-static int binder_last_id;
+static atomic_t binder_last_id;
 static struct workqueue_struct *binder_deferred_workqueue;
 
 #define BINDER_DEBUG_ENTRY(name) \
@@ -105,6 +137,10 @@ module_param_named(debug_mask, binder_debug_mask, uint, S_IWUSR | S_IRUGO);
 static int binder_debug_no_lock;
 module_param_named(proc_no_lock, binder_debug_no_lock, bool, S_IWUSR | S_IRUGO);
 
+/* pages of freed buffers a proc keeps mapped for reuse */
+static int binder_cached_pages = 16;
+module_param_named(cached_pages, binder_cached_pages, int, S_IWUSR | S_IRUGO);
+
 static DECLARE_WAIT_QUEUE_HEAD(binder_user_error_wait);
 static int binder_stop_on_user_error;
 
@@ -146,22 +182,22 @@ enum binder_stat_types {
 };
 
 struct binder_stats {
-	int br[_IOC_NR(BR_FAILED_REPLY) + 1];
-	int bc[_IOC_NR(BC_DEAD_BINDER_DONE) + 1];
-	int obj_created[BINDER_STAT_COUNT];
-	int obj_deleted[BINDER_STAT_COUNT];
+	atomic_t br[_IOC_NR(BR_FAILED_REPLY) + 1];
+	atomic_t bc[_IOC_NR(BC_DEAD_BINDER_DONE) + 1];
+	atomic_t obj_created[BINDER_STAT_COUNT];
+	atomic_t obj_deleted[BINDER_STAT_COUNT];
 };
 
 static struct binder_stats binder_stats;
 
 static inline void binder_stats_deleted(enum binder_stat_types type)
 {
-	binder_stats.obj_deleted[type]++;
+	atomic_inc(&binder_stats.obj_deleted[type]);
 }
 
 static inline void binder_stats_created(enum binder_stat_types type)
 {
-	binder_stats.obj_created[type]++;
+	atomic_inc(&binder_stats.obj_created[type]);
 }
 
 struct binder_transaction_log_entry {
@@ -183,11 +219,14 @@ struct binder_transaction_log {
 };
 static struct binder_transaction_log binder_transaction_log;
 static struct binder_transaction_log binder_transaction_log_failed;
+static DEFINE_SPINLOCK(binder_transaction_log_lock);
 
 static struct binder_transaction_log_entry *binder_transaction_log_add(
 	struct binder_transaction_log *log)
 {
 	struct binder_transaction_log_entry *e;
+
+	spin_lock(&binder_transaction_log_lock);
 	e = &log->entry[log->next];
 	memset(e, 0, sizeof(*e));
 	log->next++;
@@ -195,6 +234,7 @@ static struct binder_transaction_log_entry *binder_transaction_log_add(
 		log->next = 0;
 		log->full = 1;
 	}
+	spin_unlock(&binder_transaction_log_lock);
 	return e;
 }
 
@@ -218,6 +258,7 @@ struct binder_node {
 		struct hlist_node dead_node;
 	};
 	struct binder_proc *proc;
+	spinlock_t lock;
 	struct hlist_head refs;
 	int internal_strong_refs;
 	int local_weak_refs;
@@ -258,8 +299,11 @@ struct binder_ref {
 
 struct binder_buffer {
 	struct list_head entry; /* free and allocated entries by addesss */
-	struct rb_node rb_node; /* free entry by size or allocated entry */
-				/* by address */
+	union {
+		struct rb_node rb_node; /* large free entry by size or */
+					/* allocated entry by address */
+		struct list_head class_entry; /* small free entry */
+	};
 	unsigned free:1;
 	unsigned allow_user_free:1;
 	unsigned async_transaction:1;
@@ -279,8 +323,52 @@ enum binder_deferred_state {
 	BINDER_DEFERRED_RELEASE      = 0x04,
 };
 
+/*
+ * Scheduling policy and kernel priority (task->normal_prio scale, lower is
+ * more important) a thread runs a transaction at.
+ */
+struct binder_priority {
+	unsigned int sched_policy;
+	int prio;
+};
+
+/*
+ * Free buffers smaller than BINDER_BUF_CLASSES << BINDER_BUF_CLASS_SHIFT
+ * bytes sit on per-size-class lists, larger ones in the free_buffers tree.
+ * Any buffer on a class list above the one a size rounds up to fits it.
+ */
+#define BINDER_BUF_CLASS_SHIFT		5
+#define BINDER_BUF_CLASSES		32
+
+/* zeroed pages kept ready so the transaction path need not allocate */
+#define BINDER_SPARE_PAGES		8
+
+/* log2 microsecond buckets of binder_alloc_buf() run time */
+#define BINDER_ALLOC_LATENCY_BUCKETS	10
+
+/*
+ * A present page is either backing an allocated buffer (or the header of a
+ * free one), or it is cached: still mapped but unused, linked on
+ * proc->page_lru and handed out again before anything is allocated.
+ */
+struct binder_page {
+	struct page *page;
+	struct list_head lru;
+	unsigned cached:1;
+};
+
+struct binder_alloc_stats {
+	unsigned long latency[BINDER_ALLOC_LATENCY_BUCKETS];
+	unsigned long failed;
+	unsigned long page_cached;
+	unsigned long page_spare;
+	unsigned long page_alloc;
+};
+
 struct binder_proc {
 	struct hlist_node proc_node;
+	struct mutex lock;
+	spinlock_t todo_lock;
 	struct rb_root threads;
 	struct rb_root nodes;
 	struct rb_root refs_by_desc;
@@ -296,10 +384,19 @@ struct binder_proc {
 
 	struct list_head buffers;
 	struct rb_root free_buffers;
+	struct list_head free_classes[BINDER_BUF_CLASSES];
+	DECLARE_BITMAP(free_class_map, BINDER_BUF_CLASSES);
 	struct rb_root allocated_buffers;
 	size_t free_async_space;
 
-	struct page **pages;
+	struct binder_page *pages;
+	struct list_head page_lru;
+	int pages_cached;
+	spinlock_t spare_lock;
+	struct list_head spare_pages;
+	int spare_count;
+	struct work_struct spare_work;
+	struct binder_alloc_stats alloc_stats;
 	size_t buffer_size;
 	uint32_t buffer_free;
 	struct list_head todo;
@@ -310,7 +407,7 @@ struct binder_proc {
 	int requested_threads;
 	int requested_threads_started;
 	int ready_threads;
-	long default_priority;
+	struct list_head waiting_threads;
 	struct dentry *debugfs_entry;
 };
 
@@ -326,8 +423,11 @@ enum {
 struct binder_thread {
 	struct binder_proc *proc;
 	struct rb_node rb_node;
+	struct list_head waiting_thread_node;
+	struct task_struct *task; /* valid while on proc->waiting_threads */
 	int pid;
 	int looper;
+	struct binder_priority looper_priority; /* restored while idle */
 	struct binder_transaction *transaction_stack;
 	struct list_head todo;
 	uint32_t return_error; /* Write failed, return error code in read buf */
@@ -352,13 +452,14 @@ struct binder_transaction {
 	struct binder_buffer *buffer;
 	unsigned int	code;
 	unsigned int	flags;
-	long	priority;
-	long	saved_priority;
+	struct binder_priority	priority;
+	struct binder_priority	saved_priority;
 	uid_t	sender_euid;
 };
 
 static void
 binder_defer_work(struct binder_proc *proc, enum binder_deferred_state defer);
+static void binder_defer_failed_reply(struct binder_transaction *t);
 
 /*
  * copied from get_unused_fd_flags
@@ -515,6 +616,64 @@ static void binder_set_nice(long nice)
 	binder_user_error("binder: %d RLIMIT_NICE not set\n", current->pid);
 }
 
+static int binder_is_rt_policy(unsigned int policy)
+{
+	return policy == SCHED_FIFO || policy == SCHED_RR;
+}
+
+static int binder_nice_to_prio(long nice)
+{
+	return MAX_RT_PRIO + nice + 20;
+}
+
+static long binder_prio_to_nice(int prio)
+{
+	return prio - MAX_RT_PRIO - 20;
+}
+
+static struct binder_priority binder_current_priority(void)
+{
+	struct binder_priority priority = {
+		.sched_policy = current->policy,
+		.prio = current->normal_prio,
+	};
+	return priority;
+}
+
+/*
+ * Switch the current thread to the policy and priority of the sender of a
+ * transaction, or back to what it had before. The thread acts for the
+ * sender, who already runs at that priority, so a real time policy is set
+ * without the permission and RLIMIT_RTPRIO checks of sched_setscheduler();
+ * it never goes above the sender's own priority.
+ */
+static void binder_set_priority(struct binder_priority priority)
+{
+	struct sched_param param = { .sched_priority = 0 };
+
+	if (current->policy == priority.sched_policy &&
+	    current->normal_prio == priority.prio)
+		return;
+
+	if (binder_is_rt_policy(priority.sched_policy)) {
+		param.sched_priority = MAX_RT_PRIO - 1 - priority.prio;
+		if (!sched_setscheduler_nocheck(current, priority.sched_policy,
+						&param))
+			return;
+		binder_debug(BINDER_DEBUG_PRIORITY_CAP,
+			     "binder: %d: policy %u prio %d not allowed use "
+			     "nice -20 instead\n", current->pid,
+			     priority.sched_policy, priority.prio);
+		priority.sched_policy = SCHED_NORMAL;
+		priority.prio = binder_nice_to_prio(-20);
+		param.sched_priority = 0;
+	}
+	if (current->policy != priority.sched_policy)
+		sched_setscheduler_nocheck(current, priority.sched_policy,
+					   &param);
+	binder_set_nice(binder_prio_to_nice(priority.prio));
+}
+
 static size_t binder_buffer_size(struct binder_proc *proc,
 				 struct binder_buffer *buffer)
 {
@@ -525,6 +684,11 @@ static size_t binder_buffer_size(struct binder_proc *proc,
 			struct binder_buffer, entry) - (size_t)buffer->data;
 }
 
+static int binder_buffer_class(size_t size)
+{
+	return size >> BINDER_BUF_CLASS_SHIFT;
+}
+
 static void binder_insert_free_buffer(struct binder_proc *proc,
 				      struct binder_buffer *new_buffer)
 {
@@ -533,6 +697,7 @@ static void binder_insert_free_buffer(struct binder_proc *proc,
 	struct binder_buffer *buffer;
 	size_t buffer_size;
 	size_t new_buffer_size;
+	int class;
 
 	BUG_ON(!new_buffer->free);
 
@@ -542,6 +707,13 @@ static void binder_insert_free_buffer(struct binder_proc *proc,
 		     "binder: %d: add free buffer, size %zd, "
 		     "at %p\n", proc->pid, new_buffer_size, new_buffer);
 
+	class = binder_buffer_class(new_buffer_size);
+	if (class < BINDER_BUF_CLASSES) {
+		list_add(&new_buffer->class_entry, &proc->free_classes[class]);
+		__set_bit(class, proc->free_class_map);
+		return;
+	}
+
 	while (*p) {
 		parent = *p;
 		buffer = rb_entry(parent, struct binder_buffer, rb_node);
@@ -558,6 +730,64 @@ static void binder_insert_free_buffer(struct binder_proc *proc,
 	rb_insert_color(&new_buffer->rb_node, &proc->free_buffers);
 }
 
+/* Must be called before the buffer or its neighbours change size */
+static void binder_erase_free_buffer(struct binder_proc *proc,
+				     struct binder_buffer *buffer)
+{
+	int class = binder_buffer_class(binder_buffer_size(proc, buffer));
+
+	BUG_ON(!buffer->free);
+
+	if (class < BINDER_BUF_CLASSES) {
+		list_del(&buffer->class_entry);
+		if (list_empty(&proc->free_classes[class]))
+			__clear_bit(class, proc->free_class_map);
+	} else
+		rb_erase(&buffer->rb_node, &proc->free_buffers);
+}
+
+/*
+ * Small sizes take the most recently freed buffer of the first non-empty
+ * class that is certain to fit, large ones (and small ones when no class
+ * has anything) the best fit from the tree.
+ */
+static struct binder_buffer *binder_find_free_buffer(struct binder_proc *proc,
+						     size_t size)
+{
+	struct rb_node *n = proc->free_buffers.rb_node;
+	struct rb_node *best_fit = NULL;
+	struct binder_buffer *buffer;
+	size_t buffer_size;
+	int class;
+
+	class = DIV_ROUND_UP(size, 1 << BINDER_BUF_CLASS_SHIFT);
+	if (class < BINDER_BUF_CLASSES) {
+		class = find_next_bit(proc->free_class_map,
+				      BINDER_BUF_CLASSES, class);
+		if (class < BINDER_BUF_CLASSES)
+			return list_first_entry(&proc->free_classes[class],
+						struct binder_buffer,
+						class_entry);
+	}
+
+	while (n) {
+		buffer = rb_entry(n, struct binder_buffer, rb_node);
+		BUG_ON(!buffer->free);
+		buffer_size = binder_buffer_size(proc, buffer);
+
+		if (size < buffer_size) {
+			best_fit = n;
+			n = n->rb_left;
+		} else if (size > buffer_size)
+			n = n->rb_right;
+		else
+			return buffer;
+	}
+	if (best_fit == NULL)
+		return NULL;
+	return rb_entry(best_fit, struct binder_buffer, rb_node);
+}
+
 static void binder_insert_allocated_buffer(struct binder_proc *proc,
 					   struct binder_buffer *new_buffer)
 {
@@ -607,6 +837,154 @@ static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
 	return NULL;
 }
 
+static void binder_refill_spare_pages(struct work_struct *work)
+{
+	struct binder_proc *proc = container_of(work, struct binder_proc,
+						spare_work);
+	struct page *page;
+
+	for (;;) {
+		page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+		if (page == NULL)
+			return;
+		spin_lock(&proc->spare_lock);
+		if (proc->spare_count >= BINDER_SPARE_PAGES) {
+			spin_unlock(&proc->spare_lock);
+			__free_page(page);
+			return;
+		}
+		list_add(&page->lru, &proc->spare_pages);
+		proc->spare_count++;
+		spin_unlock(&proc->spare_lock);
+	}
+}
+
+static struct page *binder_get_spare_page(struct binder_proc *proc)
+{
+	struct page *page = NULL;
+	int refill;
+
+	spin_lock(&proc->spare_lock);
+	if (!list_empty(&proc->spare_pages)) {
+		page = list_first_entry(&proc->spare_pages, struct page, lru);
+		list_del(&page->lru);
+		proc->spare_count--;
+	}
+	refill = proc->spare_count < BINDER_SPARE_PAGES / 2;
+	spin_unlock(&proc->spare_lock);
+
+	if (refill)
+		schedule_work(&proc->spare_work);
+
+	if (page) {
+		proc->alloc_stats.page_spare++;
+		return page;
+	}
+	page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+	if (page)
+		proc->alloc_stats.page_alloc++;
+	return page;
+}
+
+static void binder_release_page(struct binder_proc *proc,
+				struct vm_area_struct *vma,
+				struct binder_page *page)
+{
+	void *page_addr = proc->buffer + (page - proc->pages) * PAGE_SIZE;
+
+	if (vma)
+		zap_page_range(vma, (uintptr_t)page_addr +
+			       proc->user_buffer_offset, PAGE_SIZE, NULL);
+	unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+	put_page(page->page);
+	page->page = NULL;
+}
+
+/* Release least recently used cached pages until at most keep are left */
+static int binder_trim_cached_pages(struct binder_proc *proc,
+				    struct vm_area_struct *vma, int keep)
+{
+	struct binder_page *page;
+	int released = 0;
+
+	while (proc->pages_cached > max(keep, 0)) {
+		page = list_entry(proc->page_lru.prev, struct binder_page, lru);
+		list_del(&page->lru);
+		page->cached = 0;
+		proc->pages_cached--;
+		binder_release_page(proc, vma, page);
+		released++;
+	}
+	return released;
+}
+
+/*
+ * Give back up to nr spare and cached pages of one proc. Reclaim can
+ * run from within binder with any of the locks below held, so they are
+ * only tried.
+ */
+static int binder_shrink_proc(struct binder_proc *proc, int nr)
+{
+	struct mm_struct *mm;
+	struct page *page;
+	int freed = 0;
+
+	spin_lock(&proc->spare_lock);
+	while (freed < nr && !list_empty(&proc->spare_pages)) {
+		page = list_first_entry(&proc->spare_pages, struct page, lru);
+		list_del(&page->lru);
+		proc->spare_count--;
+		__free_page(page);
+		freed++;
+	}
+	spin_unlock(&proc->spare_lock);
+
+	if (freed >= nr || !proc->pages_cached)
+		return freed;
+	if (!mutex_trylock(&proc->lock))
+		return freed;
+
+	mm = get_task_mm(proc->tsk);
+	if (mm && down_write_trylock(&mm->mmap_sem)) {
+		freed += binder_trim_cached_pages(proc, proc->vma,
+					proc->pages_cached - (nr - freed));
+		up_write(&mm->mmap_sem);
+	}
+	mutex_unlock(&proc->lock);
+	if (mm)
+		mmput(mm);
+	return freed;
+}
+
+static int binder_shrink(struct shrinker *s, struct shrink_control *sc)
+{
+	struct binder_proc *proc;
+	struct hlist_node *pos;
+	int nr = sc->nr_to_scan;
+	int count = 0;
+
+	if (!down_read_trylock(&binder_global_rwsem))
+		return nr ? -1 : 0;
+
+	hlist_for_each_entry(proc, pos, &binder_procs, proc_node) {
+		if (nr > 0)
+			nr -= binder_shrink_proc(proc, nr);
+		count += proc->pages_cached + proc->spare_count;
+	}
+	up_read(&binder_global_rwsem);
+
+	return count;
+}
+
+static struct shrinker binder_shrinker = {
+	.shrink = binder_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
+/*
+ * Freeing a range only moves its pages to the per-proc cache, from which
+ * they are mapped and unmapped in least recently used order.
+ */
 static int binder_update_page_range(struct binder_proc *proc, int allocate,
 				    void *start, void *end,
 				    struct vm_area_struct *vma)
@@ -614,7 +992,7 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	void *page_addr;
 	unsigned long user_page_addr;
 	struct vm_struct tmp_area;
-	struct page **page;
+	struct binder_page *page;
 	struct mm_struct *mm;
 
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
@@ -648,16 +1026,23 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		struct page **page_array_ptr;
 		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
 
-		BUG_ON(*page);
-		*page = alloc_page(GFP_KERNEL | __GFP_ZERO);
-		if (*page == NULL) {
+		if (page->page) {
+			BUG_ON(!page->cached);
+			list_del(&page->lru);
+			page->cached = 0;
+			proc->pages_cached--;
+			proc->alloc_stats.page_cached++;
+			continue;
+		}
+		page->page = binder_get_spare_page(proc);
+		if (page->page == NULL) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
 			       "for page at %p\n", proc->pid, page_addr);
 			goto err_alloc_page_failed;
 		}
 		tmp_area.addr = page_addr;
 		tmp_area.size = PAGE_SIZE + PAGE_SIZE /* guard page? */;
-		page_array_ptr = page;
+		page_array_ptr = &page->page;
 		ret = map_vm_area(&tmp_area, PAGE_KERNEL, &page_array_ptr);
 		if (ret) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
@@ -667,7 +1052,7 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		}
 		user_page_addr =
 			(uintptr_t)page_addr + proc->user_buffer_offset;
-		ret = vm_insert_page(vma, user_page_addr, page[0]);
+		ret = vm_insert_page(vma, user_page_addr, page->page);
 		if (ret) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
 			       "to map page at %lx in userspace\n",
@@ -686,17 +1071,19 @@ free_range:
 	for (page_addr = end - PAGE_SIZE; page_addr >= start;
 	     page_addr -= PAGE_SIZE) {
 		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
-		if (vma)
-			zap_page_range(vma, (uintptr_t)page_addr +
-				proc->user_buffer_offset, PAGE_SIZE, NULL);
+		list_add(&page->lru, &proc->page_lru);
+		page->cached = 1;
+		proc->pages_cached++;
+		continue;
 err_vm_insert_page_failed:
 		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
 err_map_kernel_failed:
-		__free_page(*page);
-		*page = NULL;
+		put_page(page->page);
+		page->page = NULL;
 err_alloc_page_failed:
 		;
 	}
+	binder_trim_cached_pages(proc, vma, binder_cached_pages);
 err_no_vma:
 	if (mm) {
 		up_write(&mm->mmap_sem);
@@ -705,14 +1092,23 @@ err_no_vma:
 	return -ENOMEM;
 }
 
-static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
-					      size_t data_size,
-					      size_t offsets_size, int is_async)
+static void *buffer_start_page(struct binder_buffer *buffer)
+{
+	return (void *)((uintptr_t)buffer & PAGE_MASK);
+}
+
+static void *buffer_end_page(struct binder_buffer *buffer)
+{
+	return (void *)(((uintptr_t)(buffer + 1) - 1) & PAGE_MASK);
+}
+
+static struct binder_buffer *__binder_alloc_buf(struct binder_proc *proc,
+						size_t data_size,
+						size_t offsets_size,
+						int is_async)
 {
-	struct rb_node *n = proc->free_buffers.rb_node;
 	struct binder_buffer *buffer;
 	size_t buffer_size;
-	struct rb_node *best_fit = NULL;
 	void *has_page_addr;
 	void *end_page_addr;
 	size_t size;
@@ -740,30 +1136,13 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		return NULL;
 	}
 
-	while (n) {
-		buffer = rb_entry(n, struct binder_buffer, rb_node);
-		BUG_ON(!buffer->free);
-		buffer_size = binder_buffer_size(proc, buffer);
-
-		if (size < buffer_size) {
-			best_fit = n;
-			n = n->rb_left;
-		} else if (size > buffer_size)
-			n = n->rb_right;
-		else {
-			best_fit = n;
-			break;
-		}
-	}
-	if (best_fit == NULL) {
+	buffer = binder_find_free_buffer(proc, size);
+	if (buffer == NULL) {
 		printk(KERN_ERR "binder: %d: binder_alloc_buf size %zd failed, "
 		       "no address space\n", proc->pid, size);
 		return NULL;
 	}
-	if (n == NULL) {
-		buffer = rb_entry(best_fit, struct binder_buffer, rb_node);
-		buffer_size = binder_buffer_size(proc, buffer);
-	}
+	buffer_size = binder_buffer_size(proc, buffer);
 
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 		     "binder: %d: binder_alloc_buf size %zd got buff"
@@ -771,12 +1150,10 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 
 	has_page_addr =
 		(void *)(((uintptr_t)buffer->data + buffer_size) & PAGE_MASK);
-	if (n == NULL) {
-		if (size + sizeof(struct binder_buffer) + 4 >= buffer_size)
-			buffer_size = size; /* no room for other buffers */
-		else
-			buffer_size = size + sizeof(struct binder_buffer);
-	}
+	if (size + sizeof(struct binder_buffer) + 4 >= buffer_size)
+		buffer_size = size; /* no room for other buffers */
+	else
+		buffer_size = size + sizeof(struct binder_buffer);
 	end_page_addr =
 		(void *)PAGE_ALIGN((uintptr_t)buffer->data + buffer_size);
 	if (end_page_addr > has_page_addr)
@@ -785,7 +1162,7 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	    (void *)PAGE_ALIGN((uintptr_t)buffer->data), end_page_addr, NULL))
 		return NULL;
 
-	rb_erase(best_fit, &proc->free_buffers);
+	binder_erase_free_buffer(proc, buffer);
 	buffer->free = 0;
 	binder_insert_allocated_buffer(proc, buffer);
 	if (buffer_size != size) {
@@ -811,14 +1188,22 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	return buffer;
 }
 
-static void *buffer_start_page(struct binder_buffer *buffer)
+static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
+					      size_t data_size,
+					      size_t offsets_size, int is_async)
 {
-	return (void *)((uintptr_t)buffer & PAGE_MASK);
-}
+	struct binder_buffer *buffer;
+	ktime_t start = ktime_get();
+	s64 us;
 
-static void *buffer_end_page(struct binder_buffer *buffer)
-{
-	return (void *)(((uintptr_t)(buffer + 1) - 1) & PAGE_MASK);
+	buffer = __binder_alloc_buf(proc, data_size, offsets_size, is_async);
+
+	us = ktime_us_delta(ktime_get(), start);
+	proc->alloc_stats.latency[min_t(int, fls64(us),
+				BINDER_ALLOC_LATENCY_BUCKETS - 1)]++;
+	if (buffer == NULL)
+		proc->alloc_stats.failed++;
+	return buffer;
 }
 
 static void binder_delete_free_buffer(struct binder_proc *proc,
@@ -907,7 +1292,7 @@ static void binder_free_buf(struct binder_proc *proc,
 		struct binder_buffer *next = list_entry(buffer->entry.next,
 						struct binder_buffer, entry);
 		if (next->free) {
-			rb_erase(&next->rb_node, &proc->free_buffers);
+			binder_erase_free_buffer(proc, next);
 			binder_delete_free_buffer(proc, next);
 		}
 	}
@@ -915,8 +1300,8 @@ static void binder_free_buf(struct binder_proc *proc,
 		struct binder_buffer *prev = list_entry(buffer->entry.prev,
 						struct binder_buffer, entry);
 		if (prev->free) {
+			binder_erase_free_buffer(proc, prev);
 			binder_delete_free_buffer(proc, buffer);
-			rb_erase(&prev->rb_node, &proc->free_buffers);
 			buffer = prev;
 		}
 	}
@@ -968,8 +1353,9 @@ static struct binder_node *binder_new_node(struct binder_proc *proc,
 	binder_stats_created(BINDER_STAT_NODE);
 	rb_link_node(&node->rb_node, parent, p);
 	rb_insert_color(&node->rb_node, &proc->nodes);
-	node->debug_id = ++binder_last_id;
+	node->debug_id = atomic_inc_return(&binder_last_id);
 	node->proc = proc;
+	spin_lock_init(&node->lock);
 	node->ptr = ptr;
 	node->cookie = cookie;
 	node->work.type = BINDER_WORK_NODE;
@@ -982,8 +1368,12 @@ static struct binder_node *binder_new_node(struct binder_proc *proc,
 	return node;
 }
 
-static int binder_inc_node(struct binder_node *node, int strong, int internal,
-			   struct list_head *target_list)
+/*
+ * A non-NULL target_list is always a todo list of node->proc; callers
+ * pass one only for nodes of their own process.
+ */
+static int binder_inc_node_locked(struct binder_node *node, int strong,
+				  int internal, struct list_head *target_list)
 {
 	if (strong) {
 		if (internal) {
@@ -999,8 +1389,10 @@ static int binder_inc_node(struct binder_node *node, int strong, int internal,
 		} else
 			node->local_strong_refs++;
 		if (!node->has_strong_ref && target_list) {
+			spin_lock(&node->proc->todo_lock);
 			list_del_init(&node->work.entry);
 			list_add_tail(&node->work.entry, target_list);
+			spin_unlock(&node->proc->todo_lock);
 		}
 	} else {
 		if (!internal)
@@ -1011,13 +1403,35 @@ static int binder_inc_node(struct binder_node *node, int strong, int internal,
 					"for %d\n", node->debug_id);
 				return -EINVAL;
 			}
+			spin_lock(&node->proc->todo_lock);
 			list_add_tail(&node->work.entry, target_list);
+			spin_unlock(&node->proc->todo_lock);
 		}
 	}
 	return 0;
 }
 
-static int binder_dec_node(struct binder_node *node, int strong, int internal)
+static int binder_inc_node(struct binder_node *node, int strong, int internal,
+			   struct list_head *target_list)
+{
+	int ret;
+
+	spin_lock(&node->lock);
+	ret = binder_inc_node_locked(node, strong, internal, target_list);
+	spin_unlock(&node->lock);
+	return ret;
+}
+
+/*
+ * Drops a reference and returns 1 if the caller has to free the node.
+ *
+ * The caller may not hold node->proc->lock, so a live node that lost its
+ * last reference is handed back to its owner through the todo list; the
+ * owner frees it once no BR_RELEASE or BR_DECREFS is left to deliver.
+ * Only dead nodes are freed here.
+ */
+static int binder_dec_node_locked(struct binder_node *node, int strong,
+				  int internal)
 {
 	if (strong) {
 		if (internal)
@@ -1032,34 +1446,45 @@ static int binder_dec_node(struct binder_node *node, int strong, int internal)
 		if (node->local_weak_refs || !hlist_empty(&node->refs))
 			return 0;
 	}
-	if (node->proc && (node->has_strong_ref || node->has_weak_ref)) {
+	if (node->proc && (node->has_strong_ref || node->has_weak_ref ||
+	    (hlist_empty(&node->refs) && !node->local_strong_refs &&
+	     !node->local_weak_refs))) {
+		spin_lock(&node->proc->todo_lock);
 		if (list_empty(&node->work.entry)) {
 			list_add_tail(&node->work.entry, &node->proc->todo);
 			wake_up_interruptible(&node->proc->wait);
 		}
-	} else {
+		spin_unlock(&node->proc->todo_lock);
+	} else if (!node->proc) {
 		if (hlist_empty(&node->refs) && !node->local_strong_refs &&
 		    !node->local_weak_refs) {
-			list_del_init(&node->work.entry);
-			if (node->proc) {
-				rb_erase(&node->rb_node, &node->proc->nodes);
-				binder_debug(BINDER_DEBUG_INTERNAL_REFS,
-					     "binder: refless node %d deleted\n",
-					     node->debug_id);
-			} else {
-				hlist_del(&node->dead_node);
-				binder_debug(BINDER_DEBUG_INTERNAL_REFS,
-					     "binder: dead node %d deleted\n",
-					     node->debug_id);
-			}
-			kfree(node);
-			binder_stats_deleted(BINDER_STAT_NODE);
+			spin_lock(&binder_dead_nodes_lock);
+			hlist_del(&node->dead_node);
+			spin_unlock(&binder_dead_nodes_lock);
+			binder_debug(BINDER_DEBUG_INTERNAL_REFS,
+				     "binder: dead node %d deleted\n",
+				     node->debug_id);
+			return 1;
 		}
 	}
 
 	return 0;
 }
 
+static int binder_dec_node(struct binder_node *node, int strong, int internal)
+{
+	int free_node;
+
+	spin_lock(&node->lock);
+	free_node = binder_dec_node_locked(node, strong, internal);
+	spin_unlock(&node->lock);
+	if (free_node) {
+		kfree(node);
+		binder_stats_deleted(BINDER_STAT_NODE);
+	}
+	return 0;
+}
+
 
 static struct binder_ref *binder_get_ref(struct binder_proc *proc,
 					 uint32_t desc)
@@ -1103,7 +1528,7 @@ static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
 	if (new_ref == NULL)
 		return NULL;
 	binder_stats_created(BINDER_STAT_REF);
-	new_ref->debug_id = ++binder_last_id;
+	new_ref->debug_id = atomic_inc_return(&binder_last_id);
 	new_ref->proc = proc;
 	new_ref->node = node;
 	rb_link_node(&new_ref->rb_node_node, parent, p);
@@ -1132,7 +1557,9 @@ static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
 	rb_link_node(&new_ref->rb_node_desc, parent, p);
 	rb_insert_color(&new_ref->rb_node_desc, &proc->refs_by_desc);
 	if (node) {
+		spin_lock(&node->lock);
 		hlist_add_head(&new_ref->node_entry, &node->refs);
+		spin_unlock(&node->lock);
 
 		binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 			     "binder: %d new ref %d desc %d for "
@@ -1149,23 +1576,34 @@ static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
 
 static void binder_delete_ref(struct binder_ref *ref)
 {
+	struct binder_node *node = ref->node;
+	int free_node;
+
 	binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 		     "binder: %d delete ref %d desc %d for "
 		     "node %d\n", ref->proc->pid, ref->debug_id,
-		     ref->desc, ref->node->debug_id);
+		     ref->desc, node->debug_id);
 
 	rb_erase(&ref->rb_node_desc, &ref->proc->refs_by_desc);
 	rb_erase(&ref->rb_node_node, &ref->proc->refs_by_node);
+	spin_lock(&node->lock);
 	if (ref->strong)
-		binder_dec_node(ref->node, 1, 1);
+		binder_dec_node_locked(node, 1, 1);
 	hlist_del(&ref->node_entry);
-	binder_dec_node(ref->node, 0, 1);
+	free_node = binder_dec_node_locked(node, 0, 1);
+	spin_unlock(&node->lock);
+	if (free_node) {
+		kfree(node);
+		binder_stats_deleted(BINDER_STAT_NODE);
+	}
 	if (ref->death) {
 		binder_debug(BINDER_DEBUG_DEAD_BINDER,
 			     "binder: %d delete ref %d desc %d "
 			     "has death notification\n", ref->proc->pid,
 			     ref->debug_id, ref->desc);
+		spin_lock(&ref->proc->todo_lock);
 		list_del(&ref->death->work.entry);
+		spin_unlock(&ref->proc->todo_lock);
 		kfree(ref->death);
 		binder_stats_deleted(BINDER_STAT_DEATH);
 	}
@@ -1375,12 +1813,123 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 	}
 }
 
+/*
+ * Find the process a BC_TRANSACTION or BC_REPLY is headed for, without
+ * changing any state. binder_transaction() repeats the full checks once
+ * the target is locked, so NULL only means there is nothing to lock.
+ */
+static struct binder_proc *binder_peek_target_proc(struct binder_proc *proc,
+					struct binder_thread *thread,
+					struct binder_transaction_data *tr,
+					int reply)
+{
+	struct binder_node *node;
+
+	if (reply) {
+		struct binder_transaction *t = thread->transaction_stack;
+
+		if (t == NULL || t->to_thread != thread || t->from == NULL)
+			return NULL;
+		return t->from->proc;
+	}
+	if (tr->target.handle) {
+		struct binder_ref *ref = binder_get_ref(proc, tr->target.handle);
+
+		node = ref ? ref->node : NULL;
+	} else
+		node = binder_context_mgr_node;
+	return node ? node->proc : NULL;
+}
+
+/*
+ * Lock the target of a transaction in addition to the sender, whose lock
+ * is already held. Process locks nest in address order: if the target
+ * sorts first and cannot be taken right away, drop the sender's lock,
+ * take both in order and look the target up again, since the sender may
+ * have changed in the meantime. Returns the process that was locked, or
+ * NULL if there was none besides the sender.
+ */
+static struct binder_proc *binder_lock_target_proc(struct binder_proc *proc,
+					struct binder_thread *thread,
+					struct binder_transaction_data *tr,
+					int reply)
+{
+	struct binder_proc *target_proc;
+
+	for (;;) {
+		target_proc = binder_peek_target_proc(proc, thread, tr, reply);
+		if (target_proc == NULL || target_proc == proc)
+			return NULL;
+		if (proc < target_proc) {
+			mutex_lock_nested(&target_proc->lock,
+					  SINGLE_DEPTH_NESTING);
+			return target_proc;
+		}
+		if (mutex_trylock(&target_proc->lock))
+			return target_proc;
+
+		mutex_unlock(&proc->lock);
+		mutex_lock(&target_proc->lock);
+		mutex_lock_nested(&proc->lock, SINGLE_DEPTH_NESTING);
+		if (binder_peek_target_proc(proc, thread, tr, reply) ==
+		    target_proc)
+			return target_proc;
+		mutex_unlock(&target_proc->lock);
+	}
+}
+
+/*
+ * Take the thread that most recently started waiting for work of proc,
+ * so that real time work need not queue behind whatever the busy threads
+ * will pick up next. Called with proc->lock held.
+ */
+static struct binder_thread *binder_select_idle_thread(struct binder_proc *proc)
+{
+	struct binder_thread *thread;
+
+	if (list_empty(&proc->waiting_threads))
+		return NULL;
+	thread = list_first_entry(&proc->waiting_threads, struct binder_thread,
+				  waiting_thread_node);
+	list_del_init(&thread->waiting_thread_node);
+	return thread;
+}
+
+/*
+ * Queue a real time transaction on proc->todo ahead of the transactions
+ * of lower priority at its tail, but never ahead of other kinds of work,
+ * whose order matters to userspace. Called with proc->lock and
+ * proc->todo_lock held, so no reader is working on the head of the list.
+ */
+static void binder_enqueue_rt_work(struct list_head *list,
+				   struct binder_transaction *t)
+{
+	struct list_head *pos;
+	struct binder_work *w;
+	struct binder_transaction *queued;
+
+	for (pos = list->prev; pos != list; pos = pos->prev) {
+		w = list_entry(pos, struct binder_work, entry);
+		if (w->type != BINDER_WORK_TRANSACTION)
+			break;
+		queued = container_of(w, struct binder_transaction, work);
+		if (queued->priority.prio <= t->priority.prio)
+			break;
+	}
+	list_add(&t->work.entry, pos);
+}
+
+/*
+ * Called with proc->lock held and, if it is another process, the lock
+ * of the target taken by binder_lock_target_proc().
+ */
 static void binder_transaction(struct binder_proc *proc,
 			       struct binder_thread *thread,
 			       struct binder_transaction_data *tr, int reply)
 {
 	struct binder_transaction *t;
 	struct binder_work *tcomplete;
+	struct binder_thread *idle_thread = NULL;
 	size_t *offp, *off_end;
 	struct binder_proc *target_proc;
 	struct binder_thread *target_thread = NULL;
@@ -1408,7 +1957,7 @@ static void binder_transaction(struct binder_proc *proc,
 			return_error = BR_FAILED_REPLY;
 			goto err_empty_call_stack;
 		}
-		binder_set_nice(in_reply_to->saved_priority);
+		binder_set_priority(in_reply_to->saved_priority);
 		if (in_reply_to->to_thread != thread) {
 			binder_user_error("binder: %d:%d got reply transaction "
 				"with bad transaction stack,"
@@ -1513,7 +2062,7 @@ static void binder_transaction(struct binder_proc *proc,
 	}
 	binder_stats_created(BINDER_STAT_TRANSACTION_COMPLETE);
 
-	t->debug_id = ++binder_last_id;
+	t->debug_id = atomic_inc_return(&binder_last_id);
 	e->debug_id = t->debug_id;
 
 	if (reply)
@@ -1542,7 +2091,7 @@ static void binder_transaction(struct binder_proc *proc,
 	t->to_thread = target_thread;
 	t->code = tr->code;
 	t->flags = tr->flags;
-	t->priority = task_nice(current);
+	t->priority = binder_current_priority();
 	t->buffer = binder_alloc_buf(target_proc, tr->data_size,
 		tr->offsets_size, !reply && (t->flags & TF_ONE_WAY));
 	if (t->buffer == NULL) {
@@ -1726,17 +2275,35 @@ static void binder_transaction(struct binder_proc *proc,
 	} else {
 		BUG_ON(target_node == NULL);
 		BUG_ON(t->buffer->async_transaction != 1);
+		spin_lock(&target_node->lock);
 		if (target_node->has_async_transaction) {
 			target_list = &target_node->async_todo;
 			target_wait = NULL;
 		} else
 			target_node->has_async_transaction = 1;
+		spin_unlock(&target_node->lock);
+	}
+	if (t->need_reply && target_thread == NULL &&
+	    binder_is_rt_policy(t->priority.sched_policy)) {
+		idle_thread = binder_select_idle_thread(target_proc);
+		if (idle_thread)
+			target_list = &idle_thread->todo;
 	}
 	t->work.type = BINDER_WORK_TRANSACTION;
-	list_add_tail(&t->work.entry, target_list);
+	spin_lock(&target_proc->todo_lock);
+	if (t->need_reply && target_list == &target_proc->todo &&
+	    binder_is_rt_policy(t->priority.sched_policy))
+		binder_enqueue_rt_work(target_list, t);
+	else
+		list_add_tail(&t->work.entry, target_list);
+	spin_unlock(&target_proc->todo_lock);
 	tcomplete->type = BINDER_WORK_TRANSACTION_COMPLETE;
+	spin_lock(&proc->todo_lock);
 	list_add_tail(&tcomplete->entry, &thread->todo);
-	if (target_wait)
+	spin_unlock(&proc->todo_lock);
+	if (idle_thread)
+		wake_up_process(idle_thread->task);
+	else if (target_wait)
 		wake_up_interruptible(target_wait);
 	return;
 
@@ -1778,7 +2345,10 @@ err_no_context_mgr_node:
 	BUG_ON(thread->return_error != BR_OK);
 	if (in_reply_to) {
 		thread->return_error = BR_TRANSACTION_COMPLETE;
-		binder_send_failed_reply(in_reply_to, return_error);
+		if (in_reply_to->from)
+			binder_send_failed_reply(in_reply_to, return_error);
+		else
+			binder_defer_failed_reply(in_reply_to);
 	} else
 		thread->return_error = return_error;
 }
@@ -1795,9 +2365,9 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			return -EFAULT;
 		ptr += sizeof(uint32_t);
 		if (_IOC_NR(cmd) < ARRAY_SIZE(binder_stats.bc)) {
-			binder_stats.bc[_IOC_NR(cmd)]++;
-			proc->stats.bc[_IOC_NR(cmd)]++;
-			thread->stats.bc[_IOC_NR(cmd)]++;
+			atomic_inc(&binder_stats.bc[_IOC_NR(cmd)]);
+			atomic_inc(&proc->stats.bc[_IOC_NR(cmd)]);
+			atomic_inc(&thread->stats.bc[_IOC_NR(cmd)]);
 		}
 		switch (cmd) {
 		case BC_INCREFS:
@@ -1889,8 +2459,10 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					cookie, node->cookie);
 				break;
 			}
+			spin_lock(&node->lock);
 			if (cmd == BC_ACQUIRE_DONE) {
 				if (node->pending_strong_ref == 0) {
+					spin_unlock(&node->lock);
 					binder_user_error("binder: %d:%d "
 						"BC_ACQUIRE_DONE node %d has "
 						"no pending acquire request\n",
@@ -1901,6 +2473,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				node->pending_strong_ref = 0;
 			} else {
 				if (node->pending_weak_ref == 0) {
+					spin_unlock(&node->lock);
 					binder_user_error("binder: %d:%d "
 						"BC_INCREFS_DONE node %d has "
 						"no pending increfs request\n",
@@ -1910,7 +2483,8 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				}
 				node->pending_weak_ref = 0;
 			}
-			binder_dec_node(node, cmd == BC_ACQUIRE_DONE, 0);
+			binder_dec_node_locked(node, cmd == BC_ACQUIRE_DONE, 0);
+			spin_unlock(&node->lock);
 			binder_debug(BINDER_DEBUG_USER_REFS,
 				     "binder: %d:%d %s node %d ls %d lw %d\n",
 				     proc->pid, thread->pid,
@@ -1957,11 +2531,17 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				buffer->transaction = NULL;
 			}
 			if (buffer->async_transaction && buffer->target_node) {
-				BUG_ON(!buffer->target_node->has_async_transaction);
-				if (list_empty(&buffer->target_node->async_todo))
-					buffer->target_node->has_async_transaction = 0;
+				struct binder_node *node = buffer->target_node;
+
+				spin_lock(&node->lock);
+				BUG_ON(!node->has_async_transaction);
+				spin_lock(&proc->todo_lock);
+				if (list_empty(&node->async_todo))
+					node->has_async_transaction = 0;
 				else
-					list_move_tail(buffer->target_node->async_todo.next, &thread->todo);
+					list_move_tail(node->async_todo.next, &thread->todo);
+				spin_unlock(&proc->todo_lock);
+				spin_unlock(&node->lock);
 			}
 			binder_transaction_buffer_release(proc, buffer, NULL);
 			binder_free_buf(proc, buffer);
@@ -1971,11 +2551,16 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 		case BC_TRANSACTION:
 		case BC_REPLY: {
 			struct binder_transaction_data tr;
+			struct binder_proc *target_proc;
 
 			if (copy_from_user(&tr, ptr, sizeof(tr)))
 				return -EFAULT;
 			ptr += sizeof(tr);
+			target_proc = binder_lock_target_proc(proc, thread, &tr,
+							      cmd == BC_REPLY);
 			binder_transaction(proc, thread, &tr, cmd == BC_REPLY);
+			if (target_proc)
+				mutex_unlock(&target_proc->lock);
 			break;
 		}
 
@@ -2000,6 +2585,9 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				proc->requested_threads_started++;
 			}
 			thread->looper |= BINDER_LOOPER_STATE_REGISTERED;
+			if (!thread->transaction_stack)
+				thread->looper_priority =
+					binder_current_priority();
 			break;
 		case BC_ENTER_LOOPER:
 			binder_debug(BINDER_DEBUG_THREADS,
@@ -2013,6 +2601,9 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					proc->pid, thread->pid);
 			}
 			thread->looper |= BINDER_LOOPER_STATE_ENTERED;
+			if (!thread->transaction_stack)
+				thread->looper_priority =
+					binder_current_priority();
 			break;
 		case BC_EXIT_LOOPER:
 			binder_debug(BINDER_DEBUG_THREADS,
@@ -2079,12 +2670,14 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				ref->death = death;
 				if (ref->node->proc == NULL) {
 					ref->death->work.type = BINDER_WORK_DEAD_BINDER;
+					spin_lock(&proc->todo_lock);
 					if (thread->looper & (BINDER_LOOPER_STATE_REGISTERED | BINDER_LOOPER_STATE_ENTERED)) {
 						list_add_tail(&ref->death->work.entry, &thread->todo);
 					} else {
 						list_add_tail(&ref->death->work.entry, &proc->todo);
 						wake_up_interruptible(&proc->wait);
 					}
+					spin_unlock(&proc->todo_lock);
 				}
 			} else {
 				if (ref->death == NULL) {
@@ -2107,6 +2700,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					break;
 				}
 				ref->death = NULL;
+				spin_lock(&proc->todo_lock);
 				if (list_empty(&death->work.entry)) {
 					death->work.type = BINDER_WORK_CLEAR_DEATH_NOTIFICATION;
 					if (thread->looper & (BINDER_LOOPER_STATE_REGISTERED | BINDER_LOOPER_STATE_ENTERED)) {
@@ -2119,6 +2713,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					BUG_ON(death->work.type != BINDER_WORK_DEAD_BINDER);
 					death->work.type = BINDER_WORK_DEAD_BINDER_AND_CLEAR;
 				}
+				spin_unlock(&proc->todo_lock);
 			}
 		} break;
 		case BC_DEAD_BINDER_DONE: {
@@ -2129,6 +2724,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				return -EFAULT;
 
 			ptr += sizeof(void *);
+			spin_lock(&proc->todo_lock);
 			list_for_each_entry(w, &proc->delivered_death, entry) {
 				struct binder_ref_death *tmp_death = container_of(w, struct binder_ref_death, work);
 				if (tmp_death->cookie == cookie) {
@@ -2136,6 +2732,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					break;
 				}
 			}
+			spin_unlock(&proc->todo_lock);
 			binder_debug(BINDER_DEBUG_DEAD_BINDER,
 				     "binder: %d:%d BC_DEAD_BINDER_DONE %p found %p\n",
 				     proc->pid, thread->pid, cookie, death);
@@ -2146,6 +2743,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				break;
 			}
 
+			spin_lock(&proc->todo_lock);
 			list_del_init(&death->work.entry);
 			if (death->work.type == BINDER_WORK_DEAD_BINDER_AND_CLEAR) {
 				death->work.type = BINDER_WORK_CLEAR_DEATH_NOTIFICATION;
@@ -2156,6 +2754,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					wake_up_interruptible(&proc->wait);
 				}
 			}
+			spin_unlock(&proc->todo_lock);
 		} break;
 
 		default:
@@ -2172,16 +2771,16 @@ void binder_stat_br(struct binder_proc *proc, struct binder_thread *thread,
 		    uint32_t cmd)
 {
 	if (_IOC_NR(cmd) < ARRAY_SIZE(binder_stats.br)) {
-		binder_stats.br[_IOC_NR(cmd)]++;
-		proc->stats.br[_IOC_NR(cmd)]++;
-		thread->stats.br[_IOC_NR(cmd)]++;
+		atomic_inc(&binder_stats.br[_IOC_NR(cmd)]);
+		atomic_inc(&proc->stats.br[_IOC_NR(cmd)]);
+		atomic_inc(&thread->stats.br[_IOC_NR(cmd)]);
 	}
 }
 
 static int binder_has_proc_work(struct binder_proc *proc,
 				struct binder_thread *thread)
 {
-	return !list_empty(&proc->todo) ||
+	return !list_empty(&proc->todo) || !list_empty(&thread->todo) ||
 		(thread->looper & BINDER_LOOPER_STATE_NEED_RETURN);
 }
 
@@ -2230,9 +2829,16 @@ retry:
 
 
 	thread->looper |= BINDER_LOOPER_STATE_WAITING;
-	if (wait_for_proc_work)
+	if (wait_for_proc_work) {
 		proc->ready_threads++;
-	mutex_unlock(&binder_lock);
+		if (!non_block) {
+			thread->task = current;
+			list_add(&thread->waiting_thread_node,
+				 &proc->waiting_threads);
+		}
+	}
+	mutex_unlock(&proc->lock);
+	up_read(&binder_global_rwsem);
 	if (wait_for_proc_work) {
 		if (!(thread->looper & (BINDER_LOOPER_STATE_REGISTERED |
 					BINDER_LOOPER_STATE_ENTERED))) {
@@ -2243,7 +2849,7 @@ retry:
 			wait_event_interruptible(binder_user_error_wait,
 						 binder_stop_on_user_error < 2);
 		}
-		binder_set_nice(proc->default_priority);
+		binder_set_priority(thread->looper_priority);
 		if (non_block) {
 			if (!binder_has_proc_work(proc, thread))
 				ret = -EAGAIN;
@@ -2256,9 +2862,12 @@ retry:
 		} else
 			ret = wait_event_interruptible(thread->wait, binder_has_thread_work(thread));
 	}
-	mutex_lock(&binder_lock);
-	if (wait_for_proc_work)
+	down_read(&binder_global_rwsem);
+	mutex_lock(&proc->lock);
+	if (wait_for_proc_work) {
 		proc->ready_threads--;
+		list_del_init(&thread->waiting_thread_node);
+	}
 	thread->looper &= ~BINDER_LOOPER_STATE_WAITING;
 
 	if (ret)
@@ -2270,11 +2879,22 @@ retry:
 		struct binder_work *w;
 		struct binder_transaction *t = NULL;
 
+		/*
+		 * Others only ever append to thread->todo without our
+		 * proc->lock. Real time transactions can be inserted anywhere
+		 * in proc->todo, even at the head, but only under proc->lock
+		 * (see binder_enqueue_rt_work()), which we hold. Either way
+		 * the entry stays at the head while we work on it.
+		 */
+		spin_lock(&proc->todo_lock);
 		if (!list_empty(&thread->todo))
 			w = list_first_entry(&thread->todo, struct binder_work, entry);
 		else if (!list_empty(&proc->todo) && wait_for_proc_work)
 			w = list_first_entry(&proc->todo, struct binder_work, entry);
-		else {
+		else
+			w = NULL;
+		spin_unlock(&proc->todo_lock);
+		if (w == NULL) {
 			if (ptr - buffer == 4 && !(thread->looper & BINDER_LOOPER_STATE_NEED_RETURN)) /* no data added */
 				goto retry;
 			break;
@@ -2298,7 +2918,9 @@ retry:
 				     "binder: %d:%d BR_TRANSACTION_COMPLETE\n",
 				     proc->pid, thread->pid);
 
+			spin_lock(&proc->todo_lock);
 			list_del(&w->entry);
+			spin_unlock(&proc->todo_lock);
 			kfree(w);
 			binder_stats_deleted(BINDER_STAT_TRANSACTION_COMPLETE);
 		} break;
@@ -2306,8 +2928,17 @@ retry:
 			struct binder_node *node = container_of(w, struct binder_node, work);
 			uint32_t cmd = BR_NOOP;
 			const char *cmd_name;
-			int strong = node->internal_strong_refs || node->local_strong_refs;
-			int weak = !hlist_empty(&node->refs) || node->local_weak_refs || strong;
+			int strong, weak;
+
+			/*
+			 * Decide and, if nothing is left to deliver, dequeue
+			 * under node->lock, so that a concurrent dec from
+			 * another process either sees the work still queued
+			 * and our decision covers it, or requeues it.
+			 */
+			spin_lock(&node->lock);
+			strong = node->internal_strong_refs || node->local_strong_refs;
+			weak = !hlist_empty(&node->refs) || node->local_weak_refs || strong;
 			if (weak && !node->has_weak_ref) {
 				cmd = BR_INCREFS;
 				cmd_name = "BR_INCREFS";
@@ -2329,6 +2960,12 @@ retry:
 				cmd_name = "BR_DECREFS";
 				node->has_weak_ref = 0;
 			}
+			if (cmd == BR_NOOP) {
+				spin_lock(&proc->todo_lock);
+				list_del_init(&w->entry);
+				spin_unlock(&proc->todo_lock);
+			}
+			spin_unlock(&node->lock);
 			if (cmd != BR_NOOP) {
 				if (put_user(cmd, (uint32_t __user *)ptr))
 					return -EFAULT;
@@ -2345,7 +2982,6 @@ retry:
 					     "binder: %d:%d %s %d u%p c%p\n",
 					     proc->pid, thread->pid, cmd_name, node->debug_id, node->ptr, node->cookie);
 			} else {
-				list_del_init(&w->entry);
 				if (!weak && !strong) {
 					binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 						     "binder: %d:%d node %d u%p c%p deleted\n",
@@ -2388,11 +3024,16 @@ retry:
 				      death->cookie);
 
 			if (w->type == BINDER_WORK_CLEAR_DEATH_NOTIFICATION) {
+				spin_lock(&proc->todo_lock);
 				list_del(&w->entry);
+				spin_unlock(&proc->todo_lock);
 				kfree(death);
 				binder_stats_deleted(BINDER_STAT_DEATH);
-			} else
+			} else {
+				spin_lock(&proc->todo_lock);
 				list_move(&w->entry, &proc->delivered_death);
+				spin_unlock(&proc->todo_lock);
+			}
 			if (cmd == BR_DEAD_BINDER)
 				goto done; /* DEAD_BINDER notifications can cause transactions */
 		} break;
@@ -2404,15 +3045,20 @@ retry:
 		BUG_ON(t->buffer == NULL);
 		if (t->buffer->target_node) {
 			struct binder_node *target_node = t->buffer->target_node;
+			struct binder_priority node_prio = {
+				.sched_policy = SCHED_NORMAL,
+				.prio = binder_nice_to_prio(
+						target_node->min_priority),
+			};
 			tr.target.ptr = target_node->ptr;
 			tr.cookie =  target_node->cookie;
-			t->saved_priority = task_nice(current);
-			if (t->priority < target_node->min_priority &&
+			t->saved_priority = binder_current_priority();
+			if (t->priority.prio < node_prio.prio &&
 			    !(t->flags & TF_ONE_WAY))
-				binder_set_nice(t->priority);
+				binder_set_priority(t->priority);
 			else if (!(t->flags & TF_ONE_WAY) ||
-				 t->saved_priority > target_node->min_priority)
-				binder_set_nice(target_node->min_priority);
+				 t->saved_priority.prio > node_prio.prio)
+				binder_set_priority(node_prio);
 			cmd = BR_TRANSACTION;
 		} else {
 			tr.target.ptr = NULL;
@@ -2458,7 +3104,9 @@ retry:
 			     t->buffer->data_size, t->buffer->offsets_size,
 			     tr.data.ptr.buffer, tr.data.ptr.offsets);
 
+		spin_lock(&proc->todo_lock);
 		list_del(&t->work.entry);
+		spin_unlock(&proc->todo_lock);
 		t->buffer->allow_user_free = 1;
 		if (cmd == BR_TRANSACTION && !(t->flags & TF_ONE_WAY)) {
 			t->to_parent = thread->transaction_stack;
@@ -2539,8 +3187,10 @@ static struct binder_thread *binder_get_thread(struct binder_proc *proc)
 		binder_stats_created(BINDER_STAT_THREAD);
 		thread->proc = proc;
 		thread->pid = current->pid;
+		thread->looper_priority = binder_current_priority();
 		init_waitqueue_head(&thread->wait);
 		INIT_LIST_HEAD(&thread->todo);
+		INIT_LIST_HEAD(&thread->waiting_thread_node);
 		rb_link_node(&thread->rb_node, parent, p);
 		rb_insert_color(&thread->rb_node, &proc->threads);
 		thread->looper |= BINDER_LOOPER_STATE_NEED_RETURN;
@@ -2598,12 +3248,14 @@ static unsigned int binder_poll(struct file *filp,
 	struct binder_thread *thread = NULL;
 	int wait_for_proc_work;
 
-	mutex_lock(&binder_lock);
+	down_read(&binder_global_rwsem);
+	mutex_lock(&proc->lock);
 	thread = binder_get_thread(proc);
 
 	wait_for_proc_work = thread->transaction_stack == NULL &&
 		list_empty(&thread->todo) && thread->return_error == BR_OK;
-	mutex_unlock(&binder_lock);
+	mutex_unlock(&proc->lock);
+	up_read(&binder_global_rwsem);
 
 	if (wait_for_proc_work) {
 		if (binder_has_proc_work(proc, thread))
@@ -2628,6 +3280,7 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	struct binder_thread *thread;
 	unsigned int size = _IOC_SIZE(cmd);
 	void __user *ubuf = (void __user *)arg;
+	int exclusive;
 
 	/*printk(KERN_INFO "binder_ioctl: %d:%d %x %lx\n", proc->pid, current->pid, cmd, arg);*/
 
@@ -2635,7 +3288,17 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	if (ret)
 		return ret;
 
-	mutex_lock(&binder_lock);
+	/*
+	 * Freeing a thread reaches into the transaction stacks of other
+	 * processes and the context manager is global, so those two need
+	 * everyone else out of the way.
+	 */
+	exclusive = cmd == BINDER_THREAD_EXIT || cmd == BINDER_SET_CONTEXT_MGR;
+	if (exclusive)
+		down_write(&binder_global_rwsem);
+	else
+		down_read(&binder_global_rwsem);
+	mutex_lock(&proc->lock);
 	thread = binder_get_thread(proc);
 	if (thread == NULL) {
 		ret = -ENOMEM;
@@ -2744,7 +3407,11 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 err:
 	if (thread)
 		thread->looper &= ~BINDER_LOOPER_STATE_NEED_RETURN;
-	mutex_unlock(&binder_lock);
+	mutex_unlock(&proc->lock);
+	if (exclusive)
+		up_write(&binder_global_rwsem);
+	else
+		up_read(&binder_global_rwsem);
 	wait_event_interruptible(binder_user_error_wait, binder_stop_on_user_error < 2);
 	if (ret && ret != -ERESTARTSYS)
 		printk(KERN_INFO "binder: %d:%d ioctl %x %lx returned %d\n", proc->pid, current->pid, cmd, arg, ret);
@@ -2843,7 +3510,6 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 		goto err_alloc_small_buf_failed;
 	}
 	buffer = proc->buffer;
-	INIT_LIST_HEAD(&proc->buffers);
 	list_add(&buffer->entry, &proc->buffers);
 	buffer->free = 1;
 	binder_insert_free_buffer(proc, buffer);
@@ -2851,6 +3517,7 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 	barrier();
 	proc->files = get_files_struct(current);
 	proc->vma = vma;
+	schedule_work(&proc->spare_work);
 
 	/*printk(KERN_INFO "binder_mmap: %d %lx-%lx maps %p\n",
 		 proc->pid, vma->vm_start, vma->vm_end, proc->buffer);*/
@@ -2873,6 +3540,7 @@ err_bad_arg:
 static int binder_open(struct inode *nodp, struct file *filp)
 {
 	struct binder_proc *proc;
+	int i;
 
 	binder_debug(BINDER_DEBUG_OPEN_CLOSE, "binder_open: %d:%d\n",
 		     current->group_leader->pid, current->pid);
@@ -2882,16 +3550,25 @@ static int binder_open(struct inode *nodp, struct file *filp)
 		return -ENOMEM;
 	get_task_struct(current);
 	proc->tsk = current;
+	mutex_init(&proc->lock);
+	spin_lock_init(&proc->todo_lock);
 	INIT_LIST_HEAD(&proc->todo);
 	init_waitqueue_head(&proc->wait);
-	proc->default_priority = task_nice(current);
-	mutex_lock(&binder_lock);
+	INIT_LIST_HEAD(&proc->buffers);
+	for (i = 0; i < BINDER_BUF_CLASSES; i++)
+		INIT_LIST_HEAD(&proc->free_classes[i]);
+	INIT_LIST_HEAD(&proc->page_lru);
+	spin_lock_init(&proc->spare_lock);
+	INIT_LIST_HEAD(&proc->spare_pages);
+	INIT_WORK(&proc->spare_work, binder_refill_spare_pages);
+	INIT_LIST_HEAD(&proc->waiting_threads);
+	down_write(&binder_global_rwsem);
 	binder_stats_created(BINDER_STAT_PROC);
 	hlist_add_head(&proc->proc_node, &binder_procs);
 	proc->pid = current->group_leader->pid;
 	INIT_LIST_HEAD(&proc->delivered_death);
 	filp->private_data = proc;
-	mutex_unlock(&binder_lock);
+	up_write(&binder_global_rwsem);
 
 	if (binder_debugfs_dir_entry_proc) {
 		char strbuf[11];
@@ -2983,7 +3660,9 @@ static void binder_deferred_release(struct binder_proc *proc)
 			node->proc = NULL;
 			node->local_strong_refs = 0;
 			node->local_weak_refs = 0;
+			spin_lock(&binder_dead_nodes_lock);
 			hlist_add_head(&node->dead_node, &binder_dead_nodes);
+			spin_unlock(&binder_dead_nodes_lock);
 
 			hlist_for_each_entry(ref, pos, &node->refs, node_entry) {
 				incoming_refs++;
@@ -3031,11 +3710,19 @@ static void binder_deferred_release(struct binder_proc *proc)
 
 	binder_stats_deleted(BINDER_STAT_PROC);
 
+	cancel_work_sync(&proc->spare_work);
+	while (!list_empty(&proc->spare_pages)) {
+		struct page *page = list_first_entry(&proc->spare_pages,
+						     struct page, lru);
+		list_del(&page->lru);
+		__free_page(page);
+	}
+
 	page_count = 0;
 	if (proc->pages) {
 		int i;
 		for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++) {
-			if (proc->pages[i]) {
+			if (proc->pages[i].page) {
 				void *page_addr = proc->buffer + i * PAGE_SIZE;
 				binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 					     "binder_release: %d: "
@@ -3044,7 +3731,7 @@ static void binder_deferred_release(struct binder_proc *proc)
 					     page_addr);
 				unmap_kernel_range((unsigned long)page_addr,
 					PAGE_SIZE);
-				__free_page(proc->pages[i]);
+				put_page(proc->pages[i].page);
 				page_count++;
 			}
 		}
@@ -3064,14 +3751,36 @@ static void binder_deferred_release(struct binder_proc *proc)
 	kfree(proc);
 }
 
+static void binder_deferred_failed_replies(void)
+{
+	struct binder_transaction *t;
+	LIST_HEAD(replies);
+
+	mutex_lock(&binder_deferred_lock);
+	list_splice_init(&binder_deferred_replies, &replies);
+	mutex_unlock(&binder_deferred_lock);
+
+	while (!list_empty(&replies)) {
+		t = list_first_entry(&replies, struct binder_transaction,
+				     work.entry);
+		list_del_init(&t->work.entry);
+		binder_send_failed_reply(t, BR_DEAD_REPLY);
+	}
+}
+
 static void binder_deferred_func(struct work_struct *work)
 {
 	struct binder_proc *proc;
 	struct files_struct *files;
 
 	int defer;
+
+	down_write(&binder_global_rwsem);
+	binder_deferred_failed_replies();
+	up_write(&binder_global_rwsem);
+
 	do {
-		mutex_lock(&binder_lock);
+		down_write(&binder_global_rwsem);
 		mutex_lock(&binder_deferred_lock);
 		if (!hlist_empty(&binder_deferred_list)) {
 			proc = hlist_entry(binder_deferred_list.first,
@@ -3098,7 +3807,7 @@ static void binder_deferred_func(struct work_struct *work)
 		if (defer & BINDER_DEFERRED_RELEASE)
 			binder_deferred_release(proc); /* frees proc */
 
-		mutex_unlock(&binder_lock);
+		up_write(&binder_global_rwsem);
 		if (files)
 			put_files_struct(files);
 	} while (proc);
@@ -3118,17 +3827,46 @@ binder_defer_work(struct binder_proc *proc, enum binder_deferred_state defer)
 	mutex_unlock(&binder_deferred_lock);
 }
 
+/*
+ * The thread that sent t has exited, so the failure has to be passed on
+ * down its caller chain, into processes whose locks we do not hold.
+ * Release t here and leave the rest to the deferred work, which runs
+ * with binder_global_rwsem held for writing.
+ */
+static void binder_defer_failed_reply(struct binder_transaction *t)
+{
+	struct binder_transaction *next = t->from_parent;
+
+	binder_debug(BINDER_DEBUG_FAILED_TRANSACTION,
+		     "binder: send failed reply "
+		     "for transaction %d, target dead\n",
+		     t->debug_id);
+
+	binder_pop_transaction(NULL, t);
+	if (next == NULL) {
+		binder_debug(BINDER_DEBUG_DEAD_BINDER,
+			     "binder: reply failed,"
+			     " no target thread at root\n");
+		return;
+	}
+	mutex_lock(&binder_deferred_lock);
+	list_add_tail(&next->work.entry, &binder_deferred_replies);
+	queue_work(binder_deferred_workqueue, &binder_deferred_work);
+	mutex_unlock(&binder_deferred_lock);
+}
+
 static void print_binder_transaction(struct seq_file *m, const char *prefix,
 				     struct binder_transaction *t)
 {
 	seq_printf(m,
-		   "%s %d: %p from %d:%d to %d:%d code %x flags %x pri %ld r%d",
+		   "%s %d: %p from %d:%d to %d:%d code %x flags %x pri %u:%d r%d",
 		   prefix, t->debug_id, t,
 		   t->from ? t->from->proc->pid : 0,
 		   t->from ? t->from->pid : 0,
 		   t->to_proc ? t->to_proc->pid : 0,
 		   t->to_thread ? t->to_thread->pid : 0,
-		   t->code, t->flags, t->priority, t->need_reply);
+		   t->code, t->flags, t->priority.sched_policy,
+		   t->priority.prio, t->need_reply);
 	if (t->buffer == NULL) {
 		seq_puts(m, " buffer free\n");
 		return;
@@ -3351,17 +4089,21 @@ static void print_binder_stats(struct seq_file *m, const char *prefix,
 	BUILD_BUG_ON(ARRAY_SIZE(stats->bc) !=
 		     ARRAY_SIZE(binder_command_strings));
 	for (i = 0; i < ARRAY_SIZE(stats->bc); i++) {
-		if (stats->bc[i])
+		int temp = atomic_read(&stats->bc[i]);
+
+		if (temp)
 			seq_printf(m, "%s%s: %d\n", prefix,
-				   binder_command_strings[i], stats->bc[i]);
+				   binder_command_strings[i], temp);
 	}
 
 	BUILD_BUG_ON(ARRAY_SIZE(stats->br) !=
 		     ARRAY_SIZE(binder_return_strings));
 	for (i = 0; i < ARRAY_SIZE(stats->br); i++) {
-		if (stats->br[i])
+		int temp = atomic_read(&stats->br[i]);
+
+		if (temp)
 			seq_printf(m, "%s%s: %d\n", prefix,
-				   binder_return_strings[i], stats->br[i]);
+				   binder_return_strings[i], temp);
 	}
 
 	BUILD_BUG_ON(ARRAY_SIZE(stats->obj_created) !=
@@ -3369,11 +4111,13 @@ static void print_binder_stats(struct seq_file *m, const char *prefix,
 	BUILD_BUG_ON(ARRAY_SIZE(stats->obj_created) !=
 		     ARRAY_SIZE(stats->obj_deleted));
 	for (i = 0; i < ARRAY_SIZE(stats->obj_created); i++) {
-		if (stats->obj_created[i] || stats->obj_deleted[i])
+		int created = atomic_read(&stats->obj_created[i]);
+		int deleted = atomic_read(&stats->obj_deleted[i]);
+
+		if (created || deleted)
 			seq_printf(m, "%s%s: active %d total %d\n", prefix,
 				binder_objstat_strings[i],
-				stats->obj_created[i] - stats->obj_deleted[i],
-				stats->obj_created[i]);
+				created - deleted, created);
 	}
 }
 
@@ -3381,8 +4125,10 @@ static void print_binder_proc_stats(struct seq_file *m,
 				    struct binder_proc *proc)
 {
 	struct binder_work *w;
+	struct binder_buffer *buffer;
 	struct rb_node *n;
-	int count, strong, weak;
+	int count, strong, weak, i;
+	size_t free_size, largest;
 
 	seq_printf(m, "proc %d\n", proc->pid);
 	count = 0;
@@ -3415,6 +4161,37 @@ static void print_binder_proc_stats(struct seq_file *m,
 		count++;
 	seq_printf(m, "  buffers: %d\n", count);
 
+	count = 0;
+	free_size = 0;
+	largest = 0;
+	list_for_each_entry(buffer, &proc->buffers, entry) {
+		size_t size;
+
+		if (!buffer->free)
+			continue;
+		size = binder_buffer_size(proc, buffer);
+		count++;
+		free_size += size;
+		if (size > largest)
+			largest = size;
+	}
+	seq_printf(m, "  free buffers: %d size %zu largest %zu "
+			"fragmentation %zu%%\n", count, free_size, largest,
+			free_size ? 100 - largest * 100 / free_size : 0);
+	seq_printf(m, "  pages: cached %d spare %d\n"
+			"  page source: cached %lu spare %lu allocated %lu\n",
+			proc->pages_cached, proc->spare_count,
+			proc->alloc_stats.page_cached,
+			proc->alloc_stats.page_spare,
+			proc->alloc_stats.page_alloc);
+	seq_printf(m, "  alloc failed: %lu\n  alloc latency:",
+			proc->alloc_stats.failed);
+	for (i = 0; i < BINDER_ALLOC_LATENCY_BUCKETS - 1; i++)
+		seq_printf(m, " <%dus %lu", 1 << i,
+			   proc->alloc_stats.latency[i]);
+	seq_printf(m, " >=%dus %lu\n", 1 << (i - 1),
+		   proc->alloc_stats.latency[i]);
+
 	count = 0;
 	list_for_each_entry(w, &proc->todo, entry) {
 		switch (w->type) {
@@ -3439,7 +4216,7 @@ static int binder_state_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		down_write(&binder_global_rwsem);
 
 	seq_puts(m, "binder state:\n");
 
@@ -3451,7 +4228,7 @@ static int binder_state_show(struct seq_file *m, void *unused)
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc(m, proc, 1);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		up_write(&binder_global_rwsem);
 	return 0;
 }
 
@@ -3462,7 +4239,7 @@ static int binder_stats_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		down_write(&binder_global_rwsem);
 
 	seq_puts(m, "binder stats:\n");
 
@@ -3471,7 +4248,7 @@ static int binder_stats_show(struct seq_file *m, void *unused)
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc_stats(m, proc);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		up_write(&binder_global_rwsem);
 	return 0;
 }
 
@@ -3482,13 +4259,13 @@ static int binder_transactions_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		down_write(&binder_global_rwsem);
 
 	seq_puts(m, "binder transactions:\n");
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc(m, proc, 0);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		up_write(&binder_global_rwsem);
 	return 0;
 }
 
@@ -3498,11 +4275,11 @@ static int binder_proc_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		down_write(&binder_global_rwsem);
 	seq_puts(m, "binder proc state:\n");
 	print_binder_proc(m, proc, 1);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		up_write(&binder_global_rwsem);
 	return 0;
 }
 
@@ -3565,6 +4342,7 @@ static int __init binder_init(void)
 		binder_debugfs_dir_entry_proc = debugfs_create_dir("proc",
 						 binder_debugfs_dir_entry_root);
 	ret = misc_register(&binder_miscdev);
+	register_shrinker(&binder_shrinker);
 	if (binder_debugfs_dir_entry_root) {
 		debugfs_create_file("state",
 				    S_IRUGO,
@@ -16,6 +16,14 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * To give user-space a chance to release memory before anything is killed,
+ * /dev/memory_pressure reports how hard reclaim is working as a level (low,
+ * medium or critical). A read blocks until the next event at or above the
+ * level last written to that file descriptor ("low" by default) and returns
+ * the level, reclaim efficiency and free pages per zone; poll() can be used
+ * as well. The thresholds (percent of scanned pages not reclaimed) are set
+ * by the pressure_medium and pressure_critical parameters.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -35,6 +43,15 @@
 #include <linux/oom.h>
 #include <linux/sched.h>
 #include <linux/notifier.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/miscdevice.h>
+#include <linux/poll.h>
+#include <linux/uaccess.h>
+#include <linux/slab.h>
+#include <linux/swap.h>
 /* #define ENHANCED_LMK_ROUTINE */
 
 #ifdef CONFIG_ZRAM_FOR_ANDROID
@@ -60,11 +77,41 @@
 #define MIN_CSWAP_INTERVAL 		(10*HZ) /* 10 senconds */
 #endif
 
+/* Upper bounds of the adaptive reclaim target and interval */
+#define MAX_RECLAIM_PAGES_SCALE		2	/* x number_of_reclaim_pages */
+#define MAX_CSWAP_INTERVAL_SCALE	8	/* x minimum_interval_time */
+
+/* Statistics of one kcompcached run */
+struct rtcc_run_stats {
+	unsigned long target;		/* pages asked for */
+	unsigned long reclaimed;	/* pages reclaimed */
+	long freed;			/* change in free pages */
+	unsigned long swapout;		/* pages swapped out by the run */
+	unsigned long swapin;		/* pages swapped in since last run */
+	u64 time_ns;			/* wall time */
+	u64 cpu_ns;			/* kcompcached cpu time */
+};
+
 struct soft_reclaim {
 	atomic_t kcompcached_running;
 	atomic_t need_to_reclaim;
 	atomic_t lmk_running;
 	struct task_struct *kcompcached;
+
+	/* Current reclaim target and interval, adapted after each run */
+	unsigned long nr_to_reclaim;
+	unsigned long interval;
+	/* Swap counters at the end of the last run */
+	unsigned long pswpin;
+	unsigned long pswpout;
+
+	spinlock_t stats_lock;		/* protects the stats below */
+	struct rtcc_run_stats last;
+	unsigned long nr_runs;
+	unsigned long nr_thrashing;	/* runs that backed off */
+	u64 total_reclaimed;
+	u64 total_time_ns;
+	u64 total_cpu_ns;
 };
 
 static struct soft_reclaim s_reclaim;
@@ -109,6 +156,441 @@ static unsigned long lowmem_deathpending_timeout;
 			printk(x);			\
 	} while (0)
 
+/*
+ * Thread group leaders indexed by oom_adj, so that lowmem_shrink() only
+ * looks at the processes in the highest non-empty buckets instead of
+ * walking the whole task list. Kept up to date at fork, exec, release
+ * and on writes to /proc/<pid>/oom_adj and oom_score_adj.
+ */
+#define LOWMEM_ADJ_BUCKETS	(OOM_ADJUST_MAX - OOM_DISABLE + 1)
+
+static struct hlist_head lowmem_adj_index[LOWMEM_ADJ_BUCKETS];
+static DEFINE_SPINLOCK(lowmem_adj_lock);
+
+static struct hlist_head *lowmem_adj_bucket(int oom_adj)
+{
+	if (oom_adj < OOM_DISABLE)
+		oom_adj = OOM_DISABLE;
+	else if (oom_adj > OOM_ADJUST_MAX)
+		oom_adj = OOM_ADJUST_MAX;
+
+	return &lowmem_adj_index[oom_adj - OOM_DISABLE];
+}
+
+void lowmem_task_add(struct task_struct *p)
+{
+	spin_lock(&lowmem_adj_lock);
+	hlist_add_head(&p->lowmem_node, lowmem_adj_bucket(p->signal->oom_adj));
+	spin_unlock(&lowmem_adj_lock);
+}
+
+void lowmem_task_del(struct task_struct *p)
+{
+	spin_lock(&lowmem_adj_lock);
+	if (!hlist_unhashed(&p->lowmem_node))
+		hlist_del_init(&p->lowmem_node);
+	spin_unlock(&lowmem_adj_lock);
+}
+
+/* A non-leader thread exec()ed and took over from the old leader */
+void lowmem_task_replace(struct task_struct *old, struct task_struct *new)
+{
+	spin_lock(&lowmem_adj_lock);
+	if (!hlist_unhashed(&old->lowmem_node)) {
+		hlist_del_init(&old->lowmem_node);
+		hlist_add_head(&new->lowmem_node,
+			       lowmem_adj_bucket(new->signal->oom_adj));
+	}
+	spin_unlock(&lowmem_adj_lock);
+}
+
+/*
+ * oom_adj is read under lowmem_adj_lock, so concurrent writers always
+ * leave the task in the bucket of the value written last.
+ */
+void lowmem_task_adj_changed(struct task_struct *p)
+{
+	p = p->group_leader;
+
+	spin_lock(&lowmem_adj_lock);
+	if (!hlist_unhashed(&p->lowmem_node)) {
+		hlist_del(&p->lowmem_node);
+		hlist_add_head(&p->lowmem_node,
+			       lowmem_adj_bucket(p->signal->oom_adj));
+	}
+	spin_unlock(&lowmem_adj_lock);
+}
+
+#ifdef CONFIG_DEBUG_FS
+/*
+ * Histogram of lowmem_shrink() run time for scanning calls. Bucket 0
+ * counts calls under 1us, bucket n calls of [2^(n-1), 2^n) us, and the
+ * last one everything slower.
+ */
+#define LOWMEM_LAT_BUCKETS	16
+
+static atomic_t lowmem_lat_hist[LOWMEM_LAT_BUCKETS];
+
+static void lowmem_lat_record(ktime_t start)
+{
+	s64 us = ktime_us_delta(ktime_get(), start);
+	int bucket = us > 0 ? fls64(us) : 0;
+
+	if (bucket >= LOWMEM_LAT_BUCKETS)
+		bucket = LOWMEM_LAT_BUCKETS - 1;
+	atomic_inc(&lowmem_lat_hist[bucket]);
+}
+
+static int lowmem_lat_show(struct seq_file *m, void *unused)
+{
+	int i;
+
+	for (i = 0; i < LOWMEM_LAT_BUCKETS - 1; i++)
+		seq_printf(m, "%6lu - %6lu us: %d\n",
+			   i ? 1UL << (i - 1) : 0, 1UL << i,
+			   atomic_read(&lowmem_lat_hist[i]));
+	seq_printf(m, "%6lu -    inf us: %d\n", 1UL << (i - 1),
+		   atomic_read(&lowmem_lat_hist[i]));
+
+	return 0;
+}
+
+static int lowmem_lat_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, lowmem_lat_show, NULL);
+}
+
+/* Any write clears the histogram */
+static ssize_t lowmem_lat_write(struct file *file, const char __user *buf,
+				size_t count, loff_t *ppos)
+{
+	int i;
+
+	for (i = 0; i < LOWMEM_LAT_BUCKETS; i++)
+		atomic_set(&lowmem_lat_hist[i], 0);
+
+	return count;
+}
+
+static const struct file_operations lowmem_lat_fops = {
+	.open		= lowmem_lat_open,
+	.read		= seq_read,
+	.write		= lowmem_lat_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static struct dentry *lowmem_debugfs_dir;
+
+static void lowmem_debugfs_init(void)
+{
+	lowmem_debugfs_dir = debugfs_create_dir("lowmemorykiller", NULL);
+	if (IS_ERR_OR_NULL(lowmem_debugfs_dir))
+		return;
+
+	debugfs_create_file("shrink_latency", S_IRUGO | S_IWUSR,
+			    lowmem_debugfs_dir, NULL, &lowmem_lat_fops);
+}
+
+static void lowmem_debugfs_exit(void)
+{
+	debugfs_remove_recursive(lowmem_debugfs_dir);
+}
+#else
+static inline void lowmem_lat_record(ktime_t start) {}
+static inline void lowmem_debugfs_init(void) {}
+static inline void lowmem_debugfs_exit(void) {}
+#endif
+
+/*
+ * Memory pressure notification. Every time the shrinker is consulted,
+ * at most once per lowmem_pressure_window, reclaim efficiency since the
+ * previous sample is computed from the vmscan counters:
+ *
+ *	pressure = 100 * (1 - reclaimed / scanned)
+ *
+ * and turned into a level: low below pressure_medium, medium below
+ * pressure_critical, critical above that or once free memory is below
+ * a minfree threshold, i.e. we are about to kill. Each sample with
+ * reclaim activity is an event that wakes up readers of
+ * /dev/memory_pressure polling for that level or a lower one.
+ */
+enum lowmem_level {
+	LOWMEM_LEVEL_NONE,
+	LOWMEM_LEVEL_LOW,
+	LOWMEM_LEVEL_MEDIUM,
+	LOWMEM_LEVEL_CRITICAL,
+	LOWMEM_NR_LEVELS,
+};
+
+static const char * const lowmem_level_names[LOWMEM_NR_LEVELS] = {
+	"none", "low", "medium", "critical",
+};
+
+static uint32_t lowmem_pressure_medium = 60;
+static uint32_t lowmem_pressure_critical = 95;
+static uint32_t lowmem_pressure_window = HZ / 10;
+/* Minimum no. of pages scanned for a sample to be meaningful */
+#define LOWMEM_PRESSURE_MIN_SCAN	(SWAP_CLUSTER_MAX * 16)
+
+static struct {
+	spinlock_t lock;
+	wait_queue_head_t wait;
+	unsigned long last_sample;	/* jiffies */
+	unsigned long scanned;		/* vmscan counters at last sample */
+	unsigned long reclaimed;
+	unsigned long win_scanned;	/* ... and the deltas to the one before */
+	unsigned long win_reclaimed;
+	unsigned int pressure;
+	enum lowmem_level level;
+	unsigned int seq;		/* bumped on every event */
+	unsigned long zone_free[MAX_NUMNODES][MAX_NR_ZONES];
+	long zone_delta[MAX_NUMNODES][MAX_NR_ZONES];
+} lowmem_pressure = {
+	.lock = __SPIN_LOCK_UNLOCKED(lowmem_pressure.lock),
+	.wait = __WAIT_QUEUE_HEAD_INITIALIZER(lowmem_pressure.wait),
+};
+
+/*
+ * Sum the per-cpu vmscan counters by hand: all_vm_events() takes the
+ * cpu hotplug lock, which we must not do from reclaim.
+ */
+static void lowmem_read_vmscan(unsigned long *scanned,
+			       unsigned long *reclaimed)
+{
+#ifdef CONFIG_VM_EVENT_COUNTERS
+	int cpu, i;
+
+	*scanned = *reclaimed = 0;
+	for_each_online_cpu(cpu) {
+		struct vm_event_state *this = &per_cpu(vm_event_states, cpu);
+
+		for (i = 0; i < MAX_NR_ZONES; i++) {
+			*scanned += this->event[PGSCAN_KSWAPD_NORMAL -
+						ZONE_NORMAL + i];
+			*scanned += this->event[PGSCAN_DIRECT_NORMAL -
+						ZONE_NORMAL + i];
+			*reclaimed += this->event[PGSTEAL_NORMAL -
+						  ZONE_NORMAL + i];
+		}
+	}
+#else
+	*scanned = *reclaimed = 0;
+#endif
+}
+
+static void lowmem_pressure_update(bool below_minfree)
+{
+	struct zone *zone;
+	unsigned long scanned, reclaimed, win_scanned, win_reclaimed;
+	enum lowmem_level level;
+	unsigned int pressure = 0;
+
+	if (time_before(jiffies, lowmem_pressure.last_sample +
+			lowmem_pressure_window))
+		return;
+
+	/* Someone else is sampling right now */
+	if (!spin_trylock(&lowmem_pressure.lock))
+		return;
+
+	lowmem_read_vmscan(&scanned, &reclaimed);
+	win_scanned = scanned - lowmem_pressure.scanned;
+	win_reclaimed = reclaimed - lowmem_pressure.reclaimed;
+
+	if (win_scanned < LOWMEM_PRESSURE_MIN_SCAN && !below_minfree)
+		goto out;
+
+	if (win_scanned) {
+		/* Reclaim may free more than it scanned (e.g. THP) */
+		if (win_reclaimed > win_scanned)
+			win_reclaimed = win_scanned;
+		pressure = 100 - win_reclaimed * 100 / win_scanned;
+	}
+
+	if (below_minfree || pressure >= lowmem_pressure_critical)
+		level = LOWMEM_LEVEL_CRITICAL;
+	else if (pressure >= lowmem_pressure_medium)
+		level = LOWMEM_LEVEL_MEDIUM;
+	else
+		level = LOWMEM_LEVEL_LOW;
+
+	for_each_populated_zone(zone) {
+		int nid = zone_to_nid(zone), idx = zone_idx(zone);
+		unsigned long free = zone_page_state(zone, NR_FREE_PAGES);
+
+		lowmem_pressure.zone_delta[nid][idx] =
+			free - lowmem_pressure.zone_free[nid][idx];
+		lowmem_pressure.zone_free[nid][idx] = free;
+	}
+
+	lowmem_pressure.last_sample = jiffies;
+	lowmem_pressure.scanned = scanned;
+	lowmem_pressure.reclaimed = reclaimed;
+	lowmem_pressure.win_scanned = win_scanned;
+	lowmem_pressure.win_reclaimed = win_reclaimed;
+	lowmem_pressure.pressure = pressure;
+	lowmem_pressure.level = level;
+	lowmem_pressure.seq++;
+	spin_unlock(&lowmem_pressure.lock);
+
+	lowmem_print(4, "pressure %u, level %s\n", pressure,
+		     lowmem_level_names[level]);
+	wake_up_interruptible(&lowmem_pressure.wait);
+	return;
+
+out:
+	spin_unlock(&lowmem_pressure.lock);
+}
+
+/* Pressure goes back to none once reclaim has been quiet for a second */
+static enum lowmem_level lowmem_pressure_level(void)
+{
+	if (time_after(jiffies, lowmem_pressure.last_sample + HZ))
+		return LOWMEM_LEVEL_NONE;
+
+	return lowmem_pressure.level;
+}
+
+/* Per open file: the level it waits for and the last event it read */
+struct lowmem_pressure_file {
+	enum lowmem_level min_level;
+	unsigned int seq;
+};
+
+static int lowmem_pressure_open(struct inode *inode, struct file *file)
+{
+	struct lowmem_pressure_file *pf;
+
+	pf = kzalloc(sizeof(*pf), GFP_KERNEL);
+	if (!pf)
+		return -ENOMEM;
+
+	pf->min_level = LOWMEM_LEVEL_LOW;
+	pf->seq = lowmem_pressure.seq;
+	file->private_data = pf;
+
+	return nonseekable_open(inode, file);
+}
+
+static int lowmem_pressure_release(struct inode *inode, struct file *file)
+{
+	kfree(file->private_data);
+	return 0;
+}
+
+static bool lowmem_pressure_pending(struct lowmem_pressure_file *pf)
+{
+	return pf->seq != lowmem_pressure.seq &&
+		lowmem_pressure.level >= pf->min_level;
+}
+
+/*
+ * Returns a snapshot of the state at the next event at or above the
+ * file's level, blocking until there is one. With O_NONBLOCK, fails
+ * with -EAGAIN instead if no event is pending.
+ */
+static ssize_t lowmem_pressure_read(struct file *file, char __user *buf,
+				    size_t count, loff_t *ppos)
+{
+	struct lowmem_pressure_file *pf = file->private_data;
+	struct zone *zone;
+	char *kbuf;
+	size_t len = 0, size = PAGE_SIZE;
+	ssize_t ret;
+
+	if (file->f_flags & O_NONBLOCK) {
+		if (!lowmem_pressure_pending(pf))
+			return -EAGAIN;
+	} else {
+		ret = wait_event_interruptible(lowmem_pressure.wait,
+					       lowmem_pressure_pending(pf));
+		if (ret)
+			return ret;
+	}
+
+	kbuf = kmalloc(size, GFP_KERNEL);
+	if (!kbuf)
+		return -ENOMEM;
+
+	spin_lock(&lowmem_pressure.lock);
+	pf->seq = lowmem_pressure.seq;
+	len += scnprintf(kbuf + len, size - len,
+			 "level %s\npressure %u\nscanned %lu\nreclaimed %lu\n",
+			 lowmem_level_names[lowmem_pressure_level()],
+			 lowmem_pressure.pressure,
+			 lowmem_pressure.win_scanned,
+			 lowmem_pressure.win_reclaimed);
+	for_each_populated_zone(zone) {
+		int nid = zone_to_nid(zone), idx = zone_idx(zone);
+
+		len += scnprintf(kbuf + len, size - len,
+				 "zone %d %s free %lu delta %ld\n", nid,
+				 zone->name, lowmem_pressure.zone_free[nid][idx],
+				 lowmem_pressure.zone_delta[nid][idx]);
+	}
+	spin_unlock(&lowmem_pressure.lock);
+
+	ret = min(count, len);
+	if (copy_to_user(buf, kbuf, ret))
+		ret = -EFAULT;
+	kfree(kbuf);
+
+	return ret;
+}
+
+/* Writing a level name selects the lowest level the file is woken for */
+static ssize_t lowmem_pressure_write(struct file *file,
+				     const char __user *buf, size_t count,
+				     loff_t *ppos)
+{
+	struct lowmem_pressure_file *pf = file->private_data;
+	char kbuf[16];
+	int i;
+
+	if (count >= sizeof(kbuf))
+		return -EINVAL;
+	if (copy_from_user(kbuf, buf, count))
+		return -EFAULT;
+	kbuf[count] = '\0';
+
+	for (i = LOWMEM_LEVEL_LOW; i < LOWMEM_NR_LEVELS; i++) {
+		if (sysfs_streq(kbuf, lowmem_level_names[i])) {
+			pf->min_level = i;
+			return count;
+		}
+	}
+
+	return -EINVAL;
+}
+
+static unsigned int lowmem_pressure_poll(struct file *file, poll_table *wait)
+{
+	struct lowmem_pressure_file *pf = file->private_data;
+
+	poll_wait(file, &lowmem_pressure.wait, wait);
+	if (lowmem_pressure_pending(pf))
+		return POLLIN | POLLRDNORM | POLLPRI;
+
+	return 0;
+}
+
+static const struct file_operations lowmem_pressure_fops = {
+	.owner		= THIS_MODULE,
+	.open		= lowmem_pressure_open,
+	.release	= lowmem_pressure_release,
+	.read		= lowmem_pressure_read,
+	.write		= lowmem_pressure_write,
+	.poll		= lowmem_pressure_poll,
+	.llseek		= no_llseek,
+};
+
+static struct miscdevice lowmem_pressure_miscdev = {
+	.minor		= MISC_DYNAMIC_MINOR,
+	.name		= "memory_pressure",
+	.fops		= &lowmem_pressure_fops,
+};
+
 static int
 task_notify_func(struct notifier_block *self, unsigned long val, void *data);
 
@@ -138,6 +620,9 @@ task_notify_func(struct notifier_block *self, unsigned long val, void *data)
 static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 {
 	struct task_struct *p;
+	struct hlist_node *node;
+	int adj;
+	ktime_t start = ktime_get();
 #ifdef ENHANCED_LMK_ROUTINE
 	struct task_struct *selected[LOWMEM_DEATHPENDING_DEPTH] = {NULL,};
 #else
@@ -165,6 +650,20 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	other_file -= total_swapcache_pages;
 #endif /* CONFIG_ZRAM_FOR_ANDROID */
 
+	if (lowmem_adj_size < array_size)
+		array_size = lowmem_adj_size;
+	if (lowmem_minfree_size < array_size)
+		array_size = lowmem_minfree_size;
+	for (i = 0; i < array_size; i++) {
+		if (other_free < lowmem_minfree[i] &&
+		    other_file < lowmem_minfree[i]) {
+			min_adj = lowmem_adj[i];
+			break;
+		}
+	}
+
+	lowmem_pressure_update(min_adj != OOM_ADJUST_MAX + 1);
+
 	/*
 	 * If we already have a death outstanding, then
 	 * bail out right away; indicating to vmscan
@@ -184,17 +683,6 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 		return 0;
 #endif
 
-	if (lowmem_adj_size < array_size)
-		array_size = lowmem_adj_size;
-	if (lowmem_minfree_size < array_size)
-		array_size = lowmem_minfree_size;
-	for (i = 0; i < array_size; i++) {
-		if (other_free < lowmem_minfree[i] &&
-		    other_file < lowmem_minfree[i]) {
-			min_adj = lowmem_adj[i];
-			break;
-		}
-	}
 	if (sc->nr_to_scan > 0)
 		lowmem_print(3, "lowmem_shrink %lu, %x, ofree %d %d, ma %d\n",
 			     sc->nr_to_scan, sc->gfp_mask, other_free, other_file,
@@ -219,82 +707,108 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 #ifdef CONFIG_ZRAM_FOR_ANDROID
 	atomic_set(&s_reclaim.lmk_running, 1);
 #endif /* CONFIG_ZRAM_FOR_ANDROID */
-	read_lock(&tasklist_lock);
-	for_each_process(p) {
-		struct mm_struct *mm;
-		struct signal_struct *sig;
-		int oom_adj;
+	spin_lock(&lowmem_adj_lock);
+	for (adj = OOM_ADJUST_MAX; adj >= max(min_adj, OOM_DISABLE); adj--) {
+		hlist_for_each_entry(p, node, lowmem_adj_bucket(adj),
+				     lowmem_node) {
+			struct mm_struct *mm;
+			struct signal_struct *sig;
+			int oom_adj;
 #ifdef ENHANCED_LMK_ROUTINE
-		int is_exist_oom_task = 0;
+			int is_exist_oom_task = 0;
 #endif
-		task_lock(p);
-		mm = p->mm;
-		sig = p->signal;
-		if (!mm || !sig) {
-			task_unlock(p);
-			continue;
-		}
-		oom_adj = sig->oom_adj;
-		if (oom_adj < min_adj) {
+			task_lock(p);
+			mm = p->mm;
+			sig = p->signal;
+			if (!mm || !sig) {
+				task_unlock(p);
+				continue;
+			}
+			oom_adj = sig->oom_adj;
+			if (oom_adj < min_adj) {
+				task_unlock(p);
+				continue;
+			}
+			tasksize = get_mm_rss(mm);
 			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
+			if (tasksize <= 0)
+				continue;
 
 #ifdef ENHANCED_LMK_ROUTINE
-		if (all_selected_oom < LOWMEM_DEATHPENDING_DEPTH) {
-			for (i = 0; i < LOWMEM_DEATHPENDING_DEPTH; i++) {
-				if (!selected[i]) {
-					is_exist_oom_task = 1;
-					max_selected_oom_idx = i;
-					break;
+			if (all_selected_oom < LOWMEM_DEATHPENDING_DEPTH) {
+				for (i = 0; i < LOWMEM_DEATHPENDING_DEPTH; i++) {
+					if (!selected[i]) {
+						is_exist_oom_task = 1;
+						max_selected_oom_idx = i;
+						break;
+					}
 				}
+			} else if (selected_oom_adj[max_selected_oom_idx] < oom_adj ||
+				(selected_oom_adj[max_selected_oom_idx] == oom_adj &&
+				selected_tasksize[max_selected_oom_idx] < tasksize)) {
+				is_exist_oom_task = 1;
 			}
-		} else if (selected_oom_adj[max_selected_oom_idx] < oom_adj ||
-			(selected_oom_adj[max_selected_oom_idx] == oom_adj &&
-			selected_tasksize[max_selected_oom_idx] < tasksize)) {
-			is_exist_oom_task = 1;
-		}
 
-		if (is_exist_oom_task) {
-			selected[max_selected_oom_idx] = p;
-			selected_tasksize[max_selected_oom_idx] = tasksize;
-			selected_oom_adj[max_selected_oom_idx] = oom_adj;
+			if (is_exist_oom_task) {
+				selected[max_selected_oom_idx] = p;
+				selected_tasksize[max_selected_oom_idx] = tasksize;
+				selected_oom_adj[max_selected_oom_idx] = oom_adj;
 
-			if (all_selected_oom < LOWMEM_DEATHPENDING_DEPTH)
-				all_selected_oom++;
+				if (all_selected_oom < LOWMEM_DEATHPENDING_DEPTH)
+					all_selected_oom++;
 
-			if (all_selected_oom == LOWMEM_DEATHPENDING_DEPTH) {
-				for (i = 0; i < LOWMEM_DEATHPENDING_DEPTH; i++) {
-					if (selected_oom_adj[i] < selected_oom_adj[max_selected_oom_idx])
-						max_selected_oom_idx = i;
-					else if (selected_oom_adj[i] == selected_oom_adj[max_selected_oom_idx] &&
-						selected_tasksize[i] < selected_tasksize[max_selected_oom_idx])
-						max_selected_oom_idx = i;
+				if (all_selected_oom == LOWMEM_DEATHPENDING_DEPTH) {
+					for (i = 0; i < LOWMEM_DEATHPENDING_DEPTH; i++) {
+						if (selected_oom_adj[i] < selected_oom_adj[max_selected_oom_idx])
+							max_selected_oom_idx = i;
+						else if (selected_oom_adj[i] == selected_oom_adj[max_selected_oom_idx] &&
+							selected_tasksize[i] < selected_tasksize[max_selected_oom_idx])
+							max_selected_oom_idx = i;
+					}
 				}
-			}
 
+				lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
+					p->pid, p->comm, oom_adj, tasksize);
+			}
+#else
+			if (selected) {
+				if (oom_adj < selected_oom_adj)
+					continue;
+				if (oom_adj == selected_oom_adj &&
+				    tasksize <= selected_tasksize)
+					continue;
+			}
+			selected = p;
+			selected_tasksize = tasksize;
+			selected_oom_adj = oom_adj;
 			lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-				p->pid, p->comm, oom_adj, tasksize);
+				     p->pid, p->comm, oom_adj, tasksize);
+#endif
 		}
+		/* Tasks in lower buckets cannot beat what we have */
+#ifdef ENHANCED_LMK_ROUTINE
+		if (all_selected_oom == LOWMEM_DEATHPENDING_DEPTH)
+			break;
 #else
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
-				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
-				continue;
-		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
+		if (selected)
+			break;
 #endif
 	}
+#ifdef ENHANCED_LMK_ROUTINE
+	for (i = 0; i < LOWMEM_DEATHPENDING_DEPTH; i++)
+		if (selected[i])
+			get_task_struct(selected[i]);
+#else
+	if (selected)
+		get_task_struct(selected);
+#endif
+	spin_unlock(&lowmem_adj_lock);
+
+	/*
+	 * Only a task reference is held from here on and the victim may
+	 * be exiting, so signal it with send_sig(), which goes through
+	 * lock_task_sighand(), rather than force_sig().
+	 */
 #ifdef ENHANCED_LMK_ROUTINE
 	for (i = 0; i < LOWMEM_DEATHPENDING_DEPTH; i++) {
 		if (selected[i]) {
@@ -303,7 +817,8 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 				selected_oom_adj[i], selected_tasksize[i]);
 			lowmem_deathpending[i] = selected[i];
 			lowmem_deathpending_timeout = jiffies + HZ;
-			force_sig(SIGKILL, selected[i]);
+			send_sig(SIGKILL, selected[i], 0);
+			put_task_struct(selected[i]);
 			rem -= selected_tasksize[i];
 		}
 	}
@@ -314,13 +829,14 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 			     selected_oom_adj, selected_tasksize);
 		lowmem_deathpending = selected;
 		lowmem_deathpending_timeout = jiffies + timeout;
-		force_sig(SIGKILL, selected);
+		send_sig(SIGKILL, selected, 0);
+		put_task_struct(selected);
 		rem -= selected_tasksize;
 	}
 #endif
 	lowmem_print(4, "lowmem_shrink %lu, %x, return %d\n",
 		     sc->nr_to_scan, sc->gfp_mask, rem);
-	read_unlock(&tasklist_lock);
+	lowmem_lat_record(start);
 
 #ifdef CONFIG_ZRAM_FOR_ANDROID
 	atomic_set(&s_reclaim.lmk_running, 0);
@@ -335,7 +851,7 @@ void could_cswap(void)
 	if (atomic_read(&s_reclaim.need_to_reclaim) == 0)
 		return;
 
-	if (time_before(jiffies, prev_jiffy + minimum_interval_time))
+	if (time_before(jiffies, prev_jiffy + s_reclaim.interval))
 		return;
 
 	if (atomic_read(&s_reclaim.lmk_running) == 1 || atomic_read(&kswapd_thread_on) == 1) 
@@ -369,7 +885,109 @@ int get_soft_reclaim_status(void)
 	return kcompcache_running;
 }
 
+static void rtcc_read_swap_events(unsigned long *pswpin,
+				  unsigned long *pswpout)
+{
+#ifdef CONFIG_VM_EVENT_COUNTERS
+	int cpu;
+
+	*pswpin = *pswpout = 0;
+	for_each_online_cpu(cpu) {
+		struct vm_event_state *this = &per_cpu(vm_event_states, cpu);
+
+		*pswpin += this->event[PSWPIN];
+		*pswpout += this->event[PSWPOUT];
+	}
+#else
+	*pswpin = *pswpout = 0;
+#endif
+}
+
+/*
+ * Pick the target and interval of the next run from how this one went:
+ *
+ *  - if more than half of what the previous run swapped out came back
+ *    in before this one, we are thrashing: halve the target and double
+ *    the interval;
+ *  - if the run came up short of minimum_reclaim_pages, there is little
+ *    left to reclaim cheaply: double the interval;
+ *  - if free memory grew by less than a quarter of what was reclaimed,
+ *    zram is keeping most of it (poor compression): shrink the target;
+ *  - otherwise grow the target and shorten the interval.
+ *
+ * The target never exceeds a quarter of the free swap space.
+ */
+static void rtcc_adapt(const struct rtcc_run_stats *run,
+		       unsigned long prev_swapout)
+{
+	unsigned long target = s_reclaim.nr_to_reclaim;
+	unsigned long interval = s_reclaim.interval;
+	unsigned long max_target = number_of_reclaim_pages *
+					MAX_RECLAIM_PAGES_SCALE;
+	unsigned long max_interval = minimum_interval_time *
+					MAX_CSWAP_INTERVAL_SCALE;
+	bool thrashing = prev_swapout && run->swapin > prev_swapout / 2;
+
+	if (thrashing) {
+		target /= 2;
+		interval *= 2;
+	} else if (run->reclaimed < minimum_reclaim_pages) {
+		interval *= 2;
+	} else if (run->freed < (long)run->reclaimed / 4) {
+		target -= target / 4;
+	} else {
+		target += target / 4;
+		interval -= interval / 4;
+	}
+
+	target = min(target, max_target);
+	target = min_t(unsigned long, target, nr_swap_pages / 4);
+	target = max_t(unsigned long, target, minimum_reclaim_pages);
+	interval = clamp_t(unsigned long, interval, minimum_interval_time,
+			   max_interval);
+
+	s_reclaim.nr_to_reclaim = target;
+	s_reclaim.interval = interval;
+
+	spin_lock(&s_reclaim.stats_lock);
+	s_reclaim.last = *run;
+	s_reclaim.nr_runs++;
+	if (thrashing)
+		s_reclaim.nr_thrashing++;
+	s_reclaim.total_reclaimed += run->reclaimed;
+	s_reclaim.total_time_ns += run->time_ns;
+	s_reclaim.total_cpu_ns += run->cpu_ns;
+	spin_unlock(&s_reclaim.stats_lock);
+}
+
 extern long rtcc_reclaim_pages(long nr_to_reclaim);
+
+static void rtcc_run(void)
+{
+	struct rtcc_run_stats run = { .target = s_reclaim.nr_to_reclaim };
+	unsigned long pswpin, pswpout, prev_swapout;
+	long free = global_page_state(NR_FREE_PAGES);
+	u64 cpu = task_sched_runtime(current);
+	ktime_t start = ktime_get();
+
+	rtcc_read_swap_events(&pswpin, &pswpout);
+	run.swapin = pswpin - s_reclaim.pswpin;
+	prev_swapout = s_reclaim.last.swapout;
+
+	run.reclaimed = max(rtcc_reclaim_pages(run.target), 0L);
+
+	run.time_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	run.cpu_ns = task_sched_runtime(current) - cpu;
+	run.freed = global_page_state(NR_FREE_PAGES) - free;
+	rtcc_read_swap_events(&s_reclaim.pswpin, &s_reclaim.pswpout);
+	run.swapout = s_reclaim.pswpout - pswpout;
+
+	rtcc_adapt(&run, prev_swapout);
+
+	if (run.reclaimed < minimum_reclaim_pages)
+		cancel_soft_reclaim();
+}
+
 static int do_compcache(void * nothing)
 {
 	int ret;
@@ -381,9 +999,7 @@ static int do_compcache(void * nothing)
 			break;
 
 		if (atomic_read(&s_reclaim.kcompcached_running) == 1) {
-			if (rtcc_reclaim_pages(number_of_reclaim_pages) < minimum_reclaim_pages)
-				cancel_soft_reclaim();
-
+			rtcc_run();
 			atomic_set(&s_reclaim.kcompcached_running, 0);
 		}
 
@@ -412,6 +1028,46 @@ out:
 	return count;
 }
 static CLASS_ATTR(rtcc_trigger, 0200, NULL, rtcc_trigger_store);
+
+static ssize_t rtcc_stats_show(struct class *class,
+			       struct class_attribute *attr, char *buf)
+{
+	struct rtcc_run_stats last;
+	unsigned long nr_runs, nr_thrashing;
+	u64 reclaimed, time_ns, cpu_ns;
+
+	spin_lock(&s_reclaim.stats_lock);
+	last = s_reclaim.last;
+	nr_runs = s_reclaim.nr_runs;
+	nr_thrashing = s_reclaim.nr_thrashing;
+	reclaimed = s_reclaim.total_reclaimed;
+	time_ns = s_reclaim.total_time_ns;
+	cpu_ns = s_reclaim.total_cpu_ns;
+	spin_unlock(&s_reclaim.stats_lock);
+
+	return sprintf(buf,
+		"runs %lu\n"
+		"thrashing %lu\n"
+		"reclaimed %llu\n"
+		"time_us %llu\n"
+		"cpu_us %llu\n"
+		"next_target %lu\n"
+		"next_interval_ms %u\n"
+		"last_target %lu\n"
+		"last_reclaimed %lu\n"
+		"last_freed %ld\n"
+		"last_swapout %lu\n"
+		"last_swapin %lu\n"
+		"last_time_us %llu\n"
+		"last_cpu_us %llu\n",
+		nr_runs, nr_thrashing, reclaimed,
+		div_u64(time_ns, NSEC_PER_USEC), div_u64(cpu_ns, NSEC_PER_USEC),
+		s_reclaim.nr_to_reclaim, jiffies_to_msecs(s_reclaim.interval),
+		last.target, last.reclaimed, last.freed, last.swapout,
+		last.swapin, div_u64(last.time_ns, NSEC_PER_USEC),
+		div_u64(last.cpu_ns, NSEC_PER_USEC));
+}
+static CLASS_ATTR(rtcc_stats, 0444, rtcc_stats_show, NULL);
 static struct class *kcompcache_class;
 
 static int kcompcache_idle_notifier(struct notifier_block *nb, unsigned long val, void *data)
@@ -434,16 +1090,28 @@ static int __init lowmem_init(void)
 {
 	task_free_register(&task_nb);
 	register_shrinker(&lowmem_shrinker);
+	lowmem_debugfs_init();
+	if (misc_register(&lowmem_pressure_miscdev))
+		pr_err("%s: couldn't register memory_pressure device\n",
+		       __func__);
 #ifdef CONFIG_ZRAM_FOR_ANDROID
+	/* Everything kcompcached uses must be set up before it runs */
+	atomic_set(&s_reclaim.need_to_reclaim, 0);
+	atomic_set(&s_reclaim.kcompcached_running, 0);
+	spin_lock_init(&s_reclaim.stats_lock);
+	s_reclaim.nr_to_reclaim = number_of_reclaim_pages;
+	s_reclaim.interval = minimum_interval_time;
+	rtcc_read_swap_events(&s_reclaim.pswpin, &s_reclaim.pswpout);
+	prev_jiffy = jiffies;
+
 	s_reclaim.kcompcached = kthread_run(do_compcache, NULL, "kcompcached");
 	if (IS_ERR(s_reclaim.kcompcached)) {
 		/* failure at boot is fatal */
 		BUG_ON(system_state == SYSTEM_BOOTING);
+		s_reclaim.kcompcached = NULL;
+		return 0;
 	}
 	set_user_nice(s_reclaim.kcompcached, 0);
-	atomic_set(&s_reclaim.need_to_reclaim, 0);
-	atomic_set(&s_reclaim.kcompcached_running, 0);
-	prev_jiffy = jiffies;
 
 	idle_notifier_register(&kcompcache_idle_nb);
 
@@ -455,13 +1123,19 @@ static int __init lowmem_init(void)
 	if (class_create_file(kcompcache_class, &class_attr_rtcc_trigger) < 0) {
 		pr_err("%s: couldn't create rtcc trigger sysfs file.\n", __func__);
 		class_destroy(kcompcache_class);
+		kcompcache_class = NULL;
+		return 0;
 	}
+	if (class_create_file(kcompcache_class, &class_attr_rtcc_stats) < 0)
+		pr_err("%s: couldn't create rtcc stats sysfs file.\n", __func__);
 #endif /* CONFIG_ZRAM_FOR_ANDROID */
 	return 0;
 }
 
 static void __exit lowmem_exit(void)
 {
+	misc_deregister(&lowmem_pressure_miscdev);
+	lowmem_debugfs_exit();
 	unregister_shrinker(&lowmem_shrinker);
 	task_free_unregister(&task_nb);
 
@@ -474,6 +1148,7 @@ static void __exit lowmem_exit(void)
 	}
 
 	if (kcompcache_class) {
+		class_remove_file(kcompcache_class, &class_attr_rtcc_stats);
 		class_remove_file(kcompcache_class, &class_attr_rtcc_trigger);
 		class_destroy(kcompcache_class);
 	}
@@ -487,6 +1162,12 @@ module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
 module_param_named(timeout, timeout, uint, S_IRUGO | S_IWUSR);
+module_param_named(pressure_medium, lowmem_pressure_medium, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(pressure_critical, lowmem_pressure_critical, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(pressure_window, lowmem_pressure_window, uint,
+		   S_IRUGO | S_IWUSR);
 
 #ifdef CONFIG_ZRAM_FOR_ANDROID
 module_param_named(nr_reclaim, number_of_reclaim_pages, uint, S_IRUSR | S_IWUSR);
@@ -0,0 +1,297 @@
+/*
+ * Compressed RAM block device
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Project home: http://compcache.googlecode.com
+ */
+
+#define KMSG_COMPONENT "zram"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/lz4.h>
+#include <linux/lzo.h>
+#include <linux/mm.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "zram_comp.h"
+
+static int zram_lzo_compress(struct zram_comp *comp, const unsigned char *src,
+			unsigned char *dst, size_t *dst_len, void *workmem)
+{
+	int ret = lzo1x_1_compress(src, PAGE_SIZE, dst, dst_len, workmem);
+
+	return ret == LZO_E_OK ? 0 : -EINVAL;
+}
+
+static int zram_lzo_decompress(struct zram_comp *comp,
+			const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len)
+{
+	int ret = lzo1x_decompress_safe(src, src_len, dst, dst_len);
+
+	return ret == LZO_E_OK ? 0 : -EINVAL;
+}
+
+static int zram_lz4_compress(struct zram_comp *comp, const unsigned char *src,
+			unsigned char *dst, size_t *dst_len, void *workmem)
+{
+	return lz4_compress(src, PAGE_SIZE, dst, dst_len, workmem);
+}
+
+static int zram_lz4_decompress(struct zram_comp *comp,
+			const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len)
+{
+	return lz4_decompress_unknownoutputsize(src, src_len, dst, dst_len);
+}
+
+static const struct zram_comp_backend zram_backends[] = {
+	{
+		.name		= "lzo",
+		.workmem_size	= LZO1X_MEM_COMPRESS,
+		.compress	= zram_lzo_compress,
+		.decompress	= zram_lzo_decompress,
+	},
+	{
+		.name		= "lz4",
+		.workmem_size	= LZ4_MEM_COMPRESS,
+		.compress	= zram_lz4_compress,
+		.decompress	= zram_lz4_decompress,
+	},
+};
+
+#if defined(CONFIG_CRYPTO) || defined(CONFIG_CRYPTO_MODULE)
+/*
+ * Any other name is looked up in the crypto API. A crypto_comp tfm
+ * carries its own working memory and is not reentrant, so keep one
+ * per CPU and use it with preemption disabled.
+ */
+static const char * const zram_crypto_names[] = {
+	"deflate",
+};
+
+static void zram_crypto_exit(struct zram_comp *comp)
+{
+	int cpu;
+	struct crypto_comp * __percpu *tfms = comp->private;
+
+	if (!tfms)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct crypto_comp *tfm = *per_cpu_ptr(tfms, cpu);
+
+		if (tfm && !IS_ERR(tfm))
+			crypto_free_comp(tfm);
+	}
+
+	free_percpu(tfms);
+	comp->private = NULL;
+}
+
+static int zram_crypto_init(struct zram_comp *comp)
+{
+	int cpu;
+	struct crypto_comp * __percpu *tfms;
+
+	tfms = alloc_percpu(struct crypto_comp *);
+	if (!tfms)
+		return -ENOMEM;
+	comp->private = tfms;
+
+	for_each_possible_cpu(cpu) {
+		struct crypto_comp *tfm = crypto_alloc_comp(comp->name, 0, 0);
+
+		*per_cpu_ptr(tfms, cpu) = tfm;
+		if (IS_ERR(tfm)) {
+			int ret = PTR_ERR(tfm);
+
+			zram_crypto_exit(comp);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+static int zram_crypto_compress(struct zram_comp *comp,
+			const unsigned char *src, unsigned char *dst,
+			size_t *dst_len, void *workmem)
+{
+	int ret;
+	unsigned int dlen = *dst_len;
+	struct crypto_comp * __percpu *tfms = comp->private;
+
+	ret = crypto_comp_compress(*per_cpu_ptr(tfms, get_cpu()),
+				src, PAGE_SIZE, dst, &dlen);
+	put_cpu();
+
+	*dst_len = dlen;
+	return ret;
+}
+
+static int zram_crypto_decompress(struct zram_comp *comp,
+			const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len)
+{
+	int ret;
+	unsigned int dlen = *dst_len;
+	struct crypto_comp * __percpu *tfms = comp->private;
+
+	ret = crypto_comp_decompress(*per_cpu_ptr(tfms, get_cpu()),
+				src, src_len, dst, &dlen);
+	put_cpu();
+
+	*dst_len = dlen;
+	return ret;
+}
+
+static const struct zram_comp_backend zram_crypto_backend = {
+	.name		= "crypto",
+	.init		= zram_crypto_init,
+	.exit		= zram_crypto_exit,
+	.compress	= zram_crypto_compress,
+	.decompress	= zram_crypto_decompress,
+};
+
+static int zram_crypto_available(const char *name)
+{
+	return crypto_has_comp(name, 0, 0);
+}
+#else
+static const char * const zram_crypto_names[] = { };
+
+static int zram_crypto_available(const char *name)
+{
+	return 0;
+}
+#endif
+
+static const struct zram_comp_backend *zram_find_backend(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(zram_backends); i++) {
+		if (!strcmp(name, zram_backends[i].name))
+			return &zram_backends[i];
+	}
+
+	return NULL;
+}
+
+int zram_comp_available(const char *name)
+{
+	return zram_find_backend(name) || zram_crypto_available(name);
+}
+
+/*
+ * Call fn() for every compressor usable right now, stopping at the
+ * first non-zero return value.
+ */
+int zram_comp_for_each(int (*fn)(const char *name, void *data), void *data)
+{
+	int i, ret;
+
+	for (i = 0; i < ARRAY_SIZE(zram_backends); i++) {
+		ret = fn(zram_backends[i].name, data);
+		if (ret)
+			return ret;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(zram_crypto_names); i++) {
+		if (zram_find_backend(zram_crypto_names[i]) ||
+				!zram_crypto_available(zram_crypto_names[i]))
+			continue;
+
+		ret = fn(zram_crypto_names[i], data);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+struct zram_comp_show {
+	const char *cur;
+	char *buf;
+	ssize_t len;
+	int found;
+};
+
+static int zram_comp_show_one(const char *name, void *data)
+{
+	struct zram_comp_show *show = data;
+
+	if (!strcmp(name, show->cur)) {
+		show->found = 1;
+		show->len += scnprintf(show->buf + show->len,
+				PAGE_SIZE - show->len, "[%s] ", name);
+	} else {
+		show->len += scnprintf(show->buf + show->len,
+				PAGE_SIZE - show->len, "%s ", name);
+	}
+
+	return 0;
+}
+
+/* List compressors in sysfs format, the current one in brackets */
+ssize_t zram_comp_show_available(const char *cur, char *buf)
+{
+	struct zram_comp_show show = {
+		.cur = cur,
+		.buf = buf,
+	};
+
+	zram_comp_for_each(zram_comp_show_one, &show);
+
+	/* Selected through the crypto API but not in the list above */
+	if (!show.found)
+		show.len += scnprintf(buf + show.len, PAGE_SIZE - show.len,
+				"[%s] ", cur);
+
+	show.len += scnprintf(buf + show.len, PAGE_SIZE - show.len, "\n");
+	return show.len;
+}
+
+int zram_comp_create(struct zram_comp *comp, const char *name)
+{
+	int ret = 0;
+
+	strlcpy(comp->name, name, sizeof(comp->name));
+	comp->private = NULL;
+
+	comp->backend = zram_find_backend(name);
+#if defined(CONFIG_CRYPTO) || defined(CONFIG_CRYPTO_MODULE)
+	if (!comp->backend && zram_crypto_available(name))
+		comp->backend = &zram_crypto_backend;
+#endif
+	if (!comp->backend) {
+		pr_err("Unknown compressor: %s\n", name);
+		return -EINVAL;
+	}
+
+	if (comp->backend->init)
+		ret = comp->backend->init(comp);
+	if (ret)
+		comp->backend = NULL;
+
+	return ret;
+}
+
+void zram_comp_destroy(struct zram_comp *comp)
+{
+	if (comp->backend && comp->backend->exit)
+		comp->backend->exit(comp);
+	comp->backend = NULL;
+}
@@ -0,0 +1,72 @@
+/*
+ * Compressed RAM block device
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Project home: http://compcache.googlecode.com
+ */
+
+#ifndef _ZRAM_COMP_H_
+#define _ZRAM_COMP_H_
+
+#include <linux/crypto.h>
+
+#define ZRAM_COMP_NAME_LEN	CRYPTO_MAX_ALG_NAME
+
+/* Compressor selected for a device unless told otherwise */
+#define ZRAM_COMP_DEFAULT	"lzo"
+
+struct zram_comp;
+
+/*
+ * A compression backend. compress() always consumes one page and may
+ * use 'workmem' (workmem_size bytes, owned by the calling stream).
+ * Both operations are called in atomic context and return 0 or a
+ * negative errno.
+ */
+struct zram_comp_backend {
+	const char *name;
+	size_t workmem_size;
+	int (*init)(struct zram_comp *comp);
+	void (*exit)(struct zram_comp *comp);
+	int (*compress)(struct zram_comp *comp, const unsigned char *src,
+			unsigned char *dst, size_t *dst_len, void *workmem);
+	int (*decompress)(struct zram_comp *comp, const unsigned char *src,
+			size_t src_len, unsigned char *dst, size_t *dst_len);
+};
+
+/* A backend instance, one per initialized device */
+struct zram_comp {
+	const struct zram_comp_backend *backend;
+	char name[ZRAM_COMP_NAME_LEN];
+	void *private;
+};
+
+int zram_comp_available(const char *name);
+ssize_t zram_comp_show_available(const char *cur, char *buf);
+int zram_comp_for_each(int (*fn)(const char *name, void *data), void *data);
+
+int zram_comp_create(struct zram_comp *comp, const char *name);
+void zram_comp_destroy(struct zram_comp *comp);
+
+static inline int zram_comp_compress(struct zram_comp *comp,
+			const unsigned char *src, unsigned char *dst,
+			size_t *dst_len, void *workmem)
+{
+	return comp->backend->compress(comp, src, dst, dst_len, workmem);
+}
+
+static inline int zram_comp_decompress(struct zram_comp *comp,
+			const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len)
+{
+	return comp->backend->decompress(comp, src, src_len, dst, dst_len);
+}
+
+#endif
@@ -25,13 +25,18 @@
 #include <linux/bitops.h>
 #include <linux/blkdev.h>
 #include <linux/buffer_head.h>
+#include <linux/completion.h>
 #include <linux/device.h>
+#include <linux/fs.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
+#include <linux/jhash.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 
 #include "zram_drv.h"
 
@@ -133,15 +138,416 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
+static u32 zram_page_checksum(void *ptr)
+{
+	return jhash2(ptr, PAGE_SIZE / sizeof(u32), 0);
+}
+
+static void zram_dedup_insert(struct zram *zram,
+			struct zram_dedup_entry *new)
+{
+	struct rb_node **p, *parent = NULL;
+	struct zram_dedup_entry *entry;
+
+	spin_lock(&zram->dedup_lock);
+	p = &zram->dedup_root.rb_node;
+	while (*p) {
+		parent = *p;
+		entry = rb_entry(parent, struct zram_dedup_entry, node);
+		if (new->checksum < entry->checksum)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&new->node, parent, p);
+	rb_insert_color(&new->node, &zram->dedup_root);
+
+	parent = NULL;
+	p = &zram->dedup_handles.rb_node;
+	while (*p) {
+		parent = *p;
+		entry = rb_entry(parent, struct zram_dedup_entry, handle_node);
+		if (new->handle < entry->handle)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&new->handle_node, parent, p);
+	rb_insert_color(&new->handle_node, &zram->dedup_handles);
+	spin_unlock(&zram->dedup_lock);
+}
+
+/*
+ * Return the entry of the object behind handle, or NULL.
+ * Called with dedup_lock held.
+ */
+static struct zram_dedup_entry *zram_dedup_find(struct zram *zram,
+						unsigned long handle)
+{
+	struct rb_node *rb = zram->dedup_handles.rb_node;
+	struct zram_dedup_entry *entry;
+
+	while (rb) {
+		entry = rb_entry(rb, struct zram_dedup_entry, handle_node);
+		if (handle < entry->handle)
+			rb = rb->rb_left;
+		else if (handle > entry->handle)
+			rb = rb->rb_right;
+		else
+			return entry;
+	}
+
+	return NULL;
+}
+
+/*
+ * Return the leftmost entry with the given checksum, or NULL.
+ * Called with dedup_lock held.
+ */
+static struct zram_dedup_entry *zram_dedup_first(struct zram *zram,
+						u32 checksum)
+{
+	struct rb_node *rb = zram->dedup_root.rb_node;
+	struct zram_dedup_entry *entry, *found = NULL;
+
+	while (rb) {
+		entry = rb_entry(rb, struct zram_dedup_entry, node);
+		if (checksum < entry->checksum) {
+			rb = rb->rb_left;
+		} else if (checksum > entry->checksum) {
+			rb = rb->rb_right;
+		} else {
+			found = entry;
+			rb = rb->rb_left;
+		}
+	}
+
+	return found;
+}
+
+static struct zram_dedup_entry *zram_dedup_next(
+			struct zram_dedup_entry *entry)
+{
+	struct rb_node *rb = rb_next(&entry->node);
+	struct zram_dedup_entry *next;
+
+	if (!rb)
+		return NULL;
+
+	next = rb_entry(rb, struct zram_dedup_entry, node);
+	return next->checksum == entry->checksum ? next : NULL;
+}
+
+/*
+ * Check whether the object behind 'entry' holds the same data as
+ * 'mem'. Compressed objects are decompressed into 'buffer', which
+ * is much cheaper than compressing the page again.
+ */
+static int zram_dedup_match(struct zram *zram,
+			struct zram_dedup_entry *entry,
+			unsigned char *mem, unsigned char *buffer)
+{
+	int ret, match;
+	size_t clen = PAGE_SIZE;
+	unsigned char *cmem;
+
+	cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_RO);
+	if (entry->clen == PAGE_SIZE) {
+		match = !memcmp(cmem, mem, PAGE_SIZE);
+	} else {
+		ret = zram_comp_decompress(&zram->comp,
+			cmem + sizeof(struct zobj_header), entry->clen,
+			buffer, &clen);
+		match = !ret && clen == PAGE_SIZE &&
+			!memcmp(buffer, mem, PAGE_SIZE);
+	}
+	zs_unmap_object(zram->mem_pool, entry->handle);
+
+	return match;
+}
+
+/*
+ * Look for a stored object with the same contents as 'page' and take
+ * a reference on it. Each candidate is pinned under dedup_lock and
+ * compared after dropping it, so writers do not serialize on the
+ * decompression. A pinned object is not freed underneath us; if its
+ * last table reference goes away meanwhile, the lookup frees it.
+ */
+static struct zram_dedup_entry *zram_dedup_get(struct zram *zram,
+			struct page *page, u32 checksum, void *buffer)
+{
+	int match, last;
+	unsigned char *user_mem;
+	struct zram_dedup_entry *entry, *next;
+
+	spin_lock(&zram->dedup_lock);
+	entry = zram_dedup_first(zram, checksum);
+	if (entry)
+		entry->pins++;
+	spin_unlock(&zram->dedup_lock);
+
+	while (entry) {
+		user_mem = kmap_atomic(page, KM_USER0);
+		match = zram_dedup_match(zram, entry, user_mem, buffer);
+		kunmap_atomic(user_mem, KM_USER0);
+
+		spin_lock(&zram->dedup_lock);
+		next = NULL;
+		/* An entry whose refcount dropped to 0 is out of the tree */
+		if (!entry->refcount)
+			match = 0;
+		else if (match)
+			entry->refcount++;
+		else
+			next = zram_dedup_next(entry);
+		if (next)
+			next->pins++;
+		last = !--entry->pins && !entry->refcount;
+		spin_unlock(&zram->dedup_lock);
+
+		if (match)
+			return entry;
+
+		if (last) {
+			zs_free(zram->mem_pool, entry->handle);
+			kfree(entry);
+		}
+		entry = next;
+	}
+
+	return NULL;
+}
+
+/*
+ * Drop a reference on the object behind handle. Returns 1 if other
+ * table entries still use it, 0 if the caller must free the object
+ * and -EBUSY if a lookup has it pinned and will free it when done.
+ *
+ * The entry is found by handle, so the slot free path never has to
+ * map the object or checksum the page again.
+ */
+static int zram_dedup_put(struct zram *zram, unsigned long handle)
+{
+	struct zram_dedup_entry *entry;
+
+	spin_lock(&zram->dedup_lock);
+	entry = zram_dedup_find(zram, handle);
+
+	/* Not indexed: entry allocation failed when it was stored */
+	if (!entry) {
+		spin_unlock(&zram->dedup_lock);
+		return 0;
+	}
+
+	if (--entry->refcount) {
+		spin_unlock(&zram->dedup_lock);
+		zram_stat_dec(&zram->stats.pages_dedup);
+		return 1;
+	}
+
+	rb_erase(&entry->node, &zram->dedup_root);
+	rb_erase(&entry->handle_node, &zram->dedup_handles);
+	if (entry->pins) {
+		spin_unlock(&zram->dedup_lock);
+		return -EBUSY;
+	}
+	spin_unlock(&zram->dedup_lock);
+	kfree(entry);
+
+	return 0;
+}
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+static void zram_reset_bdev(struct zram *zram)
+{
+	if (!zram->backing_dev)
+		return;
+
+	blkdev_put(zram->bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	filp_close(zram->backing_dev, NULL);
+	vfree(zram->bitmap);
+
+	zram->backing_dev = NULL;
+	zram->bdev = NULL;
+	zram->bitmap = NULL;
+	zram->nr_blocks = 0;
+}
+
+/*
+ * Block 0 is never handed out, so that a table entry with a zero
+ * handle still means "nothing stored" for written back pages.
+ */
+static unsigned long zram_bd_alloc_block(struct zram *zram)
+{
+	unsigned long blk_idx = 1;
+
+	do {
+		blk_idx = find_next_zero_bit(zram->bitmap, zram->nr_blocks,
+					blk_idx);
+		if (blk_idx >= zram->nr_blocks)
+			return 0;
+	} while (test_and_set_bit(blk_idx, zram->bitmap));
+
+	return blk_idx;
+}
+
+struct zram_bd_read {
+	struct work_struct work;
+	struct zram *zram;
+	struct page *page;
+	unsigned long blk_idx;
+	int ret;
+	struct list_head list;	/* in zram->bd_reads while in flight */
+	int freed;		/* block was freed during the read */
+};
+
+/*
+ * A block that is still being read is not handed back to the bitmap,
+ * or writeback could reuse it under the reader. Mark the reads instead
+ * and let the last of them free it.
+ */
+static void zram_bd_free_block(struct zram *zram, unsigned long blk_idx)
+{
+	int busy = 0;
+	struct zram_bd_read *rd;
+
+	spin_lock(&zram->bd_read_lock);
+	list_for_each_entry(rd, &zram->bd_reads, list) {
+		if (rd->blk_idx == blk_idx) {
+			rd->freed = 1;
+			busy = 1;
+		}
+	}
+	spin_unlock(&zram->bd_read_lock);
+
+	if (!busy)
+		WARN_ON(!test_and_clear_bit(blk_idx, zram->bitmap));
+}
+
+static void zram_bd_end_io(struct bio *bio, int err)
+{
+	complete(bio->bi_private);
+}
+
+/* Synchronously read or write one block of the backing device */
+static int zram_bd_rw_page(struct zram *zram, struct page *page,
+			unsigned long blk_idx, int rw)
+{
+	int ret;
+	struct bio *bio;
+	DECLARE_COMPLETION_ONSTACK(done);
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_bdev = zram->bdev;
+	bio->bi_sector = blk_idx << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_end_io = zram_bd_end_io;
+	bio->bi_private = &done;
+	if (!bio_add_page(bio, page, PAGE_SIZE, 0)) {
+		bio_put(bio);
+		return -EIO;
+	}
+
+	submit_bio(rw, bio);
+	wait_for_completion(&done);
+
+	ret = test_bit(BIO_UPTODATE, &bio->bi_flags) ? 0 : -EIO;
+	bio_put(bio);
+
+	return ret;
+}
+
+static void zram_bd_read_work(struct work_struct *work)
+{
+	struct zram_bd_read *rd = container_of(work, struct zram_bd_read,
+						work);
+
+	rd->ret = zram_bd_rw_page(rd->zram, rd->page, rd->blk_idx, READ);
+}
+
+/*
+ * Read a written back page. Called with table_lock held for reading,
+ * which is dropped once the block is pinned against being freed.
+ *
+ * Bios submitted from within a make_request function are only
+ * dispatched once it returns, so waiting for our own read from
+ * zram_make_request() would deadlock. Let a worker issue it.
+ */
+static int zram_bd_read_page(struct zram *zram, struct page *page,
+			u32 index)
+{
+	int last = 0;
+	struct zram_bd_read *other;
+	struct zram_bd_read rd = {
+		.zram = zram,
+		.page = page,
+		.blk_idx = zram->table[index].handle,
+	};
+
+	spin_lock(&zram->bd_read_lock);
+	list_add(&rd.list, &zram->bd_reads);
+	spin_unlock(&zram->bd_read_lock);
+	read_unlock(&zram->table_lock);
+
+	INIT_WORK_ONSTACK(&rd.work, zram_bd_read_work);
+	queue_work(system_unbound_wq, &rd.work);
+	flush_work(&rd.work);
+	destroy_work_on_stack(&rd.work);
+
+	spin_lock(&zram->bd_read_lock);
+	list_del(&rd.list);
+	if (rd.freed) {
+		last = 1;
+		list_for_each_entry(other, &zram->bd_reads, list) {
+			if (other->blk_idx == rd.blk_idx) {
+				last = 0;
+				break;
+			}
+		}
+	}
+	spin_unlock(&zram->bd_read_lock);
+
+	if (last)
+		WARN_ON(!test_and_clear_bit(rd.blk_idx, zram->bitmap));
+
+	zram_stat64_inc(zram, &zram->stats.wb_reads);
+	if (unlikely(rd.ret)) {
+		pr_err("Backing device read failed! err=%d, block=%lu\n",
+			rd.ret, rd.blk_idx);
+		zram_stat64_inc(zram, &zram->stats.failed_reads);
+		return rd.ret;
+	}
+
+	flush_dcache_page(page);
+	return 0;
+}
+#else
+static inline void zram_reset_bdev(struct zram *zram) {}
+static inline void zram_bd_free_block(struct zram *zram,
+			unsigned long blk_idx) {}
+static inline int zram_bd_read_page(struct zram *zram, struct page *page,
+			u32 index)
+{
+	read_unlock(&zram->table_lock);
+	return -EIO;
+}
+#endif
+
+/* Called with table_lock held for writing */
 static void zram_free_page(struct zram *zram, size_t index)
 {
 	u32 clen;
-	void *obj;
+	int ret, uncompressed;
+
+	unsigned long handle = zram->table[index].handle;
+	u16 size = zram->table[index].size;
 
-	struct page *page = zram->table[index].page;
-	u32 offset = zram->table[index].offset;
+	zram_clear_flag(zram, index, ZRAM_IDLE);
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
 
-	if (unlikely(!page)) {
+	if (unlikely(!handle)) {
 		/*
 		 * No memory is allocated for zero filled pages.
 		 * Simply clear zero page flag.
@@ -153,28 +559,39 @@ static void zram_free_page(struct zram *zram, size_t index)
 		return;
 	}
 
-	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-		clen = PAGE_SIZE;
-		__free_page(page);
-		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
-		zram_stat_dec(&zram->stats.pages_expand);
-		goto out;
+	if (unlikely(zram_test_flag(zram, index, ZRAM_WB))) {
+		zram_clear_flag(zram, index, ZRAM_WB);
+		zram->table[index].handle = 0;
+		zram_bd_free_block(zram, handle);
+		zram_stat_dec(&zram->stats.pages_wb);
+		return;
 	}
 
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
+	uncompressed = zram_test_flag(zram, index, ZRAM_UNCOMPRESSED);
+	zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
+	zram_stat_dec(&zram->stats.pages_stored);
 
-	xv_free(zram->mem_pool, page, offset);
-	if (clen <= PAGE_SIZE / 2)
-		zram_stat_dec(&zram->stats.good_compress);
+	zram->table[index].handle = 0;
+	zram->table[index].size = 0;
 
-out:
-	zram_stat64_sub(zram, &zram->stats.compr_size, clen);
-	zram_stat_dec(&zram->stats.pages_stored);
+	ret = zram->use_dedup ? zram_dedup_put(zram, handle) : 0;
+	if (ret > 0)
+		return;
 
-	zram->table[index].page = NULL;
-	zram->table[index].offset = 0;
+	/* On -EBUSY a lookup still compares against it and frees it after */
+	if (!ret)
+		zs_free(zram->mem_pool, handle);
+
+	if (unlikely(uncompressed)) {
+		clen = PAGE_SIZE;
+		zram_stat_dec(&zram->stats.pages_expand);
+	} else {
+		clen = size - sizeof(struct zobj_header);
+		if (clen <= PAGE_SIZE / 2)
+			zram_stat_dec(&zram->stats.good_compress);
+	}
+
+	zram_stat64_sub(zram, &zram->stats.compr_size, clen);
 }
 
 static void handle_zero_page(struct page *page)
@@ -193,82 +610,447 @@ static void handle_uncompressed_page(struct zram *zram,
 {
 	unsigned char *user_mem, *cmem;
 
+	unsigned long handle = zram->table[index].handle;
+
 	user_mem = kmap_atomic(page, KM_USER0);
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-			zram->table[index].offset;
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
 
 	memcpy(user_mem, cmem, PAGE_SIZE);
+	zs_unmap_object(zram->mem_pool, handle);
 	kunmap_atomic(user_mem, KM_USER0);
-	kunmap_atomic(cmem, KM_USER1);
 
 	flush_dcache_page(page);
 }
 
-static void zram_read(struct zram *zram, struct bio *bio)
+/*
+ * Called with table_lock held for reading, which is dropped before
+ * returning. Leaves the idle flag alone.
+ */
+static int __zram_read_page(struct zram *zram, struct page *page, u32 index)
 {
+	int ret;
+	size_t clen;
+	struct zobj_header *zheader;
+	unsigned char *user_mem, *cmem;
 
-	int i;
-	u32 index;
-	struct bio_vec *bvec;
+	if (zram_test_flag(zram, index, ZRAM_ZERO)) {
+		read_unlock(&zram->table_lock);
+		handle_zero_page(page);
+		return 0;
+	}
 
-	zram_stat64_inc(zram, &zram->stats.num_reads);
-	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+	/* Requested page is not present in compressed area */
+	if (unlikely(!zram->table[index].handle)) {
+		read_unlock(&zram->table_lock);
+		pr_debug("Read before write: index=%u\n", index);
+		handle_zero_page(page);
+		return 0;
+	}
 
-	bio_for_each_segment(bvec, bio, i) {
-		int ret;
-		size_t clen;
-		struct page *page;
-		struct zobj_header *zheader;
-		unsigned char *user_mem, *cmem;
+	/* Page was written back; this drops table_lock */
+	if (unlikely(zram_test_flag(zram, index, ZRAM_WB)))
+		return zram_bd_read_page(zram, page, index);
+
+	/* Page is stored uncompressed since it's incompressible */
+	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+		handle_uncompressed_page(zram, page, index);
+		read_unlock(&zram->table_lock);
+		return 0;
+	}
 
-		page = bvec->bv_page;
+	user_mem = kmap_atomic(page, KM_USER0);
+	clen = PAGE_SIZE;
 
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			handle_zero_page(page);
-			index++;
-			continue;
-		}
+	cmem = zs_map_object(zram->mem_pool, zram->table[index].handle,
+				ZS_MM_RO);
 
-		/* Requested page is not present in compressed area */
-		if (unlikely(!zram->table[index].page)) {
-			pr_debug("Read before write: sector=%lu, size=%u",
-				(ulong)(bio->bi_sector), bio->bi_size);
-			handle_zero_page(page);
-			index++;
-			continue;
+	ret = zram_comp_decompress(&zram->comp,
+		cmem + sizeof(*zheader),
+		zram->table[index].size - sizeof(*zheader),
+		user_mem, &clen);
+
+	zs_unmap_object(zram->mem_pool, zram->table[index].handle);
+	kunmap_atomic(user_mem, KM_USER0);
+
+	read_unlock(&zram->table_lock);
+
+	/* Should NEVER happen. Return bio error if it does. */
+	if (unlikely(ret)) {
+		pr_err("Decompression failed! err=%d, page=%u\n",
+			ret, index);
+		zram_stat64_inc(zram, &zram->stats.failed_reads);
+		return ret;
+	}
+
+	flush_dcache_page(page);
+	return 0;
+}
+
+static int zram_read_page(struct zram *zram, struct page *page, u32 index)
+{
+	read_lock(&zram->table_lock);
+
+	/*
+	 * Only readers run concurrently here and all they do to the
+	 * flags is clear this same bit, so the update cannot be lost.
+	 */
+	if (unlikely(zram_test_flag(zram, index, ZRAM_IDLE)))
+		zram_clear_flag(zram, index, ZRAM_IDLE);
+
+	return __zram_read_page(zram, page, index);
+}
+
+/*
+ * Take an idle compression stream, sleeping until one is released
+ * if all of them are in use by other writers.
+ */
+static struct zram_stream *zram_stream_get(struct zram *zram)
+{
+	struct zram_stream *strm;
+
+	spin_lock(&zram->strm_lock);
+	if (unlikely(list_empty(&zram->idle_strm))) {
+		spin_unlock(&zram->strm_lock);
+		zram_stat64_inc(zram, &zram->stats.strm_waits);
+
+		for (;;) {
+			wait_event(zram->strm_wait,
+				!list_empty(&zram->idle_strm));
+			spin_lock(&zram->strm_lock);
+			if (!list_empty(&zram->idle_strm))
+				break;
+			spin_unlock(&zram->strm_lock);
 		}
+	}
 
-		/* Page is stored uncompressed since it's incompressible */
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-			handle_uncompressed_page(zram, page, index);
-			index++;
-			continue;
+	strm = list_first_entry(&zram->idle_strm, struct zram_stream, list);
+	list_del(&strm->list);
+	spin_unlock(&zram->strm_lock);
+
+	return strm;
+}
+
+static void zram_stream_put(struct zram *zram, struct zram_stream *strm)
+{
+	spin_lock(&zram->strm_lock);
+	list_add(&strm->list, &zram->idle_strm);
+	spin_unlock(&zram->strm_lock);
+
+	wake_up(&zram->strm_wait);
+}
+
+static int zram_write_page(struct zram *zram, struct page *page, u32 index)
+{
+	int ret, zero;
+	u32 checksum = 0;
+	size_t clen, size;
+	unsigned long handle;
+	bool uncompressed = false;
+	struct zobj_header *zheader;
+	struct zram_stream *strm;
+	struct zram_dedup_entry *entry = NULL;
+	unsigned char *user_mem, *cmem, *src;
+
+	user_mem = kmap_atomic(page, KM_USER0);
+	zero = page_zero_filled(user_mem);
+	if (!zero && zram->use_dedup)
+		checksum = zram_page_checksum(user_mem);
+	kunmap_atomic(user_mem, KM_USER0);
+
+	if (zero) {
+		write_lock(&zram->table_lock);
+		/*
+		 * System overwrites unused sectors. Free memory associated
+		 * with this sector now.
+		 */
+		zram_free_page(zram, index);
+		zram_stat_inc(&zram->stats.pages_zero);
+		zram_set_flag(zram, index, ZRAM_ZERO);
+		write_unlock(&zram->table_lock);
+		return 0;
+	}
+
+	/* Only the stream is exclusive; other writers compress in parallel */
+	strm = zram_stream_get(zram);
+	src = strm->buffer;
+
+	if (zram->use_dedup) {
+		entry = zram_dedup_get(zram, page, checksum, strm->buffer);
+		if (entry) {
+			zram_stream_put(zram, strm);
+			goto dedup;
 		}
 
-		user_mem = kmap_atomic(page, KM_USER0);
+		/* Not fatal: the object is just not shareable then */
+		entry = kmalloc(sizeof(*entry), GFP_NOIO);
+	}
+
+	user_mem = kmap_atomic(page, KM_USER0);
+	clen = ZRAM_STRM_BUF_SIZE;
+	ret = zram_comp_compress(&zram->comp, user_mem, src, &clen,
+				strm->workmem);
+	kunmap_atomic(user_mem, KM_USER0);
+
+	if (unlikely(ret)) {
+		pr_err("Compression failed! err=%d\n", ret);
+		goto out;
+	}
+
+	/*
+	 * Page is incompressible. Store it as-is (uncompressed)
+	 * since we do not want to return too many disk write
+	 * errors which has side effect of hanging the system.
+	 */
+	if (unlikely(clen > max_zpage_size)) {
 		clen = PAGE_SIZE;
+		size = PAGE_SIZE;
+		uncompressed = true;
+	} else {
+		size = clen + sizeof(*zheader);
+	}
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+	handle = zs_malloc(zram->mem_pool, size, GFP_NOIO | __GFP_HIGHMEM);
+	if (unlikely(!handle)) {
+		pr_info("Error allocating memory for compressed "
+			"page: %u, size=%zu\n", index, size);
+		ret = -ENOMEM;
+		goto out;
+	}
 
-		ret = lzo1x_decompress_safe(
-			cmem + sizeof(*zheader),
-			xv_get_object_size(cmem) - sizeof(*zheader),
-			user_mem, &clen);
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_WO);
+	if (unlikely(uncompressed))
+		src = kmap_atomic(page, KM_USER0);
 
-		kunmap_atomic(user_mem, KM_USER0);
-		kunmap_atomic(cmem, KM_USER1);
+	if (!uncompressed) {
+		zheader = (struct zobj_header *)cmem;
+#if 0
+		/* Back-reference needed for memory defragmentation */
+		zheader->table_idx = index;
+#endif
+		cmem += sizeof(*zheader);
+	}
 
-		/* Should NEVER happen. Return bio error if it does. */
-		if (unlikely(ret != LZO_E_OK)) {
-			pr_err("Decompression failed! err=%d, page=%u\n",
-				ret, index);
-			zram_stat64_inc(zram, &zram->stats.failed_reads);
-			goto out;
+	memcpy(cmem, src, clen);
+
+	if (unlikely(uncompressed))
+		kunmap_atomic(src, KM_USER0);
+	zs_unmap_object(zram->mem_pool, handle);
+
+	zram_stream_put(zram, strm);
+
+	if (entry) {
+		entry->handle = handle;
+		entry->checksum = checksum;
+		entry->clen = clen;
+		entry->refcount = 1;
+		entry->pins = 0;
+		zram_dedup_insert(zram, entry);
+	}
+
+	write_lock(&zram->table_lock);
+
+	/*
+	 * System overwrites unused sectors. Free memory associated
+	 * with this sector now.
+	 */
+	zram_free_page(zram, index);
+
+	zram->table[index].handle = handle;
+	if (!uncompressed)
+		zram->table[index].size = size;
+
+	/* Update stats */
+	if (unlikely(uncompressed)) {
+		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
+		zram_stat_inc(&zram->stats.pages_expand);
+	}
+	zram_stat64_add(zram, &zram->stats.compr_size, clen);
+	zram_stat_inc(&zram->stats.pages_stored);
+	if (clen <= PAGE_SIZE / 2)
+		zram_stat_inc(&zram->stats.good_compress);
+
+	write_unlock(&zram->table_lock);
+	return 0;
+
+dedup:
+	write_lock(&zram->table_lock);
+	zram_free_page(zram, index);
+
+	zram->table[index].handle = entry->handle;
+	if (unlikely(entry->clen == PAGE_SIZE))
+		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
+	else
+		zram->table[index].size = entry->clen + sizeof(*zheader);
+	zram_stat_inc(&zram->stats.pages_stored);
+	zram_stat_inc(&zram->stats.pages_dedup);
+	write_unlock(&zram->table_lock);
+
+	zram_stat64_inc(zram, &zram->stats.dedup_hits);
+	return 0;
+
+out:
+	kfree(entry);
+	zram_stream_put(zram, strm);
+	zram_stat64_inc(zram, &zram->stats.failed_writes);
+	return ret;
+}
+
+static inline int is_partial_io(struct bio_vec *bvec)
+{
+	return bvec->bv_len != PAGE_SIZE;
+}
+
+/*
+ * Sub-page reads decompress the whole page into a scratch page and
+ * copy out the requested part. Full pages are decompressed in place.
+ */
+static int zram_read_partial(struct zram *zram, struct bio_vec *bvec,
+			u32 index, int offset)
+{
+	int ret;
+	struct page *page;
+	unsigned char *src, *dst;
+
+	page = alloc_page(GFP_NOIO);
+	if (!page)
+		return -ENOMEM;
+
+	ret = zram_read_page(zram, page, index);
+	if (!ret) {
+		src = kmap_atomic(page, KM_USER0);
+		dst = kmap_atomic(bvec->bv_page, KM_USER1);
+		memcpy(dst + bvec->bv_offset, src + offset, bvec->bv_len);
+		kunmap_atomic(dst, KM_USER1);
+		kunmap_atomic(src, KM_USER0);
+
+		flush_dcache_page(bvec->bv_page);
+	}
+
+	__free_page(page);
+	return ret;
+}
+
+static int zram_lock_wait(void *word)
+{
+	schedule();
+	return 0;
+}
+
+/*
+ * Writes to one index are serialized, since sub-page writes are a
+ * read-modify-write of the whole page and would otherwise undo a
+ * concurrent write to another part of it or to the full page. The
+ * compression may sleep, so this is a sleeping bit lock per index.
+ */
+static void zram_lock_index(struct zram *zram, u32 index)
+{
+	wait_on_bit_lock(&zram->write_locks[BIT_WORD(index)],
+			index % BITS_PER_LONG, zram_lock_wait,
+			TASK_UNINTERRUPTIBLE);
+}
+
+static void zram_unlock_index(struct zram *zram, u32 index)
+{
+	unsigned long *word = &zram->write_locks[BIT_WORD(index)];
+
+	clear_bit_unlock(index % BITS_PER_LONG, word);
+	smp_mb__after_clear_bit();
+	wake_up_bit(word, index % BITS_PER_LONG);
+}
+
+/* Called with the index locked */
+static int zram_write_partial(struct zram *zram, struct bio_vec *bvec,
+			u32 index, int offset)
+{
+	int ret;
+	struct page *page;
+	unsigned char *src, *dst;
+
+	page = alloc_page(GFP_NOIO);
+	if (!page)
+		return -ENOMEM;
+
+	ret = zram_read_page(zram, page, index);
+	if (!ret) {
+		src = kmap_atomic(bvec->bv_page, KM_USER0);
+		dst = kmap_atomic(page, KM_USER1);
+		memcpy(dst + offset, src + bvec->bv_offset, bvec->bv_len);
+		kunmap_atomic(dst, KM_USER1);
+		kunmap_atomic(src, KM_USER0);
+
+		ret = zram_write_page(zram, page, index);
+	}
+
+	__free_page(page);
+	return ret;
+}
+
+static int zram_bvec_rw(struct zram *zram, struct bio_vec *bvec,
+			u32 index, int offset, int rw)
+{
+	int ret;
+
+	if (rw == READ) {
+		if (unlikely(is_partial_io(bvec)))
+			return zram_read_partial(zram, bvec, index, offset);
+		return zram_read_page(zram, bvec->bv_page, index);
+	}
+
+	zram_lock_index(zram, index);
+	if (unlikely(is_partial_io(bvec)))
+		ret = zram_write_partial(zram, bvec, index, offset);
+	else
+		ret = zram_write_page(zram, bvec->bv_page, index);
+	zram_unlock_index(zram, index);
+
+	return ret;
+}
+
+static void update_position(u32 *index, int *offset, struct bio_vec *bvec)
+{
+	if (*offset + bvec->bv_len >= PAGE_SIZE)
+		(*index)++;
+	*offset = (*offset + bvec->bv_len) % PAGE_SIZE;
+}
+
+static void __zram_make_request(struct zram *zram, struct bio *bio, int rw)
+{
+	int i, offset;
+	u32 index;
+	struct bio_vec *bvec;
+
+	if (rw == READ)
+		zram_stat64_inc(zram, &zram->stats.num_reads);
+	else
+		zram_stat64_inc(zram, &zram->stats.num_writes);
+
+	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+	offset = (bio->bi_sector & (SECTORS_PER_PAGE - 1)) << SECTOR_SHIFT;
+
+	bio_for_each_segment(bvec, bio, i) {
+		int max_transfer_size = PAGE_SIZE - offset;
+
+		/* Segment crosses a zram page boundary: split it in two */
+		if (bvec->bv_len > max_transfer_size) {
+			struct bio_vec bv;
+
+			bv.bv_page = bvec->bv_page;
+			bv.bv_len = max_transfer_size;
+			bv.bv_offset = bvec->bv_offset;
+
+			if (zram_bvec_rw(zram, &bv, index, offset, rw) < 0)
+				goto out;
+
+			bv.bv_len = bvec->bv_len - max_transfer_size;
+			bv.bv_offset += max_transfer_size;
+			if (zram_bvec_rw(zram, &bv, index + 1, 0, rw) < 0)
+				goto out;
+		} else {
+			if (zram_bvec_rw(zram, bvec, index, offset, rw) < 0)
+				goto out;
 		}
 
-		flush_dcache_page(page);
-		index++;
+		update_position(&index, &offset, bvec);
 	}
 
 	set_bit(BIO_UPTODATE, &bio->bi_flags);
@@ -279,144 +1061,361 @@ out:
 	bio_io_error(bio);
 }
 
-static void zram_write(struct zram *zram, struct bio *bio)
+#ifdef CONFIG_ZRAM_WRITEBACK
+/*
+ * Attach the block device at 'name' as backing device, or detach the
+ * current one if name is "none". Only allowed before initialization.
+ */
+int zram_set_backing_dev(struct zram *zram, const char *name)
 {
-	int i;
-	u32 index;
-	struct bio_vec *bvec;
+	int ret;
+	struct file *file;
+	struct inode *inode;
+	struct block_device *bdev;
+	unsigned long nr_blocks, *bitmap;
 
-	zram_stat64_inc(zram, &zram->stats.num_writes);
-	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done) {
+		ret = -EBUSY;
+		goto out;
+	}
 
-	bio_for_each_segment(bvec, bio, i) {
-		int ret;
-		u32 offset;
-		size_t clen;
-		struct zobj_header *zheader;
-		struct page *page, *page_store;
-		unsigned char *user_mem, *cmem, *src;
+	zram_reset_bdev(zram);
+	if (!strcmp(name, "none")) {
+		ret = 0;
+		goto out;
+	}
 
-		page = bvec->bv_page;
-		src = zram->compress_buffer;
+	file = filp_open(name, O_RDWR | O_LARGEFILE, 0);
+	if (IS_ERR(file)) {
+		ret = PTR_ERR(file);
+		goto out;
+	}
 
-		/*
-		 * System overwrites unused sectors. Free memory associated
-		 * with this sector now.
-		 */
-		if (zram->table[index].page ||
-				zram_test_flag(zram, index, ZRAM_ZERO))
-			zram_free_page(zram, index);
+	inode = file->f_mapping->host;
+	if (!S_ISBLK(inode->i_mode)) {
+		ret = -ENOTBLK;
+		goto out_close;
+	}
 
-		mutex_lock(&zram->lock);
+	bdev = bdgrab(I_BDEV(inode));
+	ret = blkdev_get(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL, zram);
+	if (ret < 0)
+		goto out_close;
 
-		user_mem = kmap_atomic(page, KM_USER0);
-		if (page_zero_filled(user_mem)) {
-			kunmap_atomic(user_mem, KM_USER0);
-			mutex_unlock(&zram->lock);
-			zram_stat_inc(&zram->stats.pages_zero);
-			zram_set_flag(zram, index, ZRAM_ZERO);
-			index++;
+	nr_blocks = i_size_read(inode) >> PAGE_SHIFT;
+	if (nr_blocks < 2) {
+		ret = -EINVAL;
+		goto out_put;
+	}
+
+	bitmap = vzalloc(BITS_TO_LONGS(nr_blocks) * sizeof(long));
+	if (!bitmap) {
+		ret = -ENOMEM;
+		goto out_put;
+	}
+
+	zram->backing_dev = file;
+	zram->bdev = bdev;
+	zram->bitmap = bitmap;
+	zram->nr_blocks = nr_blocks;
+	mutex_unlock(&zram->init_lock);
+
+	pr_info("%s: using %s as backing device (%lu pages)\n",
+		zram->disk->disk_name, name, nr_blocks - 1);
+	return 0;
+
+out_put:
+	blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+out_close:
+	filp_close(file, NULL);
+out:
+	mutex_unlock(&zram->init_lock);
+	return ret;
+}
+
+/* Mark every stored page idle; reading or rewriting it clears this */
+void zram_mark_idle(struct zram *zram)
+{
+	size_t index, num_pages;
+
+	mutex_lock(&zram->init_lock);
+	if (!zram->init_done)
+		goto out;
+
+	num_pages = zram->disksize >> PAGE_SHIFT;
+	for (index = 0; index < num_pages; index++) {
+		write_lock(&zram->table_lock);
+		if (zram->table[index].handle &&
+				!zram_test_flag(zram, index, ZRAM_WB))
+			zram_set_flag(zram, index, ZRAM_IDLE);
+		write_unlock(&zram->table_lock);
+		cond_resched();
+	}
+out:
+	mutex_unlock(&zram->init_lock);
+}
+
+/*
+ * Move stored pages that have 'flag' set (ZRAM_IDLE or
+ * ZRAM_UNCOMPRESSED) to the backing device and free their memory.
+ * Each page is read and written out with the table unlocked; if it
+ * is freed or overwritten meanwhile, ZRAM_UNDER_WB is cleared by
+ * zram_free_page() and the copy on the backing device is dropped.
+ */
+int zram_writeback(struct zram *zram, enum zram_pageflags flag)
+{
+	int ret = 0;
+	size_t index, num_pages;
+	unsigned long blk_idx = 0;
+	struct page *page;
+
+	mutex_lock(&zram->init_lock);
+	if (!zram->init_done) {
+		ret = -ENXIO;
+		goto out;
+	}
+
+	if (!zram->backing_dev) {
+		ret = -ENODEV;
+		goto out;
+	}
+
+	page = alloc_page(GFP_KERNEL);
+	if (!page) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	num_pages = zram->disksize >> PAGE_SHIFT;
+	for (index = 0; index < num_pages; index++) {
+		cond_resched();
+
+		if (!blk_idx) {
+			blk_idx = zram_bd_alloc_block(zram);
+			if (!blk_idx) {
+				ret = -ENOSPC;
+				break;
+			}
+		}
+
+		write_lock(&zram->table_lock);
+		if (!zram->table[index].handle ||
+				zram_test_flag(zram, index, ZRAM_WB) ||
+				!zram_test_flag(zram, index, flag)) {
+			write_unlock(&zram->table_lock);
 			continue;
 		}
+		zram_set_flag(zram, index, ZRAM_UNDER_WB);
+		write_unlock(&zram->table_lock);
 
-		ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-					zram->compress_workmem);
+		if (zram_read_page(zram, page, index))
+			ret = -EIO;
+		else
+			ret = zram_bd_rw_page(zram, page, blk_idx, WRITE);
 
-		kunmap_atomic(user_mem, KM_USER0);
+		if (unlikely(ret)) {
+			write_lock(&zram->table_lock);
+			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+			write_unlock(&zram->table_lock);
+			pr_err("Writeback failed! err=%d, page=%zu\n",
+				ret, index);
+			break;
+		}
+		zram_stat64_inc(zram, &zram->stats.wb_writes);
 
-		if (unlikely(ret != LZO_E_OK)) {
-			mutex_unlock(&zram->lock);
-			pr_err("Compression failed! err=%d\n", ret);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
-			goto out;
+		write_lock(&zram->table_lock);
+		if (!zram_test_flag(zram, index, ZRAM_UNDER_WB)) {
+			/* Lost the race; the block is reused for the next */
+			write_unlock(&zram->table_lock);
+			continue;
 		}
 
-		/*
-		 * Page is incompressible. Store it as-is (uncompressed)
-		 * since we do not want to return too many disk write
-		 * errors which has side effect of hanging the system.
-		 */
-		if (unlikely(clen > max_zpage_size)) {
-			clen = PAGE_SIZE;
-			page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
-			if (unlikely(!page_store)) {
-				mutex_unlock(&zram->lock);
-				pr_info("Error allocating memory for "
-					"incompressible page: %u\n", index);
-				zram_stat64_inc(zram,
-					&zram->stats.failed_writes);
-				goto out;
-			}
+		zram_free_page(zram, index);
+		zram_set_flag(zram, index, ZRAM_WB);
+		zram->table[index].handle = blk_idx;
+		zram_stat_inc(&zram->stats.pages_wb);
+		write_unlock(&zram->table_lock);
 
-			offset = 0;
-			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-			zram_stat_inc(&zram->stats.pages_expand);
-			zram->table[index].page = page_store;
-			src = kmap_atomic(page, KM_USER0);
-			goto memstore;
-		}
+		blk_idx = 0;
+	}
+
+	if (blk_idx)
+		zram_bd_free_block(zram, blk_idx);
+	__free_page(page);
+out:
+	mutex_unlock(&zram->init_lock);
+	return ret;
+}
+#endif
+
+struct zram_bench {
+	void *pages;		/* copies of the sampled stored pages */
+	unsigned int nr_pages;
+	void *cbuf;		/* compressor output */
+	void *dbuf;		/* decompressor output */
+	char *buf;		/* sysfs report */
+	ssize_t len;
+};
+
+/* Compress and decompress every sampled page with one compressor */
+static int zram_bench_one(const char *name, void *data)
+{
+	int ret;
+	unsigned int i, errors = 0;
+	u64 bytes, stored = 0, ctime = 0, dtime = 0;
+	ktime_t start;
+	void *workmem = NULL;
+	struct zram_comp comp;
+	struct zram_bench *bench = data;
+
+	ret = zram_comp_create(&comp, name);
+	if (ret)
+		goto out;
 
-		if (xv_malloc(zram->mem_pool, clen + sizeof(*zheader),
-				&zram->table[index].page, &offset,
-				GFP_NOIO | __GFP_HIGHMEM)) {
-			mutex_unlock(&zram->lock);
-			pr_info("Error allocating memory for compressed "
-				"page: %u, size=%zu\n", index, clen);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
-			goto out;
+	if (comp.backend->workmem_size) {
+		workmem = vmalloc(comp.backend->workmem_size);
+		if (!workmem) {
+			ret = -ENOMEM;
+			goto out_destroy;
 		}
+	}
 
-memstore:
-		zram->table[index].offset = offset;
+	for (i = 0; i < bench->nr_pages; i++) {
+		unsigned char *src = bench->pages + i * PAGE_SIZE;
+		size_t clen = ZRAM_STRM_BUF_SIZE, dlen = PAGE_SIZE;
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+		start = ktime_get();
+		ret = zram_comp_compress(&comp, src, bench->cbuf, &clen,
+					workmem);
+		ctime += ktime_to_ns(ktime_sub(ktime_get(), start));
+		if (ret) {
+			errors++;
+			continue;
+		}
 
-#if 0
-		/* Back-reference needed for memory defragmentation */
-		if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-			zheader = (struct zobj_header *)cmem;
-			zheader->table_idx = index;
-			cmem += sizeof(*zheader);
+		start = ktime_get();
+		ret = zram_comp_decompress(&comp, bench->cbuf, clen,
+					bench->dbuf, &dlen);
+		dtime += ktime_to_ns(ktime_sub(ktime_get(), start));
+		if (ret || dlen != PAGE_SIZE ||
+				memcmp(src, bench->dbuf, PAGE_SIZE)) {
+			errors++;
+			continue;
 		}
-#endif
 
-		memcpy(cmem, src, clen);
+		/* Account what zram_write_page() would actually store */
+		stored += clen > max_zpage_size ? PAGE_SIZE : clen;
+		cond_resched();
+	}
+	ret = 0;
+
+	bytes = (u64)bench->nr_pages << PAGE_SHIFT;
+	bench->len += scnprintf(bench->buf + bench->len,
+		PAGE_SIZE - bench->len,
+		"%-8s stored %3llu%%  compress %5llu MB/s  "
+		"decompress %5llu MB/s  errors %u\n",
+		name, div64_u64(stored * 100, bytes),
+		div64_u64(bytes * 1000, ctime ? ctime : 1),
+		div64_u64(bytes * 1000, dtime ? dtime : 1), errors);
+
+	vfree(workmem);
+out_destroy:
+	zram_comp_destroy(&comp);
+out:
+	if (ret)
+		bench->len += scnprintf(bench->buf + bench->len,
+			PAGE_SIZE - bench->len, "%-8s error %d\n", name, ret);
+	return 0;
+}
 
-		kunmap_atomic(cmem, KM_USER1);
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			kunmap_atomic(src, KM_USER0);
+/*
+ * Run every available compressor over a sample of the pages currently
+ * stored in the device and report the resulting size (as a percentage
+ * of the original) and throughput.
+ */
+ssize_t zram_comp_bench(struct zram *zram, char *buf)
+{
+	ssize_t ret;
+	size_t index, num_pages;
+	u32 seen = 0, stride;
+	struct zram_bench bench = {
+		.buf = buf,
+	};
 
-		/* Update stats */
-		zram_stat64_add(zram, &zram->stats.compr_size, clen);
-		zram_stat_inc(&zram->stats.pages_stored);
-		if (clen <= PAGE_SIZE / 2)
-			zram_stat_inc(&zram->stats.good_compress);
+	mutex_lock(&zram->init_lock);
+	if (!zram->init_done) {
+		ret = -ENXIO;
+		goto out;
+	}
 
-		mutex_unlock(&zram->lock);
-		index++;
+	bench.pages = vmalloc(ZRAM_BENCH_MAX_PAGES * PAGE_SIZE);
+	bench.cbuf = kmalloc(ZRAM_STRM_BUF_SIZE, GFP_KERNEL);
+	bench.dbuf = kmalloc(PAGE_SIZE, GFP_KERNEL);
+	if (!bench.pages || !bench.cbuf || !bench.dbuf) {
+		ret = -ENOMEM;
+		goto out_free;
 	}
 
-	set_bit(BIO_UPTODATE, &bio->bi_flags);
-	bio_endio(bio, 0);
-	return;
+	/* Spread the sample evenly over the stored pages */
+	stride = DIV_ROUND_UP(zram->stats.pages_stored, ZRAM_BENCH_MAX_PAGES);
+	if (!stride)
+		stride = 1;
+
+	num_pages = zram->disksize >> PAGE_SHIFT;
+	for (index = 0; index < num_pages &&
+			bench.nr_pages < ZRAM_BENCH_MAX_PAGES; index++) {
+		void *dst = bench.pages + bench.nr_pages * PAGE_SIZE;
+
+		read_lock(&zram->table_lock);
+		if (!zram->table[index].handle ||
+				zram_test_flag(zram, index, ZRAM_WB) ||
+				seen++ % stride) {
+			read_unlock(&zram->table_lock);
+			continue;
+		}
+
+		/* Sampling must not count as an access for writeback */
+		if (!__zram_read_page(zram, vmalloc_to_page(dst), index))
+			bench.nr_pages++;
+	}
+
+	if (!bench.nr_pages) {
+		ret = sprintf(buf, "no pages stored\n");
+		goto out_free;
+	}
+
+	bench.len = scnprintf(buf, PAGE_SIZE, "sampled %u pages using %s\n",
+			bench.nr_pages, zram->compressor);
+	zram_comp_for_each(zram_bench_one, &bench);
+	ret = bench.len;
 
+out_free:
+	kfree(bench.dbuf);
+	kfree(bench.cbuf);
+	vfree(bench.pages);
 out:
-	bio_io_error(bio);
+	mutex_unlock(&zram->init_lock);
+	return ret;
 }
 
 /*
- * Check if request is within bounds and page aligned.
+ * Check if request is within bounds and aligned on zram logical blocks.
  */
 static inline int valid_io_request(struct zram *zram, struct bio *bio)
 {
-	if (unlikely(
-		(bio->bi_sector >= (zram->disksize >> SECTOR_SHIFT)) ||
-		(bio->bi_sector & (SECTORS_PER_PAGE - 1)) ||
-		(bio->bi_size & (PAGE_SIZE - 1)))) {
+	u64 start, end, bound;
 
+	if (unlikely(bio->bi_sector & (ZRAM_SECTORS_PER_LOGICAL_BLOCK - 1)))
+		return 0;
+	if (unlikely(bio->bi_size & (ZRAM_LOGICAL_BLOCK_SIZE - 1)))
+		return 0;
+
+	start = bio->bi_sector;
+	end = start + (bio->bi_size >> SECTOR_SHIFT);
+	bound = zram->disksize >> SECTOR_SHIFT;
+	if (unlikely(start >= bound || end > bound || start > end))
 		return 0;
-	}
 
 	/* I/O request is valid */
 	return 1;
@@ -440,17 +1439,61 @@ static int zram_make_request(struct request_queue *queue, struct bio *bio)
 		return 0;
 	}
 
-	switch (bio_data_dir(bio)) {
-	case READ:
-		zram_read(zram, bio);
-		break;
+	__zram_make_request(zram, bio, bio_data_dir(bio));
 
-	case WRITE:
-		zram_write(zram, bio);
-		break;
+	return 0;
+}
+
+static void zram_destroy_streams(struct zram *zram)
+{
+	struct zram_stream *strm, *tmp;
+
+	list_for_each_entry_safe(strm, tmp, &zram->idle_strm, list) {
+		list_del(&strm->list);
+		kfree(strm->workmem);
+		free_pages((unsigned long)strm->buffer,
+			get_order(ZRAM_STRM_BUF_SIZE));
+		kfree(strm);
+	}
+}
+
+static int zram_create_streams(struct zram *zram)
+{
+	unsigned int i;
+	struct zram_stream *strm;
+
+	if (!zram->max_strm)
+		zram->max_strm = num_possible_cpus();
+
+	for (i = 0; i < zram->max_strm; i++) {
+		strm = kzalloc(sizeof(*strm), GFP_KERNEL);
+		if (!strm)
+			goto fail;
+
+		/* Add it first so that a partial stream is freed on error */
+		list_add(&strm->list, &zram->idle_strm);
+
+		strm->workmem = kzalloc(zram->comp.backend->workmem_size,
+					GFP_KERNEL);
+		if (!strm->workmem && zram->comp.backend->workmem_size) {
+			pr_err("Error allocating compressor working "
+				"memory!\n");
+			goto fail;
+		}
+
+		strm->buffer = (void *)__get_free_pages(GFP_KERNEL |
+				__GFP_ZERO, get_order(ZRAM_STRM_BUF_SIZE));
+		if (!strm->buffer) {
+			pr_err("Error allocating compressor buffer space\n");
+			goto fail;
+		}
 	}
 
 	return 0;
+
+fail:
+	zram_destroy_streams(zram);
+	return -ENOMEM;
 }
 
 void zram_reset_device(struct zram *zram)
@@ -461,34 +1504,33 @@ void zram_reset_device(struct zram *zram)
 	zram->init_done = 0;
 
 	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
-
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
-
-	/* Free all pages that are still in this zram device */
-	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
+	zram_destroy_streams(zram);
 
-		page = zram->table[index].page;
-		offset = zram->table[index].offset;
-
-		if (!page)
+	/*
+	 * Free all pages that are still in this zram device. This goes
+	 * through zram_free_page() so that shared objects are dropped
+	 * only once their last reference is gone.
+	 */
+	for (index = 0; zram->table &&
+			index < zram->disksize >> PAGE_SHIFT; index++) {
+		if (!zram->table[index].handle)
 			continue;
 
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			__free_page(page);
-		else
-			xv_free(zram->mem_pool, page, offset);
+		zram_free_page(zram, index);
 	}
 
 	vfree(zram->table);
 	zram->table = NULL;
+	vfree(zram->write_locks);
+	zram->write_locks = NULL;
 
-	xv_destroy_pool(zram->mem_pool);
+	zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
+	zram->dedup_root = RB_ROOT;
+	zram->dedup_handles = RB_ROOT;
+
+	zram_comp_destroy(&zram->comp);
+	zram_reset_bdev(zram);
 
 	/* Reset stats */
 	memset(&zram->stats, 0, sizeof(zram->stats));
@@ -511,19 +1553,13 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
+	ret = zram_comp_create(&zram->comp, zram->compressor);
+	if (ret)
 		goto fail;
-	}
 
-	zram->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
+	ret = zram_create_streams(zram);
+	if (ret)
 		goto fail;
-	}
 
 	num_pages = zram->disksize >> PAGE_SHIFT;
 	zram->table = vzalloc(num_pages * sizeof(*zram->table));
@@ -535,12 +1571,19 @@ int zram_init_device(struct zram *zram)
 		goto fail;
 	}
 
+	zram->write_locks = vzalloc(BITS_TO_LONGS(num_pages) * sizeof(long));
+	if (!zram->write_locks) {
+		pr_err("Error allocating zram write locks\n");
+		ret = -ENOMEM;
+		goto fail;
+	}
+
 	set_capacity(zram->disk, zram->disksize >> SECTOR_SHIFT);
 
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = xv_create_pool();
+	zram->mem_pool = zs_create_pool(zram->disk->disk_name);
 	if (!zram->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
@@ -566,7 +1609,9 @@ void zram_slot_free_notify(struct block_device *bdev, unsigned long index)
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
+	write_lock(&zram->table_lock);
 	zram_free_page(zram, index);
+	write_unlock(&zram->table_lock);
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -579,9 +1624,21 @@ static int create_device(struct zram *zram, int device_id)
 {
 	int ret = 0;
 
-	mutex_init(&zram->lock);
 	mutex_init(&zram->init_lock);
 	spin_lock_init(&zram->stat64_lock);
+	rwlock_init(&zram->table_lock);
+	spin_lock_init(&zram->strm_lock);
+	INIT_LIST_HEAD(&zram->idle_strm);
+	init_waitqueue_head(&zram->strm_wait);
+	spin_lock_init(&zram->dedup_lock);
+	zram->dedup_root = RB_ROOT;
+	zram->dedup_handles = RB_ROOT;
+	zram->use_dedup = 1;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	spin_lock_init(&zram->bd_read_lock);
+	INIT_LIST_HEAD(&zram->bd_reads);
+#endif
+	strlcpy(zram->compressor, ZRAM_COMP_DEFAULT, sizeof(zram->compressor));
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
@@ -615,8 +1672,9 @@ static int create_device(struct zram *zram, int device_id)
 	set_capacity(zram->disk, 0);
 
 	/*
-	 * To ensure that we always get PAGE_SIZE aligned
-	 * and n*PAGE_SIZED sized I/O requests.
+	 * Any sector aligned I/O is accepted, so that filesystems with
+	 * small blocks can live on zram, but sub-page requests need a
+	 * read-modify-write: ask for PAGE_SIZE aligned and sized I/O.
 	 */
 	blk_queue_physical_block_size(zram->disk->queue, PAGE_SIZE);
 	blk_queue_logical_block_size(zram->disk->queue,
@@ -17,8 +17,12 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/list.h>
+#include <linux/rbtree.h>
+#include <linux/wait.h>
 
-#include "xvmalloc.h"
+#include "zsmalloc.h"
+#include "zram_comp.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -51,8 +55,8 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /*
  * NOTE: max_zpage_size must be less than or equal to:
- *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ *   PAGE_SIZE - sizeof(struct zobj_header)
+ * otherwise, zs_malloc() would always return failure.
  */
 
 /*-- End of configurable params */
@@ -61,7 +65,19 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 #define SECTOR_SIZE		(1 << SECTOR_SHIFT)
 #define SECTORS_PER_PAGE_SHIFT	(PAGE_SHIFT - SECTOR_SHIFT)
 #define SECTORS_PER_PAGE	(1 << SECTORS_PER_PAGE_SHIFT)
-#define ZRAM_LOGICAL_BLOCK_SIZE	4096
+#define ZRAM_LOGICAL_BLOCK_SIZE	SECTOR_SIZE
+#define ZRAM_SECTORS_PER_LOGICAL_BLOCK	\
+	(ZRAM_LOGICAL_BLOCK_SIZE >> SECTOR_SHIFT)
+
+/*
+ * Compression output buffer of each stream. Larger than a page since
+ * incompressible input can expand before we fall back to storing it
+ * uncompressed.
+ */
+#define ZRAM_STRM_BUF_SIZE	(2 * PAGE_SIZE)
+
+/* Max. no. of stored pages sampled by the comp_bench sysfs node */
+#define ZRAM_BENCH_MAX_PAGES	1024
 
 /* Flags for zram pages (table[page_no].flags) */
 enum zram_pageflags {
@@ -71,6 +87,15 @@ enum zram_pageflags {
 	/* Page consists entirely of zeros */
 	ZRAM_ZERO,
 
+	/* Page is stored on the backing device, handle is the block */
+	ZRAM_WB,
+
+	/* Page is being written to the backing device */
+	ZRAM_UNDER_WB,
+
+	/* Page has not been accessed since it was last marked idle */
+	ZRAM_IDLE,
+
 	__NR_ZRAM_PAGEFLAGS,
 };
 
@@ -78,8 +103,8 @@ enum zram_pageflags {
 
 /* Allocated for each disk page */
 struct table {
-	struct page *page;
-	u16 offset;
+	unsigned long handle;	/* or backing device block, if ZRAM_WB */
+	u16 size;	/* object size, if compressed */
 	u8 count;	/* object ref count (not yet used) */
 	u8 flags;
 } __attribute__((aligned(4)));
@@ -90,27 +115,83 @@ struct zram_stats {
 	u64 num_writes;		/* --do-- */
 	u64 failed_reads;	/* should NEVER! happen */
 	u64 failed_writes;	/* can happen when memory is too low */
-	u64 invalid_io;		/* non-page-aligned I/O requests */
+	u64 invalid_io;		/* unaligned or out of range I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
+	u64 strm_waits;		/* no. of writes that waited for a stream */
+	u64 dedup_hits;		/* no. of writes that shared an object */
+	u64 wb_reads;		/* no. of pages read from backing device */
+	u64 wb_writes;		/* no. of pages written to backing device */
 	u32 pages_zero;		/* no. of zero filled pages */
 	u32 pages_stored;	/* no. of pages currently stored */
+	u32 pages_dedup;	/* no. of pages sharing another's object */
+	u32 pages_wb;		/* no. of pages on backing device */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
 	u32 pages_expand;	/* % of incompressible pages */
 };
 
+/*
+ * Compression stream: working memory and output buffer used by
+ * one writer at a time. Each device owns max_strm of these so that
+ * concurrent writes can compress in parallel.
+ */
+struct zram_stream {
+	void *workmem;
+	void *buffer;
+	struct list_head list;
+};
+
+/*
+ * Index entry for one stored object (compressed or not) that may be
+ * shared by several table entries with identical page contents.
+ */
+struct zram_dedup_entry {
+	struct rb_node node;		/* in dedup_root, by checksum */
+	struct rb_node handle_node;	/* in dedup_handles, by handle */
+	unsigned long handle;
+	u32 checksum;
+	u32 refcount;	/* table entries using the object */
+	u32 pins;	/* lookups comparing against it */
+	u32 clen;	/* stored size, PAGE_SIZE if uncompressed */
+};
+
 struct zram {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zs_pool *mem_pool;
 	struct table *table;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;	/* protect compression buffers against
-				 * concurrent writes */
+	rwlock_t table_lock;	/* protect table entries and the
+				 * 32-bit stats updated with them */
+	/* Idle compression streams */
+	struct list_head idle_strm;
+	spinlock_t strm_lock;	/* protect idle_strm */
+	wait_queue_head_t strm_wait;
+	/* Compressor and the name it was selected by */
+	struct zram_comp comp;
+	char compressor[ZRAM_COMP_NAME_LEN];
+	/* Number of compression streams created at init time */
+	unsigned int max_strm;
+	/* Objects indexed by page checksum, for deduplication */
+	struct rb_root dedup_root;
+	/* The same objects indexed by handle, for dropping references */
+	struct rb_root dedup_handles;
+	spinlock_t dedup_lock;	/* protect both trees, refcounts and pins */
+	int use_dedup;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	/* Backing device and bitmap of its PAGE_SIZE blocks in use */
+	struct file *backing_dev;
+	struct block_device *bdev;
+	unsigned long *bitmap;
+	unsigned long nr_blocks;
+	/* Backing device reads in flight, pinning their blocks */
+	struct list_head bd_reads;
+	spinlock_t bd_read_lock;	/* protect bd_reads */
+#endif
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
 	/* Prevent concurrent execution of device init and reset */
 	struct mutex init_lock;
+	/* One bit per page, held across a write to it */
+	unsigned long *write_locks;
 	/*
 	 * This is the limit on amount of *uncompressed* worth of data
 	 * we can store in a disk.
@@ -128,5 +209,11 @@ extern struct attribute_group zram_disk_attr_group;
 
 extern int zram_init_device(struct zram *zram);
 extern void zram_reset_device(struct zram *zram);
+extern ssize_t zram_comp_bench(struct zram *zram, char *buf);
+#ifdef CONFIG_ZRAM_WRITEBACK
+extern int zram_set_backing_dev(struct zram *zram, const char *name);
+extern void zram_mark_idle(struct zram *zram);
+extern int zram_writeback(struct zram *zram, enum zram_pageflags flag);
+#endif
 
 #endif
@@ -0,0 +1,816 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+/*
+ * Objects are grouped by size into size classes. Each class carves
+ * its objects out of "zspages": groups of 1 to ZS_MAX_PAGES_PER_ZSPAGE
+ * order-0 (possibly highmem) pages, with the group size chosen so that
+ * little space is left over at the end. Objects may straddle a page
+ * boundary inside a zspage; such objects are accessed through a
+ * per-cpu bounce buffer.
+ *
+ * Callers get an opaque handle, not a <page, offset> pair, so objects
+ * can be moved between zspages behind their back. zs_compact() uses
+ * this to empty sparsely used zspages into denser ones of the same
+ * class and give the pages back to the system.
+ *
+ * Locking:
+ *  - class->lock protects the class lists, zspage slot arrays and the
+ *    location stored in each handle.
+ *  - Each handle has a pin bit, held while the object is mapped or
+ *    being moved. zs_free() takes the pin then class->lock; compaction
+ *    takes class->lock and only try-locks pins, skipping busy objects.
+ *
+ * zs_map_object() maps objects through KM_USER1 and zs_compact() copies
+ * them through KM_USER0 and KM_USER1; zs_malloc() and zs_free() do not
+ * kmap. Callers may hold a KM_USER0 mapping across zs_map_object(), but
+ * must not hold atomic kmaps in either slot across zs_compact().
+ */
+
+#ifdef CONFIG_ZRAM_DEBUG
+#define DEBUG
+#endif
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bit_spinlock.h>
+#include <linux/bitops.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+
+#include "zsmalloc.h"
+
+#define ZS_MIN_ALLOC_SIZE	32
+#define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
+
+/* Distance between consecutive size classes */
+#define ZS_SIZE_CLASS_DELTA	(PAGE_SIZE >> 8)
+#define ZS_SIZE_CLASSES		((ZS_MAX_ALLOC_SIZE - ZS_MIN_ALLOC_SIZE) / \
+					ZS_SIZE_CLASS_DELTA + 1)
+
+#define ZS_MAX_PAGES_PER_ZSPAGE	4
+
+/* Bit in zs_handle.lock held while the object is mapped or moved */
+#define ZS_HANDLE_PIN_BIT	0
+
+/*
+ * A zspage is "almost empty" when at most this fraction (in quarters)
+ * of its objects are in use. Allocation prefers fuller zspages and
+ * compaction drains almost empty ones.
+ */
+#define ZS_ALMOST_FULL_QUARTERS	3
+
+enum fullness_group {
+	ZS_ALMOST_FULL,
+	ZS_ALMOST_EMPTY,
+	_ZS_NR_FULLNESS_GROUPS,
+
+	ZS_EMPTY,
+	ZS_FULL
+};
+
+struct zspage;
+
+/* What the opaque handle given to users points to */
+struct zs_handle {
+	unsigned long lock;
+	struct zspage *zspage;
+	unsigned int idx;
+};
+
+struct size_class {
+	spinlock_t lock;
+	struct list_head fullness_list[_ZS_NR_FULLNESS_GROUPS];
+	unsigned int size;		/* object size */
+	unsigned int pages_per_zspage;
+	unsigned int objs_per_zspage;
+
+	unsigned long zspages;		/* no. of zspages in this class */
+	unsigned long objs_inuse;
+};
+
+struct zspage {
+	struct list_head list;		/* in class->fullness_list */
+	struct size_class *class;
+	enum fullness_group fullness;
+	unsigned int inuse;
+	unsigned int free_hint;		/* no free slot below this index */
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+	struct zs_handle *handles[];	/* per object slot, NULL if free */
+};
+
+/* Per-cpu state of the (single) object currently mapped on a cpu */
+struct zs_map_area {
+	char *buf;			/* bounce buffer for straddling objs */
+	void *kaddr;			/* kmap address if not straddling */
+	enum zs_mapmode mm;
+};
+
+struct zs_pool {
+	struct size_class size_class[ZS_SIZE_CLASSES];
+	struct kmem_cache *handle_cachep;
+	struct zs_map_area __percpu *map_area;
+	struct shrinker shrinker;
+	atomic_long_t pages_allocated;
+	atomic_long_t pages_compacted;	/* freed by compaction, ever */
+	char *name;
+};
+
+static int get_size_class_index(size_t size)
+{
+	int idx = 0;
+
+	if (likely(size > ZS_MIN_ALLOC_SIZE))
+		idx = DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE,
+				ZS_SIZE_CLASS_DELTA);
+
+	return idx;
+}
+
+/*
+ * Pick the number of pages per zspage that wastes the least space
+ * for objects of the given size.
+ */
+static unsigned int get_pages_per_zspage(unsigned int size)
+{
+	unsigned int i, max_usedpc = 0, max_usedpc_order = 1;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		unsigned int zspage_size = i * PAGE_SIZE;
+		unsigned int waste = zspage_size % size;
+		unsigned int usedpc = (zspage_size - waste) * 100 / zspage_size;
+
+		if (usedpc > max_usedpc) {
+			max_usedpc = usedpc;
+			max_usedpc_order = i;
+		}
+	}
+
+	return max_usedpc_order;
+}
+
+static enum fullness_group get_fullness_group(struct size_class *class,
+					struct zspage *zspage)
+{
+	if (zspage->inuse == 0)
+		return ZS_EMPTY;
+	if (zspage->inuse == class->objs_per_zspage)
+		return ZS_FULL;
+	if (zspage->inuse * 4 <=
+			class->objs_per_zspage * ZS_ALMOST_FULL_QUARTERS)
+		return ZS_ALMOST_EMPTY;
+
+	return ZS_ALMOST_FULL;
+}
+
+static void remove_zspage(struct zspage *zspage)
+{
+	if (zspage->fullness < _ZS_NR_FULLNESS_GROUPS)
+		list_del_init(&zspage->list);
+}
+
+static void insert_zspage(struct size_class *class, struct zspage *zspage,
+			enum fullness_group fullness)
+{
+	zspage->fullness = fullness;
+	if (fullness < _ZS_NR_FULLNESS_GROUPS)
+		list_add(&zspage->list, &class->fullness_list[fullness]);
+}
+
+/*
+ * Move zspage to the list matching its current usage. Empty zspages
+ * are left off all lists; the caller frees them.
+ */
+static enum fullness_group fix_fullness_group(struct size_class *class,
+					struct zspage *zspage)
+{
+	enum fullness_group newfg = get_fullness_group(class, zspage);
+
+	if (newfg != zspage->fullness) {
+		remove_zspage(zspage);
+		insert_zspage(class, zspage, newfg);
+	}
+
+	return newfg;
+}
+
+/* Pick a zspage with a free slot, preferring fuller ones */
+static struct zspage *find_get_zspage(struct size_class *class)
+{
+	int i;
+
+	for (i = 0; i < _ZS_NR_FULLNESS_GROUPS; i++) {
+		if (!list_empty(&class->fullness_list[i]))
+			return list_first_entry(&class->fullness_list[i],
+						struct zspage, list);
+	}
+
+	return NULL;
+}
+
+static struct zspage *alloc_zspage(struct size_class *class, gfp_t flags)
+{
+	unsigned int i;
+	struct zspage *zspage;
+
+	zspage = kzalloc(sizeof(*zspage) + class->objs_per_zspage *
+			sizeof(zspage->handles[0]), flags & ~__GFP_HIGHMEM);
+	if (!zspage)
+		return NULL;
+
+	INIT_LIST_HEAD(&zspage->list);
+	zspage->class = class;
+	zspage->fullness = ZS_EMPTY;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		zspage->pages[i] = alloc_page(flags);
+		if (!zspage->pages[i])
+			goto fail;
+	}
+
+	return zspage;
+
+fail:
+	while (i--)
+		__free_page(zspage->pages[i]);
+	kfree(zspage);
+	return NULL;
+}
+
+static void free_zspage(struct zs_pool *pool, struct size_class *class,
+			struct zspage *zspage)
+{
+	unsigned int i;
+
+	BUG_ON(zspage->inuse);
+
+	for (i = 0; i < class->pages_per_zspage; i++)
+		__free_page(zspage->pages[i]);
+	kfree(zspage);
+
+	class->zspages--;
+	atomic_long_sub(class->pages_per_zspage, &pool->pages_allocated);
+}
+
+/* Take a free slot in zspage for handle. Called with class->lock held */
+static void obj_alloc(struct size_class *class, struct zspage *zspage,
+			struct zs_handle *handle)
+{
+	unsigned int idx;
+
+	for (idx = zspage->free_hint; zspage->handles[idx]; idx++)
+		;
+
+	zspage->handles[idx] = handle;
+	zspage->free_hint = idx + 1;
+	zspage->inuse++;
+	class->objs_inuse++;
+
+	handle->zspage = zspage;
+	handle->idx = idx;
+}
+
+/* Release the slot of handle. Called with class->lock held */
+static void obj_free(struct size_class *class, struct zs_handle *handle)
+{
+	struct zspage *zspage = handle->zspage;
+
+	zspage->handles[handle->idx] = NULL;
+	if (handle->idx < zspage->free_hint)
+		zspage->free_hint = handle->idx;
+	zspage->inuse--;
+	class->objs_inuse--;
+}
+
+static void obj_location(struct size_class *class, struct zspage *zspage,
+			unsigned int idx, struct page **page,
+			unsigned long *offset)
+{
+	unsigned long off = (unsigned long)idx * class->size;
+
+	*page = zspage->pages[off >> PAGE_SHIFT];
+	*offset = off & ~PAGE_MASK;
+}
+
+/*
+ * Copy one object between slots, page by page since either of them
+ * may straddle a page boundary.
+ */
+static void obj_copy(struct size_class *class,
+			struct zspage *d_zspage, unsigned int d_idx,
+			struct zspage *s_zspage, unsigned int s_idx)
+{
+	unsigned long s_off = (unsigned long)s_idx * class->size;
+	unsigned long d_off = (unsigned long)d_idx * class->size;
+	unsigned int written = 0;
+
+	while (written < class->size) {
+		unsigned long s_poff = s_off & ~PAGE_MASK;
+		unsigned long d_poff = d_off & ~PAGE_MASK;
+		unsigned int len = class->size - written;
+		void *s_addr, *d_addr;
+
+		len = min_t(unsigned int, len, PAGE_SIZE - s_poff);
+		len = min_t(unsigned int, len, PAGE_SIZE - d_poff);
+
+		s_addr = kmap_atomic(s_zspage->pages[s_off >> PAGE_SHIFT],
+					KM_USER0);
+		d_addr = kmap_atomic(d_zspage->pages[d_off >> PAGE_SHIFT],
+					KM_USER1);
+		memcpy(d_addr + d_poff, s_addr + s_poff, len);
+		kunmap_atomic(d_addr, KM_USER1);
+		kunmap_atomic(s_addr, KM_USER0);
+
+		s_off += len;
+		d_off += len;
+		written += len;
+	}
+}
+
+/**
+ * zs_malloc - Allocate block of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of block to allocate
+ * @flags: page allocation flags, used when the pool has to grow
+ *
+ * Returns a handle to the new object, or 0 on failure. The object
+ * must be mapped with zs_map_object() before it can be accessed.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size, gfp_t flags)
+{
+	struct zs_handle *handle;
+	struct size_class *class;
+	struct zspage *zspage;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
+		return 0;
+
+	handle = kmem_cache_zalloc(pool->handle_cachep,
+				flags & ~__GFP_HIGHMEM);
+	if (!handle)
+		return 0;
+
+	class = &pool->size_class[get_size_class_index(size)];
+
+	spin_lock(&class->lock);
+	zspage = find_get_zspage(class);
+	if (!zspage) {
+		/* Grow the class; page allocation may sleep */
+		spin_unlock(&class->lock);
+		zspage = alloc_zspage(class, flags);
+		if (!zspage) {
+			kmem_cache_free(pool->handle_cachep, handle);
+			return 0;
+		}
+		atomic_long_add(class->pages_per_zspage,
+				&pool->pages_allocated);
+
+		spin_lock(&class->lock);
+		class->zspages++;
+	}
+
+	obj_alloc(class, zspage, handle);
+	fix_fullness_group(class, zspage);
+	spin_unlock(&class->lock);
+
+	return (unsigned long)handle;
+}
+EXPORT_SYMBOL_GPL(zs_malloc);
+
+/**
+ * zs_free - Free the object behind handle.
+ * @pool: pool the object was allocated from
+ * @handle: handle returned by zs_malloc()
+ */
+void zs_free(struct zs_pool *pool, unsigned long handle)
+{
+	struct zs_handle *h = (struct zs_handle *)handle;
+	struct size_class *class;
+	struct zspage *zspage;
+
+	if (unlikely(!h))
+		return;
+
+	/*
+	 * Wait for a concurrent compaction move of this object; the
+	 * location only changes while the pin is held.
+	 */
+	bit_spin_lock(ZS_HANDLE_PIN_BIT, &h->lock);
+	zspage = h->zspage;
+	class = zspage->class;
+
+	spin_lock(&class->lock);
+	obj_free(class, h);
+	if (fix_fullness_group(class, zspage) == ZS_EMPTY)
+		free_zspage(pool, class, zspage);
+	spin_unlock(&class->lock);
+
+	bit_spin_unlock(ZS_HANDLE_PIN_BIT, &h->lock);
+	kmem_cache_free(pool->handle_cachep, h);
+}
+EXPORT_SYMBOL_GPL(zs_free);
+
+/**
+ * zs_map_object - Get a pointer to the object behind handle.
+ * @pool: pool the object was allocated from
+ * @handle: handle returned by zs_malloc()
+ * @mm: how the object will be accessed, see enum zs_mapmode
+ *
+ * The object cannot move until zs_unmap_object() is called. Only one
+ * object can be mapped per cpu at a time and the caller must not
+ * sleep while it is mapped.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long handle,
+			enum zs_mapmode mm)
+{
+	struct zs_handle *h = (struct zs_handle *)handle;
+	struct size_class *class;
+	struct zs_map_area *area;
+	struct page *page;
+	unsigned long off;
+	unsigned int size, first;
+	void *addr;
+
+	BUG_ON(!h);
+
+	bit_spin_lock(ZS_HANDLE_PIN_BIT, &h->lock);
+
+	class = h->zspage->class;
+	obj_location(class, h->zspage, h->idx, &page, &off);
+
+	area = get_cpu_ptr(pool->map_area);
+	area->mm = mm;
+
+	if (off + class->size <= PAGE_SIZE) {
+		area->kaddr = kmap_atomic(page, KM_USER1);
+		return area->kaddr + off;
+	}
+
+	/* Straddles two pages: bounce through the per-cpu buffer */
+	area->kaddr = NULL;
+	if (mm == ZS_MM_WO)
+		return area->buf;
+
+	size = class->size;
+	first = PAGE_SIZE - off;
+
+	addr = kmap_atomic(page, KM_USER1);
+	memcpy(area->buf, addr + off, first);
+	kunmap_atomic(addr, KM_USER1);
+
+	page = h->zspage->pages[((unsigned long)h->idx * size >> PAGE_SHIFT)
+				+ 1];
+	addr = kmap_atomic(page, KM_USER1);
+	memcpy(area->buf + first, addr, size - first);
+	kunmap_atomic(addr, KM_USER1);
+
+	return area->buf;
+}
+EXPORT_SYMBOL_GPL(zs_map_object);
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
+{
+	struct zs_handle *h = (struct zs_handle *)handle;
+	struct size_class *class;
+	struct zs_map_area *area;
+	struct page *page;
+	unsigned long off;
+	unsigned int size, first;
+	void *addr;
+
+	area = this_cpu_ptr(pool->map_area);
+
+	if (area->kaddr) {
+		kunmap_atomic(area->kaddr, KM_USER1);
+		goto out;
+	}
+
+	if (area->mm == ZS_MM_RO)
+		goto out;
+
+	class = h->zspage->class;
+	obj_location(class, h->zspage, h->idx, &page, &off);
+	size = class->size;
+	first = PAGE_SIZE - off;
+
+	addr = kmap_atomic(page, KM_USER1);
+	memcpy(addr + off, area->buf, first);
+	kunmap_atomic(addr, KM_USER1);
+
+	page = h->zspage->pages[((unsigned long)h->idx * size >> PAGE_SHIFT)
+				+ 1];
+	addr = kmap_atomic(page, KM_USER1);
+	memcpy(addr, area->buf + first, size - first);
+	kunmap_atomic(addr, KM_USER1);
+
+out:
+	put_cpu_ptr(pool->map_area);
+	bit_spin_unlock(ZS_HANDLE_PIN_BIT, &h->lock);
+}
+EXPORT_SYMBOL_GPL(zs_unmap_object);
+
+/*
+ * Number of pages that compaction could give back in this class if
+ * the objects were packed perfectly.
+ */
+static unsigned long zs_can_compact(struct size_class *class)
+{
+	unsigned long objs_free;
+
+	objs_free = class->zspages * class->objs_per_zspage -
+			class->objs_inuse;
+
+	return objs_free / class->objs_per_zspage * class->pages_per_zspage;
+}
+
+/*
+ * Pick the next zspage to drain: an almost empty one, least used
+ * first, whose objects all fit in the free slots of the rest of the
+ * class. Called with class->lock held.
+ */
+static struct zspage *isolate_source_zspage(struct size_class *class)
+{
+	unsigned long objs_free;
+	struct zspage *zspage, *src = NULL;
+
+	list_for_each_entry(zspage,
+			&class->fullness_list[ZS_ALMOST_EMPTY], list) {
+		if (!src || zspage->inuse < src->inuse)
+			src = zspage;
+	}
+
+	if (!src)
+		return NULL;
+
+	/* Free slots outside of src */
+	objs_free = (class->zspages - 1) * class->objs_per_zspage -
+			(class->objs_inuse - src->inuse);
+	if (objs_free < src->inuse)
+		return NULL;
+
+	remove_zspage(src);
+	src->fullness = ZS_EMPTY;
+	return src;
+}
+
+/*
+ * Move every object out of src. Returns 0 if src is now empty, or
+ * -EBUSY if some object was pinned (mapped or being freed).
+ */
+static int migrate_zspage(struct size_class *class, struct zspage *src)
+{
+	int ret = 0;
+	unsigned int idx;
+	struct zs_handle *h;
+	struct zspage *dst;
+
+	for (idx = 0; idx < class->objs_per_zspage && src->inuse; idx++) {
+		h = src->handles[idx];
+		if (!h)
+			continue;
+
+		if (!bit_spin_trylock(ZS_HANDLE_PIN_BIT, &h->lock)) {
+			ret = -EBUSY;
+			continue;
+		}
+
+		/* src is off the lists, so this never returns it */
+		dst = find_get_zspage(class);
+		if (!dst) {
+			bit_spin_unlock(ZS_HANDLE_PIN_BIT, &h->lock);
+			ret = -ENOSPC;
+			break;
+		}
+
+		obj_free(class, h);
+		obj_alloc(class, dst, h);
+		obj_copy(class, dst, h->idx, src, idx);
+		fix_fullness_group(class, dst);
+
+		bit_spin_unlock(ZS_HANDLE_PIN_BIT, &h->lock);
+	}
+
+	return src->inuse ? (ret ? ret : -EBUSY) : 0;
+}
+
+static unsigned long zs_compact_class(struct zs_pool *pool,
+				struct size_class *class)
+{
+	unsigned long freed = 0;
+	struct zspage *src;
+
+	spin_lock(&class->lock);
+	while ((src = isolate_source_zspage(class))) {
+		if (migrate_zspage(class, src)) {
+			/* Put it back; retrying now would not help */
+			insert_zspage(class, src,
+				get_fullness_group(class, src));
+			break;
+		}
+
+		free_zspage(pool, class, src);
+		freed += class->pages_per_zspage;
+
+		if (need_resched()) {
+			spin_unlock(&class->lock);
+			cond_resched();
+			spin_lock(&class->lock);
+		}
+	}
+	spin_unlock(&class->lock);
+
+	return freed;
+}
+
+/**
+ * zs_compact - Pack objects into fewer zspages.
+ * @pool: pool to compact
+ *
+ * Returns the number of pages given back to the system.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	int i;
+	unsigned long freed = 0;
+
+	for (i = ZS_SIZE_CLASSES - 1; i >= 0; i--) {
+		struct size_class *class = &pool->size_class[i];
+
+		/* One object per zspage: nothing to pack */
+		if (class->objs_per_zspage == 1)
+			continue;
+
+		freed += zs_compact_class(pool, class);
+	}
+
+	atomic_long_add(freed, &pool->pages_compacted);
+	return freed;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+static int zs_shrinker_scan(struct shrinker *shrinker,
+			struct shrink_control *sc)
+{
+	int i;
+	unsigned long freeable = 0;
+	struct zs_pool *pool = container_of(shrinker, struct zs_pool,
+					shrinker);
+
+	if (sc->nr_to_scan)
+		zs_compact(pool);
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		if (class->objs_per_zspage == 1)
+			continue;
+
+		spin_lock(&class->lock);
+		freeable += zs_can_compact(class);
+		spin_unlock(&class->lock);
+	}
+
+	return min_t(unsigned long, freeable, INT_MAX);
+}
+
+/**
+ * zs_create_pool - Creates an allocation pool to work from.
+ * @name: name of the pool, used for the handle slab cache
+ *
+ * The pool registers a shrinker that compacts it under memory
+ * pressure. Returns NULL on failure.
+ */
+struct zs_pool *zs_create_pool(const char *name)
+{
+	int i, cpu;
+	struct zs_pool *pool;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		int fg;
+		struct size_class *class = &pool->size_class[i];
+
+		spin_lock_init(&class->lock);
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++)
+			INIT_LIST_HEAD(&class->fullness_list[fg]);
+
+		class->size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		class->pages_per_zspage = get_pages_per_zspage(class->size);
+		class->objs_per_zspage = class->pages_per_zspage *
+					PAGE_SIZE / class->size;
+	}
+
+	pool->name = kasprintf(GFP_KERNEL, "zs_handle_%s", name);
+	if (!pool->name)
+		goto fail;
+
+	pool->handle_cachep = kmem_cache_create(pool->name,
+				sizeof(struct zs_handle), 0, 0, NULL);
+	if (!pool->handle_cachep)
+		goto fail;
+
+	pool->map_area = alloc_percpu(struct zs_map_area);
+	if (!pool->map_area)
+		goto fail;
+
+	for_each_possible_cpu(cpu) {
+		struct zs_map_area *area = per_cpu_ptr(pool->map_area, cpu);
+
+		area->buf = kmalloc(ZS_MAX_ALLOC_SIZE, GFP_KERNEL);
+		if (!area->buf)
+			goto fail;
+	}
+
+	pool->shrinker.shrink = zs_shrinker_scan;
+	pool->shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&pool->shrinker);
+
+	return pool;
+
+fail:
+	zs_destroy_pool(pool);
+	return NULL;
+}
+EXPORT_SYMBOL_GPL(zs_create_pool);
+
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	int i, cpu;
+
+	if (!pool)
+		return;
+
+	if (pool->shrinker.shrink)
+		unregister_shrinker(&pool->shrinker);
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		int fg;
+		struct size_class *class = &pool->size_class[i];
+
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++) {
+			if (!list_empty(&class->fullness_list[fg]))
+				pr_info("Freeing non-empty class: %d\n", i);
+		}
+	}
+
+	if (pool->map_area) {
+		for_each_possible_cpu(cpu)
+			kfree(per_cpu_ptr(pool->map_area, cpu)->buf);
+		free_percpu(pool->map_area);
+	}
+
+	if (pool->handle_cachep)
+		kmem_cache_destroy(pool->handle_cachep);
+	kfree(pool->name);
+	kfree(pool);
+}
+EXPORT_SYMBOL_GPL(zs_destroy_pool);
+
+/* Memory taken from the system, including metadata-free slack */
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_long_read(&pool->pages_allocated) << PAGE_SHIFT;
+}
+EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
+
+/* Memory occupied by live objects (rounded up to their class size) */
+u64 zs_get_used_size_bytes(struct zs_pool *pool)
+{
+	int i;
+	u64 used = 0;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		used += (u64)class->objs_inuse * class->size;
+	}
+
+	return used;
+}
+EXPORT_SYMBOL_GPL(zs_get_used_size_bytes);
+
+unsigned long zs_get_compacted_pages(struct zs_pool *pool)
+{
+	return atomic_long_read(&pool->pages_compacted);
+}
+EXPORT_SYMBOL_GPL(zs_get_compacted_pages);
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("zsmalloc memory allocator");
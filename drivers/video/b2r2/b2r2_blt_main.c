@@ -48,6 +48,7 @@
 #include "b2r2_input_validation.h"
 #include "b2r2_core.h"
 #include "b2r2_filters.h"
+#include "b2r2_cpu_blt.h"
 
 #define B2R2_HEAP_SIZE (4 * PAGE_SIZE)
 #define MAX_TMP_BUF_SIZE (128 * PAGE_SIZE)
@@ -72,6 +73,10 @@ static void job_callback(struct b2r2_core_job *job);
 static void job_release(struct b2r2_core_job *job);
 static int job_acquire_resources(struct b2r2_core_job *job, bool atomic);
 static void job_release_resources(struct b2r2_core_job *job, bool atomic);
+#ifdef CONFIG_B2R2_CPU_BLT
+static bool is_cpu_job(struct b2r2_blt_request *request);
+static int job_execute_cpu(struct b2r2_core_job *job);
+#endif
 #endif
 
 #ifdef CONFIG_B2R2_GENERIC
@@ -625,6 +630,10 @@ int b2r2_control_blt(struct b2r2_blt_request *request)
 	request->job.release = job_release;
 	request->job.acquire_resources = job_acquire_resources;
 	request->job.release_resources = job_release_resources;
+#ifdef CONFIG_B2R2_CPU_BLT
+	if (is_cpu_job(request))
+		request->job.execute_cpu = job_execute_cpu;
+#endif
 
 	/* Synchronize memory occupied by the buffers */
 
@@ -989,6 +998,7 @@ static int job_acquire_resources(struct b2r2_core_job *job, bool atomic)
 		if (ret < 0)
 			goto error;
 	}
+	request->bufs_acquired = true;
 
 	return 0;
 
@@ -1018,15 +1028,21 @@ static void job_release_resources(struct b2r2_core_job *job, bool atomic)
 
 	b2r2_log_info(cont->dev, "%s\n", __func__);
 
-	/* Free any temporary buffers */
+	/*
+	 * Free any temporary buffers. A job that was cancelled in the
+	 * queue or performed on the CPU never got them, and must not take
+	 * them away from the job that has.
+	 */
 	for (i = 0; i < request->buf_count; i++) {
 
 		b2r2_log_info(cont->dev, "%s: freeing %d bytes\n",
 				__func__, request->bufs[i].size);
-		cont->tmp_bufs[i].in_use = false;
+		if (request->bufs_acquired)
+			cont->tmp_bufs[i].in_use = false;
 		memset(&request->bufs[i], 0, sizeof(request->bufs[i]));
 	}
 	request->buf_count = 0;
+	request->bufs_acquired = false;
 
 	/*
 	 * Early release of nodes
@@ -1044,6 +1060,140 @@ static void job_release_resources(struct b2r2_core_job *job, bool atomic)
 	}
 }
 
+#ifdef CONFIG_B2R2_CPU_BLT
+/**
+ * cpu_addr() - Returns the kernel address of the first byte of an image
+ *
+ * @img: The image
+ * @resolved: The resolved image buffer
+ *
+ * Returns NULL if the image is not mapped into the kernel
+ */
+static void *cpu_addr(struct b2r2_blt_img *img,
+		struct b2r2_resolved_buf *resolved)
+{
+	/* The hwmem mapping is of the whole allocation */
+	if (resolved->hwmem_alloc != NULL)
+		return resolved->virtual_address ?
+			resolved->virtual_address + img->buf.offset : NULL;
+
+	return resolved->virtual_address;
+}
+
+/**
+ * is_cpu_job() - Checks whether a request can be performed on the CPU
+ *
+ * @request: The request, with its buffers resolved
+ */
+static bool is_cpu_job(struct b2r2_blt_request *request)
+{
+	struct b2r2_blt_req *req = &request->user_req;
+	struct b2r2_control *cont = request->instance->control;
+
+	if (cpu_addr(&req->dst_img, &request->dst_resolved) == NULL)
+		return false;
+
+	if (!(req->flags & (B2R2_BLT_FLAG_SOURCE_FILL |
+				B2R2_BLT_FLAG_SOURCE_FILL_RAW)) &&
+			cpu_addr(&req->src_img, &request->src_resolved) == NULL)
+		return false;
+
+	if ((req->flags & B2R2_BLT_FLAG_BG_BLEND) &&
+			cpu_addr(&req->bg_img, &request->bg_resolved) == NULL)
+		return false;
+
+	return b2r2_cpu_blt_supported(cont, request);
+}
+
+/**
+ * set_cpu_domain() - Moves a hwmem image buffer to or from the CPU domain
+ *
+ * @img: The image
+ * @resolved: The resolved image buffer
+ * @rect: The part of the image that is accessed
+ * @access: Access of the new domain
+ * @domain: The new domain
+ */
+static void set_cpu_domain(struct b2r2_control *cont,
+		struct b2r2_blt_img *img, struct b2r2_resolved_buf *resolved,
+		struct b2r2_blt_rect *rect, enum hwmem_access access,
+		enum hwmem_domain domain)
+{
+	struct hwmem_region region;
+
+	if (resolved->hwmem_alloc == NULL)
+		return;
+
+	set_up_hwmem_region(cont, img, rect, &region);
+	if (hwmem_set_domain(resolved->hwmem_alloc, access, domain,
+			&region) < 0)
+		b2r2_log_warn(cont->dev, "%s: hwmem_set_domain failed\n",
+			__func__);
+}
+
+/**
+ * job_execute_cpu() - Performs the job on the CPU
+ *
+ * @job: The job
+ *
+ * Called from the core instead of dispatching the job to B2R2. Returns 0
+ * if OK, else a negative error code and the job is left for B2R2.
+ */
+static int job_execute_cpu(struct b2r2_core_job *job)
+{
+	struct b2r2_blt_request *request =
+		container_of(job, struct b2r2_blt_request, job);
+	struct b2r2_core *core = (struct b2r2_core *) job->data;
+	struct b2r2_control *cont = core->control;
+	struct b2r2_blt_req *req = &request->user_req;
+	struct b2r2_blt_rect dst_rect;
+	bool fill = req->flags & (B2R2_BLT_FLAG_SOURCE_FILL |
+			B2R2_BLT_FLAG_SOURCE_FILL_RAW);
+	bool bg_blend = req->flags & B2R2_BLT_FLAG_BG_BLEND;
+	int ret;
+
+	b2r2_log_info(cont->dev, "%s\n", __func__);
+
+	get_actual_dst_rect(req, &dst_rect);
+
+	if (!fill)
+		set_cpu_domain(cont, &req->src_img, &request->src_resolved,
+			&req->src_rect, HWMEM_ACCESS_READ, HWMEM_DOMAIN_CPU);
+	if (bg_blend)
+		set_cpu_domain(cont, &req->bg_img, &request->bg_resolved,
+			&req->bg_rect, HWMEM_ACCESS_READ, HWMEM_DOMAIN_CPU);
+	set_cpu_domain(cont, &req->dst_img, &request->dst_resolved, &dst_rect,
+		HWMEM_ACCESS_READ | HWMEM_ACCESS_WRITE, HWMEM_DOMAIN_CPU);
+
+	ret = b2r2_cpu_blt(cont, request,
+		fill ? NULL : cpu_addr(&req->src_img, &request->src_resolved),
+		bg_blend ? cpu_addr(&req->bg_img, &request->bg_resolved) : NULL,
+		cpu_addr(&req->dst_img, &request->dst_resolved));
+
+	/* Hand the buffers back to B2R2 and whoever reads the result */
+	if (!fill)
+		set_cpu_domain(cont, &req->src_img, &request->src_resolved,
+			&req->src_rect, HWMEM_ACCESS_READ, HWMEM_DOMAIN_SYNC);
+	if (bg_blend)
+		set_cpu_domain(cont, &req->bg_img, &request->bg_resolved,
+			&req->bg_rect, HWMEM_ACCESS_READ, HWMEM_DOMAIN_SYNC);
+	set_cpu_domain(cont, &req->dst_img, &request->dst_resolved, &dst_rect,
+		HWMEM_ACCESS_READ | HWMEM_ACCESS_WRITE, HWMEM_DOMAIN_SYNC);
+
+	if (ret < 0) {
+		b2r2_log_info(cont->dev, "%s: b2r2_cpu_blt failed (%d)\n",
+			__func__, ret);
+		return ret;
+	}
+
+	if (!(req->flags & B2R2_BLT_FLAG_DST_NO_CACHE_FLUSH))
+		sync_buf(cont, &req->dst_img, &request->dst_resolved, true,
+			&req->dst_rect);
+
+	return 0;
+}
+#endif /* CONFIG_B2R2_CPU_BLT */
+
 #endif /* !CONFIG_B2R2_GENERIC_ONLY */
 
 #ifdef CONFIG_B2R2_GENERIC
@@ -3057,6 +3207,9 @@ int b2r2_control_init(struct b2r2_control *cont)
 		debugfs_create_file("bypass", 0664,
 			cont->debugfs_root_dir,
 			cont, &debugfs_b2r2_bypass_fops);
+#ifdef CONFIG_B2R2_CPU_BLT
+		b2r2_cpu_blt_check_init(cont);
+#endif
 	}
 #endif
 
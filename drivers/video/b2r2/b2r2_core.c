@@ -137,6 +137,7 @@ static void trigger_job(struct b2r2_core *core, struct b2r2_core_job *job);
 static void exit_job_list(struct b2r2_core *core,
 		struct list_head *job_list);
 static void job_work_function(struct work_struct *ptr);
+static void cpu_work_function(struct work_struct *ptr);
 static void init_job(struct b2r2_core_job *job);
 static void insert_into_prio_list(struct b2r2_core *core,
 		struct b2r2_core_job *job);
@@ -148,6 +149,9 @@ static struct b2r2_core_job *find_tag_in_list(struct b2r2_core *core,
 		int tag, struct list_head *list);
 static struct b2r2_core_job *find_tag_in_active_jobs(struct b2r2_core *core,
 		int tag);
+static bool is_tag_on_cpu(struct b2r2_core *core, int tag);
+static bool is_tag_on_hw(struct b2r2_core *core, int tag);
+static bool is_job_for_cpu(struct b2r2_core *core, struct b2r2_core_job *job);
 
 static int domain_enable(struct b2r2_core *core);
 static void domain_disable(struct b2r2_core *core);
@@ -394,6 +398,23 @@ int b2r2_core_job_add(struct b2r2_control *control,
 	/* Initial reference, should be released by caller of this function */
 	job->ref_count = 1;
 
+	if (is_job_for_cpu(core, job)) {
+		/*
+		 * Ref count is increased when job put on the CPU queue,
+		 * released when the CPU is done with it
+		 */
+		internal_job_addref(core, job, __func__);
+		list_add_tail(&job->list, &core->cpu_queue);
+		job->on_cpu = true;
+		core->n_cpu_jobs++;
+		core->stat_n_jobs_on_cpu++;
+		job->job_state = B2R2_CORE_JOB_QUEUED;
+		queue_work(core->cpu_work_queue, &job->cpu_work);
+		spin_unlock_irqrestore(&core->lock, flags);
+
+		return job->job_id;
+	}
+
 	/* Insert job into prio list */
 	insert_into_prio_list(core, job);
 
@@ -424,6 +445,9 @@ struct b2r2_core_job *b2r2_core_job_find(struct b2r2_control *control,
 	if (!job)
 		job = find_job_in_active_jobs(core, job_id);
 
+	if (!job)
+		job = find_job_in_list(job_id, &core->cpu_queue);
+
 	spin_unlock_irqrestore(&core->lock, flags);
 
 	return job;
@@ -449,6 +473,9 @@ struct b2r2_core_job *b2r2_core_job_find_first_with_tag(
 	if (!job)
 		job = find_tag_in_active_jobs(core, tag);
 
+	if (!job)
+		job = find_tag_in_list(core, tag, &core->cpu_queue);
+
 	spin_unlock_irqrestore(&core->lock, flags);
 
 	return job;
@@ -514,8 +541,8 @@ int b2r2_core_job_wait(struct b2r2_core_job *job)
 }
 
 /**
- * cancel_job() - Cancels a job (removes it from prio list or active jobs) and
- *                calls the job callback
+ * cancel_job() - Cancels a job (removes it from prio list, active jobs or
+ *                the CPU queue) and calls the job callback
  *
  * @job: Job to cancel
  *
@@ -528,6 +555,23 @@ static bool cancel_job(struct b2r2_core *core, struct b2r2_core_job *job)
 	bool found_job = false;
 	bool job_was_active = false;
 
+	/* Remove from the CPU queue, unless the CPU has started the job */
+	if (job->on_cpu) {
+		if (job->job_state != B2R2_CORE_JOB_QUEUED)
+			return false;
+
+		list_del_init(&job->list);
+		job->on_cpu = false;
+		core->n_cpu_jobs--;
+
+		/*
+		 * Job is canceled, cpu_work_function() dispatches the
+		 * callback when it gets to the job
+		 */
+		job->job_state = B2R2_CORE_JOB_CANCELED;
+		return true;
+	}
+
 	/* Remove from prio list */
 	if (job->job_state == B2R2_CORE_JOB_QUEUED) {
 		list_del_init(&job->list);
@@ -572,6 +616,7 @@ int b2r2_core_job_cancel(struct b2r2_core_job *job)
 {
 	unsigned long flags;
 	int ret = 0;
+	bool running_on_cpu;
 	struct b2r2_core *core = (struct b2r2_core *) job->data;
 
 	b2r2_log_info(core->dev, "%s (core: %p, job: %p) (st: %d)\n",
@@ -583,11 +628,28 @@ int b2r2_core_job_cancel(struct b2r2_core_job *job)
 		return -ENOENT;
 	}
 
-	/* Remove from prio list */
+	/* Remove from prio list or CPU queue */
 	spin_lock_irqsave(&core->lock, flags);
-	cancel_job(core, job);
+	running_on_cpu = !cancel_job(core, job) && job->on_cpu;
 	spin_unlock_irqrestore(&core->lock, flags);
 
+	if (running_on_cpu) {
+		/*
+		 * The CPU cannot be stopped. Wait for it, after which the
+		 * job is either done or back in the prio list for B2R2.
+		 */
+		flush_work(&job->cpu_work);
+
+		spin_lock_irqsave(&core->lock, flags);
+		if (!cancel_job(core, job))
+			ret = -EBUSY;
+		spin_unlock_irqrestore(&core->lock, flags);
+
+		/* Let the callback of the done job run before we return */
+		if (ret)
+			flush_work(&job->work);
+	}
+
 	return ret;
 }
 
@@ -795,6 +857,104 @@ static void job_work_function(struct work_struct *ptr)
 	b2r2_core_job_release(job, __func__);
 }
 
+/**
+ * cpu_work_function() - Work queue function that performs a job on the CPU
+ *
+ * @ptr: Pointer to work struct (embedded in struct b2r2_core_job)
+ *
+ * A job the CPU fails to perform is put in the prio list, to be
+ * performed by the hardware instead, followed by the jobs of the same
+ * client still waiting for the CPU so that they keep their order.
+ */
+static void cpu_work_function(struct work_struct *ptr)
+{
+	unsigned long flags;
+	int ret;
+	struct b2r2_core_job *job =
+			container_of(ptr, struct b2r2_core_job, cpu_work);
+	struct b2r2_core *core = (struct b2r2_core *) job->data;
+	struct b2r2_core_job *next, *tmp;
+
+	spin_lock_irqsave(&core->lock, flags);
+	if (job->requeued) {
+		/*
+		 * Moved to the hardware after an earlier job of its client
+		 * failed. Matching release to the addref in
+		 * b2r2_core_job_add, the prio list holds its own reference
+		 */
+		internal_job_release(core, job, __func__);
+		spin_unlock_irqrestore(&core->lock, flags);
+		return;
+	}
+	if (job->job_state == B2R2_CORE_JOB_CANCELED) {
+		/*
+		 * Canceled before the CPU got to it. Dispatch to work queue
+		 * to handle callbacks, which drops the reference taken in
+		 * b2r2_core_job_add
+		 */
+		queue_work(core->work_queue, &job->work);
+		spin_unlock_irqrestore(&core->lock, flags);
+		return;
+	}
+	job->job_state = B2R2_CORE_JOB_RUNNING;
+	spin_unlock_irqrestore(&core->lock, flags);
+
+	ret = job->execute_cpu(job);
+
+	spin_lock_irqsave(&core->lock, flags);
+
+	list_del_init(&job->list);
+	job->on_cpu = false;
+	core->n_cpu_jobs--;
+
+	if (ret < 0) {
+		b2r2_log_info(core->dev, "%s: CPU failed job %d (%d), "
+			"queueing it for B2R2\n", __func__, job->job_id, ret);
+		core->stat_n_jobs_cpu_failed++;
+
+		/* Not started by B2R2 yet */
+		job->job_state = B2R2_CORE_JOB_QUEUED;
+		insert_into_prio_list(core, job);
+
+		/*
+		 * Matching release to the addref in b2r2_core_job_add,
+		 * the prio list holds its own reference
+		 */
+		internal_job_release(core, job, __func__);
+
+		/*
+		 * The CPU queue runs in order, so the jobs of the client
+		 * behind this one have not been started
+		 */
+		list_for_each_entry_safe(next, tmp, &core->cpu_queue, list) {
+			if (next->tag != job->tag)
+				continue;
+			list_del_init(&next->list);
+			next->on_cpu = false;
+			next->requeued = true;
+			core->n_cpu_jobs--;
+			insert_into_prio_list(core, next);
+		}
+	} else {
+		/* Job is done */
+		job->job_state = B2R2_CORE_JOB_DONE;
+
+		/* Handle done */
+		wake_up_interruptible(&job->event);
+
+		/*
+		 * Dispatch to work queue to handle callbacks, which drops
+		 * the reference taken in b2r2_core_job_add
+		 */
+		queue_work(core->work_queue, &job->work);
+	}
+
+	/* Jobs of the same client may have been waiting for this one */
+	check_prio_list(core, false);
+
+	spin_unlock_irqrestore(&core->lock, flags);
+}
+
 #ifdef HANDLE_TIMEOUTED_JOBS
 /**
  * timeout_work_function() - Work queue function that checks for
@@ -1004,6 +1164,9 @@ static void init_job(struct b2r2_core_job *job)
 	INIT_LIST_HEAD(&job->list);
 	init_waitqueue_head(&job->event);
 	INIT_WORK(&job->work, job_work_function);
+	INIT_WORK(&job->cpu_work, cpu_work_function);
+	job->on_cpu = false;
+	job->requeued = false;
 
 	/* Map given prio to B2R2 queues */
 	if (job->prio < B2R2_CORE_LOWEST_PRIO)
@@ -1115,19 +1278,25 @@ static void check_prio_list(struct b2r2_core *core, bool atomic)
 {
 	bool dispatched_job;
 	int n_dispatched = 0;
-	struct b2r2_core_job *job;
+	struct b2r2_core_job *job, *waiting;
 
 	do {
 		dispatched_job = false;
 
-		/* Do we have anything in our prio list? */
-		if (list_empty(&core->prio_queue))
+		/*
+		 * The first job waiting, skipping those that must wait for
+		 * jobs of their client on the CPU
+		 */
+		job = NULL;
+		list_for_each_entry(waiting, &core->prio_queue, list) {
+			if (!is_tag_on_cpu(core, waiting->tag)) {
+				job = waiting;
+				break;
+			}
+		}
+		if (!job)
 			break;
 
-		/* The first job waiting */
-		job = list_first_entry(&core->prio_queue,
-				 struct b2r2_core_job, list);
-
 		/* Is the B2R2 queue available? */
 		if (core->active_jobs[job->queue] != NULL)
 			break;
@@ -1289,6 +1458,85 @@ static struct b2r2_core_job *find_tag_in_active_jobs(struct b2r2_core *core,
 	return found_job;
 }
 
+/**
+ * is_tag_on_cpu() - Checks if a job with tag is being performed on the CPU
+ *
+ * @tag: Tag to find
+ *
+ * core->lock must be held
+ */
+static bool is_tag_on_cpu(struct b2r2_core *core, int tag)
+{
+	struct b2r2_core_job *job;
+
+	if (!core->n_cpu_jobs)
+		return false;
+
+	list_for_each_entry(job, &core->cpu_queue, list)
+		if (job->tag == tag)
+			return true;
+
+	return false;
+}
+
+/**
+ * is_tag_on_hw() - Checks if a job with tag is queued or active on B2R2
+ *
+ * @tag: Tag to find
+ *
+ * core->lock must be held
+ */
+static bool is_tag_on_hw(struct b2r2_core *core, int tag)
+{
+	int i;
+	struct b2r2_core_job *job;
+
+	list_for_each_entry(job, &core->prio_queue, list)
+		if (job->tag == tag)
+			return true;
+
+	for (i = 0; i < ARRAY_SIZE(core->active_jobs); i++) {
+		job = core->active_jobs[i];
+		if (job && job->tag == tag)
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * is_job_for_cpu() - Checks if a job being added should go to the CPU
+ *
+ * @job: The job being added
+ *
+ * Jobs overflow to the CPU when the B2R2 queue of the job is busy and at
+ * least cpu_overflow jobs are waiting for the hardware, as long as the CPU
+ * has less work queued than the hardware, or always when cpu_only is
+ * set. The jobs of a client stay on the CPU or the hardware until they
+ * are done, so that they complete in the order they were added.
+ *
+ * core->lock must be held
+ */
+static bool is_job_for_cpu(struct b2r2_core *core, struct b2r2_core_job *job)
+{
+	if (!job->execute_cpu || !core->cpu_work_queue)
+		return false;
+
+	if (is_tag_on_cpu(core, job->tag))
+		return true;
+
+	if (is_tag_on_hw(core, job->tag))
+		return false;
+
+	if (core->cpu_only)
+		return true;
+
+	return core->cpu_overflow &&
+		core->stat_n_jobs_in_prio_list >= core->cpu_overflow &&
+		core->n_cpu_jobs < core->stat_n_jobs_in_prio_list &&
+		core->active_jobs[job->queue] != NULL;
+}
+
 
 #ifdef HANDLE_TIMEOUTED_JOBS
 /**
@@ -2030,6 +2278,12 @@ static int debugfs_b2r2_stat_read(struct file *filp, char __user *buf,
 		dev_size += sprintf(tmpbuf + dev_size,
 				"   Job in queue %d : 0x%08lx\n",
 				i, (unsigned long) core->active_jobs[i]);
+	dev_size += sprintf(tmpbuf + dev_size, "Jobs on CPU       : %lu\n",
+			core->n_cpu_jobs);
+	dev_size += sprintf(tmpbuf + dev_size, "Jobs sent to CPU  : %lu\n",
+			core->stat_n_jobs_on_cpu);
+	dev_size += sprintf(tmpbuf + dev_size, "CPU failed jobs   : %lu\n",
+			core->stat_n_jobs_cpu_failed);
 	dev_size += sprintf(tmpbuf + dev_size, "Clock requests    : %lu\n",
 			core->clock_request_count);
 
@@ -2402,6 +2656,7 @@ static int b2r2_probe(struct platform_device *pdev)
 
 	/* Init job queues */
 	INIT_LIST_HEAD(&core->prio_queue);
+	INIT_LIST_HEAD(&core->cpu_queue);
 
 #ifdef HANDLE_TIMEOUTED_JOBS
 	/* Create work queue for callbacks & timeout */
@@ -2415,6 +2670,16 @@ static int b2r2_probe(struct platform_device *pdev)
 		goto error_exit;
 	}
 
+#ifdef CONFIG_B2R2_CPU_BLT
+	/* Work queue for jobs performed on the CPU, one at a time in order */
+	core->cpu_work_queue = create_singlethread_workqueue("B2R2_CPU");
+	if (!core->cpu_work_queue) {
+		ret = -ENOMEM;
+		goto error_exit;
+	}
+	core->cpu_overflow = B2R2_CPU_OVERFLOW_DEFAULT;
+#endif
+
 	/* Get the clock for B2R2 */
 	core->b2r2_clock = clk_get(core->dev, pdata->clock_id);
 	if (IS_ERR(core->b2r2_clock)) {
@@ -2529,6 +2794,14 @@ static int b2r2_probe(struct platform_device *pdev)
 				&core->mg_size);
 		debugfs_create_u16("min_req_time", 0664,
 			core->debugfs_core_root_dir, &core->min_req_time);
+		if (core->cpu_work_queue) {
+			debugfs_create_u8("cpu_overflow", 0664,
+				core->debugfs_core_root_dir,
+				&core->cpu_overflow);
+			debugfs_create_bool("cpu_only", 0664,
+				core->debugfs_core_root_dir,
+				&core->cpu_only);
+		}
 	}
 #endif
 
@@ -2571,6 +2844,9 @@ error_exit:
 	if (!IS_ERR_OR_NULL(core->b2r2_clock))
 		clk_put(core->b2r2_clock);
 
+	if (!IS_ERR_OR_NULL(core->cpu_work_queue))
+		destroy_workqueue(core->cpu_work_queue);
+
 	if (!IS_ERR_OR_NULL(core->work_queue))
 		destroy_workqueue(core->work_queue);
 
@@ -2631,9 +2907,12 @@ void b2r2_core_release(struct kref *control_ref)
 		core->hw = NULL;
 	}
 
+	if (core->cpu_work_queue)
+		destroy_workqueue(core->cpu_work_queue);
 	destroy_workqueue(core->work_queue);
 
 	spin_lock_irqsave(&core->lock, flags);
+	core->cpu_work_queue = NULL;
 	core->work_queue = NULL;
 	spin_unlock_irqrestore(&core->lock, flags);
 
@@ -2677,6 +2956,10 @@ static int b2r2_remove(struct platform_device *pdev)
 	}
 #endif
 
+	/* Let the CPU finish its jobs, they are then handled as B2R2 jobs */
+	if (core->cpu_work_queue)
+		flush_workqueue(core->cpu_work_queue);
+
 	/* Flush B2R2 work queue (call all callbacks) */
 	flush_workqueue(core->work_queue);
 
@@ -2820,7 +3103,8 @@ void b2r2_core_print_stats(struct b2r2_core *core)
 		"%s: n_irq %ld, n_irq_exit %ld, n_irq_skipped %ld,\n"
 		"n_jobs_added %ld, n_active_jobs %ld, "
 		"n_jobs_in_prio_list %ld,\n"
-		"n_jobs_removed %ld\n",
+		"n_jobs_removed %ld, n_jobs_on_cpu %ld, "
+		"n_jobs_cpu_failed %ld\n",
 		__func__,
 		core->stat_n_irq,
 		core->stat_n_irq_exit,
@@ -2828,7 +3112,9 @@ void b2r2_core_print_stats(struct b2r2_core *core)
 		core->stat_n_jobs_added,
 		core->n_active_jobs,
 		core->stat_n_jobs_in_prio_list,
-		core->stat_n_jobs_removed);
+		core->stat_n_jobs_removed,
+		core->stat_n_jobs_on_cpu,
+		core->stat_n_jobs_cpu_failed);
 }
 
 /**
@@ -66,6 +66,12 @@
  */
 #define B2R2_CORE_HIGHEST_PRIO 20
 
+/**
+ * B2R2_CPU_OVERFLOW_DEFAULT - Default depth of the prio list from which
+ * jobs overflow to the CPU
+ */
+#define B2R2_CPU_OVERFLOW_DEFAULT 2
+
 /**
  * B2R2_DOMAIN_DISABLE -
  */
@@ -109,6 +115,8 @@ struct addref_release {
  * @prio_queue: Queue of jobs sorted in priority order
  * @active_jobs: Array containing pointer to zero or one job per queue
  * @n_active_jobs: Number of active jobs
+ * @cpu_queue: Jobs being performed on the CPU, in the order they were added
+ * @n_cpu_jobs: Number of jobs in cpu_queue
  * @jiffies_last_active: jiffie value when adding last active job
  * @jiffies_last_irq: jiffie value when last irq occured
  * @timeout_work: Work structure for timeout work
@@ -121,11 +129,19 @@ struct addref_release {
  *
  * @work_queue: Work queue to handle done jobs (callbacks) and timeouts in
  *              non-interrupt context.
+ * @cpu_work_queue: Ordered work queue performing jobs on the CPU, NULL
+ *                  if the CPU blitter is not built in
+ * @cpu_overflow: Depth of the priority queue from which jobs are sent to
+ *                the CPU rather than queued for the hardware, 0 to never
+ * @cpu_only: When non-zero, all jobs that can run on the CPU do
  *
  * @stat_n_irq: Number of interrupts (statistics)
  * @stat_n_jobs_added: Number of jobs added (statistics)
  * @stat_n_jobs_removed: Number of jobs removed (statistics)
  * @stat_n_jobs_in_prio_list: Number of jobs in prio list (statistics)
+ * @stat_n_jobs_on_cpu: Number of jobs sent to the CPU (statistics)
+ * @stat_n_jobs_cpu_failed: Number of jobs the CPU gave back to the
+ *                          hardware (statistics)
  *
  * @debugfs_root_dir: Root directory for B2R2 debugfs
  *
@@ -154,6 +170,9 @@ struct b2r2_core {
 	struct b2r2_core_job *active_jobs[B2R2_CORE_QUEUE_NO_OF];
 	unsigned long    n_active_jobs;
 
+	struct list_head cpu_queue;
+	unsigned long    n_cpu_jobs;
+
 	unsigned long    jiffies_last_active;
 	unsigned long    jiffies_last_irq;
 #ifdef HANDLE_TIMEOUTED_JOBS
@@ -165,6 +184,9 @@ struct b2r2_core {
 	struct timer_list clock_off_timer;
 
 	struct workqueue_struct *work_queue;
+	struct workqueue_struct *cpu_work_queue;
+	u8 cpu_overflow;
+	u32 cpu_only;
 
 	/* Statistics */
 	unsigned long    stat_n_irq_exit;
@@ -174,6 +196,8 @@ struct b2r2_core {
 	unsigned long    stat_n_jobs_removed;
 
 	unsigned long    stat_n_jobs_in_prio_list;
+	unsigned long    stat_n_jobs_on_cpu;
+	unsigned long    stat_n_jobs_cpu_failed;
 
 #ifdef CONFIG_DEBUG_FS
 	struct dentry *debugfs_root_dir;
@@ -241,7 +265,11 @@ int b2r2_core_job_wait(struct b2r2_core_job *job);
  *
  * @job: Job to cancel
  *
- * Returns 0 if job cancelled or done else negative error code
+ * A job the CPU has started cannot be cancelled. It is waited for,
+ * including its callback, instead.
+ *
+ * Returns 0 if job cancelled or done, -EBUSY if the CPU completed the
+ * job instead, else negative error code
  *
  */
 int b2r2_core_job_cancel(struct b2r2_core_job *job);
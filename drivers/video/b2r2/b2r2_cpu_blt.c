@@ -0,0 +1,1136 @@
+/*
+ * ST-Ericsson B2R2 CPU blitter
+ *
+ * Performs blit requests on the CPU, producing what the node splitter
+ * would have the hardware produce for the same request. Used when the
+ * hardware queues are saturated and as a reference for the node splitter.
+ *
+ * License terms: GNU General Public License (GPL), version 2.
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/bitops.h>
+#include <linux/sched.h>
+#include <video/b2r2_blt.h>
+#ifdef CONFIG_KERNEL_MODE_NEON
+#include <asm/neon.h>
+#endif
+
+#include "b2r2_cpu_blt.h"
+#include "b2r2_internal.h"
+#include "b2r2_debug.h"
+#include "b2r2_filters.h"
+#include "b2r2_hw_convert.h"
+#include "b2r2_utils.h"
+
+/*
+ * Macros and constants
+ */
+
+/*
+ * Lines are kept unpacked, four bytes per pixel: the three color
+ * components in the order the VMX matrices use them, (R, G, B) or
+ * (Cr, Y, Cb), followed by alpha.
+ */
+#define CPU_BLT_C0 0
+#define CPU_BLT_C1 1
+#define CPU_BLT_C2 2
+#define CPU_BLT_A  3
+#define CPU_BLT_PIXEL_SIZE 4
+
+/* Edge pixels repeated on each side of a source line for the 8-tap filter */
+#define CPU_BLT_HPAD 4
+
+/* Horizontally filtered source lines kept for the 5-tap vertical filter */
+#define CPU_BLT_VTAPS 5
+#define CPU_BLT_HTAPS 8
+
+#define CPU_BLT_UNSUPPORTED_FLAGS (B2R2_BLT_FLAG_SOURCE_COLOR_KEY | \
+		B2R2_BLT_FLAG_DEST_COLOR_KEY | \
+		B2R2_BLT_FLAG_DITHER | \
+		B2R2_BLT_FLAG_BLUR | \
+		B2R2_BLT_FLAG_SOURCE_MASK | \
+		B2R2_BLT_FLAG_CLUT_COLOR_CORRECTION)
+
+#define CPU_BLT_BLEND_FLAGS (B2R2_BLT_FLAG_PER_PIXEL_ALPHA_BLEND | \
+		B2R2_BLT_FLAG_GLOBAL_ALPHA_BLEND | \
+		B2R2_BLT_FLAG_BG_BLEND)
+
+/*
+ * Internal types
+ */
+
+/**
+ * struct cpu_blt_vmx - A decoded VMX color conversion matrix
+ *
+ * @coeff: Matrix coefficients, 8.8 fixed point
+ * @offset: Offset added to each output component
+ */
+struct cpu_blt_vmx {
+	s32 coeff[3][3];
+	s32 offset[3];
+};
+
+/**
+ * struct cpu_blt_src - A source of transformed lines
+ *
+ * @fmt: The image format
+ * @base: Address of the first pixel of the source rectangle
+ * @pitch: The image byte pitch
+ * @bpp: Bytes per pixel
+ * @width: Width of the source rectangle
+ * @height: Height of the source rectangle
+ * @transform: The transform of the request
+ * @vmx: Conversion to the color space of the destination, or NULL
+ */
+struct cpu_blt_src {
+	enum b2r2_blt_fmt fmt;
+	u8 *base;
+	u32 pitch;
+	u32 bpp;
+	s32 width;
+	s32 height;
+	enum b2r2_blt_transform transform;
+	struct cpu_blt_vmx *vmx;
+};
+
+/*
+ * Format helpers
+ */
+
+static u32 fmt_bytes(enum b2r2_blt_fmt fmt)
+{
+	switch (fmt) {
+	case B2R2_BLT_FMT_16_BIT_ARGB4444:
+	case B2R2_BLT_FMT_16_BIT_ABGR4444:
+	case B2R2_BLT_FMT_16_BIT_ARGB1555:
+	case B2R2_BLT_FMT_16_BIT_RGB565:
+		return 2;
+	case B2R2_BLT_FMT_24_BIT_RGB888:
+	case B2R2_BLT_FMT_24_BIT_ARGB8565:
+	case B2R2_BLT_FMT_24_BIT_YUV888:
+	case B2R2_BLT_FMT_24_BIT_VUY888:
+		return 3;
+	case B2R2_BLT_FMT_32_BIT_ARGB8888:
+	case B2R2_BLT_FMT_32_BIT_ABGR8888:
+	case B2R2_BLT_FMT_32_BIT_AYUV8888:
+	case B2R2_BLT_FMT_32_BIT_VUYA8888:
+		return 4;
+	default:
+		return 0;
+	}
+}
+
+static bool fmt_is_yuv(enum b2r2_blt_fmt fmt)
+{
+	switch (fmt) {
+	case B2R2_BLT_FMT_24_BIT_YUV888:
+	case B2R2_BLT_FMT_24_BIT_VUY888:
+	case B2R2_BLT_FMT_32_BIT_AYUV8888:
+	case B2R2_BLT_FMT_32_BIT_VUYA8888:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static inline u8 expand5(u32 v)
+{
+	return (v << 3) | (v >> 2);
+}
+
+static inline u8 expand6(u32 v)
+{
+	return (v << 2) | (v >> 4);
+}
+
+static inline u8 expand4(u32 v)
+{
+	return v * 17;
+}
+
+static inline u8 clamp_u8(s32 v)
+{
+	return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+/**
+ * unpack_line() - Unpacks n pixels starting at p, step bytes apart
+ */
+static void unpack_line(enum b2r2_blt_fmt fmt, const u8 *p, s32 step,
+		u8 *out, s32 n)
+{
+	u32 v;
+
+	switch (fmt) {
+	case B2R2_BLT_FMT_16_BIT_ARGB4444:
+		for (; n > 0; n--, p += step, out += CPU_BLT_PIXEL_SIZE) {
+			v = p[0] | (p[1] << 8);
+			out[CPU_BLT_C0] = expand4((v >> 8) & 0xf);
+			out[CPU_BLT_C1] = expand4((v >> 4) & 0xf);
+			out[CPU_BLT_C2] = expand4(v & 0xf);
+			out[CPU_BLT_A] = expand4(v >> 12);
+		}
+		break;
+	case B2R2_BLT_FMT_16_BIT_ABGR4444:
+		for (; n > 0; n--, p += step, out += CPU_BLT_PIXEL_SIZE) {
+			v = p[0] | (p[1] << 8);
+			out[CPU_BLT_C0] = expand4(v & 0xf);
+			out[CPU_BLT_C1] = expand4((v >> 4) & 0xf);
+			out[CPU_BLT_C2] = expand4((v >> 8) & 0xf);
+			out[CPU_BLT_A] = expand4(v >> 12);
+		}
+		break;
+	case B2R2_BLT_FMT_16_BIT_ARGB1555:
+		for (; n > 0; n--, p += step, out += CPU_BLT_PIXEL_SIZE) {
+			v = p[0] | (p[1] << 8);
+			out[CPU_BLT_C0] = expand5((v >> 10) & 0x1f);
+			out[CPU_BLT_C1] = expand5((v >> 5) & 0x1f);
+			out[CPU_BLT_C2] = expand5(v & 0x1f);
+			out[CPU_BLT_A] = (v & 0x8000) ? 255 : 0;
+		}
+		break;
+	case B2R2_BLT_FMT_16_BIT_RGB565:
+		for (; n > 0; n--, p += step, out += CPU_BLT_PIXEL_SIZE) {
+			v = p[0] | (p[1] << 8);
+			out[CPU_BLT_C0] = expand5(v >> 11);
+			out[CPU_BLT_C1] = expand6((v >> 5) & 0x3f);
+			out[CPU_BLT_C2] = expand5(v & 0x1f);
+			out[CPU_BLT_A] = 255;
+		}
+		break;
+	case B2R2_BLT_FMT_24_BIT_RGB888:
+		for (; n > 0; n--, p += step, out += CPU_BLT_PIXEL_SIZE) {
+			out[CPU_BLT_C0] = p[2];
+			out[CPU_BLT_C1] = p[1];
+			out[CPU_BLT_C2] = p[0];
+			out[CPU_BLT_A] = 255;
+		}
+		break;
+	case B2R2_BLT_FMT_24_BIT_ARGB8565:
+		for (; n > 0; n--, p += step, out += CPU_BLT_PIXEL_SIZE) {
+			v = p[0] | (p[1] << 8);
+			out[CPU_BLT_C0] = expand5(v >> 11);
+			out[CPU_BLT_C1] = expand6((v >> 5) & 0x3f);
+			out[CPU_BLT_C2] = expand5(v & 0x1f);
+			out[CPU_BLT_A] = p[2];
+		}
+		break;
+	case B2R2_BLT_FMT_32_BIT_ARGB8888:
+		for (; n > 0; n--, p += step, out += CPU_BLT_PIXEL_SIZE) {
+			out[CPU_BLT_C0] = p[2];
+			out[CPU_BLT_C1] = p[1];
+			out[CPU_BLT_C2] = p[0];
+			out[CPU_BLT_A] = p[3];
+		}
+		break;
+	case B2R2_BLT_FMT_32_BIT_ABGR8888:
+		for (; n > 0; n--, p += step, out += CPU_BLT_PIXEL_SIZE) {
+			out[CPU_BLT_C0] = p[0];
+			out[CPU_BLT_C1] = p[1];
+			out[CPU_BLT_C2] = p[2];
+			out[CPU_BLT_A] = p[3];
+		}
+		break;
+	case B2R2_BLT_FMT_24_BIT_YUV888:
+		for (; n > 0; n--, p += step, out += CPU_BLT_PIXEL_SIZE) {
+			out[CPU_BLT_C0] = p[0];
+			out[CPU_BLT_C1] = p[2];
+			out[CPU_BLT_C2] = p[1];
+			out[CPU_BLT_A] = 255;
+		}
+		break;
+	case B2R2_BLT_FMT_32_BIT_AYUV8888:
+		for (; n > 0; n--, p += step, out += CPU_BLT_PIXEL_SIZE) {
+			out[CPU_BLT_C0] = p[0];
+			out[CPU_BLT_C1] = p[2];
+			out[CPU_BLT_C2] = p[1];
+			out[CPU_BLT_A] = p[3];
+		}
+		break;
+	case B2R2_BLT_FMT_24_BIT_VUY888:
+		for (; n > 0; n--, p += step, out += CPU_BLT_PIXEL_SIZE) {
+			out[CPU_BLT_C0] = p[2];
+			out[CPU_BLT_C1] = p[0];
+			out[CPU_BLT_C2] = p[1];
+			out[CPU_BLT_A] = 255;
+		}
+		break;
+	case B2R2_BLT_FMT_32_BIT_VUYA8888:
+		for (; n > 0; n--, p += step, out += CPU_BLT_PIXEL_SIZE) {
+			out[CPU_BLT_C0] = p[3];
+			out[CPU_BLT_C1] = p[1];
+			out[CPU_BLT_C2] = p[2];
+			out[CPU_BLT_A] = p[0];
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * pack_line() - Packs n pixels into consecutive pixels at p
+ */
+static void pack_line(enum b2r2_blt_fmt fmt, const u8 *in, u8 *p, s32 n)
+{
+	u32 v;
+
+	switch (fmt) {
+	case B2R2_BLT_FMT_16_BIT_ARGB4444:
+		for (; n > 0; n--, p += 2, in += CPU_BLT_PIXEL_SIZE) {
+			v = ((in[CPU_BLT_A] >> 4) << 12) |
+				((in[CPU_BLT_C0] >> 4) << 8) |
+				((in[CPU_BLT_C1] >> 4) << 4) |
+				(in[CPU_BLT_C2] >> 4);
+			p[0] = v;
+			p[1] = v >> 8;
+		}
+		break;
+	case B2R2_BLT_FMT_16_BIT_ABGR4444:
+		for (; n > 0; n--, p += 2, in += CPU_BLT_PIXEL_SIZE) {
+			v = ((in[CPU_BLT_A] >> 4) << 12) |
+				((in[CPU_BLT_C2] >> 4) << 8) |
+				((in[CPU_BLT_C1] >> 4) << 4) |
+				(in[CPU_BLT_C0] >> 4);
+			p[0] = v;
+			p[1] = v >> 8;
+		}
+		break;
+	case B2R2_BLT_FMT_16_BIT_ARGB1555:
+		for (; n > 0; n--, p += 2, in += CPU_BLT_PIXEL_SIZE) {
+			v = ((in[CPU_BLT_A] >> 7) << 15) |
+				((in[CPU_BLT_C0] >> 3) << 10) |
+				((in[CPU_BLT_C1] >> 3) << 5) |
+				(in[CPU_BLT_C2] >> 3);
+			p[0] = v;
+			p[1] = v >> 8;
+		}
+		break;
+	case B2R2_BLT_FMT_16_BIT_RGB565:
+		for (; n > 0; n--, p += 2, in += CPU_BLT_PIXEL_SIZE) {
+			v = ((in[CPU_BLT_C0] >> 3) << 11) |
+				((in[CPU_BLT_C1] >> 2) << 5) |
+				(in[CPU_BLT_C2] >> 3);
+			p[0] = v;
+			p[1] = v >> 8;
+		}
+		break;
+	case B2R2_BLT_FMT_24_BIT_RGB888:
+		for (; n > 0; n--, p += 3, in += CPU_BLT_PIXEL_SIZE) {
+			p[0] = in[CPU_BLT_C2];
+			p[1] = in[CPU_BLT_C1];
+			p[2] = in[CPU_BLT_C0];
+		}
+		break;
+	case B2R2_BLT_FMT_24_BIT_ARGB8565:
+		for (; n > 0; n--, p += 3, in += CPU_BLT_PIXEL_SIZE) {
+			v = ((in[CPU_BLT_C0] >> 3) << 11) |
+				((in[CPU_BLT_C1] >> 2) << 5) |
+				(in[CPU_BLT_C2] >> 3);
+			p[0] = v;
+			p[1] = v >> 8;
+			p[2] = in[CPU_BLT_A];
+		}
+		break;
+	case B2R2_BLT_FMT_32_BIT_ARGB8888:
+		for (; n > 0; n--, p += 4, in += CPU_BLT_PIXEL_SIZE) {
+			p[0] = in[CPU_BLT_C2];
+			p[1] = in[CPU_BLT_C1];
+			p[2] = in[CPU_BLT_C0];
+			p[3] = in[CPU_BLT_A];
+		}
+		break;
+	case B2R2_BLT_FMT_32_BIT_ABGR8888:
+		for (; n > 0; n--, p += 4, in += CPU_BLT_PIXEL_SIZE) {
+			p[0] = in[CPU_BLT_C0];
+			p[1] = in[CPU_BLT_C1];
+			p[2] = in[CPU_BLT_C2];
+			p[3] = in[CPU_BLT_A];
+		}
+		break;
+	case B2R2_BLT_FMT_24_BIT_YUV888:
+		for (; n > 0; n--, p += 3, in += CPU_BLT_PIXEL_SIZE) {
+			p[0] = in[CPU_BLT_C0];
+			p[1] = in[CPU_BLT_C2];
+			p[2] = in[CPU_BLT_C1];
+		}
+		break;
+	case B2R2_BLT_FMT_32_BIT_AYUV8888:
+		for (; n > 0; n--, p += 4, in += CPU_BLT_PIXEL_SIZE) {
+			p[0] = in[CPU_BLT_C0];
+			p[1] = in[CPU_BLT_C2];
+			p[2] = in[CPU_BLT_C1];
+			p[3] = in[CPU_BLT_A];
+		}
+		break;
+	case B2R2_BLT_FMT_24_BIT_VUY888:
+		for (; n > 0; n--, p += 3, in += CPU_BLT_PIXEL_SIZE) {
+			p[0] = in[CPU_BLT_C1];
+			p[1] = in[CPU_BLT_C2];
+			p[2] = in[CPU_BLT_C0];
+		}
+		break;
+	case B2R2_BLT_FMT_32_BIT_VUYA8888:
+		for (; n > 0; n--, p += 4, in += CPU_BLT_PIXEL_SIZE) {
+			p[0] = in[CPU_BLT_A];
+			p[1] = in[CPU_BLT_C1];
+			p[2] = in[CPU_BLT_C2];
+			p[3] = in[CPU_BLT_C0];
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Color conversion
+ */
+
+/**
+ * vmx_coeff_c() - Decodes the 10-bit c coefficient of a VMX row
+ *
+ * The field has a range of +-512 but holds coefficients of up to +-768,
+ * those beyond +-256 stored with a third of the precision.
+ */
+static s32 vmx_coeff_c(u32 field)
+{
+	s32 c = sign_extend32(field & 0x3ff, 9);
+
+	if (c > 256)
+		c = 3 * c - 512;
+	else if (c < -256)
+		c = 3 * c + 512;
+
+	return c;
+}
+
+static void vmx_decode(const u32 *regs, struct cpu_blt_vmx *vmx)
+{
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		vmx->coeff[i][0] = sign_extend32(regs[i] >> 21, 10);
+		vmx->coeff[i][1] = sign_extend32((regs[i] >> 10) & 0x7ff, 10);
+		vmx->coeff[i][2] = vmx_coeff_c(regs[i]);
+	}
+
+	vmx->offset[0] = sign_extend32((regs[3] >> 20) & 0x3ff, 9);
+	vmx->offset[1] = sign_extend32((regs[3] >> 10) & 0x3ff, 9);
+	vmx->offset[2] = sign_extend32(regs[3] & 0x3ff, 9);
+}
+
+/**
+ * get_vmx() - Decodes the conversion from one format to another
+ *
+ * Returns false if no conversion is needed.
+ */
+static bool get_vmx(enum b2r2_blt_fmt from, enum b2r2_blt_fmt to,
+		bool fullrange, struct cpu_blt_vmx *vmx)
+{
+	enum b2r2_color_conversion cc;
+	const u32 *regs = NULL;
+
+	if (fmt_is_yuv(from) == fmt_is_yuv(to))
+		return false;
+
+	if (fmt_is_yuv(from))
+		cc = fullrange ? B2R2_CC_YUV_FULL_TO_RGB : B2R2_CC_YUV_TO_RGB;
+	else
+		cc = fullrange ? B2R2_CC_RGB_TO_YUV_FULL : B2R2_CC_RGB_TO_YUV;
+
+	if (b2r2_get_vmx(cc, &regs) < 0 || regs == NULL)
+		return false;
+
+	vmx_decode(regs, vmx);
+	return true;
+}
+
+#ifdef CONFIG_KERNEL_MODE_NEON
+/*
+ * The NEON versions of the per pixel loops below work on blocks of eight
+ * pixels (or bytes) and leave the rest of the line to the C loops. They
+ * compute exactly what the C loops do. The kernel is built soft-float, so
+ * the compiler keeps nothing of its own in the NEON registers.
+ */
+
+/**
+ * convert_line_neon() - Converts blocks of eight pixels
+ *
+ * @blocks: Number of blocks, at least one
+ */
+static void convert_line_neon(const struct cpu_blt_vmx *vmx, u8 *line,
+		s32 blocks)
+{
+	s16 coeff[3][4];
+	s32 offset[4];
+	int i, j;
+
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 3; j++)
+			coeff[i][j] = vmx->coeff[i][j];
+		coeff[i][3] = 0;
+		offset[i] = vmx->offset[i];
+	}
+	offset[3] = 0;
+
+	kernel_neon_begin();
+	asm volatile(
+	"	.fpu	neon\n"
+	"	vld1.16	{d0-d2}, [%[coeff]]\n"
+	"	vld1.32	{d24-d25}, [%[offset]]\n"
+	"	vdup.32	q13, d24[0]\n"
+	"	vdup.32	q14, d24[1]\n"
+	"	vdup.32	q15, d25[0]\n"
+	"1:	vld4.8	{d4-d7}, [%[line]]\n"
+	"	vmovl.u8	q4, d4\n"
+	"	vmovl.u8	q5, d5\n"
+	"	vmovl.u8	q6, d6\n"
+	"	vmull.s16	q8, d8, d0[0]\n"
+	"	vmull.s16	q9, d9, d0[0]\n"
+	"	vmlal.s16	q8, d10, d0[1]\n"
+	"	vmlal.s16	q9, d11, d0[1]\n"
+	"	vmlal.s16	q8, d12, d0[2]\n"
+	"	vmlal.s16	q9, d13, d0[2]\n"
+	"	vrshr.s32	q8, q8, #8\n"
+	"	vrshr.s32	q9, q9, #8\n"
+	"	vadd.i32	q8, q8, q13\n"
+	"	vadd.i32	q9, q9, q13\n"
+	"	vqmovun.s32	d20, q8\n"
+	"	vqmovun.s32	d21, q9\n"
+	"	vqmovn.u16	d4, q10\n"
+	"	vmull.s16	q8, d8, d1[0]\n"
+	"	vmull.s16	q9, d9, d1[0]\n"
+	"	vmlal.s16	q8, d10, d1[1]\n"
+	"	vmlal.s16	q9, d11, d1[1]\n"
+	"	vmlal.s16	q8, d12, d1[2]\n"
+	"	vmlal.s16	q9, d13, d1[2]\n"
+	"	vrshr.s32	q8, q8, #8\n"
+	"	vrshr.s32	q9, q9, #8\n"
+	"	vadd.i32	q8, q8, q14\n"
+	"	vadd.i32	q9, q9, q14\n"
+	"	vqmovun.s32	d20, q8\n"
+	"	vqmovun.s32	d21, q9\n"
+	"	vqmovn.u16	d5, q10\n"
+	"	vmull.s16	q8, d8, d2[0]\n"
+	"	vmull.s16	q9, d9, d2[0]\n"
+	"	vmlal.s16	q8, d10, d2[1]\n"
+	"	vmlal.s16	q9, d11, d2[1]\n"
+	"	vmlal.s16	q8, d12, d2[2]\n"
+	"	vmlal.s16	q9, d13, d2[2]\n"
+	"	vrshr.s32	q8, q8, #8\n"
+	"	vrshr.s32	q9, q9, #8\n"
+	"	vadd.i32	q8, q8, q15\n"
+	"	vadd.i32	q9, q9, q15\n"
+	"	vqmovun.s32	d20, q8\n"
+	"	vqmovun.s32	d21, q9\n"
+	"	vqmovn.u16	d6, q10\n"
+	"	vst4.8	{d4-d7}, [%[line]]!\n"
+	"	subs	%[blocks], %[blocks], #1\n"
+	"	bne	1b\n"
+	: [line] "+r" (line), [blocks] "+r" (blocks)
+	: [coeff] "r" (coeff), [offset] "r" (offset)
+	: "cc", "memory");
+	kernel_neon_end();
+}
+
+/**
+ * vfilter_line_neon() - Filters blocks of eight bytes
+ *
+ * @coeffs: The five filter taps, widened
+ * @blocks: Number of blocks, at least one
+ */
+static void vfilter_line_neon(const u8 **rows, const s16 *coeffs, u8 *out,
+		s32 blocks)
+{
+	const u8 *r0 = rows[0], *r1 = rows[1], *r2 = rows[2];
+	const u8 *r3 = rows[3], *r4 = rows[4];
+
+	kernel_neon_begin();
+	asm volatile(
+	"	.fpu	neon\n"
+	"	vld1.16	{d0-d1}, [%[coeffs]]\n"
+	"1:	vld1.8	{d2}, [%[r0]]!\n"
+	"	vld1.8	{d3}, [%[r1]]!\n"
+	"	vld1.8	{d4}, [%[r2]]!\n"
+	"	vld1.8	{d5}, [%[r3]]!\n"
+	"	vld1.8	{d6}, [%[r4]]!\n"
+	"	vmovl.u8	q4, d2\n"
+	"	vmull.s16	q8, d8, d0[0]\n"
+	"	vmull.s16	q9, d9, d0[0]\n"
+	"	vmovl.u8	q4, d3\n"
+	"	vmlal.s16	q8, d8, d0[1]\n"
+	"	vmlal.s16	q9, d9, d0[1]\n"
+	"	vmovl.u8	q4, d4\n"
+	"	vmlal.s16	q8, d8, d0[2]\n"
+	"	vmlal.s16	q9, d9, d0[2]\n"
+	"	vmovl.u8	q4, d5\n"
+	"	vmlal.s16	q8, d8, d0[3]\n"
+	"	vmlal.s16	q9, d9, d0[3]\n"
+	"	vmovl.u8	q4, d6\n"
+	"	vmlal.s16	q8, d8, d1[0]\n"
+	"	vmlal.s16	q9, d9, d1[0]\n"
+	"	vqrshrun.s32	d20, q8, #6\n"
+	"	vqrshrun.s32	d21, q9, #6\n"
+	"	vqmovn.u16	d22, q10\n"
+	"	vst1.8	{d22}, [%[out]]!\n"
+	"	subs	%[blocks], %[blocks], #1\n"
+	"	bne	1b\n"
+	: [r0] "+r" (r0), [r1] "+r" (r1), [r2] "+r" (r2),
+	  [r3] "+r" (r3), [r4] "+r" (r4), [out] "+r" (out),
+	  [blocks] "+r" (blocks)
+	: [coeffs] "r" (coeffs)
+	: "cc", "memory");
+	kernel_neon_end();
+}
+
+/**
+ * blend_line_neon() - Blends blocks of eight pixels
+ *
+ * @blocks: Number of blocks, at least one
+ */
+static void blend_line_neon(const u8 *src, u8 *dst, s32 blocks, u32 ga,
+		bool per_pixel, bool premult)
+{
+	u32 pp_mask = per_pixel ? 0xffff : 0;
+	u32 pm_mask = premult ? 0xffff : 0;
+
+	kernel_neon_begin();
+	asm volatile(
+	"	.fpu	neon\n"
+	"	vdup.16	q15, %[ga]\n"
+	"	vmov.i16	q14, #128\n"
+	"	vdup.16	q13, %[pm]\n"
+	"	vdup.16	q12, %[pp]\n"
+	"1:	vld4.8	{d0-d3}, [%[src]]!\n"
+	"	vld4.8	{d4-d7}, [%[dst]]\n"
+	/* a = ((per_pixel ? alpha_to_128(A) : 128) * ga + 64) >> 7 */
+	"	vmovl.u8	q8, d3\n"
+	"	vshr.u16	q9, q8, #7\n"
+	"	vadd.i16	q8, q8, q9\n"
+	"	vshr.u16	q8, q8, #1\n"
+	"	vmov	q9, q12\n"
+	"	vbsl	q9, q8, q14\n"
+	"	vmul.i16	q9, q9, q15\n"
+	"	vrshr.u16	q9, q9, #7\n"
+	/* inv = 128 - a, q11 = premult ? ga : a */
+	"	vsub.i16	q10, q14, q9\n"
+	"	vmov	q11, q13\n"
+	"	vbsl	q11, q15, q9\n"
+	/* Colors */
+	"	vmovl.u8	q4, d0\n"
+	"	vmovl.u8	q5, d4\n"
+	"	vmul.i16	q4, q4, q11\n"
+	"	vmla.i16	q4, q5, q10\n"
+	"	vrshr.u16	q4, q4, #7\n"
+	"	vqmovn.u16	d4, q4\n"
+	"	vmovl.u8	q4, d1\n"
+	"	vmovl.u8	q5, d5\n"
+	"	vmul.i16	q4, q4, q11\n"
+	"	vmla.i16	q4, q5, q10\n"
+	"	vrshr.u16	q4, q4, #7\n"
+	"	vqmovn.u16	d5, q4\n"
+	"	vmovl.u8	q4, d2\n"
+	"	vmovl.u8	q5, d6\n"
+	"	vmul.i16	q4, q4, q11\n"
+	"	vmla.i16	q4, q5, q10\n"
+	"	vrshr.u16	q4, q4, #7\n"
+	"	vqmovn.u16	d6, q4\n"
+	/* Alpha: alpha_to_255(a + ((alpha_to_128(dA) * inv) >> 7)) */
+	"	vmovl.u8	q4, d7\n"
+	"	vshr.u16	q5, q4, #7\n"
+	"	vadd.i16	q4, q4, q5\n"
+	"	vshr.u16	q4, q4, #1\n"
+	"	vmul.i16	q4, q4, q10\n"
+	"	vshr.u16	q4, q4, #7\n"
+	"	vadd.i16	q4, q4, q9\n"
+	"	vshl.i16	q5, q4, #1\n"
+	"	vshr.u16	q4, q4, #7\n"
+	"	vsub.i16	q4, q5, q4\n"
+	"	vmovn.i16	d7, q4\n"
+	"	vst4.8	{d4-d7}, [%[dst]]!\n"
+	"	subs	%[blocks], %[blocks], #1\n"
+	"	bne	1b\n"
+	: [src] "+r" (src), [dst] "+r" (dst), [blocks] "+r" (blocks)
+	: [ga] "r" (ga), [pm] "r" (pm_mask), [pp] "r" (pp_mask)
+	: "cc", "memory");
+	kernel_neon_end();
+}
+#endif
+
+static void convert_line(const struct cpu_blt_vmx *vmx, u8 *line, s32 n)
+{
+	s32 c0, c1, c2;
+	int i;
+
+#ifdef CONFIG_KERNEL_MODE_NEON
+	if (n >= 8 && cpu_has_neon()) {
+		convert_line_neon(vmx, line, n >> 3);
+		line += (n & ~7) * CPU_BLT_PIXEL_SIZE;
+		n &= 7;
+	}
+#endif
+
+	for (; n > 0; n--, line += CPU_BLT_PIXEL_SIZE) {
+		c0 = line[CPU_BLT_C0];
+		c1 = line[CPU_BLT_C1];
+		c2 = line[CPU_BLT_C2];
+		for (i = 0; i < 3; i++)
+			line[i] = clamp_u8(((vmx->coeff[i][0] * c0 +
+					vmx->coeff[i][1] * c1 +
+					vmx->coeff[i][2] * c2 + 128) >> 8) +
+					vmx->offset[i]);
+	}
+}
+
+/*
+ * Source access
+ */
+
+/**
+ * fetch_line() - Fetches line ty of the transformed source rectangle
+ *
+ * The line is unpacked into line + CPU_BLT_HPAD pixels, converted to the
+ * color space of the destination, and its edge pixels repeated into the
+ * CPU_BLT_HPAD pixels on each side.
+ */
+static void fetch_line(struct cpu_blt_src *src, s32 ty, u8 *line)
+{
+	bool rot = src->transform & B2R2_BLT_TRANSFORM_CCW_ROT_90;
+	bool flip_h = src->transform & B2R2_BLT_TRANSFORM_FLIP_H;
+	bool flip_v = src->transform & B2R2_BLT_TRANSFORM_FLIP_V;
+	u8 *pixels = line + CPU_BLT_HPAD * CPU_BLT_PIXEL_SIZE;
+	s32 sx, sy, step, n;
+	int i;
+
+	if (rot) {
+		/* Transformed lines are source columns */
+		sx = flip_h ? ty : src->width - 1 - ty;
+		sy = flip_v ? src->height - 1 : 0;
+		step = flip_v ? -(s32)src->pitch : (s32)src->pitch;
+		n = src->height;
+	} else {
+		sx = flip_h ? src->width - 1 : 0;
+		sy = flip_v ? src->height - 1 - ty : ty;
+		step = flip_h ? -(s32)src->bpp : (s32)src->bpp;
+		n = src->width;
+	}
+
+	unpack_line(src->fmt, src->base + sy * src->pitch + sx * src->bpp,
+		step, pixels, n);
+
+	if (src->vmx)
+		convert_line(src->vmx, pixels, n);
+
+	for (i = 0; i < CPU_BLT_HPAD; i++) {
+		memcpy(line + i * CPU_BLT_PIXEL_SIZE, pixels,
+			CPU_BLT_PIXEL_SIZE);
+		memcpy(pixels + (n + i) * CPU_BLT_PIXEL_SIZE,
+			pixels + (n - 1) * CPU_BLT_PIXEL_SIZE,
+			CPU_BLT_PIXEL_SIZE);
+	}
+}
+
+/**
+ * hfilter() - Resamples a padded source line to n destination pixels
+ *
+ * @x: Offset of the first pixel from the start of the destination rectangle
+ * @sf: The horizontal scale factor, 6.10 fixed point
+ * @hf: The filter, NULL to take the nearest pixel
+ */
+static void hfilter(const u8 *line, u8 *out, s32 x, s32 n, u16 sf,
+		struct b2r2_filter_spec *hf)
+{
+	const u8 *pixels = line + CPU_BLT_HPAD * CPU_BLT_PIXEL_SIZE;
+	const s8 *coeffs;
+	const u8 *p;
+	u32 pos;
+	s32 sum;
+	int c, k;
+
+	for (; n > 0; n--, x++, out += CPU_BLT_PIXEL_SIZE) {
+		pos = (u32)x * sf;
+		p = pixels + (pos >> 10) * CPU_BLT_PIXEL_SIZE;
+
+		if (!hf) {
+			memcpy(out, p, CPU_BLT_PIXEL_SIZE);
+			continue;
+		}
+
+		/* Tap k weighs pixel i + 4 - k */
+		coeffs = (const s8 *)&hf->h_coeffs[((pos >> 7) & 7) *
+			CPU_BLT_HTAPS];
+		p += 4 * CPU_BLT_PIXEL_SIZE;
+		for (c = 0; c < CPU_BLT_PIXEL_SIZE; c++) {
+			sum = 0;
+			for (k = 0; k < CPU_BLT_HTAPS; k++)
+				sum += coeffs[k] * p[c - k * CPU_BLT_PIXEL_SIZE];
+			out[c] = clamp_u8((sum + 32) >> 6);
+		}
+	}
+}
+
+/*
+ * Blending
+ */
+
+static inline u32 alpha_to_128(u32 a)
+{
+	return (a + (a >> 7)) >> 1;
+}
+
+static inline u32 alpha_to_255(u32 a)
+{
+	return (a << 1) - (a >> 7);
+}
+
+/**
+ * blend_line() - Blends a source line onto a destination line
+ *
+ * @ga: Global alpha, 0...128
+ * @per_pixel: Whether to weigh in the alpha of each source pixel
+ * @premult: Whether the source is premultiplied
+ *
+ * Follows the hardware blender: the source alpha is applied to the color
+ * unless the source is premultiplied, the global alpha always is.
+ */
+static void blend_line(const u8 *src, u8 *dst, s32 n, u32 ga,
+		bool per_pixel, bool premult)
+{
+	u32 as, a, inv, c;
+	int i;
+
+#ifdef CONFIG_KERNEL_MODE_NEON
+	if (n >= 8 && cpu_has_neon()) {
+		blend_line_neon(src, dst, n >> 3, ga, per_pixel, premult);
+		src += (n & ~7) * CPU_BLT_PIXEL_SIZE;
+		dst += (n & ~7) * CPU_BLT_PIXEL_SIZE;
+		n &= 7;
+	}
+#endif
+
+	for (; n > 0; n--, src += CPU_BLT_PIXEL_SIZE,
+			dst += CPU_BLT_PIXEL_SIZE) {
+		as = per_pixel ? alpha_to_128(src[CPU_BLT_A]) : 128;
+		a = (as * ga + 64) >> 7;
+		inv = 128 - a;
+
+		for (i = 0; i < 3; i++) {
+			c = ((premult ? ga : a) * src[i] + inv * dst[i] + 64)
+				>> 7;
+			dst[i] = c > 255 ? 255 : c;
+		}
+
+		a += (alpha_to_128(dst[CPU_BLT_A]) * inv) >> 7;
+		dst[CPU_BLT_A] = alpha_to_255(a);
+	}
+}
+
+/**
+ * vfilter_line() - Filters n bytes of five horizontally filtered lines
+ *
+ * @rows: The lines, rows[k] weighed by tap k
+ * @coeffs: The five taps of the vertical filter
+ */
+static void vfilter_line(const u8 **rows, const s8 *coeffs, u8 *out, s32 n)
+{
+	s32 sum;
+	int i, k;
+
+	i = 0;
+#ifdef CONFIG_KERNEL_MODE_NEON
+	if (n >= 8 && cpu_has_neon()) {
+		s16 taps[8] = { 0 };
+
+		for (k = 0; k < CPU_BLT_VTAPS; k++)
+			taps[k] = coeffs[k];
+		vfilter_line_neon(rows, taps, out, n >> 3);
+		i = n & ~7;
+	}
+#endif
+
+	for (; i < n; i++) {
+		sum = 0;
+		for (k = 0; k < CPU_BLT_VTAPS; k++)
+			sum += coeffs[k] * rows[k][i];
+		out[i] = clamp_u8((sum + 32) >> 6);
+	}
+}
+
+static void fill_line(u8 *line, const u8 *color, s32 n)
+{
+	for (; n > 0; n--, line += CPU_BLT_PIXEL_SIZE)
+		memcpy(line, color, CPU_BLT_PIXEL_SIZE);
+}
+
+/*
+ * Public functions
+ */
+
+bool b2r2_cpu_blt_supported(struct b2r2_control *cont,
+		struct b2r2_blt_request *request)
+{
+	struct b2r2_blt_req *req = &request->user_req;
+	struct b2r2_blt_rect src_img_rect;
+	struct b2r2_blt_rect bg_img_rect;
+	bool fill = req->flags & (B2R2_BLT_FLAG_SOURCE_FILL |
+			B2R2_BLT_FLAG_SOURCE_FILL_RAW);
+	s32 src_w, src_h;
+	u16 sf;
+
+	if (req->flags & CPU_BLT_UNSUPPORTED_FLAGS)
+		return false;
+
+	if (!fmt_bytes(req->dst_img.fmt) ||
+			b2r2_is_zero_area_rect(&req->dst_rect))
+		return false;
+
+	if ((req->flags & B2R2_BLT_FLAG_SOURCE_FILL_RAW) &&
+			(req->flags & CPU_BLT_BLEND_FLAGS))
+		return false;
+
+	if (req->flags & B2R2_BLT_FLAG_BG_BLEND) {
+		b2r2_get_img_bounding_rect(&req->bg_img, &bg_img_rect);
+		if (!fmt_bytes(req->bg_img.fmt) ||
+				req->bg_rect.width != req->dst_rect.width ||
+				req->bg_rect.height != req->dst_rect.height ||
+				!b2r2_is_rect_inside_rect(&req->bg_rect,
+					&bg_img_rect))
+			return false;
+	}
+
+	if (fill)
+		return true;
+
+	b2r2_get_img_bounding_rect(&req->src_img, &src_img_rect);
+	if (!fmt_bytes(req->src_img.fmt) ||
+			b2r2_is_zero_area_rect(&req->src_rect) ||
+			!b2r2_is_rect_inside_rect(&req->src_rect,
+				&src_img_rect))
+		return false;
+
+	if (req->transform & B2R2_BLT_TRANSFORM_CCW_ROT_90) {
+		src_w = req->src_rect.height;
+		src_h = req->src_rect.width;
+	} else {
+		src_w = req->src_rect.width;
+		src_h = req->src_rect.height;
+	}
+
+	return calculate_scale_factor(cont->dev, src_w,
+			req->dst_rect.width, &sf) >= 0 &&
+		calculate_scale_factor(cont->dev, src_h,
+			req->dst_rect.height, &sf) >= 0;
+}
+
+int b2r2_cpu_blt(struct b2r2_control *cont, struct b2r2_blt_request *request,
+		void *src_ptr, void *bg_ptr, void *dst_ptr)
+{
+	struct b2r2_blt_req *req = &request->user_req;
+	struct b2r2_blt_rect clip;
+	struct b2r2_blt_rect dst_img_rect;
+	struct cpu_blt_src src = { 0 };
+	struct cpu_blt_vmx src_vmx;
+	struct cpu_blt_vmx bg_vmx;
+	struct b2r2_filter_spec *hf = NULL;
+	struct b2r2_filter_spec *vf = NULL;
+	struct cpu_blt_vmx *bg_conv = NULL;
+	bool fullrange = req->flags & B2R2_BLT_FLAG_FULL_RANGE_YUV;
+	bool fill = req->flags & B2R2_BLT_FLAG_SOURCE_FILL;
+	bool fill_raw = req->flags & B2R2_BLT_FLAG_SOURCE_FILL_RAW;
+	bool bg_blend = req->flags & B2R2_BLT_FLAG_BG_BLEND;
+	bool per_pixel = req->flags & B2R2_BLT_FLAG_PER_PIXEL_ALPHA_BLEND;
+	bool blend;
+	u32 ga = 255;
+	u32 dst_pitch, dst_bpp, bg_pitch = 0, bg_bpp = 0;
+	u16 hsf = 1 << 10, vsf = 1 << 10;
+	u8 color[CPU_BLT_PIXEL_SIZE];
+	u8 *mem, *line = NULL, *out, *cur;
+	u8 *rows[CPU_BLT_VTAPS];
+	const u8 *taps[CPU_BLT_VTAPS];
+	s32 row_tag[CPU_BLT_VTAPS];
+	s32 tw = 0, th = 0;
+	s32 cw, x, y, dx, ty, k, c;
+	u32 pos;
+	const s8 *coeffs;
+	int i;
+
+	if (!b2r2_cpu_blt_supported(cont, request))
+		return -ENOSYS;
+
+	/* Clip to the destination image and the clip rectangle */
+	b2r2_get_img_bounding_rect(&req->dst_img, &dst_img_rect);
+	b2r2_intersect_rects(&req->dst_rect, &dst_img_rect, &clip);
+	if (req->flags & B2R2_BLT_FLAG_DESTINATION_CLIP)
+		b2r2_intersect_rects(&clip, &req->dst_clip_rect, &clip);
+	if (b2r2_is_zero_area_rect(&clip))
+		return 0;
+
+	dst_bpp = fmt_bytes(req->dst_img.fmt);
+	dst_pitch = b2r2_get_img_pitch(cont->dev, &req->dst_img);
+	cw = clip.width;
+
+	if (fill_raw) {
+		for (i = 0; i < dst_bpp; i++)
+			color[i] = req->src_color >> (8 * i);
+		for (y = clip.y; y < clip.y + clip.height; y++) {
+			cur = (u8 *)dst_ptr + y * dst_pitch + clip.x * dst_bpp;
+			for (x = 0; x < cw; x++, cur += dst_bpp)
+				memcpy(cur, color, dst_bpp);
+		}
+		return 0;
+	}
+
+	if (req->flags & B2R2_BLT_FLAG_GLOBAL_ALPHA_BLEND)
+		ga = req->global_alpha;
+
+	if (fill) {
+		/* ARGB8888 or AYUV8888 after the color space of dst */
+		color[CPU_BLT_A] = req->src_color >> 24;
+		if (fmt_is_yuv(req->dst_img.fmt)) {
+			color[CPU_BLT_C0] = req->src_color;
+			color[CPU_BLT_C1] = req->src_color >> 16;
+			color[CPU_BLT_C2] = req->src_color >> 8;
+		} else {
+			color[CPU_BLT_C0] = req->src_color >> 16;
+			color[CPU_BLT_C1] = req->src_color >> 8;
+			color[CPU_BLT_C2] = req->src_color;
+		}
+
+		/* The fill alpha goes into the global alpha */
+		if (per_pixel) {
+			ga = ga * color[CPU_BLT_A] / 255;
+			color[CPU_BLT_A] = 255;
+		}
+	} else {
+		src.fmt = req->src_img.fmt;
+		src.bpp = fmt_bytes(src.fmt);
+		src.pitch = b2r2_get_img_pitch(cont->dev, &req->src_img);
+		src.base = (u8 *)src_ptr + req->src_rect.y * src.pitch +
+			req->src_rect.x * src.bpp;
+		src.width = req->src_rect.width;
+		src.height = req->src_rect.height;
+		src.transform = req->transform;
+		src.vmx = get_vmx(src.fmt, req->dst_img.fmt, fullrange,
+				&src_vmx) ? &src_vmx : NULL;
+
+		/* Size of the source rectangle after the transform */
+		if (req->transform & B2R2_BLT_TRANSFORM_CCW_ROT_90) {
+			tw = src.height;
+			th = src.width;
+		} else {
+			tw = src.width;
+			th = src.height;
+		}
+		calculate_scale_factor(cont->dev, tw, req->dst_rect.width, &hsf);
+		calculate_scale_factor(cont->dev, th, req->dst_rect.height,
+			&vsf);
+
+		/* As in the node splitter, only filter on an actual rescale */
+		if (hsf != (1 << 10))
+			hf = b2r2_filter_find(hsf);
+		if (vsf != (1 << 10))
+			vf = b2r2_filter_find(vsf);
+	}
+
+	blend = ((req->flags & B2R2_BLT_FLAG_GLOBAL_ALPHA_BLEND) &&
+			ga != 255) || per_pixel || bg_blend;
+	ga = ga * 128 / 255;
+
+	if (bg_blend) {
+		bg_bpp = fmt_bytes(req->bg_img.fmt);
+		bg_pitch = b2r2_get_img_pitch(cont->dev, &req->bg_img);
+		bg_conv = get_vmx(req->bg_img.fmt, req->dst_img.fmt, fullrange,
+				&bg_vmx) ? &bg_vmx : NULL;
+	}
+
+	/*
+	 * One line for the unpacked source, the filtered source lines for
+	 * the vertical filter and one line for the result.
+	 */
+	mem = kmalloc((tw + 2 * CPU_BLT_HPAD + (CPU_BLT_VTAPS + 2) * cw) *
+			CPU_BLT_PIXEL_SIZE, GFP_KERNEL);
+	if (!mem)
+		return -ENOMEM;
+
+	out = mem;
+	cur = out + cw * CPU_BLT_PIXEL_SIZE;
+	for (i = 0; i < CPU_BLT_VTAPS; i++) {
+		rows[i] = cur + (i + 1) * cw * CPU_BLT_PIXEL_SIZE;
+		row_tag[i] = -1;
+	}
+	line = rows[CPU_BLT_VTAPS - 1] + cw * CPU_BLT_PIXEL_SIZE;
+
+	if (fill)
+		fill_line(cur, color, cw);
+
+	for (y = clip.y; y < clip.y + clip.height; y++) {
+		dx = clip.x - req->dst_rect.x;
+
+		if (!fill) {
+			pos = (u32)(y - req->dst_rect.y) * vsf;
+
+			/* Tap k weighs line i + 2 - k */
+			for (k = 0; k < (vf ? CPU_BLT_VTAPS : 1); k++) {
+				ty = (s32)(pos >> 10) + (vf ? 2 - k : 0);
+				ty = clamp(ty, 0, th - 1);
+				if (row_tag[ty % CPU_BLT_VTAPS] == ty)
+					continue;
+				fetch_line(&src, ty, line);
+				hfilter(line, rows[ty % CPU_BLT_VTAPS], dx, cw,
+					hsf, hf);
+				row_tag[ty % CPU_BLT_VTAPS] = ty;
+			}
+
+			ty = pos >> 10;
+			if (!vf) {
+				ty = min(ty, th - 1);
+				memcpy(cur, rows[ty % CPU_BLT_VTAPS],
+					cw * CPU_BLT_PIXEL_SIZE);
+			} else {
+				coeffs = (const s8 *)&vf->v_coeffs[
+					((pos >> 7) & 7) * CPU_BLT_VTAPS];
+				for (k = 0; k < CPU_BLT_VTAPS; k++) {
+					c = ty + 2 - k;
+					c = clamp(c, 0, th - 1);
+					taps[k] = rows[c % CPU_BLT_VTAPS];
+				}
+				vfilter_line(taps, coeffs, cur,
+					cw * CPU_BLT_PIXEL_SIZE);
+			}
+		}
+
+		if (!blend) {
+			pack_line(req->dst_img.fmt, cur, (u8 *)dst_ptr +
+				y * dst_pitch + clip.x * dst_bpp, cw);
+			cond_resched();
+			continue;
+		}
+
+		if (bg_blend) {
+			unpack_line(req->bg_img.fmt, (u8 *)bg_ptr +
+				(req->bg_rect.y + y - req->dst_rect.y) *
+				bg_pitch + (req->bg_rect.x + dx) * bg_bpp,
+				bg_bpp, out, cw);
+			if (bg_conv)
+				convert_line(bg_conv, out, cw);
+		} else {
+			unpack_line(req->dst_img.fmt, (u8 *)dst_ptr +
+				y * dst_pitch + clip.x * dst_bpp,
+				dst_bpp, out, cw);
+		}
+
+		blend_line(cur, out, cw, ga, per_pixel, !(req->flags &
+				B2R2_BLT_FLAG_SRC_IS_NOT_PREMULT));
+
+		pack_line(req->dst_img.fmt, out, (u8 *)dst_ptr +
+			y * dst_pitch + clip.x * dst_bpp, cw);
+		cond_resched();
+	}
+
+	kfree(mem);
+	return 0;
+}
@@ -0,0 +1,57 @@
+/*
+ * ST-Ericsson B2R2 CPU blitter
+ *
+ * License terms: GNU General Public License (GPL), version 2.
+ */
+
+#ifndef B2R2_CPU_BLT_H__
+#define B2R2_CPU_BLT_H__
+
+#include "b2r2_internal.h"
+
+/**
+ * b2r2_cpu_blt_supported() - Checks whether a request can be done on the CPU
+ *
+ * @cont: The b2r2 core control
+ * @request: The request, with the user request already validated
+ *
+ * Only single plane, one pixel per sample formats are handled, and neither
+ * color keys, masks, dither, blur nor color look-up tables.
+ */
+bool b2r2_cpu_blt_supported(struct b2r2_control *cont,
+		struct b2r2_blt_request *request);
+
+/**
+ * b2r2_cpu_blt() - Performs a blit request on the CPU
+ *
+ * @cont: The b2r2 core control
+ * @request: The request
+ * @src: Kernel address of the first byte of the source image
+ * @bg: Kernel address of the first byte of the background image, or NULL
+ *      if there is no background blend
+ * @dst: Kernel address of the first byte of the destination image
+ *
+ * The result follows what the node splitter programs into the hardware:
+ * color conversion with the VMX matrices of b2r2_hw_convert.c, rescale
+ * with the filters of b2r2_filters.c and blending in the 0...128 alpha
+ * range of the blender. Cache maintenance is left to the caller.
+ *
+ * Returns 0 if OK, -ENOSYS if the request is not supported and other
+ * negative error codes on failure.
+ */
+int b2r2_cpu_blt(struct b2r2_control *cont, struct b2r2_blt_request *request,
+		void *src, void *bg, void *dst);
+
+#ifdef CONFIG_DEBUG_FS
+/**
+ * b2r2_cpu_blt_check_init() - Adds the cpu_blt_check debugfs file
+ *
+ * @cont: The b2r2 core control
+ *
+ * Reading the file runs a set of blits on both the hardware and the CPU
+ * blitter, for all supported formats, and reports the ones that differ.
+ */
+void b2r2_cpu_blt_check_init(struct b2r2_control *cont);
+#endif
+
+#endif /* B2R2_CPU_BLT_H__ */
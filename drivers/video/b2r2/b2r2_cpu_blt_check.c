@@ -0,0 +1,417 @@
+/*
+ * ST-Ericsson B2R2 CPU blitter reference check
+ *
+ * Runs the same blits on the hardware and on the CPU blitter and compares
+ * the results byte for byte. Reading <debugfs>/b2r2/cpu_blt_check runs
+ * the check and reports every case that differs, followed by a summary.
+ *
+ * License terms: GNU General Public License (GPL), version 2.
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/fs.h>
+#include <linux/debugfs.h>
+#include <linux/dma-mapping.h>
+#include <linux/uaccess.h>
+#include <video/b2r2_blt.h>
+
+#include "b2r2_cpu_blt.h"
+#include "b2r2_internal.h"
+#include "b2r2_debug.h"
+#include "b2r2_utils.h"
+
+/*
+ * Macros and constants
+ */
+
+/* Not a multiple of eight, so that the NEON loops leave a tail */
+#define CHECK_WIDTH  29
+#define CHECK_HEIGHT 13
+
+/* Large enough for the biggest destination in 32 bits per pixel */
+#define CHECK_BUF_SIZE (64 * 32 * 4)
+
+#define CHECK_REPORT_SIZE (64 * 1024)
+
+#define CHECK_NO_FLUSH (B2R2_BLT_FLAG_SRC_NO_CACHE_FLUSH | \
+		B2R2_BLT_FLAG_DST_NO_CACHE_FLUSH | \
+		B2R2_BLT_FLAG_BG_NO_CACHE_FLUSH)
+
+/*
+ * Internal types
+ */
+
+/**
+ * struct check_case - A blit done for every format combination
+ *
+ * @name: Name in the report
+ * @flags: Request flags
+ * @transform: Request transform
+ * @dst_width: Width of the destination rectangle
+ * @dst_height: Height of the destination rectangle
+ */
+struct check_case {
+	const char *name;
+	u32 flags;
+	enum b2r2_blt_transform transform;
+	s32 dst_width;
+	s32 dst_height;
+};
+
+/**
+ * struct check_buf - A buffer the hardware can reach
+ *
+ * @virt: Kernel address
+ * @phys: Physical address
+ */
+struct check_buf {
+	void *virt;
+	dma_addr_t phys;
+};
+
+/**
+ * struct check_ctx - State of a check run
+ *
+ * @cont: The b2r2 core control
+ * @handle: Blitter handle for the hardware blits
+ * @src: Source buffer
+ * @bg: Background buffer
+ * @dst: Destination buffer written by the hardware
+ * @cpu_dst: Destination buffer written by the CPU
+ * @request: Request given to the CPU blitter
+ * @seed: State of the pattern generator
+ * @report: The report
+ * @size: Bytes in the report
+ */
+struct check_ctx {
+	struct b2r2_control *cont;
+	int handle;
+	struct check_buf src;
+	struct check_buf bg;
+	struct check_buf dst;
+	u8 *cpu_dst;
+	struct b2r2_blt_request *request;
+	u32 seed;
+	char *report;
+	size_t size;
+};
+
+static const enum b2r2_blt_fmt check_fmts[] = {
+	B2R2_BLT_FMT_16_BIT_ARGB4444,
+	B2R2_BLT_FMT_16_BIT_ABGR4444,
+	B2R2_BLT_FMT_16_BIT_ARGB1555,
+	B2R2_BLT_FMT_16_BIT_RGB565,
+	B2R2_BLT_FMT_24_BIT_RGB888,
+	B2R2_BLT_FMT_24_BIT_ARGB8565,
+	B2R2_BLT_FMT_24_BIT_YUV888,
+	B2R2_BLT_FMT_24_BIT_VUY888,
+	B2R2_BLT_FMT_32_BIT_ARGB8888,
+	B2R2_BLT_FMT_32_BIT_ABGR8888,
+	B2R2_BLT_FMT_32_BIT_AYUV8888,
+	B2R2_BLT_FMT_32_BIT_VUYA8888,
+};
+
+static const struct check_case check_cases[] = {
+	{ "copy", 0, B2R2_BLT_TRANSFORM_NONE,
+		CHECK_WIDTH, CHECK_HEIGHT },
+	{ "global alpha", B2R2_BLT_FLAG_GLOBAL_ALPHA_BLEND,
+		B2R2_BLT_TRANSFORM_NONE, CHECK_WIDTH, CHECK_HEIGHT },
+	{ "per pixel alpha", B2R2_BLT_FLAG_PER_PIXEL_ALPHA_BLEND,
+		B2R2_BLT_TRANSFORM_NONE, CHECK_WIDTH, CHECK_HEIGHT },
+	{ "per pixel alpha, not premult",
+		B2R2_BLT_FLAG_PER_PIXEL_ALPHA_BLEND |
+		B2R2_BLT_FLAG_SRC_IS_NOT_PREMULT,
+		B2R2_BLT_TRANSFORM_NONE, CHECK_WIDTH, CHECK_HEIGHT },
+	{ "per pixel and global alpha",
+		B2R2_BLT_FLAG_PER_PIXEL_ALPHA_BLEND |
+		B2R2_BLT_FLAG_GLOBAL_ALPHA_BLEND,
+		B2R2_BLT_TRANSFORM_NONE, CHECK_WIDTH, CHECK_HEIGHT },
+	{ "background blend",
+		B2R2_BLT_FLAG_BG_BLEND | B2R2_BLT_FLAG_PER_PIXEL_ALPHA_BLEND,
+		B2R2_BLT_TRANSFORM_NONE, CHECK_WIDTH, CHECK_HEIGHT },
+	{ "upscale", 0, B2R2_BLT_TRANSFORM_NONE, 45, 20 },
+	{ "downscale", 0, B2R2_BLT_TRANSFORM_NONE, 17, 7 },
+	{ "upscale, per pixel alpha", B2R2_BLT_FLAG_PER_PIXEL_ALPHA_BLEND,
+		B2R2_BLT_TRANSFORM_NONE, 45, 20 },
+	{ "rotate", 0, B2R2_BLT_TRANSFORM_CCW_ROT_90,
+		CHECK_HEIGHT, CHECK_WIDTH },
+	{ "rotate 180", 0, B2R2_BLT_TRANSFORM_CCW_ROT_180,
+		CHECK_WIDTH, CHECK_HEIGHT },
+	{ "flip, rotate and scale", 0, B2R2_BLT_TRANSFORM_FLIP_H_CCW_ROT_90,
+		20, 45 },
+	{ "fill", B2R2_BLT_FLAG_SOURCE_FILL, B2R2_BLT_TRANSFORM_NONE,
+		CHECK_WIDTH, CHECK_HEIGHT },
+	{ "fill, per pixel alpha", B2R2_BLT_FLAG_SOURCE_FILL |
+		B2R2_BLT_FLAG_PER_PIXEL_ALPHA_BLEND,
+		B2R2_BLT_TRANSFORM_NONE, CHECK_WIDTH, CHECK_HEIGHT },
+	{ "fill raw", B2R2_BLT_FLAG_SOURCE_FILL_RAW, B2R2_BLT_TRANSFORM_NONE,
+		CHECK_WIDTH, CHECK_HEIGHT },
+};
+
+/*
+ * Helpers
+ */
+
+static void check_printf(struct check_ctx *ctx, const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	ctx->size += vscnprintf(ctx->report + ctx->size,
+			CHECK_REPORT_SIZE - ctx->size, fmt, args);
+	va_end(args);
+}
+
+/* Deterministic pattern, so that a failing case can be repeated */
+static void check_pattern(struct check_ctx *ctx, u8 *p, size_t size)
+{
+	for (; size > 0; size--, p++) {
+		ctx->seed = ctx->seed * 1103515245 + 12345;
+		*p = ctx->seed >> 16;
+	}
+}
+
+static void check_set_img(struct check_ctx *ctx, struct b2r2_blt_img *img,
+		enum b2r2_blt_fmt fmt, struct check_buf *buf, s32 width,
+		s32 height)
+{
+	img->fmt = fmt;
+	img->buf.type = B2R2_BLT_PTR_PHYSICAL;
+	img->buf.offset = buf->phys;
+	img->buf.len = CHECK_BUF_SIZE;
+	img->width = width;
+	img->height = height;
+	img->pitch = width * b2r2_get_fmt_bpp(ctx->cont->dev, fmt) / 8;
+}
+
+static int check_alloc(struct check_ctx *ctx, struct check_buf *buf)
+{
+	buf->virt = dma_alloc_coherent(ctx->cont->dev, CHECK_BUF_SIZE,
+			&buf->phys, GFP_KERNEL);
+	return buf->virt ? 0 : -ENOMEM;
+}
+
+static void check_free(struct check_ctx *ctx, struct check_buf *buf)
+{
+	if (buf->virt)
+		dma_free_coherent(ctx->cont->dev, CHECK_BUF_SIZE, buf->virt,
+			buf->phys);
+}
+
+/**
+ * check_one() - Runs one blit on the hardware and on the CPU
+ *
+ * Returns 1 if the results are identical, 0 if they differ, -ENOSYS if
+ * the CPU blitter does not take the request and other negative error
+ * codes if the hardware fails it.
+ */
+static int check_one(struct check_ctx *ctx, const struct check_case *cc,
+		enum b2r2_blt_fmt src_fmt, enum b2r2_blt_fmt dst_fmt)
+{
+	struct b2r2_blt_req *req = &ctx->request->user_req;
+	size_t dst_size;
+	size_t i;
+	int ret;
+
+	memset(req, 0, sizeof(*req));
+	req->size = sizeof(*req);
+	req->flags = cc->flags | CHECK_NO_FLUSH;
+	req->transform = cc->transform;
+	req->global_alpha = 0xa5;
+	req->src_color = 0x80c04020;
+
+	/* The CPU blitter takes the fill color in the color space of dst */
+	if (cc->flags & B2R2_BLT_FLAG_SOURCE_FILL)
+		src_fmt = b2r2_is_yuv_fmt(dst_fmt) ?
+			B2R2_BLT_FMT_32_BIT_AYUV8888 :
+			B2R2_BLT_FMT_32_BIT_ARGB8888;
+
+	check_set_img(ctx, &req->src_img, src_fmt, &ctx->src, CHECK_WIDTH,
+		CHECK_HEIGHT);
+	req->src_rect.width = CHECK_WIDTH;
+	req->src_rect.height = CHECK_HEIGHT;
+
+	check_set_img(ctx, &req->dst_img, dst_fmt, &ctx->dst, cc->dst_width,
+		cc->dst_height);
+	req->dst_rect.width = cc->dst_width;
+	req->dst_rect.height = cc->dst_height;
+
+	if (cc->flags & B2R2_BLT_FLAG_BG_BLEND) {
+		check_set_img(ctx, &req->bg_img, src_fmt, &ctx->bg,
+			cc->dst_width, cc->dst_height);
+		req->bg_rect = req->dst_rect;
+	}
+
+	if (!b2r2_cpu_blt_supported(ctx->cont, ctx->request))
+		return -ENOSYS;
+
+	check_pattern(ctx, ctx->src.virt, CHECK_BUF_SIZE);
+	check_pattern(ctx, ctx->bg.virt, CHECK_BUF_SIZE);
+	check_pattern(ctx, ctx->dst.virt, CHECK_BUF_SIZE);
+	memcpy(ctx->cpu_dst, ctx->dst.virt, CHECK_BUF_SIZE);
+
+	/* Synchronous, the hardware is done when it returns */
+	ret = b2r2_blt_request(ctx->handle, req);
+	if (ret < 0)
+		return ret;
+
+	ret = b2r2_cpu_blt(ctx->cont, ctx->request, ctx->src.virt,
+			ctx->bg.virt, ctx->cpu_dst);
+	if (ret < 0)
+		return ret;
+
+	dst_size = req->dst_img.pitch * req->dst_img.height;
+	if (!memcmp(ctx->cpu_dst, ctx->dst.virt, dst_size))
+		return 1;
+
+	for (i = 0; i < dst_size; i++)
+		if (ctx->cpu_dst[i] != ((u8 *)ctx->dst.virt)[i])
+			break;
+	check_printf(ctx, "%-8s -> %-8s %-28s: differs at byte %zu, "
+		"hw %02x cpu %02x\n", b2r2_fmt_to_string(src_fmt),
+		b2r2_fmt_to_string(dst_fmt), cc->name, i,
+		((u8 *)ctx->dst.virt)[i], ctx->cpu_dst[i]);
+	return 0;
+}
+
+static void check_run(struct check_ctx *ctx)
+{
+	const struct check_case *cc;
+	bool fill;
+	int n_same = 0, n_diff = 0, n_skip = 0, n_fail = 0;
+	int c, s, d;
+	int ret;
+
+	for (c = 0; c < ARRAY_SIZE(check_cases); c++) {
+		cc = &check_cases[c];
+		fill = cc->flags & (B2R2_BLT_FLAG_SOURCE_FILL |
+				B2R2_BLT_FLAG_SOURCE_FILL_RAW);
+
+		/* A fill has no source, one source format is enough */
+		for (s = 0; s < (fill ? 1 : ARRAY_SIZE(check_fmts)); s++) {
+			for (d = 0; d < ARRAY_SIZE(check_fmts); d++) {
+				ret = check_one(ctx, cc, check_fmts[s],
+						check_fmts[d]);
+				if (ret == 1) {
+					n_same++;
+				} else if (ret == 0) {
+					n_diff++;
+				} else if (ret == -ENOSYS) {
+					n_skip++;
+				} else {
+					n_fail++;
+					check_printf(ctx, "%-8s -> %-8s "
+						"%-28s: failed (%d)\n",
+						b2r2_fmt_to_string(
+							check_fmts[s]),
+						b2r2_fmt_to_string(
+							check_fmts[d]),
+						cc->name, ret);
+				}
+			}
+		}
+	}
+
+	check_printf(ctx, "Identical : %d\n", n_same);
+	check_printf(ctx, "Different : %d\n", n_diff);
+	check_printf(ctx, "Failed    : %d\n", n_fail);
+	check_printf(ctx, "Skipped   : %d\n", n_skip);
+}
+
+/*
+ * Debugfs
+ */
+
+/**
+ * debugfs_cpu_blt_check_open() - Runs the check
+ *
+ * The report is kept for the reads of this open file.
+ */
+static int debugfs_cpu_blt_check_open(struct inode *inode, struct file *filp)
+{
+	struct check_ctx *ctx;
+	int ret;
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+
+	ctx->cont = inode->i_private;
+	ctx->seed = 1;
+	ctx->report = kzalloc(CHECK_REPORT_SIZE, GFP_KERNEL);
+	ctx->cpu_dst = kmalloc(CHECK_BUF_SIZE, GFP_KERNEL);
+	ctx->request = kzalloc(sizeof(*ctx->request), GFP_KERNEL);
+	if (!ctx->report || !ctx->cpu_dst || !ctx->request) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	ret = check_alloc(ctx, &ctx->src);
+	if (!ret)
+		ret = check_alloc(ctx, &ctx->bg);
+	if (!ret)
+		ret = check_alloc(ctx, &ctx->dst);
+	if (ret)
+		goto out;
+
+	ctx->handle = b2r2_blt_open();
+	if (ctx->handle < 0) {
+		ret = ctx->handle;
+		goto out;
+	}
+
+	check_run(ctx);
+	b2r2_blt_close(ctx->handle);
+
+out:
+	check_free(ctx, &ctx->dst);
+	check_free(ctx, &ctx->bg);
+	check_free(ctx, &ctx->src);
+	kfree(ctx->request);
+	kfree(ctx->cpu_dst);
+
+	if (ret) {
+		kfree(ctx->report);
+		kfree(ctx);
+		return ret;
+	}
+
+	filp->private_data = ctx;
+	return 0;
+}
+
+static ssize_t debugfs_cpu_blt_check_read(struct file *filp,
+		char __user *buf, size_t count, loff_t *f_pos)
+{
+	struct check_ctx *ctx = filp->private_data;
+
+	return simple_read_from_buffer(buf, count, f_pos, ctx->report,
+			ctx->size);
+}
+
+static int debugfs_cpu_blt_check_release(struct inode *inode,
+		struct file *filp)
+{
+	struct check_ctx *ctx = filp->private_data;
+
+	kfree(ctx->report);
+	kfree(ctx);
+	return 0;
+}
+
+static const struct file_operations debugfs_cpu_blt_check_fops = {
+	.owner = THIS_MODULE,
+	.open = debugfs_cpu_blt_check_open,
+	.read = debugfs_cpu_blt_check_read,
+	.release = debugfs_cpu_blt_check_release,
+};
+
+void b2r2_cpu_blt_check_init(struct b2r2_control *cont)
+{
+	if (!IS_ERR_OR_NULL(cont->debugfs_root_dir))
+		debugfs_create_file("cpu_blt_check", 0444,
+			cont->debugfs_root_dir, cont,
+			&debugfs_cpu_blt_check_fops);
+}
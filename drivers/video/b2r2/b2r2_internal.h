@@ -360,6 +360,11 @@ struct b2r2_node_split_job {
  *                     allocated by acquire_resources (i.e. SRAM alloc).
  * @release: Function that will be called when the reference count reaches
  *           zero.
+ * @execute_cpu: Function that performs the job on the CPU instead, or NULL
+ *               if the job can only run on the hardware. Called from the
+ *               CPU work queue when the hardware queues are saturated,
+ *               should return a negative error code to have the job
+ *               requeued for the hardware.
  *
  * @job_id: Unique id for this job, assigned by B2R2 core
  * @job_state: The current state of the job
@@ -368,6 +373,11 @@ struct b2r2_node_split_job {
  * @list: List entry element for internal list management
  * @event: Wait queue event to wait for job done
  * @work: Work queue structure, for callback implementation
+ * @cpu_work: Work queue structure, for running the job on the CPU
+ * @on_cpu: The job is in the CPU queue, waiting for or being performed
+ *          by the CPU
+ * @requeued: The job was moved from the CPU queue to the hardware before
+ *            the CPU got to it
  *
  * @queue: The queue that this job shall be submitted to
  * @control: B2R2 Queue control
@@ -393,6 +403,7 @@ struct b2r2_core_job {
 	void (*release_resources)(struct b2r2_core_job *,
 		bool atomic);
 	void (*release)(struct b2r2_core_job *);
+	int (*execute_cpu)(struct b2r2_core_job *);
 
 	/* Output data, do not modify */
 	int  job_id;
@@ -408,6 +419,9 @@ struct b2r2_core_job {
 	struct list_head  list;
 	wait_queue_head_t event;
 	struct work_struct work;
+	struct work_struct cpu_work;
+	bool on_cpu;
+	bool requeued;
 
 	/* B2R2 HW data */
 	enum b2r2_core_queue queue;
@@ -440,6 +454,8 @@ struct b2r2_core_job {
  * @src_mask_resolved:  Calculated info about the source mask buffer
  * @bg_resolved:        Calculated info about the background buffer
  * @dst_resolved:       Calculated info about the destination buffer
+ * @bufs_acquired:      True while the job holds the temporary buffers,
+ *                      which jobs performed on the CPU never do
  * @profile:            True if the blit shall be profiled, false otherwise
  * @ts_start:           Timestamp for start of job processing.
  * @nsec_active_in_cpu: Time between ts_start and that the hardware starts
@@ -466,6 +482,7 @@ struct b2r2_blt_request {
 	/* TBD: Info about SRAM usage & needs */
 	struct b2r2_work_buf *bufs;
 	u32 buf_count;
+	bool bufs_acquired;
 
 	/* color look-up table */
 	void *clut;
@@ -186,6 +186,8 @@ int inode_init_always(struct super_block *sb, struct inode *inode)
 	mapping->assoc_mapping = NULL;
 	mapping->backing_dev_info = &default_backing_dev_info;
 	mapping->writeback_index = 0;
+	/* Not the shadows of an evicted inode that lived here before */
+	workingset_forget(mapping);
 
 	/*
 	 * If the block_device provides a backing_dev_info for client
@@ -83,6 +83,7 @@
 #include <linux/pid_namespace.h>
 #include <linux/fs_struct.h>
 #include <linux/slab.h>
+#include <linux/ksm.h>
 #ifdef CONFIG_HARDWALL
 #include <asm/hardwall.h>
 #endif
@@ -1148,6 +1149,8 @@ err_sighand:
 	unlock_task_sighand(task, &flags);
 err_task_lock:
 	task_unlock(task);
+	if (!err)
+		lowmem_task_adj_changed(task);
 	put_task_struct(task);
 out:
 	return err < 0 ? err : count;
@@ -1283,6 +1286,8 @@ err_sighand:
 	unlock_task_sighand(task, &flags);
 err_task_lock:
 	task_unlock(task);
+	if (!err)
+		lowmem_task_adj_changed(task);
 	put_task_struct(task);
 out:
 	return err < 0 ? err : count;
@@ -1294,6 +1299,84 @@ static const struct file_operations proc_oom_score_adj_operations = {
 	.llseek		= default_llseek,
 };
 
+static ssize_t latency_nice_read(struct file *file, char __user *buf,
+				 size_t count, loff_t *ppos)
+{
+	struct task_struct *task = get_proc_task(file->f_path.dentry->d_inode);
+	char buffer[PROC_NUMBUF];
+	size_t len;
+
+	if (!task)
+		return -ESRCH;
+	len = snprintf(buffer, sizeof(buffer), "%d\n", task->se.latency_nice);
+	put_task_struct(task);
+	return simple_read_from_buffer(buf, count, ppos, buffer, len);
+}
+
+/*
+ * sched_set_latency_nice() checks the credentials of whoever opened the
+ * file, not of the writer, so that a privileged process cannot be fooled
+ * into writing to a descriptor passed in by someone else.
+ */
+static ssize_t latency_nice_write(struct file *file, const char __user *buf,
+				  size_t count, loff_t *ppos)
+{
+	const struct cred *old_cred;
+	struct task_struct *task;
+	char buffer[PROC_NUMBUF];
+	int latency_nice;
+	int err;
+
+	memset(buffer, 0, sizeof(buffer));
+	if (count > sizeof(buffer) - 1)
+		count = sizeof(buffer) - 1;
+	if (copy_from_user(buffer, buf, count))
+		return -EFAULT;
+
+	err = kstrtoint(strstrip(buffer), 0, &latency_nice);
+	if (err)
+		return err;
+
+	task = get_proc_task(file->f_path.dentry->d_inode);
+	if (!task)
+		return -ESRCH;
+	old_cred = override_creds(file->f_cred);
+	err = sched_set_latency_nice(task, latency_nice);
+	revert_creds(old_cred);
+	put_task_struct(task);
+
+	return err < 0 ? err : count;
+}
+
+/*
+ * Besides the owner, a task with CAP_SYS_NICE may open the file for
+ * writing, since sched_set_latency_nice() lets it change any thread.
+ */
+static int latency_nice_permission(struct inode *inode, int mask,
+				   unsigned int flags)
+{
+	int rwx = mask & (MAY_READ | MAY_WRITE | MAY_EXEC);
+
+	if (flags & IPERM_FLAG_RCU)
+		return -ECHILD;
+
+	if ((rwx & MAY_WRITE) && (inode->i_mode >> 6 & rwx) == rwx &&
+	    capable(CAP_SYS_NICE))
+		return 0;
+
+	return generic_permission(inode, mask, flags, NULL);
+}
+
+static const struct inode_operations proc_latency_nice_inode_operations = {
+	.permission	= latency_nice_permission,
+};
+
+static const struct file_operations proc_latency_nice_operations = {
+	.read		= latency_nice_read,
+	.write		= latency_nice_write,
+	.llseek		= default_llseek,
+};
+
 #ifdef CONFIG_AUDITSYSCALL
 #define TMPBUFLEN 21
 static ssize_t proc_loginuid_read(struct file * file, char __user * buf,
@@ -2814,6 +2897,27 @@ static int proc_pid_personality(struct seq_file *m, struct pid_namespace *ns,
 	return err;
 }
 
+#ifdef CONFIG_UKSM
+static int proc_pid_uksm_stat(struct seq_file *m, struct pid_namespace *ns,
+			      struct pid *pid, struct task_struct *task)
+{
+	struct mm_struct *mm = get_task_mm(task);
+
+	if (mm) {
+		seq_printf(m, "uksm_rmap_items %ld\n",
+			   atomic_long_read(&mm->uksm_rmap_items));
+		seq_printf(m, "uksm_merging_pages %ld\n",
+			   atomic_long_read(&mm->uksm_merging_pages));
+		seq_printf(m, "uksm_zero_pages %ld\n",
+			   atomic_long_read(&mm->uksm_zero_pages));
+		seq_printf(m, "uksm_process_profit %ld\n",
+			   uksm_process_profit(mm));
+		mmput(mm);
+	}
+	return 0;
+}
+#endif /* CONFIG_UKSM */
+
 /*
  * Thread groups
  */
@@ -2846,6 +2950,9 @@ static const struct pid_entry tgid_base_stuff[] = {
 	INF("cmdline",    S_IRUGO, proc_pid_cmdline),
 	ONE("stat",       S_IRUGO, proc_tgid_stat),
 	ONE("statm",      S_IRUGO, proc_pid_statm),
+#ifdef CONFIG_UKSM
+	ONE("uksm_stat",  S_IRUGO, proc_pid_uksm_stat),
+#endif
 	REG("maps",       S_IRUGO, proc_maps_operations),
 #ifdef CONFIG_NUMA
 	REG("numa_maps",  S_IRUGO, proc_numa_maps_operations),
@@ -2886,6 +2993,7 @@ static const struct pid_entry tgid_base_stuff[] = {
 	INF("oom_score",  S_IRUGO, proc_oom_score),
 	ANDROID("oom_adj",S_IRUGO|S_IWUSR, oom_adjust),
 	REG("oom_score_adj", S_IRUGO|S_IWUSR, proc_oom_score_adj_operations),
+	ANDROID("latency_nice", S_IRUGO|S_IWUSR, latency_nice),
 #ifdef CONFIG_AUDITSYSCALL
 	REG("loginuid",   S_IWUSR|S_IRUGO, proc_loginuid_operations),
 	REG("sessionid",  S_IRUGO, proc_sessionid_operations),
@@ -3192,6 +3300,9 @@ static const struct pid_entry tid_base_stuff[] = {
 	INF("cmdline",   S_IRUGO, proc_pid_cmdline),
 	ONE("stat",      S_IRUGO, proc_tid_stat),
 	ONE("statm",     S_IRUGO, proc_pid_statm),
+#ifdef CONFIG_UKSM
+	ONE("uksm_stat", S_IRUGO, proc_pid_uksm_stat),
+#endif
 	REG("maps",      S_IRUGO, proc_maps_operations),
 #ifdef CONFIG_NUMA
 	REG("numa_maps", S_IRUGO, proc_numa_maps_operations),
@@ -3231,6 +3342,7 @@ static const struct pid_entry tid_base_stuff[] = {
 	INF("oom_score", S_IRUGO, proc_oom_score),
 	REG("oom_adj",   S_IRUGO|S_IWUSR, proc_oom_adjust_operations),
 	REG("oom_score_adj", S_IRUGO|S_IWUSR, proc_oom_score_adj_operations),
+	ANDROID("latency_nice", S_IRUGO|S_IWUSR, latency_nice),
 #ifdef CONFIG_AUDITSYSCALL
 	REG("loginuid",  S_IWUSR|S_IRUGO, proc_loginuid_operations),
 	REG("sessionid",  S_IRUGO, proc_sessionid_operations),
@@ -42,6 +42,15 @@ enum ion_heap_type {
 #define ION_HEAP_SYSTEM_CONTIG_MASK	(1 << ION_HEAP_TYPE_SYSTEM_CONTIG)
 #define ION_HEAP_CARVEOUT_MASK		(1 << ION_HEAP_TYPE_CARVEOUT)
 
+/*
+ * Buffer flags, passed to ion_alloc() above the ION_NUM_HEAPS bits of the
+ * heap mask and honoured by the heaps that can.
+ *
+ * ION_FLAG_UNCACHED:	map the buffer write-combined rather than cached,
+ *			for buffers the CPU only streams into (system heap)
+ */
+#define ION_FLAG_UNCACHED		(1 << ION_NUM_HEAPS)
+
 #ifdef __KERNEL__
 struct ion_device;
 struct ion_heap;
@@ -63,6 +72,9 @@ struct ion_buffer;
  * @name:	used for debug purposes
  * @base:	base address of heap in physical memory if applicable
  * @size:	size of the heap in bytes if applicable
+ * @deferred_free_max:	if not zero, freed buffers are released by a
+ *		background thread, with up to this many bytes waiting;
+ *		0, the default, frees them synchronously
  *
  * Provided by the board file.
  */
@@ -72,6 +84,7 @@ struct ion_platform_heap {
 	const char *name;
 	ion_phys_addr_t base;
 	size_t size;
+	size_t deferred_free_max;
 };
 
 /**
@@ -111,7 +124,8 @@ void ion_client_destroy(struct ion_client *client);
  * @align:	requested allocation alignment, lots of hardware blocks have
  *		alignment requirements of some kind
  * @flags:	mask of heaps to allocate from, if multiple bits are set
- *		heaps will be tried in order from lowest to highest order bit
+ *		heaps will be tried in order from lowest to highest order bit,
+ *		or'ed with the ION_FLAG_* buffer flags
  *
  * Allocate memory in one of the heaps provided in heap mask and return
  * an opaque handle to it.
@@ -94,6 +94,10 @@ static inline void ksm_exit(struct mm_struct *mm)
 #elif defined(CONFIG_UKSM)
 static inline int ksm_fork(struct mm_struct *mm, struct mm_struct *oldmm)
 {
+	/* dup_mm() copied the parent's merge statistics */
+	atomic_long_set(&mm->uksm_rmap_items, 0);
+	atomic_long_set(&mm->uksm_merging_pages, 0);
+	atomic_long_set(&mm->uksm_zero_pages, 0);
 	return 0;
 }
 
@@ -70,6 +70,25 @@ extern unsigned long badness(struct task_struct *p, struct mem_cgroup *mem,
 
 extern struct task_struct *find_lock_task_mm(struct task_struct *p);
 
+/*
+ * The Android low memory killer keeps thread group leaders indexed by
+ * oom_adj. These are called under tasklist_lock (add, del, replace)
+ * or after a change to signal->oom_adj (adj_changed).
+ */
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+extern void lowmem_task_add(struct task_struct *p);
+extern void lowmem_task_del(struct task_struct *p);
+extern void lowmem_task_replace(struct task_struct *old,
+				struct task_struct *new);
+extern void lowmem_task_adj_changed(struct task_struct *p);
+#else
+static inline void lowmem_task_add(struct task_struct *p) {}
+static inline void lowmem_task_del(struct task_struct *p) {}
+static inline void lowmem_task_replace(struct task_struct *old,
+				struct task_struct *new) {}
+static inline void lowmem_task_adj_changed(struct task_struct *p) {}
+#endif
+
 /* sysctls */
 extern int sysctl_oom_dump_tasks;
 extern int sysctl_oom_kill_allocating_task;
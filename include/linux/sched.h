@@ -1162,6 +1162,7 @@ struct sched_statistics {
 	u64			nr_wakeups_remote;
 	u64			nr_wakeups_affine;
 	u64			nr_wakeups_affine_attempts;
+	u64			nr_wakeups_packed;
 	u64			nr_wakeups_passive;
 	u64			nr_wakeups_idle;
 };
@@ -1180,6 +1181,16 @@ struct sched_entity {
 
 	u64			nr_migrations;
 
+	/* wakeup latency attribute, see sched_set_latency_nice() */
+	int			latency_nice;
+
+#ifdef CONFIG_SMP
+	/* duty cycle estimate for wakeup packing, see update_task_util() */
+	unsigned long		util_avg;
+	u64			util_last_wakeup;
+	u64			util_last_exec;
+#endif
+
 #ifdef CONFIG_SCHEDSTATS
 	struct sched_statistics statistics;
 #endif
@@ -1284,6 +1295,9 @@ struct task_struct {
 #ifdef CONFIG_SMP
 	struct plist_node pushable_tasks;
 #endif
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+	struct hlist_node lowmem_node;	/* in the lowmemorykiller adj index */
+#endif
 
 	struct mm_struct *mm, *active_mm;
 #ifdef CONFIG_COMPAT_BRK
@@ -1596,6 +1610,9 @@ struct task_struct {
 #define MAX_RT_PRIO		MAX_USER_RT_PRIO
 
 #define MAX_PRIO		(MAX_RT_PRIO + 40)
+
+#define MIN_LATENCY_NICE	-20
+#define MAX_LATENCY_NICE	19
 #define DEFAULT_PRIO		(MAX_RT_PRIO + 20)
 
 static inline int rt_prio(int prio)
@@ -1969,6 +1986,13 @@ static inline void wake_up_idle_cpu(int cpu) { }
 
 extern void force_cpu_resched(int cpu);
 
+struct cpuidle_state;
+#ifdef CONFIG_CPU_IDLE
+extern void sched_idle_set_state(struct cpuidle_state *state);
+#else
+static inline void sched_idle_set_state(struct cpuidle_state *state) { }
+#endif
+
 extern unsigned int sysctl_sched_latency;
 extern unsigned int sysctl_sched_min_granularity;
 extern unsigned int sysctl_sched_wakeup_granularity;
@@ -1993,6 +2017,10 @@ int sched_proc_update_handler(struct ctl_table *table, int write,
 		void __user *buffer, size_t *length,
 		loff_t *ppos);
 #endif
+#ifdef CONFIG_SMP
+extern unsigned int sysctl_sched_pack_task_util;
+extern unsigned int sysctl_sched_pack_cpu_util;
+#endif
 #ifdef CONFIG_SCHED_DEBUG
 static inline unsigned int get_sysctl_timer_migration(void)
 {
@@ -2046,6 +2074,7 @@ extern void set_user_nice(struct task_struct *p, long nice);
 extern int task_prio(const struct task_struct *p);
 extern int task_nice(const struct task_struct *p);
 extern int can_nice(const struct task_struct *p, const int nice);
+extern int sched_set_latency_nice(struct task_struct *p, int latency_nice);
 extern int task_curr(const struct task_struct *p);
 extern int idle_cpu(int cpu);
 extern int sched_setscheduler(struct task_struct *, int,
@@ -24,11 +24,15 @@ extern struct page *empty_uksm_zero_page;
 extern void uksm_vma_add_new(struct vm_area_struct *vma);
 extern void uksm_remove_vma(struct vm_area_struct *vma);
 
+/* Bytes saved by merging @mm's pages, less the rmap_items it costs */
+extern long uksm_process_profit(struct mm_struct *mm);
+
 #define UKSM_SLOT_NEED_SORT	(1 << 0)
 #define UKSM_SLOT_NEED_RERAND 	(1 << 1)
 #define UKSM_SLOT_SCANNED     	(1 << 2) /* It's scanned in this round */
 #define UKSM_SLOT_FUL_SCANNED 	(1 << 3)
 #define UKSM_SLOT_IN_UKSM 	(1 << 4)
+#define UKSM_SLOT_IN_VISIT	(1 << 5) /* Handed to a scan worker */
 
 struct vma_slot {
 	struct sradix_tree_node *snode;
@@ -57,16 +61,20 @@ struct vma_slot {
 	struct list_head dedup_list;
 };
 
-static inline void uksm_unmap_zero_page(pte_t pte)
+static inline void uksm_unmap_zero_page(struct mm_struct *mm, pte_t pte)
 {
-	if (pte_pfn(pte) == uksm_zero_pfn)
+	if (pte_pfn(pte) == uksm_zero_pfn) {
 		__dec_zone_page_state(empty_uksm_zero_page, NR_UKSM_ZERO_PAGES);
+		atomic_long_dec(&mm->uksm_zero_pages);
+	}
 }
 
-static inline void uksm_map_zero_page(pte_t pte)
+static inline void uksm_map_zero_page(struct mm_struct *mm, pte_t pte)
 {
-	if (pte_pfn(pte) == uksm_zero_pfn)
+	if (pte_pfn(pte) == uksm_zero_pfn) {
 		__inc_zone_page_state(empty_uksm_zero_page, NR_UKSM_ZERO_PAGES);
+		atomic_long_inc(&mm->uksm_zero_pages);
+	}
 }
 
 static inline void uksm_cow_page(struct vm_area_struct *vma, struct page *page)
@@ -113,11 +121,11 @@ static inline void uksm_remove_vma(struct vm_area_struct *vma)
 {
 }
 
-static inline void uksm_unmap_zero_page(pte_t pte)
+static inline void uksm_unmap_zero_page(struct mm_struct *mm, pte_t pte)
 {
 }
 
-static inline void uksm_map_zero_page(pte_t pte)
+static inline void uksm_map_zero_page(struct mm_struct *mm, pte_t pte)
 {
 }
 
@@ -181,6 +181,7 @@ repeat:
 	write_lock_irq(&tasklist_lock);
 	tracehook_finish_release_task(p);
 	__exit_signal(p);
+	lowmem_task_del(p);
 
 	/*
 	 * If we are the last non-leader member of the thread
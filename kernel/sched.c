@@ -72,6 +72,7 @@
 #include <linux/ftrace.h>
 #include <linux/slab.h>
 #include <linux/cpuacct.h>
+#include <linux/cpuidle.h>
 
 #include <asm/tlb.h>
 #include <asm/irq_regs.h>
@@ -570,6 +571,11 @@ struct rq {
 #ifdef CONFIG_SMP
 	struct task_struct *wake_list;
 #endif
+
+#ifdef CONFIG_CPU_IDLE
+	/* cpuidle state this cpu is sleeping in, NULL while it runs */
+	struct cpuidle_state *idle_state;
+#endif
 };
 
 static DEFINE_PER_CPU_SHARED_ALIGNED(struct rq, runqueues);
@@ -651,6 +657,41 @@ static inline struct task_group *task_group(struct task_struct *p)
 
 #endif /* CONFIG_CGROUP_SCHED */
 
+#ifdef CONFIG_CPU_IDLE
+/**
+ * sched_idle_set_state - record the idle state of the current cpu
+ * @state: cpuidle state about to be entered, or NULL on the way out
+ *
+ * Lets wakeup placement see how deeply an idle cpu sleeps. Called by
+ * cpuidle with interrupts disabled; the state must stay valid until it
+ * is cleared again, which cpuidle_uninstall_idle_handler() waits for.
+ */
+void sched_idle_set_state(struct cpuidle_state *state)
+{
+	rcu_assign_pointer(this_rq()->idle_state, state);
+}
+
+/* Exit latency in usecs of the idle state @cpu is in, 0 if it runs */
+static inline unsigned int idle_exit_latency(int cpu)
+{
+	struct cpuidle_state *state;
+	unsigned int latency = 0;
+
+	rcu_read_lock();
+	state = rcu_dereference(cpu_rq(cpu)->idle_state);
+	if (state)
+		latency = state->exit_latency;
+	rcu_read_unlock();
+
+	return latency;
+}
+#else
+static inline unsigned int idle_exit_latency(int cpu)
+{
+	return 0;
+}
+#endif
+
 static void update_rq_clock_task(struct rq *rq, s64 delta);
 
 static void update_rq_clock(struct rq *rq)
@@ -2860,6 +2901,12 @@ static void __sched_fork(struct task_struct *p)
 	p->se.vruntime			= 0;
 	INIT_LIST_HEAD(&p->se.group_node);
 
+#ifdef CONFIG_SMP
+	p->se.util_avg			= SCHED_POWER_SCALE;
+	p->se.util_last_wakeup		= 0;
+	p->se.util_last_exec		= 0;
+#endif
+
 #ifdef CONFIG_SCHEDSTATS
 	memset(&p->se.statistics, 0, sizeof(p->se.statistics));
 #endif
@@ -2902,6 +2949,9 @@ void sched_fork(struct task_struct *p)
 			set_load_weight(p);
 		}
 
+		if (p->se.latency_nice < 0)
+			p->se.latency_nice = 0;
+
 		/*
 		 * We don't need the reset flag anymore after the fork. It has
 		 * fulfilled its duty:
@@ -5203,6 +5253,39 @@ static bool check_same_owner(struct task_struct *p)
 	return match;
 }
 
+/**
+ * sched_set_latency_nice - set the wakeup latency attribute of a task
+ * @p: the task in question.
+ * @latency_nice: MIN_LATENCY_NICE (most latency sensitive) to
+ *	MAX_LATENCY_NICE (most latency tolerant), 0 being the default.
+ *
+ * Latency nice biases wakeup preemption and the slice length of CFS
+ * tasks. It leaves their load weight alone, so the CPU share of a task
+ * is still set by its nice level alone. Making a task more latency
+ * sensitive than it is, or changing a task of another user, requires
+ * CAP_SYS_NICE.
+ */
+int sched_set_latency_nice(struct task_struct *p, int latency_nice)
+{
+	unsigned long flags;
+	struct rq *rq;
+
+	if (latency_nice < MIN_LATENCY_NICE || latency_nice > MAX_LATENCY_NICE)
+		return -EINVAL;
+
+	if (!check_same_owner(p) && !capable(CAP_SYS_NICE))
+		return -EPERM;
+
+	if (latency_nice < p->se.latency_nice && !capable(CAP_SYS_NICE))
+		return -EACCES;
+
+	rq = task_rq_lock(p, &flags);
+	p->se.latency_nice = latency_nice;
+	task_rq_unlock(rq, p, &flags);
+
+	return 0;
+}
+
 static int __sched_setscheduler(struct task_struct *p, int policy,
 				const struct sched_param *param, bool user)
 {
@@ -451,6 +451,7 @@ void proc_sched_show_task(struct task_struct *p, struct seq_file *m)
 	P(se.statistics.nr_wakeups_remote);
 	P(se.statistics.nr_wakeups_affine);
 	P(se.statistics.nr_wakeups_affine_attempts);
+	P(se.statistics.nr_wakeups_packed);
 	P(se.statistics.nr_wakeups_passive);
 	P(se.statistics.nr_wakeups_idle);
 
@@ -482,6 +483,10 @@ void proc_sched_show_task(struct task_struct *p, struct seq_file *m)
 		   "nr_involuntary_switches", (long long)p->nivcsw);
 
 	P(se.load.weight);
+	P(se.latency_nice);
+#ifdef CONFIG_SMP
+	P(se.util_avg);
+#endif
 	P(policy);
 	P(prio);
 #undef PN
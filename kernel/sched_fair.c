@@ -23,6 +23,7 @@
 #include <linux/latencytop.h>
 #include <linux/sched.h>
 #include <linux/cpumask.h>
+#include <linux/cpufreq.h>
 
 /*
  * Targeted preemption latency for CPU-bound tasks:
@@ -89,6 +90,20 @@ const_debug unsigned int sysctl_sched_migration_cost = 500000UL;
  */
 unsigned int __read_mostly sysctl_sched_shares_window = 10000000UL;
 
+#ifdef CONFIG_SMP
+/*
+ * Wakeup packing: a task that runs for less than sched_pack_task_util
+ * percent of a cpu at its highest OPP is woken on a cpu that is already
+ * busy, provided that this keeps the busy cpu below sched_pack_cpu_util
+ * percent of its capacity at its current OPP. Leaving the other cpu
+ * idle saves its wakeup and, once the busy cpu is done too, lets the
+ * whole cluster reach the deeper idle states.
+ * (default: 20% and 80%, sched_pack_task_util = 0 disables packing)
+ */
+unsigned int __read_mostly sysctl_sched_pack_task_util = 20;
+unsigned int __read_mostly sysctl_sched_pack_cpu_util = 80;
+#endif
+
 static const struct sched_class fair_sched_class;
 
 /**************************************************************
@@ -508,6 +523,20 @@ static u64 __sched_period(unsigned long nr_running)
 	return period;
 }
 
+/*
+ * Latency nice scales the slice by 1/64 per step: -20 runs a task in
+ * slices of about 70% of its fair share of the period, +19 in slices of
+ * 130%. Only the length of each turn changes, not the share of the
+ * period, which vruntime keeps tracking by weight.
+ */
+static u64 latency_scale_slice(u64 slice, int latency_nice)
+{
+	u64 scaled = (slice * (64 + latency_nice)) >> 6;
+
+	/* Shorten down to the minimum granularity, but never lengthen */
+	return max(scaled, min_t(u64, slice, sysctl_sched_min_granularity));
+}
+
 /*
  * We calculate the wall-time slice from the period by taking a part
  * proportional to the weight.
@@ -517,6 +546,7 @@ static u64 __sched_period(unsigned long nr_running)
 static u64 sched_slice(struct cfs_rq *cfs_rq, struct sched_entity *se)
 {
 	u64 slice = __sched_period(cfs_rq->nr_running + !se->on_rq);
+	int latency_nice = se->latency_nice;
 
 	for_each_sched_entity(se) {
 		struct load_weight *load;
@@ -533,6 +563,10 @@ static u64 sched_slice(struct cfs_rq *cfs_rq, struct sched_entity *se)
 		}
 		slice = calc_delta_mine(slice, se->load.weight, load);
 	}
+
+	if (sched_feat(LATENCY_NICE) && latency_nice)
+		slice = latency_scale_slice(slice, latency_nice);
+
 	return slice;
 }
 
@@ -1316,6 +1350,113 @@ static inline void hrtick_update(struct rq *rq)
 }
 #endif
 
+#ifdef CONFIG_SMP
+
+/*
+ * Share of its capacity a cpu offers at its current OPP, in
+ * SCHED_POWER_SCALE units, kept up to date by cpufreq notifications.
+ */
+static DEFINE_PER_CPU(unsigned long, cpu_freq_capacity) = SCHED_POWER_SCALE;
+
+static inline unsigned long freq_capacity_of(int cpu)
+{
+	return per_cpu(cpu_freq_capacity, cpu);
+}
+
+/*
+ * The duty cycle of a task: the share of the time between two of its
+ * wakeups that it spent running, in SCHED_POWER_SCALE units. Samples are
+ * scaled by the OPP the cpu was running at, so that the estimate is that
+ * of a cpu at its highest frequency, and averaged over the last few
+ * periods. Tasks start out as fully busy until their wakeups show
+ * otherwise.
+ */
+static void update_task_util(struct rq *rq, struct sched_entity *se)
+{
+	u64 period = rq->clock - se->util_last_wakeup;
+	u64 runtime = se->sum_exec_runtime - se->util_last_exec;
+	unsigned long sample;
+
+	if (se->util_last_wakeup && period) {
+		if (runtime > period)
+			runtime = period;
+		sample = div64_u64(runtime << SCHED_POWER_SHIFT, period);
+		sample = (sample * freq_capacity_of(cpu_of(rq))) >>
+			 SCHED_POWER_SHIFT;
+		se->util_avg = (se->util_avg * 3 + sample) >> 2;
+	}
+
+	se->util_last_wakeup = rq->clock;
+	se->util_last_exec = se->sum_exec_runtime;
+}
+
+#ifdef CONFIG_CPU_FREQ
+static void set_freq_capacity(int cpu, unsigned int cur, unsigned int max)
+{
+	if (!cur || !max)
+		return;
+
+	per_cpu(cpu_freq_capacity, cpu) =
+		min_t(unsigned long, SCHED_POWER_SCALE,
+		      ((unsigned long)cur << SCHED_POWER_SHIFT) / max);
+}
+
+static DEFINE_PER_CPU(unsigned int, cpu_freq_max);
+
+static int sched_freq_transition(struct notifier_block *nb,
+				 unsigned long val, void *data)
+{
+	struct cpufreq_freqs *freqs = data;
+
+	if (val == CPUFREQ_POSTCHANGE)
+		set_freq_capacity(freqs->cpu, freqs->new,
+				  per_cpu(cpu_freq_max, freqs->cpu));
+	return NOTIFY_OK;
+}
+
+static int sched_freq_policy(struct notifier_block *nb,
+			     unsigned long val, void *data)
+{
+	struct cpufreq_policy *policy = data;
+	int cpu;
+
+	if (val != CPUFREQ_NOTIFY)
+		return NOTIFY_OK;
+
+	for_each_cpu(cpu, policy->cpus) {
+		per_cpu(cpu_freq_max, cpu) = policy->cpuinfo.max_freq;
+		set_freq_capacity(cpu, policy->cur, policy->cpuinfo.max_freq);
+	}
+	return NOTIFY_OK;
+}
+
+static struct notifier_block sched_freq_transition_nb = {
+	.notifier_call = sched_freq_transition,
+};
+
+static struct notifier_block sched_freq_policy_nb = {
+	.notifier_call = sched_freq_policy,
+};
+
+static int __init sched_freq_init(void)
+{
+	cpufreq_register_notifier(&sched_freq_transition_nb,
+				  CPUFREQ_TRANSITION_NOTIFIER);
+	cpufreq_register_notifier(&sched_freq_policy_nb,
+				  CPUFREQ_POLICY_NOTIFIER);
+	return 0;
+}
+core_initcall(sched_freq_init);
+#endif /* CONFIG_CPU_FREQ */
+
+#else
+
+static inline void update_task_util(struct rq *rq, struct sched_entity *se)
+{
+}
+
+#endif /* CONFIG_SMP */
+
 /*
  * The enqueue_task method is called before nr_running is
  * increased. Here we update the fair scheduling stats and
@@ -1327,6 +1468,9 @@ enqueue_task_fair(struct rq *rq, struct task_struct *p, int flags)
 	struct cfs_rq *cfs_rq;
 	struct sched_entity *se = &p->se;
 
+	if (flags & ENQUEUE_WAKEUP)
+		update_task_util(rq, se);
+
 	for_each_sched_entity(se) {
 		if (se->on_rq)
 			break;
@@ -1614,7 +1758,9 @@ find_idlest_cpu(struct sched_group *group, struct task_struct *p, int this_cpu)
 	for_each_cpu_and(i, sched_group_cpus(group), &p->cpus_allowed) {
 		load = weighted_cpuload(i);
 
-		if (load < min_load || (load == min_load && i == this_cpu)) {
+		/* Among equally loaded cpus, wake the one that sleeps least */
+		if (load < min_load || (load == min_load && (i == this_cpu ||
+		    idle_exit_latency(i) < idle_exit_latency(idlest)))) {
 			min_load = load;
 			idlest = i;
 		}
@@ -1623,6 +1769,67 @@ find_idlest_cpu(struct sched_group *group, struct task_struct *p, int this_cpu)
 	return idlest;
 }
 
+/*
+ * Load a task would add to @cpu: its duty cycle, stretched by the OPP
+ * @cpu is running at, weighted like the cpu load it is compared with.
+ */
+static unsigned long pack_task_load(struct task_struct *p, int cpu)
+{
+	unsigned long util = p->se.util_avg << SCHED_POWER_SHIFT;
+
+	util /= max(freq_capacity_of(cpu), 1UL);
+	if (util > SCHED_POWER_SCALE)
+		util = SCHED_POWER_SCALE;
+
+	return (util * p->se.load.weight) >> SCHED_POWER_SHIFT;
+}
+
+/*
+ * Try to pack a small task onto a cpu of @sd that is already busy, so
+ * that an idle cpu does not have to be woken for it. @target, the cpu
+ * wake_affine() settled on, is preferred if it is busy and has room;
+ * otherwise the busiest cpu with room is taken, which keeps the others
+ * free for bigger tasks.
+ *
+ * source_load() only counts cfs tasks. The time taken by rt tasks comes
+ * off power_of() through scale_rt_power(), but only as of the last load
+ * balance, so a cpu with rt tasks queued right now is not packed onto:
+ * @p would wait for all of them.
+ *
+ * Returns -1 if @p is not small or no busy cpu has room for it.
+ */
+static int select_pack_cpu(struct sched_domain *sd, struct task_struct *p,
+			   int target)
+{
+	unsigned long small, load, capacity, max_load = 0;
+	int i, pack_cpu = -1;
+
+	small = sysctl_sched_pack_task_util * SCHED_POWER_SCALE / 100;
+	if (p->se.util_avg > small)
+		return -1;
+
+	for_each_cpu_and(i, sched_domain_span(sd), &p->cpus_allowed) {
+		if (idle_cpu(i) || cpu_rq(i)->rt.rt_nr_running)
+			continue;
+
+		load = source_load(i, sd->busy_idx) + pack_task_load(p, i);
+		capacity = power_of(i) * sysctl_sched_pack_cpu_util / 100;
+		capacity = (capacity * NICE_0_LOAD) >> SCHED_POWER_SHIFT;
+		if (load > capacity)
+			continue;
+
+		if (i == target)
+			return i;
+
+		if (pack_cpu < 0 || load > max_load) {
+			max_load = load;
+			pack_cpu = i;
+		}
+	}
+
+	return pack_cpu;
+}
+
 /*
  * Try and locate an idle CPU in the sched_domain.
  */
@@ -1631,6 +1838,7 @@ static int select_idle_sibling(struct task_struct *p, int target)
 	int cpu = smp_processor_id();
 	int prev_cpu = task_cpu(p);
 	struct sched_domain *sd;
+	unsigned int latency, min_latency;
 	int i;
 
 	/*
@@ -1655,10 +1863,21 @@ static int select_idle_sibling(struct task_struct *p, int target)
 		if (!(sd->flags & SD_SHARE_PKG_RESOURCES))
 			break;
 
+		/*
+		 * Prefer the idle cpu in the shallowest state: it wakes up
+		 * soonest and, on a cluster, leaves the deeper states to
+		 * cpus that got there together.
+		 */
+		min_latency = UINT_MAX;
 		for_each_cpu_and(i, sched_domain_span(sd), &p->cpus_allowed) {
 			if (idle_cpu(i)) {
-				target = i;
-				break;
+				latency = idle_exit_latency(i);
+				if (latency < min_latency) {
+					min_latency = latency;
+					target = i;
+				}
+				if (!latency)
+					break;
 			}
 		}
 
@@ -1756,6 +1975,14 @@ select_task_rq_fair(struct task_struct *p, int sd_flag, int wake_flags)
 		if (cpu == prev_cpu || wake_affine(affine_sd, p, sync))
 			prev_cpu = cpu;
 
+		if (sysctl_sched_pack_task_util) {
+			new_cpu = select_pack_cpu(affine_sd, p, prev_cpu);
+			if (new_cpu >= 0) {
+				schedstat_inc(p, se.statistics.nr_wakeups_packed);
+				goto unlock;
+			}
+		}
+
 		new_cpu = select_idle_sibling(p, prev_cpu);
 		goto unlock;
 	}
@@ -1826,6 +2053,19 @@ wakeup_gran(struct sched_entity *curr, struct sched_entity *se)
 	return calc_delta_fair(gran, se);
 }
 
+/*
+ * Latency nice moves an entity's position for wakeup preemption by up
+ * to one sched_latency period: a waking task at -20 preempts a current
+ * task that is up to sysctl_sched_latency ahead of it in vruntime, a
+ * current task at +19 is preempted about that much earlier. Nothing is
+ * charged to vruntime, so the fair share is unchanged.
+ */
+static inline s64 latency_offset(struct sched_entity *se)
+{
+	return (s64)(sysctl_sched_latency / -MIN_LATENCY_NICE) *
+		se->latency_nice;
+}
+
 /*
  * Should 'se' preempt 'curr'.
  *
@@ -1845,6 +2085,9 @@ wakeup_preempt_entity(struct sched_entity *curr, struct sched_entity *se)
 {
 	s64 gran, vdiff = curr->vruntime - se->vruntime;
 
+	if (sched_feat(LATENCY_NICE))
+		vdiff += latency_offset(curr) - latency_offset(se);
+
 	if (vdiff <= 0)
 		return -1;
 
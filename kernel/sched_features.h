@@ -72,3 +72,8 @@ SCHED_FEAT(NONIRQ_POWER, 1)
 SCHED_FEAT(TTWU_QUEUE, 1)
 
 SCHED_FEAT(FORCE_SD_OVERLAP, 0)
+
+/*
+ * Let the latency nice of tasks bias wakeup preemption and slice length
+ */
+SCHED_FEAT(LATENCY_NICE, 1)
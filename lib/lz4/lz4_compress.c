@@ -0,0 +1,136 @@
+/*
+ * LZ4 - Fast LZ compression algorithm
+ *
+ * Greedy single-pass compressor producing the LZ4 block format. It
+ * keeps one hash table of the last position seen for each 4-byte
+ * sequence, so it needs LZ4_MEM_COMPRESS bytes of working memory and
+ * no other state.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include <asm/unaligned.h>
+#include "lz4defs.h"
+
+static inline u32 lz4_hash(const unsigned char *p)
+{
+	return (get_unaligned((const u32 *)p) * 2654435761U) >> LZ4_HASH_SHIFT;
+}
+
+static inline unsigned char *lz4_put_length(unsigned char *op, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = (unsigned char)len;
+
+	return op;
+}
+
+int lz4_compress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len, void *wrkmem)
+{
+	u32 * const table = wrkmem;
+	const unsigned char *ip = src, *anchor = src;
+	const unsigned char * const iend = src + src_len;
+	const unsigned char * const mflimit = iend - MFLIMIT;
+	const unsigned char * const matchlimit = iend - LASTLITERALS;
+	unsigned char *op = dst, *token;
+	unsigned char * const oend = dst + *dst_len;
+	size_t litlen, mlen;
+
+	if (src_len < MFLIMIT + 1)
+		goto last_literals;
+
+	memset(table, 0, LZ4_MEM_COMPRESS);
+	ip++;
+
+	while (ip < mflimit) {
+		const unsigned char *ref, *p, *r;
+		u32 h = lz4_hash(ip);
+
+		ref = src + table[h];
+		table[h] = ip - src;
+
+		if (ip - ref > MAX_DISTANCE || ref == ip ||
+				get_unaligned((const u32 *)ref) !=
+				get_unaligned((const u32 *)ip)) {
+			ip++;
+			continue;
+		}
+
+		/* Extend the match backwards into pending literals */
+		while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+		}
+
+		p = ip + MINMATCH;
+		r = ref + MINMATCH;
+		while (p < matchlimit && *p == *r) {
+			p++;
+			r++;
+		}
+
+		litlen = ip - anchor;
+		mlen = p - ip - MINMATCH;
+
+		/* token + literals + offset + length bytes */
+		if (op + 1 + litlen + litlen / 255 + 1 + 2 +
+				mlen / 255 + 1 > oend)
+			return -E2BIG;
+
+		token = op++;
+		if (litlen >= RUN_MASK) {
+			*token = RUN_MASK << ML_BITS;
+			op = lz4_put_length(op, litlen - RUN_MASK);
+		} else {
+			*token = litlen << ML_BITS;
+		}
+		memcpy(op, anchor, litlen);
+		op += litlen;
+
+		put_unaligned_le16(ip - ref, op);
+		op += 2;
+
+		if (mlen >= ML_MASK) {
+			*token |= ML_MASK;
+			op = lz4_put_length(op, mlen - ML_MASK);
+		} else {
+			*token |= mlen;
+		}
+
+		ip = anchor = p;
+
+		/* Index a position inside the match for the next lookup */
+		if (ip < mflimit)
+			table[lz4_hash(ip - 2)] = ip - 2 - src;
+	}
+
+last_literals:
+	litlen = iend - anchor;
+	if (op + 1 + litlen + litlen / 255 + 1 > oend)
+		return -E2BIG;
+
+	token = op++;
+	if (litlen >= RUN_MASK) {
+		*token = RUN_MASK << ML_BITS;
+		op = lz4_put_length(op, litlen - RUN_MASK);
+	} else {
+		*token = litlen << ML_BITS;
+	}
+	memcpy(op, anchor, litlen);
+	op += litlen;
+
+	*dst_len = op - dst;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(lz4_compress);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 compressor");
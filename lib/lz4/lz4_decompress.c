@@ -0,0 +1,94 @@
+/*
+ * LZ4 Decompressor for Linux kernel
+ *
+ * Every length and offset read from the input is checked against both
+ * buffers, so corrupted or malicious input cannot cause an overrun.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include <asm/unaligned.h>
+#include "lz4defs.h"
+
+static inline int lz4_get_length(const unsigned char **ip,
+			const unsigned char *iend, size_t *len)
+{
+	unsigned int s;
+
+	do {
+		if (*ip >= iend)
+			return -EINVAL;
+		s = *(*ip)++;
+		*len += s;
+	} while (s == 255);
+
+	return 0;
+}
+
+int lz4_decompress_unknownoutputsize(const unsigned char *src, size_t src_len,
+		unsigned char *dest, size_t *dest_len)
+{
+	const unsigned char *ip = src;
+	const unsigned char * const iend = src + src_len;
+	unsigned char *op = dest;
+	unsigned char * const oend = dest + *dest_len;
+	const unsigned char *ref;
+	unsigned int token;
+	size_t len, offset;
+
+	while (ip < iend) {
+		token = *ip++;
+
+		/* Literal run */
+		len = token >> ML_BITS;
+		if (len == RUN_MASK && lz4_get_length(&ip, iend, &len))
+			return -EINVAL;
+		if (len > (size_t)(iend - ip) || len > (size_t)(oend - op))
+			return -EINVAL;
+		memcpy(op, ip, len);
+		op += len;
+		ip += len;
+
+		/* The last sequence carries literals only */
+		if (ip == iend)
+			break;
+
+		/* Match */
+		if (iend - ip < 2)
+			return -EINVAL;
+		offset = get_unaligned_le16(ip);
+		ip += 2;
+		if (!offset || offset > (size_t)(op - dest))
+			return -EINVAL;
+		ref = op - offset;
+
+		len = token & ML_MASK;
+		if (len == ML_MASK && lz4_get_length(&ip, iend, &len))
+			return -EINVAL;
+		len += MINMATCH;
+		if (len > (size_t)(oend - op))
+			return -EINVAL;
+
+		if (offset >= len) {
+			memcpy(op, ref, len);
+			op += len;
+		} else {
+			/* Overlapping copy repeats the last 'offset' bytes */
+			while (len--)
+				*op++ = *ref++;
+		}
+	}
+
+	*dest_len = op - dest;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(lz4_decompress_unknownoutputsize);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Decompressor");
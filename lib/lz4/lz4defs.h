@@ -0,0 +1,31 @@
+/*
+ * lz4defs.h -- architecture specific defines
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * Each sequence starts with a token: the high nibble is the literal
+ * run length, the low nibble the match length minus MINMATCH. A nibble
+ * value of 15 means more length bytes follow, each adding up to 255.
+ */
+#define MINMATCH	4
+#define ML_BITS		4
+#define ML_MASK		((1U << ML_BITS) - 1)
+#define RUN_BITS	(8 - ML_BITS)
+#define RUN_MASK	((1U << RUN_BITS) - 1)
+
+/* Matches are encoded as a 16-bit little endian backwards offset */
+#define MAX_DISTANCE	((1 << 16) - 1)
+
+/*
+ * The format requires the last LASTLITERALS bytes to be literals and
+ * the last match to start at least MFLIMIT bytes before the end.
+ */
+#define LASTLITERALS	5
+#define MFLIMIT		(COPYLENGTH + MINMATCH)
+#define COPYLENGTH	8
+
+#define LZ4_HASH_SHIFT	((MINMATCH * 8) - LZ4_HASH_LOG)
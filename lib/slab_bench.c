@@ -0,0 +1,371 @@
+/*
+ * Slab allocator micro-benchmark
+ *
+ * Runs the same allocation patterns against whichever slab allocator the
+ * kernel was built with (SLAB, SLUB or SLQB), so that two kernels differing
+ * only in the allocator can be compared on identical workloads:
+ *
+ *  - pair:   allocate and immediately free one object, repeatedly.
+ *  - batch:  allocate nr_objects objects, then free them all.
+ *  - remote: allocate nr_objects objects on cpu_alloc, free them on
+ *            cpu_free; reports the per-object free latency seen by the
+ *            freeing CPU, which is where queued allocators differ most.
+ *
+ * Caches are the kmalloc sizes plus private caches shaped like the hot
+ * small-object users on our devices (sk_buff heads, dentries, binder_work).
+ *
+ * All results are printed at load time; like tcrypt, the module then
+ * refuses to stay loaded, so rerunning it is just another insmod:
+ *
+ *	insmod slab_bench.ko nr_objects=512 nr_loops=200
+ */
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/skbuff.h>
+#include <linux/dcache.h>
+#include <linux/list.h>
+#include <linux/math64.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+static unsigned int nr_objects = 1024;
+module_param(nr_objects, uint, 0444);
+MODULE_PARM_DESC(nr_objects, "Objects per batch (default 1024)");
+
+static unsigned int nr_loops = 100;
+module_param(nr_loops, uint, 0444);
+MODULE_PARM_DESC(nr_loops, "Batches per test (default 100)");
+
+static unsigned int cpu_alloc;
+module_param(cpu_alloc, uint, 0444);
+MODULE_PARM_DESC(cpu_alloc, "CPU allocating in the remote test (default 0)");
+
+static unsigned int cpu_free = 1;
+module_param(cpu_free, uint, 0444);
+MODULE_PARM_DESC(cpu_free, "CPU freeing in the remote test (default 1)");
+
+#if defined(CONFIG_SLQB)
+#define SLAB_BENCH_ALLOCATOR	"SLQB"
+#elif defined(CONFIG_SLUB)
+#define SLAB_BENCH_ALLOCATOR	"SLUB"
+#elif defined(CONFIG_SLOB)
+#define SLAB_BENCH_ALLOCATOR	"SLOB"
+#else
+#define SLAB_BENCH_ALLOCATOR	"SLAB"
+#endif
+
+/* binder_work is private to binder.c: a list_head and an enum */
+struct slab_bench_binder_work {
+	struct list_head entry;
+	int type;
+};
+
+struct slab_bench_cache {
+	const char *name;
+	size_t size;
+	unsigned long flags;
+	struct kmem_cache *cache;	/* NULL: use kmalloc(size) */
+};
+
+static struct slab_bench_cache slab_bench_caches[] = {
+	{ "kmalloc-32",   32 },
+	{ "kmalloc-64",   64 },
+	{ "kmalloc-128",  128 },
+	{ "kmalloc-256",  256 },
+	{ "kmalloc-512",  512 },
+	{ "kmalloc-1024", 1024 },
+	{ "kmalloc-2048", 2048 },
+	{ "bench_skbuff_head", sizeof(struct sk_buff), SLAB_HWCACHE_ALIGN },
+	{ "bench_dentry", sizeof(struct dentry), SLAB_RECLAIM_ACCOUNT },
+	{ "bench_binder_work", sizeof(struct slab_bench_binder_work), 0 },
+};
+
+static void **slab_bench_objs;
+
+static inline void *bench_alloc(struct slab_bench_cache *bc)
+{
+	if (bc->cache)
+		return kmem_cache_alloc(bc->cache, GFP_KERNEL);
+	return kmalloc(bc->size, GFP_KERNEL);
+}
+
+static inline void bench_free(struct slab_bench_cache *bc, void *obj)
+{
+	if (bc->cache)
+		kmem_cache_free(bc->cache, obj);
+	else
+		kfree(obj);
+}
+
+static inline u64 bench_ns(void)
+{
+	return ktime_to_ns(ktime_get());
+}
+
+static int bench_alloc_batch(struct slab_bench_cache *bc)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr_objects; i++) {
+		slab_bench_objs[i] = bench_alloc(bc);
+		if (!slab_bench_objs[i]) {
+			while (i--)
+				bench_free(bc, slab_bench_objs[i]);
+			return -ENOMEM;
+		}
+	}
+	return 0;
+}
+
+static void bench_free_batch(struct slab_bench_cache *bc)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr_objects; i++)
+		bench_free(bc, slab_bench_objs[i]);
+}
+
+/* Average ns per operation over count operations */
+static unsigned long bench_avg(u64 ns, u64 count)
+{
+	return (unsigned long)div64_u64(ns, count ? count : 1);
+}
+
+static int bench_pair(struct slab_bench_cache *bc, unsigned long *pair_ns)
+{
+	u64 start, count = (u64)nr_objects * nr_loops;
+	u64 i;
+	void *obj;
+
+	start = bench_ns();
+	for (i = 0; i < count; i++) {
+		obj = bench_alloc(bc);
+		if (!obj)
+			return -ENOMEM;
+		bench_free(bc, obj);
+		if (!(i & 1023))
+			cond_resched();
+	}
+	*pair_ns = bench_avg(bench_ns() - start, count);
+	return 0;
+}
+
+static int bench_batch(struct slab_bench_cache *bc, unsigned long *alloc_ns,
+		       unsigned long *free_ns)
+{
+	u64 alloc_total = 0, free_total = 0, t0, t1;
+	unsigned int loop;
+	int err;
+
+	for (loop = 0; loop < nr_loops; loop++) {
+		t0 = bench_ns();
+		err = bench_alloc_batch(bc);
+		if (err)
+			return err;
+		t1 = bench_ns();
+		bench_free_batch(bc);
+		free_total += bench_ns() - t1;
+		alloc_total += t1 - t0;
+		cond_resched();
+	}
+	*alloc_ns = bench_avg(alloc_total, (u64)nr_objects * nr_loops);
+	*free_ns = bench_avg(free_total, (u64)nr_objects * nr_loops);
+	return 0;
+}
+
+/*
+ * kthread_stop() may not be called on a thread that has already exited,
+ * so finished threads park here until they are stopped.
+ */
+static void bench_wait_stop(void)
+{
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+}
+
+/*
+ * Remote free test. The two threads take turns on slab_bench_objs: the
+ * allocating thread fills it and hands it over, the freeing thread empties
+ * it and hands it back.
+ */
+struct bench_remote {
+	struct slab_bench_cache *bc;
+	struct completion filled;
+	struct completion emptied;
+	struct completion done;
+	int err;
+	u64 free_total;
+	u64 free_max;
+};
+
+static int bench_remote_alloc_fn(void *arg)
+{
+	struct bench_remote *r = arg;
+	unsigned int loop;
+
+	for (loop = 0; loop < nr_loops; loop++) {
+		r->err = bench_alloc_batch(r->bc);
+		complete(&r->filled);
+		if (r->err)
+			break;
+		wait_for_completion(&r->emptied);
+	}
+	complete(&r->done);
+	bench_wait_stop();
+	return 0;
+}
+
+static int bench_remote_free_fn(void *arg)
+{
+	struct bench_remote *r = arg;
+	unsigned int loop, i;
+	u64 t0, t1;
+
+	for (loop = 0; loop < nr_loops; loop++) {
+		wait_for_completion(&r->filled);
+		if (r->err)
+			break;
+		for (i = 0; i < nr_objects; i++) {
+			t0 = bench_ns();
+			bench_free(r->bc, slab_bench_objs[i]);
+			t1 = bench_ns() - t0;
+			r->free_total += t1;
+			if (t1 > r->free_max)
+				r->free_max = t1;
+		}
+		complete(&r->emptied);
+	}
+	complete(&r->done);
+	bench_wait_stop();
+	return 0;
+}
+
+static int bench_remote(struct slab_bench_cache *bc, unsigned long *free_ns,
+			unsigned long *free_max_ns)
+{
+	struct task_struct *alloc_task, *free_task;
+	struct bench_remote r = {
+		.bc = bc,
+	};
+
+	init_completion(&r.filled);
+	init_completion(&r.emptied);
+	init_completion(&r.done);
+
+	alloc_task = kthread_create(bench_remote_alloc_fn, &r, "slab_bench/a");
+	if (IS_ERR(alloc_task))
+		return PTR_ERR(alloc_task);
+	free_task = kthread_create(bench_remote_free_fn, &r, "slab_bench/f");
+	if (IS_ERR(free_task)) {
+		kthread_stop(alloc_task);
+		return PTR_ERR(free_task);
+	}
+	kthread_bind(alloc_task, cpu_alloc);
+	kthread_bind(free_task, cpu_free);
+
+	wake_up_process(free_task);
+	wake_up_process(alloc_task);
+
+	wait_for_completion(&r.done);
+	wait_for_completion(&r.done);
+	kthread_stop(alloc_task);
+	kthread_stop(free_task);
+
+	if (r.err)
+		return r.err;
+
+	*free_ns = bench_avg(r.free_total, (u64)nr_objects * nr_loops);
+	*free_max_ns = (unsigned long)r.free_max;
+	return 0;
+}
+
+static int slab_bench_one(struct slab_bench_cache *bc, bool remote)
+{
+	unsigned long pair_ns, alloc_ns, free_ns;
+	unsigned long rfree_ns = 0, rfree_max_ns = 0;
+	int err;
+
+	err = bench_pair(bc, &pair_ns);
+	if (!err)
+		err = bench_batch(bc, &alloc_ns, &free_ns);
+	if (!err && remote)
+		err = bench_remote(bc, &rfree_ns, &rfree_max_ns);
+	if (err) {
+		printk(KERN_ERR "slab_bench: %s failed (%d)\n", bc->name, err);
+		return err;
+	}
+
+	printk(KERN_INFO "slab_bench: %-18s %5zu: pair %5lu ns  "
+	       "batch alloc %5lu ns free %5lu ns  remote free %5lu ns max %lu ns\n",
+	       bc->name, bc->size, pair_ns, alloc_ns, free_ns,
+	       rfree_ns, rfree_max_ns);
+	return 0;
+}
+
+static int __init slab_bench_init(void)
+{
+	struct slab_bench_cache *bc;
+	bool remote;
+	int i, err = 0;
+
+	if (!nr_objects || !nr_loops)
+		return -EINVAL;
+
+	remote = cpu_alloc != cpu_free &&
+		 cpu_online(cpu_alloc) && cpu_online(cpu_free);
+	if (!remote)
+		printk(KERN_WARNING "slab_bench: cpus %u and %u not both online,"
+		       " skipping remote free test\n", cpu_alloc, cpu_free);
+
+	slab_bench_objs = vmalloc(nr_objects * sizeof(void *));
+	if (!slab_bench_objs)
+		return -ENOMEM;
+
+	printk(KERN_INFO "slab_bench: %s, %u objects x %u loops, "
+	       "remote free cpu%u -> cpu%u\n", SLAB_BENCH_ALLOCATOR,
+	       nr_objects, nr_loops, cpu_alloc, cpu_free);
+
+	for (i = 0; i < ARRAY_SIZE(slab_bench_caches) && !err; i++) {
+		bc = &slab_bench_caches[i];
+		if (strncmp(bc->name, "kmalloc-", 8)) {
+			bc->cache = kmem_cache_create(bc->name, bc->size, 0,
+						      bc->flags, NULL);
+			if (!bc->cache) {
+				err = -ENOMEM;
+				break;
+			}
+		}
+
+		err = slab_bench_one(bc, remote);
+
+		if (bc->cache) {
+			kmem_cache_destroy(bc->cache);
+			bc->cache = NULL;
+		}
+	}
+
+	vfree(slab_bench_objs);
+
+	/* Results are in the log; there is nothing to keep loaded */
+	return err ? err : -EAGAIN;
+}
+
+static void __exit slab_bench_exit(void)
+{
+}
+
+module_init(slab_bench_init);
+module_exit(slab_bench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Slab allocator throughput and remote free latency benchmark");
@@ -500,7 +500,15 @@ int __add_to_page_cache_lru(struct page *page, struct address_space *mapping,
 
 	ret = add_to_page_cache(page, mapping, offset, gfp_mask);
 	if (ret == 0) {
-		if (page_is_file_cache(page))
+		/*
+		 * A page that was evicted recently enough to have stayed
+		 * resident at the expense of the active list is part of
+		 * the workingset: skip its second trip through inactive.
+		 */
+		if (page_is_file_cache(page) &&
+		    workingset_refault(mapping, offset))
+			____lru_cache_add(page, LRU_ACTIVE_FILE, 0);
+		else if (page_is_file_cache(page))
 			lru_cache_add_file_tail(page, tail);
 		else
 			lru_cache_add_anon(page);
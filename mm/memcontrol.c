@@ -5578,7 +5578,6 @@ static void mem_cgroup_move_task(struct cgroup_subsys *ss,
 	if (mm) {
 		if (mc.to)
 			mem_cgroup_move_charge(mm);
-		put_swap_token(mm);
 		mmput(mm);
 	}
 	if (mc.to)
@@ -960,7 +960,7 @@ copy_one_pte(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		/* Should return NULL in vm_normal_page() */
 		uksm_bugon_zeropage(pte);
 	} else {
-		uksm_map_zero_page(pte);
+		uksm_map_zero_page(dst_mm, pte);
 	}
 
 out_set_pte:
@@ -1197,7 +1197,7 @@ again:
 							tlb->fullmm);
 			tlb_remove_tlb_entry(tlb, pte, addr);
 			if (unlikely(!page)) {
-				uksm_unmap_zero_page(ptent);
+				uksm_unmap_zero_page(mm, ptent);
 				continue;
 			}
 			if (unlikely(details) && details->nonlinear_vma
@@ -2778,7 +2778,7 @@ gotten:
 			}
 			uksm_bugon_zeropage(orig_pte);
 		} else {
-			uksm_unmap_zero_page(orig_pte);
+			uksm_unmap_zero_page(mm, orig_pte);
 			inc_mm_counter_fast(mm, MM_ANONPAGES);
 		}
 		flush_cache_page(vma, address, pte_pfn(orig_pte));
@@ -2998,7 +2998,6 @@ static int do_swap_page(struct mm_struct *mm, struct vm_area_struct *vma,
 	delayacct_set_flag(DELAYACCT_PF_SWAPIN);
 	page = lookup_swap_cache(entry);
 	if (!page) {
-		grab_swap_token(mm); /* Contend for token _before_ read-in */
 		page = swapin_readahead(entry,
 					GFP_HIGHUSER_MOVABLE, vma, address);
 		if (!page) {
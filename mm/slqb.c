@@ -69,6 +69,13 @@ static int slqb_min_order;
  */
 static int slqb_min_objects = 1;
 
+/*
+ * slqb_max_batch: upper bound on the default freebatch of a cache, hiwater
+ * being four batches. Lowering it trades some free path speed for fewer
+ * objects parked on per-CPU queues. 0 leaves the defaults alone.
+ */
+static int slqb_max_batch;
+
 #ifdef CONFIG_NUMA
 static inline int slab_numa(struct kmem_cache *s)
 {
@@ -895,6 +902,16 @@ static int __init setup_slqb_min_objects(char *str)
 
 __setup("slqb_min_objects=", setup_slqb_min_objects);
 
+static int __init setup_slqb_max_batch(char *str)
+{
+	get_option(&str, &slqb_max_batch);
+	slqb_max_batch = max(slqb_max_batch, 0);
+
+	return 1;
+}
+
+__setup("slqb_max_batch=", setup_slqb_max_batch);
+
 static unsigned long kmem_cache_flags(unsigned long objsize,
 				unsigned long flags, const char *name,
 				void (*ctor)(void *))
@@ -2206,6 +2223,8 @@ static int calculate_sizes(struct kmem_cache *s)
 
 	s->freebatch = max(4UL*PAGE_SIZE / size,
 				min(256UL, 64*PAGE_SIZE / size));
+	if (slqb_max_batch && s->freebatch > slqb_max_batch)
+		s->freebatch = slqb_max_batch;
 	if (!s->freebatch)
 		s->freebatch = 1;
 	s->hiwater = s->freebatch << 2;
@@ -2654,13 +2673,32 @@ static void kmem_cache_trim_percpu(void *arg)
 #endif
 }
 
+/*
+ * Unlike the periodic trim, which returns one batch at a time, shrinking
+ * empties the per-CPU queues so that every free object goes back to its
+ * page and empty pages go back to the page allocator.
+ */
+static void kmem_cache_shrink_percpu(void *arg)
+{
+	int cpu = smp_processor_id();
+	struct kmem_cache *s = arg;
+	struct kmem_cache_cpu *c = get_cpu_slab(s, cpu);
+	struct kmem_cache_list *l = &c->list;
+
+	claim_remote_free_list(s, l);
+	flush_free_list_all(s, l);
+#ifdef CONFIG_SMP
+	flush_remote_free_cache(s, c);
+#endif
+}
+
 int kmem_cache_shrink(struct kmem_cache *s)
 {
 #ifdef CONFIG_NUMA
 	int node;
 #endif
 
-	on_each_cpu(kmem_cache_trim_percpu, s, 1);
+	on_each_cpu(kmem_cache_shrink_percpu, s, 1);
 
 #ifdef CONFIG_NUMA
 	for_each_node_state(node, N_NORMAL_MEMORY) {
@@ -2674,7 +2712,7 @@ int kmem_cache_shrink(struct kmem_cache *s)
 
 		spin_lock_irq(&n->list_lock);
 		claim_remote_free_list(s, l);
-		flush_free_list(s, l);
+		flush_free_list_all(s, l);
 		spin_unlock_irq(&n->list_lock);
 	}
 #endif
@@ -3105,6 +3143,41 @@ err:
 EXPORT_SYMBOL(kmem_cache_create);
 
 #ifdef CONFIG_SMP
+/*
+ * Return the objects queued on a dead CPU's lists to their pages. The dead
+ * CPU can no longer touch its lists, so the caller stands in for the owner;
+ * objects belonging to other lists go out through the caller's own remote
+ * free cache, hence interrupts off.
+ *
+ * Pages still holding live objects stay on the dead CPU's list. Frees of
+ * those objects from other CPUs land on its remote_free list, which
+ * flush_remote_free_cache() stops growing at hiwater / 2 by freeing
+ * straight to the pages, so nothing piles up while the CPU is away.
+ */
+static void slab_drain_dead_cpu(long cpu)
+{
+	struct kmem_cache *s;
+
+	down_read(&slqb_lock);
+	list_for_each_entry(s, &slab_caches, list) {
+		struct kmem_cache_cpu *c = s->cpu_slab[cpu];
+		struct kmem_cache_list *l;
+
+		if (!c)
+			continue;
+		l = &c->list;
+
+		local_irq_disable();
+		claim_remote_free_list(s, l);
+		flush_free_list_all(s, l);
+		flush_remote_free_cache(s, c);
+		/* objects flush_free_list() handed to our remote cache */
+		flush_remote_free_cache(s, get_cpu_slab(s, smp_processor_id()));
+		local_irq_enable();
+	}
+	up_read(&slqb_lock);
+}
+
 /*
  * Use the cpu notifier to insure that the cpu slabs are flushed when
  * necessary.
@@ -3124,7 +3197,7 @@ static int __cpuinit slab_cpuup_callback(struct notifier_block *nfb,
 				continue;
 			s->cpu_slab[cpu] = alloc_kmem_cache_cpu(s, cpu);
 			if (!s->cpu_slab[cpu]) {
-				up_read(&slqb_lock);
+				up_write(&slqb_lock);
 				return NOTIFY_BAD;
 			}
 		}
@@ -3145,16 +3218,18 @@ static int __cpuinit slab_cpuup_callback(struct notifier_block *nfb,
 		per_cpu(slqb_cache_trim_work, cpu).work.func = NULL;
 		break;
 
-	case CPU_UP_CANCELED:
-	case CPU_UP_CANCELED_FROZEN:
 	case CPU_DEAD:
 	case CPU_DEAD_FROZEN:
 		/*
-		 * XXX: Freeing here doesn't work because objects can still be
-		 * on this CPU's list. periodic timer needs to check if a CPU
-		 * is offline and then try to cleanup from there. Same for node
-		 * offline.
+		 * The kmem_cache_cpu itself is kept: pages on its list can
+		 * still hold live objects, and CPU_UP_PREPARE picks it up
+		 * again if the CPU comes back.
 		 */
+		slab_drain_dead_cpu(cpu);
+		break;
+
+	case CPU_UP_CANCELED:
+	case CPU_UP_CANCELED_FROZEN:
 	default:
 		break;
 	}
@@ -3551,7 +3626,8 @@ static ssize_t hiwater_store(struct kmem_cache *s,
 	if (err)
 		return err;
 
-	if (hiwater < 0)
+	/* flush_free_list() must always have a full batch to take */
+	if (hiwater < 0 || hiwater < slab_freebatch(s))
 		return -EINVAL;
 
 	s->hiwater = hiwater;
@@ -3589,6 +3665,37 @@ static ssize_t freebatch_show(struct kmem_cache *s, char *buf)
 }
 SLAB_ATTR(freebatch);
 
+static ssize_t sanity_checks_show(struct kmem_cache *s, char *buf)
+{
+	return sprintf(buf, "%d\n", !!(s->flags & SLAB_DEBUG_FREE));
+}
+SLAB_ATTR_RO(sanity_checks);
+
+static ssize_t trace_show(struct kmem_cache *s, char *buf)
+{
+	return sprintf(buf, "%d\n", !!(s->flags & SLAB_TRACE));
+}
+SLAB_ATTR_RO(trace);
+
+static ssize_t shrink_show(struct kmem_cache *s, char *buf)
+{
+	return 0;
+}
+
+static ssize_t shrink_store(struct kmem_cache *s,
+			const char *buf, size_t length)
+{
+	if (buf[0] == '1') {
+		int rc = kmem_cache_shrink(s);
+
+		if (rc)
+			return rc;
+	} else
+		return -EINVAL;
+	return length;
+}
+SLAB_ATTR(shrink);
+
 #ifdef CONFIG_SLQB_STATS
 static int show_stat(struct kmem_cache *s, char *buf, enum stat_item si)
 {
@@ -3653,8 +3760,11 @@ static struct attribute *slab_attrs[] = {
 	&red_zone_attr.attr,
 	&poison_attr.attr,
 	&store_user_attr.attr,
+	&sanity_checks_attr.attr,
+	&trace_attr.attr,
 	&hiwater_attr.attr,
 	&freebatch_attr.attr,
+	&shrink_attr.attr,
 #ifdef CONFIG_ZONE_DMA
 	&cache_dma_attr.attr,
 #endif
@@ -69,8 +69,15 @@
 #include <linux/gcd.h>
 #include <linux/freezer.h>
 #include <linux/sradix-tree.h>
+#include <linux/prefetch.h>
+#include <linux/ktime.h>
+#include <linux/earlysuspend.h>
+#include <linux/power_supply.h>
 
 #include <asm/tlbflush.h>
+#ifdef CONFIG_KERNEL_MODE_NEON
+#include <asm/neon.h>
+#endif
 #include "internal.h"
 
 #ifdef CONFIG_X86
@@ -180,6 +187,166 @@ static int is_full_zero(const void *s1, size_t len)
 }
 #endif
 
+#ifdef CONFIG_ARM
+/*
+ * Order two equal length areas by their first differing word. The page
+ * trees only need some consistent total order, and this one is cheap to
+ * compute once the block holding the difference is known.
+ */
+static int memcmp_words(const void *s1, const void *s2, size_t len)
+{
+	const unsigned long *a = s1, *b = s2;
+	const unsigned long *end = a + len / sizeof(*a);
+
+	for (; a < end; a++, b++) {
+		if (*a != *b)
+			return *a < *b ? -1 : 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Scan a cache line of each page per iteration and prefetch a few lines
+ * ahead, then locate the differing word only in the line that has it.
+ */
+static int memcmp_page_arm(const void *s1, const void *s2)
+{
+	const unsigned long *a = s1, *b = s2;
+	const unsigned long *end = a + PAGE_SIZE / sizeof(*a);
+
+	for (; a < end; a += 8, b += 8) {
+		prefetch(a + 32);
+		prefetch(b + 32);
+		if ((a[0] ^ b[0]) | (a[1] ^ b[1]) | (a[2] ^ b[2]) |
+		    (a[3] ^ b[3]) | (a[4] ^ b[4]) | (a[5] ^ b[5]) |
+		    (a[6] ^ b[6]) | (a[7] ^ b[7]))
+			return memcmp_words(a, b, 8 * sizeof(*a));
+	}
+
+	return 0;
+}
+
+static int is_full_zero_arm(const void *s1, size_t len)
+{
+	const unsigned long *p = s1;
+	const unsigned long *end = p + len / sizeof(*p);
+
+	for (; p < end; p += 8) {
+		prefetch(p + 32);
+		if (p[0] | p[1] | p[2] | p[3] | p[4] | p[5] | p[6] | p[7])
+			return 0;
+	}
+
+	return 1;
+}
+#endif
+
+#ifdef CONFIG_KERNEL_MODE_NEON
+/*
+ * Both work on page aligned buffers in 128 or 256 byte blocks and only
+ * move a result to the core registers once per block. The kernel is built
+ * soft-float, so nothing of the compiler's lives in the NEON registers.
+ */
+static int memcmp_page_neon(const void *s1, const void *s2)
+{
+	const void *a = s1, *b = s2;
+	const void *end = s1 + PAGE_SIZE;
+	u32 lo, hi;
+
+	kernel_neon_begin();
+	do {
+		asm volatile(
+		"	.fpu	neon\n"
+		"	pld	[%[a], #256]\n"
+		"	pld	[%[b], #256]\n"
+		"	vld1.64	{d0-d3}, [%[a], :128]!\n"
+		"	vld1.64	{d4-d7}, [%[a], :128]!\n"
+		"	vld1.64	{d8-d11}, [%[a], :128]!\n"
+		"	vld1.64	{d12-d15}, [%[a], :128]!\n"
+		"	vld1.64	{d16-d19}, [%[b], :128]!\n"
+		"	vld1.64	{d20-d23}, [%[b], :128]!\n"
+		"	vld1.64	{d24-d27}, [%[b], :128]!\n"
+		"	vld1.64	{d28-d31}, [%[b], :128]!\n"
+		"	veor	q0, q0, q8\n"
+		"	veor	q1, q1, q9\n"
+		"	veor	q2, q2, q10\n"
+		"	veor	q3, q3, q11\n"
+		"	veor	q4, q4, q12\n"
+		"	veor	q5, q5, q13\n"
+		"	veor	q6, q6, q14\n"
+		"	veor	q7, q7, q15\n"
+		"	vorr	q0, q0, q1\n"
+		"	vorr	q2, q2, q3\n"
+		"	vorr	q4, q4, q5\n"
+		"	vorr	q6, q6, q7\n"
+		"	vorr	q0, q0, q2\n"
+		"	vorr	q4, q4, q6\n"
+		"	vorr	q0, q0, q4\n"
+		"	vorr	d0, d0, d1\n"
+		"	vmov	%[lo], %[hi], d0\n"
+		: [a] "+r" (a), [b] "+r" (b), [lo] "=r" (lo), [hi] "=r" (hi)
+		:
+		: "memory");
+	} while (!(lo | hi) && a < end);
+	kernel_neon_end();
+
+	if (!(lo | hi))
+		return 0;
+	return memcmp_words(a - 128, b - 128, 128);
+}
+
+static int is_full_zero_neon(const void *s1, size_t len)
+{
+	const void *p = s1;
+	const void *end = s1 + len;
+	u32 lo, hi;
+
+	kernel_neon_begin();
+	do {
+		asm volatile(
+		"	.fpu	neon\n"
+		"	pld	[%[p], #512]\n"
+		"	vld1.64	{d0-d3}, [%[p], :128]!\n"
+		"	vld1.64	{d4-d7}, [%[p], :128]!\n"
+		"	vld1.64	{d8-d11}, [%[p], :128]!\n"
+		"	vld1.64	{d12-d15}, [%[p], :128]!\n"
+		"	vld1.64	{d16-d19}, [%[p], :128]!\n"
+		"	vld1.64	{d20-d23}, [%[p], :128]!\n"
+		"	vld1.64	{d24-d27}, [%[p], :128]!\n"
+		"	vld1.64	{d28-d31}, [%[p], :128]!\n"
+		"	vorr	q0, q0, q1\n"
+		"	vorr	q2, q2, q3\n"
+		"	vorr	q4, q4, q5\n"
+		"	vorr	q6, q6, q7\n"
+		"	vorr	q8, q8, q9\n"
+		"	vorr	q10, q10, q11\n"
+		"	vorr	q12, q12, q13\n"
+		"	vorr	q14, q14, q15\n"
+		"	vorr	q0, q0, q2\n"
+		"	vorr	q4, q4, q6\n"
+		"	vorr	q8, q8, q10\n"
+		"	vorr	q12, q12, q14\n"
+		"	vorr	q0, q0, q4\n"
+		"	vorr	q8, q8, q12\n"
+		"	vorr	q0, q0, q8\n"
+		"	vorr	d0, d0, d1\n"
+		"	vmov	%[lo], %[hi], d0\n"
+		: [p] "+r" (p), [lo] "=r" (lo), [hi] "=r" (hi)
+		:
+		: "memory");
+	} while (!(lo | hi) && p < end);
+	kernel_neon_end();
+
+	return !(lo | hi);
+}
+
+static int neon_usable(void)
+{
+	return cpu_has_neon();
+}
+#endif
+
 #define U64_MAX		(~((u64)0))
 #define UKSM_RUNG_ROUND_FINISHED  (1 << 0)
 #define TIME_RATIO_SCALE	10000
@@ -517,6 +684,20 @@ static unsigned int uksm_sleep_saved;
 /* Max percentage of cpu utilization ksmd can take to scan in one batch */
 static unsigned int uksm_max_cpu_percentage;
 
+/* Lower caps applied while the screen is off and while on battery */
+static unsigned int uksm_screen_off_cpu_percentage = 10;
+static unsigned int uksm_battery_cpu_percentage = 30;
+
+/* Set by the early suspend hooks */
+static int uksm_screen_off;
+
+/* The cap in effect for the current scan, see uksm_cpu_budget() */
+static unsigned int uksm_cpu_budget_percentage;
+
+/* Pages merged and CPU time spent scanning since boot, for merge_rate */
+static unsigned long long uksm_pages_merged_total;
+static unsigned long long uksm_scan_cpu_nsecs;
+
 static int uksm_cpu_governor;
 
 static char *uksm_cpu_governor_str[4] = { "full", "medium", "low", "quiet" };
@@ -567,6 +748,44 @@ static unsigned int uksm_run = 1;
 static DECLARE_WAIT_QUEUE_HEAD(uksm_thread_wait);
 static DEFINE_MUTEX(uksm_thread_mutex);
 
+/*
+ * Serializes the stable and unstable trees, the tree node lists and the
+ * global scan counters between uksmd and its scan workers. Only the
+ * per-slot rmap list walk, follow_page() and page hashing run without it.
+ */
+static DEFINE_MUTEX(uksm_tree_mutex);
+
+/*
+ * With more than one scan thread, uksmd hands whole slot visits to per-cpu
+ * workers. A slot is visited by at most one worker at a time (it is marked
+ * UKSM_SLOT_IN_VISIT meanwhile), so everything in a vma_slot is private to
+ * the worker visiting it; uksmd alone moves the rung cursors and judges
+ * slots once their visit is over.
+ */
+#define UKSM_WORKER_IDLE	0
+#define UKSM_WORKER_BUSY	1
+#define UKSM_WORKER_DONE	2
+
+struct uksm_scan_worker {
+	struct task_struct *task;
+	wait_queue_head_t wait;
+	int state;
+
+	struct vma_slot *slot;
+	unsigned long pages;	/* pages to scan in this visit */
+	unsigned long scanned;	/* pages actually scanned */
+	int judge;		/* the visit ends the slot's turn in its rung */
+	int err;
+};
+
+static struct uksm_scan_worker *uksm_workers;
+
+/* Workers running, 0 when uksmd scans on its own */
+static unsigned int uksm_nr_workers;
+
+static DEFINE_SPINLOCK(uksm_worker_lock);
+static DECLARE_WAIT_QUEUE_HEAD(uksm_worker_done_wait);
+
 /*
  * List vma_slot_new is for newly created vma_slot waiting to be added by
  * ksmd. If one cannot be added(e.g. due to it's too small), it's moved to
@@ -719,6 +938,7 @@ static inline struct vma_slot *alloc_vma_slot(void)
 
 static inline void free_vma_slot(struct vma_slot *vma_slot)
 {
+	mmdrop(vma_slot->mm);
 	kmem_cache_free(vma_slot_cache, vma_slot);
 }
 
@@ -738,6 +958,7 @@ static inline struct rmap_item *alloc_rmap_item(void)
 
 static inline void free_rmap_item(struct rmap_item *rmap_item)
 {
+	atomic_long_dec(&rmap_item->slot->mm->uksm_rmap_items);
 	rmap_item->slot = NULL;	/* debug safety */
 	kmem_cache_free(rmap_item_cache, rmap_item);
 }
@@ -806,6 +1027,8 @@ static void remove_node_from_stable_tree(struct stable_node *stable_node,
 			hlist_for_each_entry(rmap_item, rmap_hlist,
 					     &node_vma->rmap_hlist, hlist) {
 				uksm_pages_sharing--;
+				atomic_long_dec(&rmap_item->slot->mm->
+						uksm_merging_pages);
 
 				uksm_drop_anon_vma(rmap_item);
 				rmap_item->address &= PAGE_MASK;
@@ -924,6 +1147,7 @@ static inline void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 		 */
 		lock_page(page);
 		hlist_del(&rmap_item->hlist);
+		atomic_long_dec(&rmap_item->slot->mm->uksm_merging_pages);
 
 		if (hlist_empty(&node_vma->rmap_hlist)) {
 			hlist_del(&node_vma->hlist);
@@ -1125,7 +1349,12 @@ void uksm_vma_add_new(struct vm_area_struct *vma)
 	vma->uksm_vma_slot = slot;
 	vma->vm_flags |= VM_MERGEABLE;
 	slot->vma = vma;
+	/*
+	 * The slot and its rmap_items outlive the vma, keep the mm_struct
+	 * around for their per-mm counters until free_vma_slot().
+	 */
 	slot->mm = vma->vm_mm;
+	atomic_inc(&slot->mm->mm_count);
 	slot->ctime_j = jiffies;
 	slot->pages = vma_pages(vma);
 	spin_lock(&vma_slot_list_lock);
@@ -1162,6 +1391,19 @@ void uksm_remove_vma(struct vm_area_struct *vma)
 	vma->uksm_vma_slot = NULL;
 }
 
+/*
+ * uksm_process_profit() - what merging saves @mm: its ptes of ksm pages and
+ * of the uksm zero page, less the rmap_items uksm keeps for it. A ksm page
+ * is counted in full by every mm mapping it, so this is an upper bound.
+ */
+long uksm_process_profit(struct mm_struct *mm)
+{
+	return (atomic_long_read(&mm->uksm_merging_pages) +
+		atomic_long_read(&mm->uksm_zero_pages)) * PAGE_SIZE -
+		atomic_long_read(&mm->uksm_rmap_items) *
+		(long)sizeof(struct rmap_item);
+}
+
 /*   32/3 < they < 32/2 */
 #define shiftl	8
 #define shiftr	12
@@ -1207,6 +1449,112 @@ static u32 random_sample_hash(void *addr, u32 hash_strength)
 	return hash;
 }
 
+#ifdef CONFIG_ARM
+#define HASH_MIX(k)					\
+do {							\
+	hash += (k);					\
+	hash += (hash << shiftl);			\
+	hash ^= (hash >> shiftr);			\
+} while (0)
+
+/*
+ * The same hash as random_sample_hash(), but the sampled words of each
+ * group of four are loaded ahead of the mixing that depends on them, so
+ * that an in-order core does not stall on every load.
+ */
+static u32 sample_hash_range_arm(u32 hash, const u32 *key, int from, int to)
+{
+	int index;
+	u32 k0, k1, k2, k3;
+
+	for (index = from; index + 4 <= to; index += 4) {
+		k0 = key[random_nums[index]];
+		k1 = key[random_nums[index + 1]];
+		k2 = key[random_nums[index + 2]];
+		k3 = key[random_nums[index + 3]];
+		HASH_MIX(k0);
+		HASH_MIX(k1);
+		HASH_MIX(k2);
+		HASH_MIX(k3);
+	}
+	for (; index < to; index++)
+		HASH_MIX(key[random_nums[index]]);
+
+	return hash;
+}
+
+static u32 random_sample_hash_arm(void *addr, u32 hash_strength)
+{
+	u32 hash = 0xdeadbeef;
+	int loop = hash_strength;
+
+	if (loop > HASH_STRENGTH_FULL)
+		loop = HASH_STRENGTH_FULL;
+
+	hash = sample_hash_range_arm(hash, addr, 0, loop);
+
+	if (hash_strength > HASH_STRENGTH_FULL)
+		hash = sample_hash_range_arm(hash, addr, 0,
+				hash_strength - HASH_STRENGTH_FULL);
+
+	return hash;
+}
+#endif
+
+static int memcmp_page_generic(const void *s1, const void *s2)
+{
+	/* the x86 versions take non-const pointers */
+	return memcmp((void *)s1, (void *)s2, PAGE_SIZE);
+}
+
+/*
+ * The page compare, zero page check and sampled hash kernels. The first
+ * usable entry that passes the self-test at boot is used; all of them
+ * must return exactly what random_sample_hash() returns, since hashes are
+ * mixed with delta_hash() and the zero page hash table.
+ */
+struct uksm_page_ops {
+	const char *name;
+	int (*memcmp_page)(const void *s1, const void *s2);
+	int (*is_full_zero)(const void *s1, size_t len);
+	u32 (*sample_hash)(void *addr, u32 hash_strength);
+	int (*usable)(void);
+	/* boot time self-test and benchmark results, in MB/s */
+	int tested;
+	unsigned long scan_mbps;
+	unsigned long merge_mbps;
+	unsigned long zero_mbps;
+};
+
+static struct uksm_page_ops uksm_page_ops_table[] = {
+#ifdef CONFIG_KERNEL_MODE_NEON
+	{
+		.name		= "neon",
+		.memcmp_page	= memcmp_page_neon,
+		.is_full_zero	= is_full_zero_neon,
+		.sample_hash	= random_sample_hash_arm,
+		.usable		= neon_usable,
+	},
+#endif
+#ifdef CONFIG_ARM
+	{
+		.name		= "arm",
+		.memcmp_page	= memcmp_page_arm,
+		.is_full_zero	= is_full_zero_arm,
+		.sample_hash	= random_sample_hash_arm,
+	},
+#endif
+	{
+		.name		= "generic",
+		.memcmp_page	= memcmp_page_generic,
+		.is_full_zero	= is_full_zero,
+		.sample_hash	= random_sample_hash,
+	},
+};
+
+static struct uksm_page_ops *uksm_page_ops =
+	&uksm_page_ops_table[ARRAY_SIZE(uksm_page_ops_table) - 1];
+
 
 /**
  * It's used when hash strength is adjusted
@@ -1325,25 +1673,30 @@ static inline void inc_rshash_neg(unsigned long delta)
 }
 
 
+static inline void account_page_hash(unsigned long hash_strength)
+{
+	unsigned long delta;
+
+	if (HASH_STRENGTH_FULL > hash_strength)
+		delta = HASH_STRENGTH_FULL - hash_strength;
+	else
+		delta = 0;
+
+	inc_rshash_pos(delta);
+}
+
 static inline u32 page_hash(struct page *page, unsigned long hash_strength,
 			    int cost_accounting)
 {
 	u32 val;
-	unsigned long delta;
 
 	void *addr = kmap_atomic(page, KM_USER0);
 
-	val = random_sample_hash(addr, hash_strength);
+	val = uksm_page_ops->sample_hash(addr, hash_strength);
 	kunmap_atomic(addr, KM_USER0);
 
-	if (cost_accounting) {
-		if (HASH_STRENGTH_FULL > hash_strength)
-			delta = HASH_STRENGTH_FULL - hash_strength;
-		else
-			delta = 0;
-
-		inc_rshash_pos(delta);
-	}
+	if (cost_accounting)
+		account_page_hash(hash_strength);
 
 	return val;
 }
@@ -1356,7 +1709,7 @@ static int memcmp_pages(struct page *page1, struct page *page2,
 
 	addr1 = kmap_atomic(page1, KM_USER0);
 	addr2 = kmap_atomic(page2, KM_USER1);
-	ret = memcmp(addr1, addr2, PAGE_SIZE);
+	ret = uksm_page_ops->memcmp_page(addr1, addr2);
 	kunmap_atomic(addr2, KM_USER1);
 	kunmap_atomic(addr1, KM_USER0);
 
@@ -1377,7 +1730,7 @@ static inline int is_page_full_zero(struct page *page)
 	int ret;
 
 	addr = kmap_atomic(page, KM_USER0);
-	ret = is_full_zero(addr, PAGE_SIZE);
+	ret = uksm_page_ops->is_full_zero(addr, PAGE_SIZE);
 	kunmap_atomic(addr, KM_USER0);
 
 	return ret;
@@ -2502,6 +2855,7 @@ static void stable_tree_append(struct rmap_item *rmap_item,
 
 	BUG_ON(!stable_node);
 	rmap_item->address |= STABLE_FLAG;
+	atomic_long_inc(&rmap_item->slot->mm->uksm_merging_pages);
 
 	if (hlist_empty(&stable_node->hlist)) {
 		uksm_pages_shared++;
@@ -2557,6 +2911,7 @@ node_vma_ok: /* ok, ready to add to the list */
 	hold_anon_vma(rmap_item, rmap_item->slot->vma->anon_vma);
 	if (logdedup) {
 		rmap_item->slot->pages_merged++;
+		uksm_pages_merged_total++;
 		if (cont_p) {
 			hlist_for_each_entry_continue(node_vma,
 						      cont_p, hlist) {
@@ -3159,10 +3514,44 @@ static inline int vma_fully_scanned(struct vma_slot *slot)
 	return slot->pages_scanned == slot->pages;
 }
 
+/*
+ * scan_get_page() - get and hash the anonymous page mapped at @addr. Called
+ * with mmap_sem held but without uksm_tree_mutex, this is the part of a
+ * page scan that the scan workers run in parallel.
+ */
+static struct page *scan_get_page(struct vm_area_struct *vma,
+				  unsigned long addr, u32 *hash)
+{
+	struct page *page;
+
+	page = follow_page(vma, addr, FOLL_GET);
+	if (IS_ERR_OR_NULL(page))
+		return NULL;
+
+	if (!PageAnon(page) && !page_trans_compound_anon(page))
+		goto putpage;
+
+	/*check is zero_page pfn or uksm_zero_page*/
+	if ((page_to_pfn(page) == zero_pfn)
+			|| (page_to_pfn(page) == uksm_zero_pfn))
+		goto putpage;
+
+	flush_anon_page(vma, page, addr);
+	flush_dcache_page(page);
+
+	*hash = page_hash(page, hash_strength, 0);
+	return page;
+
+putpage:
+	put_page(page);
+	return NULL;
+}
+
 /**
  * get_next_rmap_item() - Get the next rmap_item in a vma_slot according to
  * its random permutation. This function is embedded with the random
- * permutation index management code.
+ * permutation index management code. Called with uksm_tree_mutex held,
+ * which is dropped while the page is looked up and hashed.
  */
 static struct rmap_item *get_next_rmap_item(struct vma_slot *slot, u32 *hash)
 {
@@ -3214,29 +3603,21 @@ static struct rmap_item *get_next_rmap_item(struct vma_slot *slot, u32 *hash)
 	item = get_entry_item(scan_entry);
 	BUG_ON(addr > slot->vma->vm_end || addr < slot->vma->vm_start);
 
-	page = follow_page(slot->vma, addr, FOLL_GET);
-	if (IS_ERR_OR_NULL(page))
+	mutex_unlock(&uksm_tree_mutex);
+	page = scan_get_page(slot->vma, addr, hash);
+	mutex_lock(&uksm_tree_mutex);
+	if (!page)
 		goto nopage;
 
-	if (!PageAnon(page) && !page_trans_compound_anon(page))
-		goto putpage;
-
-	/*check is zero_page pfn or uksm_zero_page*/
-	if ((page_to_pfn(page) == zero_pfn)
-			|| (page_to_pfn(page) == uksm_zero_pfn))
-		goto putpage;
-
-	flush_anon_page(slot->vma, page, addr);
-	flush_dcache_page(page);
-
-
-	*hash = page_hash(page, hash_strength, 1);
+	account_page_hash(hash_strength);
 	inc_uksm_pages_scanned();
 	/*if the page content all zero, re-map to zero-page*/
 	if (find_zero_page_hash(hash_strength, *hash)) {
 		if (!cmp_and_merge_zero_page(slot->vma, page)) {
 			slot->pages_merged++;
+			uksm_pages_merged_total++;
 			inc_zone_page_state(page, NR_UKSM_ZERO_PAGES);
+			atomic_long_inc(&slot->mm->uksm_zero_pages);
 			dec_mm_counter(slot->mm, MM_ANONPAGES);
 
 			/* For full-zero pages, no need to create rmap item */
@@ -3254,6 +3635,7 @@ static struct rmap_item *get_next_rmap_item(struct vma_slot *slot, u32 *hash)
 			item->address = addr;
 			item->entry_index = scan_index;
 			scan_entry->item = item;
+			atomic_long_inc(&slot->mm->uksm_rmap_items);
 			inc_rmap_list_pool_count(slot, scan_index);
 		} else
 			goto putpage;
@@ -3286,7 +3668,7 @@ static inline int in_stable_tree(struct rmap_item *rmap_item)
 
 /**
  * scan_vma_one_page() - scan the next page in a vma_slot. Called with
- * mmap_sem locked.
+ * mmap_sem locked, by uksmd or by the scan worker visiting @slot.
  */
 static noinline void scan_vma_one_page(struct vma_slot *slot)
 {
@@ -3299,6 +3681,7 @@ static noinline void scan_vma_one_page(struct vma_slot *slot)
 	BUG_ON(!mm);
 	BUG_ON(!slot);
 
+	mutex_lock(&uksm_tree_mutex);
 	rmap_item = get_next_rmap_item(slot, &hash);
 	if (!rmap_item)
 		goto out1;
@@ -3316,6 +3699,7 @@ out1:
 
 	if (vma_fully_scanned(slot))
 		slot->fully_scanned_round = fully_scanned_round;
+	mutex_unlock(&uksm_tree_mutex);
 }
 
 static inline unsigned long rung_get_pages(struct scan_rung *rung)
@@ -4042,6 +4426,8 @@ static noinline void round_update_ladder(void)
 		uksm_scan_ladder[i].flags &= ~UKSM_RUNG_ROUND_FINISHED;
 	}
 
+	/* Scan workers add to the list and the counters under the mutex */
+	mutex_lock(&uksm_tree_mutex);
 	list_for_each_entry_safe(slot, tmp_slot, &vma_slot_dedup, dedup_list) {
 
 		/* slot may be rung_rm_slot() when mm exits */
@@ -4056,6 +4442,7 @@ static noinline void round_update_ladder(void)
 
 		list_del_init(&slot->dedup_list);
 	}
+	mutex_unlock(&uksm_tree_mutex);
 }
 
 static void uksm_del_vma_slot(struct vma_slot *slot)
@@ -4176,17 +4563,45 @@ static inline unsigned long cpu_ratio_to_nsec(unsigned int ratio)
 }
 
 
+static inline int uksm_on_battery(void)
+{
+#ifdef CONFIG_POWER_SUPPLY
+	return power_supply_is_system_supplied() == 0;
+#else
+	return 0;
+#endif
+}
+
+/*
+ * uksm_cpu_budget() - the percentage of one cpu that uksmd and its scan
+ * workers may use together: max_cpu_percentage, lowered while the screen
+ * is off or while we are running on battery.
+ */
+static unsigned int uksm_cpu_budget(void)
+{
+	unsigned int budget = uksm_max_cpu_percentage;
+
+	if (uksm_screen_off && uksm_screen_off_cpu_percentage < budget)
+		budget = uksm_screen_off_cpu_percentage;
+
+	if (uksm_battery_cpu_percentage < budget && uksm_on_battery())
+		budget = uksm_battery_cpu_percentage;
+
+	return budget ? budget : 1;
+}
+
 static inline unsigned long rung_real_ratio(int cpu_time_ratio)
 {
-	unsigned long ret;
+	unsigned long ret, budget;
 
 	BUG_ON(!cpu_time_ratio);
 
+	budget = uksm_cpu_budget_percentage * (TIME_RATIO_SCALE / 100);
 	if (cpu_time_ratio > 0)
-		ret = cpu_time_ratio;
+		ret = min_t(unsigned long, cpu_time_ratio, budget);
 	else
 		ret = (unsigned long)(-cpu_time_ratio) *
-			uksm_max_cpu_percentage / 100UL;
+			uksm_cpu_budget_percentage / 100UL;
 
 	return ret ? ret : 1;
 }
@@ -4348,31 +4763,36 @@ static inline int rung_round_finished(struct scan_rung *rung)
 	return rung->flags & UKSM_RUNG_ROUND_FINISHED;
 }
 
+/*
+ * judge_slot() - move a slot up or down the ladder at the end of its visit.
+ * The rung cursor has already been advanced past it when the visit was
+ * started, see uksm_start_visit().
+ */
 static inline void judge_slot(struct vma_slot *slot)
 {
-	struct scan_rung *rung = slot->rung;
 	unsigned long dedup;
-	int deleted;
 
+	/*
+	 * A worker merging into this slot's pages may still be counting
+	 * them, take and reset the counters under the mutex it holds.
+	 */
+	mutex_lock(&uksm_tree_mutex);
 	dedup = cal_dedup_ratio(slot);
+	slot->pages_merged = 0;
+	slot->pages_cowed = 0;
+	mutex_unlock(&uksm_tree_mutex);
+
 	if (vma_fully_scanned(slot) && uksm_thrash_threshold)
-		deleted = vma_rung_enter(slot, &uksm_scan_ladder[0]);
+		vma_rung_enter(slot, &uksm_scan_ladder[0]);
 	else if (dedup && dedup >= uksm_abundant_threshold)
-		deleted = vma_rung_up(slot);
+		vma_rung_up(slot);
 	else
-		deleted = vma_rung_down(slot);
-
-	slot->pages_merged = 0;
-	slot->pages_cowed = 0;
+		vma_rung_down(slot);
 
 	if (vma_fully_scanned(slot))
 		slot->pages_scanned = 0;
 
 	slot->last_scanned = slot->pages_scanned;
-
-	/* If its deleted in above, then rung was already advanced. */
-	if (!deleted)
-		advance_current_scan(rung);
 }
 
 
@@ -4392,33 +4812,315 @@ static inline int hash_round_finished(void)
 #define UKSM_MMSEM_BATCH	5
 #define BUSY_RETRY		100
 
+struct uksm_scan_control {
+	unsigned long vpages;	/* pages scanned in this uksm_do_scan() */
+	int busy_retry;		/* visits left that may find the mm busy */
+};
+
+/**
+ * uksm_scan_visit() - scan up to @pages pages of @slot, taking its mmap_sem
+ * for UKSM_MMSEM_BATCH pages at a time. Runs in uksmd or in a scan worker.
+ *
+ * @return the number of pages scanned, *err is set to -ENOENT or -EBUSY
+ * (see try_down_read_slot_mmap_sem()) if the visit ended early.
+ */
+static unsigned long uksm_scan_visit(struct vma_slot *slot,
+				     unsigned long pages, int *err)
+{
+	unsigned long scanned = 0;
+	int mmsem_batch = 0;
+
+	*err = 0;
+	while (scanned < pages && !vma_fully_scanned(slot)) {
+		if (!mmsem_batch) {
+			*err = try_down_read_slot_mmap_sem(slot);
+			if (*err)
+				break;
+
+			BUG_ON(!vma_can_enter(slot->vma));
+			if (uksm_test_exit(slot->vma->vm_mm)) {
+				up_read(&slot->vma->vm_mm->mmap_sem);
+				*err = -ENOENT;
+				break;
+			}
+			mmsem_batch = UKSM_MMSEM_BATCH;
+		}
+
+		/* Ok, we have take the mmap_sem, ready to scan */
+		scan_vma_one_page(slot);
+		scanned++;
+
+		if (!--mmsem_batch)
+			up_read(&slot->vma->vm_mm->mmap_sem);
+
+		cond_resched();
+	}
+
+	if (mmsem_batch)
+		up_read(&slot->vma->vm_mm->mmap_sem);
+
+	return scanned;
+}
+
+/*
+ * uksm_finish_visit() - account a finished visit and judge its slot. Called
+ * by uksmd only. Pages a visit could not scan go back to the rung quota.
+ */
+static void uksm_finish_visit(struct vma_slot *slot, unsigned long pages,
+			      unsigned long scanned, int judge, int err,
+			      struct uksm_scan_control *sc)
+{
+	struct scan_rung *rung = slot->rung;
+
+	slot->flags &= ~UKSM_SLOT_IN_VISIT;
+	rung->pages_to_scan += pages - scanned;
+	sc->vpages += scanned;
+
+	if (err == -ENOENT) {
+		rung_rm_slot(slot);
+		return;
+	}
+
+	if (err && !scanned)
+		sc->busy_retry--;
+	else
+		sc->busy_retry = BUSY_RETRY;
+
+	if (!err && judge)
+		judge_slot(slot);
+	else if (err && rung->current_scan == slot)
+		/* skip the busy mm for now */
+		advance_current_scan(rung);
+}
+
+/*
+ * uksm_start_visit() - plan the visit of @rung->current_scan and hand it to
+ * @worker, or scan it right away if @worker is NULL.
+ *
+ * A visit covers the pages the slot gets in this turn: one every rung->step
+ * pages of its length from rung->current_offset on, bounded by the pages it
+ * has left in this scan round and by the rung quota. If that ends the
+ * slot's turn, the cursor moves on now so that uksmd can hand the next
+ * slot to another worker; the slot is judged when the visit is over.
+ */
+static void uksm_start_visit(struct scan_rung *rung,
+			     struct uksm_scan_worker *worker,
+			     struct uksm_scan_control *sc)
+{
+	struct vma_slot *slot = rung->current_scan;
+	unsigned long offset, span, left, pages, scanned;
+	int judge, err;
+
+	BUG_ON(vma_fully_scanned(slot));
+
+	offset = rung->current_offset;
+	if (offset < slot->pages)
+		span = (slot->pages - 1 - offset) / rung->step + 1;
+	else
+		span = 1;
+	left = slot->pages - slot->pages_scanned;
+	pages = min3(span, left, rung->pages_to_scan);
+	judge = (pages == span || pages == left);
+
+	rung->pages_to_scan -= pages;
+	if (judge) {
+		rung->current_offset = offset + (pages - 1) * rung->step;
+		advance_current_scan(rung);
+	} else {
+		rung->current_offset = offset + pages * rung->step;
+	}
+
+	slot->flags |= UKSM_SLOT_IN_VISIT;
+
+	if (!worker) {
+		scanned = uksm_scan_visit(slot, pages, &err);
+		uksm_finish_visit(slot, pages, scanned, judge, err, sc);
+		return;
+	}
+
+	worker->slot = slot;
+	worker->pages = pages;
+	worker->judge = judge;
+
+	spin_lock(&uksm_worker_lock);
+	worker->state = UKSM_WORKER_BUSY;
+	spin_unlock(&uksm_worker_lock);
+	wake_up(&worker->wait);
+}
+
+static int uksm_scan_worker_thread(void *data)
+{
+	struct uksm_scan_worker *worker = data;
+	int busy;
+
+	set_freezable();
+	set_user_nice(current, 5);
+
+	while (!kthread_should_stop()) {
+		wait_event_freezable(worker->wait,
+				     worker->state == UKSM_WORKER_BUSY ||
+				     kthread_should_stop());
+
+		/* pairs with the store in uksm_start_visit() */
+		spin_lock(&uksm_worker_lock);
+		busy = worker->state == UKSM_WORKER_BUSY;
+		spin_unlock(&uksm_worker_lock);
+		if (!busy)
+			continue;
+
+		worker->scanned = uksm_scan_visit(worker->slot, worker->pages,
+						  &worker->err);
+
+		spin_lock(&uksm_worker_lock);
+		worker->state = UKSM_WORKER_DONE;
+		spin_unlock(&uksm_worker_lock);
+		wake_up(&uksm_worker_done_wait);
+	}
+
+	return 0;
+}
+
+static struct uksm_scan_worker *uksm_idle_worker(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < uksm_nr_workers; i++)
+		if (uksm_workers[i].state == UKSM_WORKER_IDLE)
+			return &uksm_workers[i];
+
+	return NULL;
+}
+
+static int uksm_count_workers(int state)
+{
+	unsigned int i;
+	int n = 0;
+
+	spin_lock(&uksm_worker_lock);
+	for (i = 0; i < uksm_nr_workers; i++)
+		if (uksm_workers[i].state == state)
+			n++;
+	spin_unlock(&uksm_worker_lock);
+
+	return n;
+}
+
+/*
+ * uksm_wait_workers() - finish the visits of the workers that are done,
+ * waiting for at least one of them, or for all of them if @all.
+ */
+static void uksm_wait_workers(struct uksm_scan_control *sc, int all)
+{
+	struct uksm_scan_worker *worker;
+	unsigned int i;
+	int reaped;
+
+	for (;;) {
+		reaped = 0;
+		for (i = 0; i < uksm_nr_workers; i++) {
+			worker = &uksm_workers[i];
+
+			spin_lock(&uksm_worker_lock);
+			if (worker->state != UKSM_WORKER_DONE) {
+				spin_unlock(&uksm_worker_lock);
+				continue;
+			}
+			worker->state = UKSM_WORKER_IDLE;
+			spin_unlock(&uksm_worker_lock);
+
+			uksm_finish_visit(worker->slot, worker->pages,
+					  worker->scanned, worker->judge,
+					  worker->err, sc);
+			worker->slot = NULL;
+			reaped++;
+		}
+
+		if ((reaped && !all) || !uksm_count_workers(UKSM_WORKER_BUSY))
+			break;
+
+		wait_event(uksm_worker_done_wait,
+			   uksm_count_workers(UKSM_WORKER_DONE));
+	}
+}
+
+/*
+ * uksm_scan_runtime() - cpu time used by uksmd and its scan workers, which
+ * is what the scan cost estimate and the cpu budget are about.
+ */
+static unsigned long long uksm_scan_runtime(void)
+{
+	unsigned long long runtime = task_sched_runtime(current);
+	unsigned int i;
+
+	for (i = 0; i < uksm_nr_workers; i++)
+		runtime += task_sched_runtime(uksm_workers[i].task);
+
+	return runtime;
+}
+
+/*
+ * uksm_set_scan_threads() - start or stop scan workers so that @nr threads
+ * scan in total; with one, uksmd scans on its own. Called with
+ * uksm_thread_mutex held, when no visit is in flight.
+ */
+static int uksm_set_scan_threads(unsigned int nr)
+{
+	struct uksm_scan_worker *worker;
+	struct task_struct *task;
+
+	if (nr <= 1)
+		nr = 0;
+
+	if (nr && !uksm_workers)
+		return -ENOMEM;
+
+	while (uksm_nr_workers > nr) {
+		worker = &uksm_workers[--uksm_nr_workers];
+		kthread_stop(worker->task);
+		worker->task = NULL;
+	}
+
+	while (uksm_nr_workers < nr) {
+		worker = &uksm_workers[uksm_nr_workers];
+		worker->state = UKSM_WORKER_IDLE;
+		task = kthread_run(uksm_scan_worker_thread, worker,
+				   "uksmd/%u", uksm_nr_workers);
+		if (IS_ERR(task))
+			return PTR_ERR(task);
+
+		worker->task = task;
+		uksm_nr_workers++;
+	}
+
+	return 0;
+}
+
 /**
  * uksm_do_scan()  - the main worker function.
  */
 static noinline void uksm_do_scan(void)
 {
-	struct vma_slot *slot, *iter;
-	struct mm_struct *busy_mm;
+	struct uksm_scan_control sc;
+	struct uksm_scan_worker *worker;
 	unsigned char round_finished, all_rungs_emtpy;
-	int i, err, mmsem_batch;
+	int i;
 	unsigned long pcost;
 	long long delta_exec;
-	unsigned long vpages, max_cpu_ratio;
+	unsigned long max_cpu_ratio;
 	unsigned long long start_time, end_time, scan_time;
 	unsigned int expected_jiffies;
 
 	might_sleep();
 
-	vpages = 0;
+	sc.vpages = 0;
+	uksm_cpu_budget_percentage = uksm_cpu_budget();
 
-	start_time = task_sched_runtime(current);
+	start_time = uksm_scan_runtime();
 	max_cpu_ratio = 0;
-	mmsem_batch = 0;
 
 	for (i = 0; i < SCAN_LADDER_SIZE;) {
 		struct scan_rung *rung = &uksm_scan_ladder[i];
 		unsigned long ratio;
-		int busy_retry;
 
 		if (!rung->pages_to_scan) {
 			i++;
@@ -4435,100 +5137,49 @@ static noinline void uksm_do_scan(void)
 		if (ratio > max_cpu_ratio)
 			max_cpu_ratio = ratio;
 
-		busy_retry = BUSY_RETRY;
+		sc.busy_retry = BUSY_RETRY;
 		/*
 		 * Do not consider rung_round_finished() here, just used up the
 		 * rung->pages_to_scan quota.
 		 */
 		while (rung->pages_to_scan && rung->vma_root.num &&
-		       likely(!freezing(current))) {
-			int reset = 0;
-
-			slot = rung->current_scan;
+		       sc.busy_retry > 0 && likely(!freezing(current))) {
+			worker = NULL;
 
-			BUG_ON(vma_fully_scanned(slot));
-
-			if (mmsem_batch) {
-				err = 0;
-			} else {
-				err = try_down_read_slot_mmap_sem(slot);
-			}
-
-			if (err == -ENOENT) {
-rm_slot:
-				rung_rm_slot(slot);
+			/*
+			 * All workers are busy, or the cursor came round to
+			 * a slot whose visit is still in flight.
+			 */
+			if ((rung->current_scan->flags & UKSM_SLOT_IN_VISIT) ||
+			    (uksm_nr_workers && !(worker = uksm_idle_worker()))) {
+				uksm_wait_workers(&sc, 0);
 				continue;
 			}
 
-			busy_mm = slot->mm;
-
-			if (err == -EBUSY) {
-				/* skip other vmas on the same mm */
-				do {
-					reset = advance_current_scan(rung);
-					iter = rung->current_scan;
-					busy_retry--;
-					if (iter->vma->vm_mm != busy_mm ||
-					    !busy_retry || reset)
-						break;
-				} while (1);
-
-				if (iter->vma->vm_mm != busy_mm) {
-					continue;
-				} else {
-					/* scan round finsished */
-					break;
-				}
-			}
-
-			BUG_ON(!vma_can_enter(slot->vma));
-			if (uksm_test_exit(slot->vma->vm_mm)) {
-				mmsem_batch = 0;
-				up_read(&slot->vma->vm_mm->mmap_sem);
-				goto rm_slot;
-			}
-
-			if (mmsem_batch)
-				mmsem_batch--;
-			else
-				mmsem_batch = UKSM_MMSEM_BATCH;
-
-			/* Ok, we have take the mmap_sem, ready to scan */
-			scan_vma_one_page(slot);
-			rung->pages_to_scan--;
-			vpages++;
-
-			if (rung->current_offset + rung->step > slot->pages - 1
-			    || vma_fully_scanned(slot)) {
-				up_read(&slot->vma->vm_mm->mmap_sem);
-				judge_slot(slot);
-				mmsem_batch = 0;
-			} else {
-				rung->current_offset += rung->step;
-				if (!mmsem_batch)
-					up_read(&slot->vma->vm_mm->mmap_sem);
-			}
-
-			busy_retry = BUSY_RETRY;
+			uksm_start_visit(rung, worker, &sc);
 			cond_resched();
 		}
 
-		if (mmsem_batch) {
-			up_read(&slot->vma->vm_mm->mmap_sem);
-			mmsem_batch = 0;
-		}
+		uksm_wait_workers(&sc, 1);
+
+		/* The mms in this rung stayed busy, leave it for next time */
+		if (sc.busy_retry <= 0)
+			rung->pages_to_scan = 0;
 
 		if (freezing(current))
 			break;
 
 		cond_resched();
 	}
-	end_time = task_sched_runtime(current);
+	end_time = uksm_scan_runtime();
 	delta_exec = end_time - start_time;
 
 	if (freezing(current))
 		return;
 
+	if (delta_exec > 0)
+		uksm_scan_cpu_nsecs += delta_exec;
+
 	cleanup_vma_slots();
 	uksm_enter_all_slots();
 
@@ -4572,8 +5223,8 @@ rm_slot:
 	}
 
 
-	if (vpages && delta_exec > 0) {
-		pcost = (unsigned long) delta_exec / vpages;
+	if (sc.vpages && delta_exec > 0) {
+		pcost = (unsigned long) delta_exec / sc.vpages;
 		if (likely(uksm_ema_page_time))
 			uksm_ema_page_time = ema(pcost, uksm_ema_page_time);
 		else
@@ -4583,7 +5234,7 @@ rm_slot:
 	uksm_calc_scan_pages();
 	uksm_sleep_real = uksm_sleep_jiffies;
 	/* in case of radical cpu bursts, apply the upper bound */
-	end_time = task_sched_runtime(current);
+	end_time = uksm_scan_runtime();
 	if (max_cpu_ratio && end_time > start_time) {
 		scan_time = end_time - start_time;
 		expected_jiffies = msecs_to_jiffies(
@@ -4989,6 +5640,7 @@ static inline void init_performance_values(void)
 	}
 
 	uksm_max_cpu_percentage = preset->max_cpu;
+	uksm_cpu_budget_percentage = uksm_max_cpu_percentage;
 }
 
 static ssize_t cpu_governor_store(struct kobject *kobj,
@@ -5309,6 +5961,129 @@ static ssize_t sleep_times_show(struct kobject *kobj,
 }
 UKSM_ATTR_RO(sleep_times);
 
+static ssize_t page_ops_show(struct kobject *kobj,
+			     struct kobj_attribute *attr, char *buf)
+{
+	struct uksm_page_ops *ops;
+	ssize_t len = 0;
+
+	for (ops = uksm_page_ops_table;
+	     ops < uksm_page_ops_table + ARRAY_SIZE(uksm_page_ops_table);
+	     ops++) {
+		if (!ops->tested)
+			continue;
+		len += sprintf(buf + len, "%s%s scan %lu merge %lu zero %lu "
+			       "MB/s\n", ops == uksm_page_ops ? "*" : "",
+			       ops->name, ops->scan_mbps, ops->merge_mbps,
+			       ops->zero_mbps);
+	}
+
+	return len;
+}
+UKSM_ATTR_RO(page_ops);
+
+static ssize_t scan_threads_show(struct kobject *kobj,
+				 struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", uksm_nr_workers ? uksm_nr_workers : 1);
+}
+
+static ssize_t scan_threads_store(struct kobject *kobj,
+				  struct kobj_attribute *attr,
+				  const char *buf, size_t count)
+{
+	unsigned long threads;
+	int err;
+
+	err = strict_strtoul(buf, 10, &threads);
+	if (err || !threads || threads > num_possible_cpus())
+		return -EINVAL;
+
+	mutex_lock(&uksm_thread_mutex);
+	err = uksm_set_scan_threads(threads);
+	mutex_unlock(&uksm_thread_mutex);
+
+	return err ? err : count;
+}
+UKSM_ATTR(scan_threads);
+
+static ssize_t screen_off_cpu_percentage_show(struct kobject *kobj,
+					      struct kobj_attribute *attr,
+					      char *buf)
+{
+	return sprintf(buf, "%u\n", uksm_screen_off_cpu_percentage);
+}
+
+static ssize_t screen_off_cpu_percentage_store(struct kobject *kobj,
+					       struct kobj_attribute *attr,
+					       const char *buf, size_t count)
+{
+	unsigned long percentage;
+	int err;
+
+	err = strict_strtoul(buf, 10, &percentage);
+	if (err || !percentage || percentage > 99)
+		return -EINVAL;
+
+	uksm_screen_off_cpu_percentage = percentage;
+
+	return count;
+}
+UKSM_ATTR(screen_off_cpu_percentage);
+
+static ssize_t battery_cpu_percentage_show(struct kobject *kobj,
+					   struct kobj_attribute *attr,
+					   char *buf)
+{
+	return sprintf(buf, "%u\n", uksm_battery_cpu_percentage);
+}
+
+static ssize_t battery_cpu_percentage_store(struct kobject *kobj,
+					    struct kobj_attribute *attr,
+					    const char *buf, size_t count)
+{
+	unsigned long percentage;
+	int err;
+
+	err = strict_strtoul(buf, 10, &percentage);
+	if (err || !percentage || percentage > 99)
+		return -EINVAL;
+
+	uksm_battery_cpu_percentage = percentage;
+
+	return count;
+}
+UKSM_ATTR(battery_cpu_percentage);
+
+static ssize_t cpu_budget_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", uksm_cpu_budget_percentage);
+}
+UKSM_ATTR_RO(cpu_budget);
+
+static ssize_t scan_cpu_msecs_show(struct kobject *kobj,
+				   struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%llu\n",
+		       div_u64(uksm_scan_cpu_nsecs, NSEC_PER_MSEC));
+}
+UKSM_ATTR_RO(scan_cpu_msecs);
+
+/* Pages merged per second of cpu time spent scanning, since boot */
+static ssize_t merge_rate_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buf)
+{
+	u64 msecs = div_u64(uksm_scan_cpu_nsecs, NSEC_PER_MSEC);
+	u64 rate = 0;
+
+	if (msecs)
+		rate = div64_u64(uksm_pages_merged_total * MSEC_PER_SEC, msecs);
+
+	return sprintf(buf, "%llu\n", rate);
+}
+UKSM_ATTR_RO(merge_rate);
+
 
 static struct attribute *uksm_attrs[] = {
 	&max_cpu_percentage_attr.attr,
@@ -5323,6 +6098,13 @@ static struct attribute *uksm_attrs[] = {
 	&pages_scanned_attr.attr,
 	&hash_strength_attr.attr,
 	&sleep_times_attr.attr,
+	&page_ops_attr.attr,
+	&scan_threads_attr.attr,
+	&screen_off_cpu_percentage_attr.attr,
+	&battery_cpu_percentage_attr.attr,
+	&cpu_budget_attr.attr,
+	&scan_cpu_msecs_attr.attr,
+	&merge_rate_attr.attr,
 	&thrash_threshold_attr.attr,
 	&abundant_threshold_attr.attr,
 	&cpu_ratios_attr.attr,
@@ -5401,6 +6183,144 @@ static inline int cal_positive_negative_costs(void)
 	return 0;
 }
 
+static int __init uksm_page_ops_selftest(struct uksm_page_ops *ops,
+					 u8 *p1, u8 *p2)
+{
+	static const unsigned int offsets[] __initconst = {
+		0, 7, 64, 127, 128, 255, 256, 2049, PAGE_SIZE - 1,
+	};
+	static const unsigned int strengths[] __initconst = {
+		0, 1, 3, 4, 5, HASH_STRENGTH_FULL >> 4, HASH_STRENGTH_FULL - 1,
+		HASH_STRENGTH_FULL, HASH_STRENGTH_FULL + 3,
+		HASH_STRENGTH_MAX - 1,
+	};
+	int i, cmp;
+
+	get_random_bytes(p1, PAGE_SIZE);
+	p1[0] |= 1;
+	memcpy(p2, p1, PAGE_SIZE);
+	if (ops->memcmp_page(p1, p2) || ops->is_full_zero(p1, PAGE_SIZE))
+		return -EINVAL;
+
+	for (i = 0; i < ARRAY_SIZE(strengths); i++) {
+		if (ops->sample_hash(p1, strengths[i]) !=
+		    random_sample_hash(p1, strengths[i]))
+			return -EINVAL;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(offsets); i++) {
+		p2[offsets[i]] ^= 0x80;
+		cmp = ops->memcmp_page(p1, p2);
+		if (!cmp || (cmp < 0) != (ops->memcmp_page(p2, p1) > 0))
+			return -EINVAL;
+		p2[offsets[i]] ^= 0x80;
+	}
+
+	memset(p1, 0, PAGE_SIZE);
+	if (!ops->is_full_zero(p1, PAGE_SIZE))
+		return -EINVAL;
+	for (i = 0; i < ARRAY_SIZE(offsets); i++) {
+		p1[offsets[i]] = 1;
+		if (ops->is_full_zero(p1, PAGE_SIZE))
+			return -EINVAL;
+		p1[offsets[i]] = 0;
+	}
+
+	return 0;
+}
+
+#define UKSM_BENCH_PAGES	1024
+
+static unsigned long __init uksm_bench_mbps(s64 ns)
+{
+	if (ns <= 0)
+		ns = 1;
+	return div64_u64((u64)UKSM_BENCH_PAGES * PAGE_SIZE * NSEC_PER_SEC,
+			 ns) >> 20;
+}
+
+/*
+ * Scanning is timed as full strength hashing of distinct pages, merging
+ * as comparing identical ones, which is the worst case for both.
+ */
+static void __init uksm_page_ops_bench(struct uksm_page_ops *ops,
+				       u8 *p1, u8 *p2)
+{
+	/* IMPORTANT: volatile is needed to prevent over-optimization by gcc. */
+	volatile u32 hash;
+	volatile int ret;
+	ktime_t start;
+	int i;
+
+	get_random_bytes(p1, PAGE_SIZE);
+	memcpy(p2, p1, PAGE_SIZE);
+
+	start = ktime_get();
+	for (i = 0; i < UKSM_BENCH_PAGES; i++)
+		hash = ops->sample_hash(i & 1 ? p1 : p2, HASH_STRENGTH_FULL);
+	ops->scan_mbps = uksm_bench_mbps(ktime_to_ns(ktime_sub(ktime_get(),
+							       start)));
+
+	start = ktime_get();
+	for (i = 0; i < UKSM_BENCH_PAGES; i++)
+		ret = ops->memcmp_page(p1, p2);
+	ops->merge_mbps = uksm_bench_mbps(ktime_to_ns(ktime_sub(ktime_get(),
+								start)));
+
+	memset(p1, 0, PAGE_SIZE);
+	start = ktime_get();
+	for (i = 0; i < UKSM_BENCH_PAGES; i++)
+		ret = ops->is_full_zero(p1, PAGE_SIZE);
+	ops->zero_mbps = uksm_bench_mbps(ktime_to_ns(ktime_sub(ktime_get(),
+							       start)));
+}
+
+/*
+ * Pick the first page ops the CPU supports that pass the self-test, and
+ * report the throughput of all of them. Must run after random_nums is set
+ * up and before anything is hashed.
+ */
+static void __init uksm_select_page_ops(void)
+{
+	struct uksm_page_ops *ops, *selected = NULL;
+	struct page *page1, *page2;
+	u8 *p1, *p2;
+
+	page1 = alloc_page(GFP_KERNEL);
+	page2 = alloc_page(GFP_KERNEL);
+	if (!page1 || !page2)
+		goto out;
+	p1 = page_address(page1);
+	p2 = page_address(page2);
+
+	for (ops = uksm_page_ops_table;
+	     ops < uksm_page_ops_table + ARRAY_SIZE(uksm_page_ops_table);
+	     ops++) {
+		if (ops->usable && !ops->usable())
+			continue;
+		if (uksm_page_ops_selftest(ops, p1, p2)) {
+			printk(KERN_ERR "UKSM: %s page ops failed self-test\n",
+			       ops->name);
+			continue;
+		}
+		uksm_page_ops_bench(ops, p1, p2);
+		ops->tested = 1;
+		printk(KERN_INFO "UKSM: %s page ops: scan %lu MB/s, "
+		       "merge %lu MB/s, zero check %lu MB/s\n", ops->name,
+		       ops->scan_mbps, ops->merge_mbps, ops->zero_mbps);
+		if (!selected)
+			selected = ops;
+	}
+	if (selected)
+		uksm_page_ops = selected;
+out:
+	if (page1)
+		__free_page(page1);
+	if (page2)
+		__free_page(page2);
+	printk(KERN_INFO "UKSM: using %s page ops\n", uksm_page_ops->name);
+}
+
 static int init_zeropage_hash_table(void)
 {
 	struct page *page;
@@ -5428,7 +6348,7 @@ static int init_zeropage_hash_table(void)
 	return 0;
 }
 
-static inline int init_random_sampling(void)
+static int __init init_random_sampling(void)
 {
 	unsigned long i;
 	random_nums = kmalloc(PAGE_SIZE, GFP_KERNEL);
@@ -5452,6 +6372,8 @@ static inline int init_random_sampling(void)
 	rshash_state.below_count = 0;
 	rshash_state.lookup_window_index = 0;
 
+	uksm_select_page_ops();
+
 	return cal_positive_negative_costs();
 }
 
@@ -5552,6 +6474,24 @@ struct page *ksm_does_need_to_copy(struct page *page,
 	return new_page;
 }
 
+#ifdef CONFIG_HAS_EARLYSUSPEND
+static void uksm_early_suspend(struct early_suspend *h)
+{
+	uksm_screen_off = 1;
+}
+
+static void uksm_late_resume(struct early_suspend *h)
+{
+	uksm_screen_off = 0;
+}
+
+static struct early_suspend uksm_early_suspend_desc = {
+	.level = EARLY_SUSPEND_LEVEL_DISABLE_FB + 1,
+	.suspend = uksm_early_suspend,
+	.resume = uksm_late_resume,
+};
+#endif
+
 static int __init uksm_init(void)
 {
 	struct task_struct *uksm_thread;
@@ -5583,10 +6523,29 @@ static int __init uksm_init(void)
 		goto out_free;
 	}
 
+	/* One scan thread per cpu; if that fails, uksmd scans on its own */
+	uksm_workers = kcalloc(num_possible_cpus(), sizeof(*uksm_workers),
+			       GFP_KERNEL);
+	if (uksm_workers) {
+		int i;
+
+		for (i = 0; i < num_possible_cpus(); i++)
+			init_waitqueue_head(&uksm_workers[i].wait);
+
+		mutex_lock(&uksm_thread_mutex);
+		if (uksm_set_scan_threads(num_online_cpus()))
+			printk(KERN_WARNING "uksm: only %u scan workers\n",
+			       uksm_nr_workers);
+		mutex_unlock(&uksm_thread_mutex);
+	}
+
 #ifdef CONFIG_SYSFS
 	err = sysfs_create_group(mm_kobj, &uksm_attr_group);
 	if (err) {
 		printk(KERN_ERR "uksm: register sysfs failed\n");
+		mutex_lock(&uksm_thread_mutex);
+		uksm_set_scan_threads(0);
+		mutex_unlock(&uksm_thread_mutex);
 		kthread_stop(uksm_thread);
 		goto out_free;
 	}
@@ -5602,6 +6561,7 @@ static int __init uksm_init(void)
 	 */
 	hotplug_memory_notifier(uksm_memory_callback, 100);
 #endif
+	register_early_suspend(&uksm_early_suspend_desc);
 	return 0;
 
 out_free:
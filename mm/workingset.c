@@ -0,0 +1,264 @@
+/*
+ * mm/workingset.c
+ *
+ * Workingset detection: tell page cache refaults that belong to the
+ * workingset from those that merely stream through memory.
+ *
+ * Released under the GPL, see the file COPYING for details.
+ *
+ * Each zone keeps a clock, zone->inactive_age, that ticks once for every
+ * file page evicted from its inactive list and once for every page
+ * activated out of it.  When reclaim evicts a file page, a shadow entry
+ * recording the zone and the clock at that moment is left behind for
+ * the (mapping, index) of the page.
+ *
+ * When the same page is read back in, the clock difference between
+ * eviction and refault - the refault distance - is the number of
+ * inactive list slots the page would have needed on top of what it got
+ * in order to stay resident.  Those slots can only come from the active
+ * list, so if the refault distance is no larger than the active file
+ * list, the page could have stayed in memory by competing with the
+ * active pages; it is put straight on the active list.  A larger
+ * distance means the page is used less often than the workingset turns
+ * over, and it starts on the inactive list as before.
+ *
+ * The page cache radix tree of this kernel has no room for non-page
+ * entries, so shadow entries live in a hash table of their own, sized
+ * from the amount of memory and indexed by (mapping, index).  A slot
+ * holds one shadow; a newer eviction hashing to the same slot replaces
+ * the older one, which is the one least likely to be within refault
+ * distance anyway.  Part of the hash is kept in the shadow so that a
+ * refault only consumes an entry left by its own page.
+ *
+ * Nothing in the table can be found by mapping, so truncation cannot
+ * remove the shadows of the pages it drops.  Instead the key also
+ * covers mapping->shadow_gen, which truncation and inode setup move to
+ * a fresh value: the old shadows no longer match any lookup and are
+ * left to be overwritten.
+ */
+
+#include <linux/mm.h>
+#include <linux/mmzone.h>
+#include <linux/swap.h>
+#include <linux/fs.h>
+#include <linux/hash.h>
+#include <linux/init.h>
+#include <linux/log2.h>
+#include <linux/vmalloc.h>
+#include <linux/vmstat.h>
+
+/*
+ * Shadow entry layout, from the least significant bit:
+ *
+ *	1 bit		always set, tells a shadow from an empty slot
+ *	ZONES_SHIFT	zone index
+ *	NODES_SHIFT	node id
+ *	KEY_BITS	hash bits of (mapping, index) below the slot number
+ *	the rest	zone->inactive_age at eviction, truncated
+ */
+#define WORKINGSET_KEY_BITS	8
+#define WORKINGSET_ZONE_SHIFT	1
+#define WORKINGSET_NODE_SHIFT	(WORKINGSET_ZONE_SHIFT + ZONES_SHIFT)
+#define WORKINGSET_KEY_SHIFT	(WORKINGSET_NODE_SHIFT + NODES_SHIFT)
+#define EVICTION_SHIFT		(WORKINGSET_KEY_SHIFT + WORKINGSET_KEY_BITS)
+#define EVICTION_MASK		(~0UL >> EVICTION_SHIFT)
+
+/* Largest and smallest hash table, in entries */
+#define WORKINGSET_HASH_MAX_SHIFT	20
+#define WORKINGSET_HASH_MIN_SHIFT	10
+
+static unsigned long *workingset_hash __read_mostly;
+static atomic_long_t workingset_gen;
+/*
+ * Starts out at the smallest table size so that a reader racing with
+ * workingset_init() never indexes past the table it sees.
+ */
+static unsigned int workingset_hash_shift __read_mostly =
+	WORKINGSET_HASH_MIN_SHIFT;
+
+static unsigned long workingset_hash_key(struct address_space *mapping,
+					 pgoff_t index)
+{
+	return hash_long((unsigned long)mapping ^ hash_long(index, BITS_PER_LONG) ^
+			 hash_long(mapping->shadow_gen, BITS_PER_LONG),
+			 BITS_PER_LONG);
+}
+
+static unsigned long *workingset_slot(unsigned long key)
+{
+	return &workingset_hash[key >> (BITS_PER_LONG - workingset_hash_shift)];
+}
+
+static unsigned long workingset_key_bits(unsigned long key)
+{
+	key >>= BITS_PER_LONG - workingset_hash_shift - WORKINGSET_KEY_BITS;
+	return key & ((1UL << WORKINGSET_KEY_BITS) - 1);
+}
+
+static unsigned long pack_shadow(unsigned long eviction, struct zone *zone,
+				 unsigned long key)
+{
+	unsigned long shadow;
+
+	shadow = (eviction & EVICTION_MASK) << EVICTION_SHIFT;
+	shadow |= workingset_key_bits(key) << WORKINGSET_KEY_SHIFT;
+	shadow |= (unsigned long)zone_to_nid(zone) << WORKINGSET_NODE_SHIFT;
+	shadow |= (unsigned long)zone_idx(zone) << WORKINGSET_ZONE_SHIFT;
+	return shadow | 1;
+}
+
+static void unpack_shadow(unsigned long shadow, struct zone **zone,
+			  unsigned long *distance)
+{
+	unsigned long eviction;
+	unsigned long refault;
+	int zid, nid;
+
+	zid = (shadow >> WORKINGSET_ZONE_SHIFT) & ((1UL << ZONES_SHIFT) - 1);
+	nid = (shadow >> WORKINGSET_NODE_SHIFT) & ((1UL << NODES_SHIFT) - 1);
+	eviction = shadow >> EVICTION_SHIFT;
+
+	*zone = NODE_DATA(nid)->node_zones + zid;
+
+	refault = atomic_long_read(&(*zone)->inactive_age);
+
+	/*
+	 * The unsigned subtraction here gives an accurate distance
+	 * across inactive_age overflows in most cases.
+	 *
+	 * There is a special case: usually, shadow entries have a short
+	 * lifetime and are either refaulted or overwritten in the hash
+	 * table long before inactive_age wraps around, but an entry can
+	 * survive long enough for the truncated clock to lap it.  The
+	 * distance then looks arbitrarily small and the page is
+	 * activated once more than it should have been; reclaim will
+	 * correct that.
+	 */
+	*distance = (refault - eviction) & EVICTION_MASK;
+}
+
+/**
+ * workingset_eviction - note the eviction of a page from memory
+ * @mapping: address space the page was backing
+ * @page: the page being evicted
+ *
+ * Records a shadow entry for @page so that a later refault of the same
+ * index in @mapping can be judged by workingset_refault().  Called by
+ * reclaim with the page locked and about to leave the page cache.
+ */
+void workingset_eviction(struct address_space *mapping, struct page *page)
+{
+	struct zone *zone = page_zone(page);
+	unsigned long eviction;
+	unsigned long key;
+
+	if (!workingset_hash)
+		return;
+
+	eviction = atomic_long_inc_return(&zone->inactive_age);
+	key = workingset_hash_key(mapping, page->index);
+	ACCESS_ONCE(*workingset_slot(key)) = pack_shadow(eviction, zone, key);
+}
+
+/**
+ * workingset_refault - evaluate the refault of a previously evicted page
+ * @mapping: address space the page is being read into
+ * @index: page index within @mapping
+ *
+ * Consumes the shadow entry left by the eviction of this page, if any,
+ * and calculates the refault distance of the page.
+ *
+ * Returns %true if the page should be activated, %false otherwise.
+ */
+bool workingset_refault(struct address_space *mapping, pgoff_t index)
+{
+	unsigned long *slot;
+	unsigned long shadow;
+	unsigned long distance;
+	unsigned long key;
+	struct zone *zone;
+
+	if (!workingset_hash)
+		return false;
+
+	key = workingset_hash_key(mapping, index);
+	slot = workingset_slot(key);
+	shadow = ACCESS_ONCE(*slot);
+	if (!shadow)
+		return false;
+	if (((shadow >> WORKINGSET_KEY_SHIFT) &
+	     ((1UL << WORKINGSET_KEY_BITS) - 1)) != workingset_key_bits(key))
+		return false;
+	/* Racing with another eviction into this slot: let it win */
+	if (cmpxchg(slot, shadow, 0) != shadow)
+		return false;
+
+	unpack_shadow(shadow, &zone, &distance);
+
+	inc_zone_state(zone, WORKINGSET_REFAULT);
+
+	if (distance <= zone_page_state(zone, NR_ACTIVE_FILE)) {
+		inc_zone_state(zone, WORKINGSET_ACTIVATE);
+		return true;
+	}
+	return false;
+}
+
+/**
+ * workingset_activation - note a page activation
+ * @page: page that is being activated
+ */
+void workingset_activation(struct page *page)
+{
+	atomic_long_inc(&page_zone(page)->inactive_age);
+}
+
+/**
+ * workingset_forget - drop the shadow entries of a mapping
+ * @mapping: address space being truncated or set up
+ *
+ * Called when pages of @mapping are truncated, which includes the
+ * eviction of its inode, and when a new inode is set up, possibly at
+ * the address of an evicted one.  A refault of any index of @mapping
+ * evicted before this is then treated as a first access.  That is
+ * more than a partial truncation needs, but cheap and rare enough.
+ */
+void workingset_forget(struct address_space *mapping)
+{
+	mapping->shadow_gen = atomic_long_inc_return(&workingset_gen);
+}
+
+static int __init workingset_init(void)
+{
+	unsigned long *table;
+	unsigned long entries;
+	unsigned int shift;
+
+	/*
+	 * A refault can only be activated while its distance fits in
+	 * the active file list, so evictions older than about one
+	 * memory's worth of page cache are of no further interest.
+	 * Half an entry per page of memory keeps those within reach
+	 * for all but the largest page caches.
+	 */
+	entries = totalram_pages / 2;
+	shift = entries ? ilog2(entries) : 0;
+	shift = clamp_t(unsigned int, shift, WORKINGSET_HASH_MIN_SHIFT,
+			min(WORKINGSET_HASH_MAX_SHIFT,
+			    BITS_PER_LONG - WORKINGSET_KEY_BITS));
+
+	table = vzalloc(sizeof(unsigned long) << shift);
+	if (!table) {
+		printk(KERN_WARNING "workingset: no memory for shadow entries\n");
+		return -ENOMEM;
+	}
+	/* Publish the table before the shift that indexes all of it */
+	workingset_hash = table;
+	smp_wmb();
+	workingset_hash_shift = shift;
+
+	printk(KERN_INFO "workingset: %lu shadow entries, %u bits of eviction\n",
+	       1UL << shift, BITS_PER_LONG - EVICTION_SHIFT);
+	return 0;
+}
+module_init(workingset_init);
@@ -0,0 +1,301 @@
+/*
+ * hwmem-stress.c - stress the hwmem contiguous allocator from userspace
+ *
+ * License terms: GNU General Public License (GPL), version 2.
+ *
+ * Runs a random mix of allocations and releases through /dev/hwmem,
+ * keeping up to a given number of buffers of random size alive, and
+ * reports the latency of both operations. The cona debugfs file of the
+ * instance backing the memory type is sampled while the buffers are
+ * alive to report fragmentation, that is how much of the free space is
+ * outside the biggest free block:
+ *
+ *	hwmem-stress -n 100000 -l 64 -m 4 -M 4096
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+
+#include <linux/hwmem.h>
+
+#define HIST_USECS	10000	/* 1us buckets up to 10ms */
+#define PAGE_KB		4
+
+struct latency {
+	const char *name;
+	unsigned long count;
+	unsigned long failed;
+	unsigned long long sum;
+	long min;
+	long max;
+	unsigned long hist[HIST_USECS + 1];
+};
+
+struct frag {
+	unsigned long samples;
+	double sum;
+	double max;
+	unsigned long free_blocks_max;
+};
+
+static struct latency alloc_lat = { .name = "alloc", .min = -1 };
+static struct latency free_lat = { .name = "release", .min = -1 };
+static struct frag frag;
+
+static unsigned long nr_ops = 10000;
+static int nr_live = 64;
+static int min_kb = 4;
+static int max_kb = 4096;
+static int mem_type = HWMEM_MEM_CONTIGUOUS_SYS;
+static int sample_every = 100;
+static unsigned int seed = 1;
+static const char *device = "/dev/" HWMEM_DEFAULT_DEVICE_NAME;
+static const char *cona_file = "/sys/kernel/debug/cona/hwmem_cona_allocs";
+
+static long timespec_diff_us(struct timespec *a, struct timespec *b)
+{
+	return (a->tv_sec - b->tv_sec) * 1000000 +
+		(a->tv_nsec - b->tv_nsec) / 1000;
+}
+
+static void latency_add(struct latency *lat, long us)
+{
+	if (us < 0)
+		us = 0;
+	lat->hist[us < HIST_USECS ? us : HIST_USECS]++;
+	lat->sum += us;
+	lat->count++;
+	if (lat->min < 0 || us < lat->min)
+		lat->min = us;
+	if (us > lat->max)
+		lat->max = us;
+}
+
+static long latency_percentile(struct latency *lat, int percent)
+{
+	unsigned long want = (lat->count * percent + 99) / 100;
+	unsigned long seen = 0;
+	int i;
+
+	for (i = 0; i <= HIST_USECS; i++) {
+		seen += lat->hist[i];
+		if (seen >= want)
+			return i;
+	}
+	return HIST_USECS;
+}
+
+static void latency_print(struct latency *lat)
+{
+	if (!lat->count) {
+		printf(" %8s: no samples, %lu failed\n", lat->name, lat->failed);
+		return;
+	}
+	printf(" %8s: %8lu ops %6lu failed  min %5ld avg %5llu 50%% %5ld "
+	       "90%% %5ld 99%% %5ld max %5ld [usec]\n", lat->name,
+	       lat->count, lat->failed, lat->min, lat->sum / lat->count,
+	       latency_percentile(lat, 50), latency_percentile(lat, 90),
+	       latency_percentile(lat, 99), lat->max);
+}
+
+/*
+ * The status at the end of the cona debugfs file has the biggest free
+ * block, the total free space and the number of free blocks.
+ */
+static int cona_sample(void)
+{
+	char line[256];
+	unsigned long biggest = 0, free = 0, blocks = 0;
+	double f;
+	FILE *file;
+
+	file = fopen(cona_file, "r");
+	if (!file)
+		return -1;
+	while (fgets(line, sizeof(line), file)) {
+		sscanf(line, "Current biggest free: %lu", &biggest);
+		sscanf(line, "Current free: %lu", &free);
+		sscanf(line, "Current free blocks: %lu", &blocks);
+	}
+	fclose(file);
+
+	if (!free)
+		return 0;
+
+	f = 100.0 * (free - biggest) / free;
+	frag.samples++;
+	frag.sum += f;
+	if (f > frag.max)
+		frag.max = f;
+	if (blocks > frag.free_blocks_max)
+		frag.free_blocks_max = blocks;
+	return 0;
+}
+
+static int do_alloc(int fd, int *id)
+{
+	struct hwmem_alloc_request req;
+	struct timespec t0, t1;
+	int ret;
+
+	memset(&req, 0, sizeof(req));
+	req.size = (min_kb + rand() % (max_kb - min_kb + 1)) * 1024;
+	req.default_access = HWMEM_ACCESS_READ | HWMEM_ACCESS_WRITE;
+	req.mem_type = mem_type;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	ret = ioctl(fd, HWMEM_ALLOC_IOC, &req);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	if (ret < 0) {
+		if (errno != ENOMEM) {
+			perror("HWMEM_ALLOC_IOC");
+			return -1;
+		}
+		alloc_lat.failed++;
+		return 0;
+	}
+
+	latency_add(&alloc_lat, timespec_diff_us(&t1, &t0));
+	*id = ret;
+	return 0;
+}
+
+static int do_release(int fd, int *id)
+{
+	struct timespec t0, t1;
+	int ret;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	ret = ioctl(fd, HWMEM_RELEASE_IOC, *id);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	if (ret < 0) {
+		perror("HWMEM_RELEASE_IOC");
+		free_lat.failed++;
+		return -1;
+	}
+
+	latency_add(&free_lat, timespec_diff_us(&t1, &t0));
+	*id = 0;
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [options]\n"
+		"\t-n ops\tnumber of alloc and release operations (%lu)\n"
+		"\t-l nr\tmaximum number of live buffers (%d)\n"
+		"\t-m kb\tminimum buffer size in KiB (%d)\n"
+		"\t-M kb\tmaximum buffer size in KiB (%d)\n"
+		"\t-t type\thwmem memory type (%d)\n"
+		"\t-f file\tcona debugfs file to sample, \"\" for none\n"
+		"\t\t(%s)\n"
+		"\t-i ops\toperations between fragmentation samples (%d)\n"
+		"\t-s seed\trandom seed (%u)\n"
+		"\t-d dev\thwmem device (%s)\n",
+		prog, nr_ops, nr_live, min_kb, max_kb, mem_type, cona_file,
+		sample_every, seed, device);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long op;
+	int *ids;
+	int fd, c, i, ret = 0;
+
+	while ((c = getopt(argc, argv, "n:l:m:M:t:f:i:s:d:h")) != -1) {
+		switch (c) {
+		case 'n':
+			nr_ops = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			nr_live = atoi(optarg);
+			break;
+		case 'm':
+			min_kb = atoi(optarg);
+			break;
+		case 'M':
+			max_kb = atoi(optarg);
+			break;
+		case 't':
+			mem_type = atoi(optarg);
+			break;
+		case 'f':
+			cona_file = optarg;
+			break;
+		case 'i':
+			sample_every = atoi(optarg);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			device = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (nr_live <= 0 || min_kb < PAGE_KB || max_kb < min_kb ||
+	    sample_every <= 0)
+		usage(argv[0]);
+
+	ids = calloc(nr_live, sizeof(*ids));
+	if (!ids) {
+		perror("calloc");
+		return 1;
+	}
+
+	fd = open(device, O_RDWR);
+	if (fd < 0) {
+		perror(device);
+		return 1;
+	}
+
+	srand(seed);
+
+	/* Picking a random slot makes the live set drift around nr_live / 2 */
+	for (op = 0; op < nr_ops; op++) {
+		i = rand() % nr_live;
+		if (ids[i])
+			ret = do_release(fd, &ids[i]);
+		else
+			ret = do_alloc(fd, &ids[i]);
+		if (ret)
+			break;
+
+		if (*cona_file && !(op % sample_every) && cona_sample()) {
+			perror(cona_file);
+			cona_file = "";
+		}
+	}
+
+	for (i = 0; i < nr_live; i++)
+		if (ids[i])
+			do_release(fd, &ids[i]);
+
+	close(fd);
+	free(ids);
+
+	printf("# %lu ops, up to %d live buffers of %d - %d KiB, mem type %d\n\n",
+	       op, nr_live, min_kb, max_kb, mem_type);
+	latency_print(&alloc_lat);
+	latency_print(&free_lat);
+
+	if (frag.samples)
+		printf("\n fragmentation: avg %.1f%% max %.1f%% of free space "
+		       "outside the biggest free block, up to %lu free blocks\n",
+		       frag.sum / frag.samples, frag.max, frag.free_blocks_max);
+
+	return ret ? 1 : 0;
+}
@@ -0,0 +1,779 @@
+/*
+ *
+ * binder-pingpong.c
+ *
+ * pingpong: Benchmark for binder transactions between process pairs
+ * payload: Binder transaction throughput against the payload size
+ *
+ * Each pair is a client process making synchronous transactions to its
+ * own server process and waiting for the reply. The pairs share nothing
+ * but the binder driver, so the rate of transactions against the number
+ * of pairs shows how far the driver lets unrelated transactions run in
+ * parallel.
+ *
+ * Servers are found through the context manager. If none is running,
+ * as on a plain Linux system, a small one is started that knows just
+ * enough of the service manager protocol to add and look up services.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "../../../drivers/staging/android/binder.h"
+
+#define BINDER_DEV		"/dev/binder"
+#define BINDER_MAP_SIZE		(1024 * 1024)
+#define BINDER_READ_SIZE	256
+
+#define MAX_PAIRS		64
+#define MAX_SERVICES		(MAX_PAIRS + 1)
+
+/* What the service manager understands, see service_manager.c */
+#define SVC_MGR_CHECK_SERVICE	2
+#define SVC_MGR_ADD_SERVICE	3
+#define SVC_MGR_NAME		"android.os.IServiceManager"
+
+#define PINGPONG_CODE		1	/* FIRST_CALL_TRANSACTION */
+
+static int nr_pairs = 1;
+static int loops = 10000;
+static int payload;
+
+static const struct option options[] = {
+	OPT_INTEGER('p', "pairs", &nr_pairs,
+		    "Specify number of client/server pairs"),
+	OPT_INTEGER('l', "loop", &loops,
+		    "Specify number of transactions per pair"),
+	OPT_INTEGER('s', "size", &payload,
+		    "Specify payload size in bytes"),
+	OPT_END()
+};
+
+static const char * const bench_binder_pingpong_usage[] = {
+	"perf bench binder pingpong <options>",
+	NULL
+};
+
+static int max_payload = 64 * 1024;
+
+static const struct option payload_options[] = {
+	OPT_INTEGER('p', "pairs", &nr_pairs,
+		    "Specify number of client/server pairs"),
+	OPT_INTEGER('l', "loop", &loops,
+		    "Specify number of transactions per pair"),
+	OPT_INTEGER('m', "max-size", &max_payload,
+		    "Specify largest payload size in bytes"),
+	OPT_END()
+};
+
+static const char * const bench_binder_payload_usage[] = {
+	"perf bench binder payload <options>",
+	NULL
+};
+
+struct parcel {
+	uint8_t data[256];
+	size_t len;
+	size_t pos;
+	size_t offs[1];
+	size_t nr_offs;
+};
+
+struct pair_result {
+	unsigned long long nsecs;
+	int failed;
+};
+
+static int binder_open(void)
+{
+	struct binder_version version;
+	int fd;
+
+	fd = open(BINDER_DEV, O_RDWR);
+	if (fd < 0)
+		return -1;
+
+	if (ioctl(fd, BINDER_VERSION, &version) < 0 ||
+	    version.protocol_version != BINDER_CURRENT_PROTOCOL_VERSION) {
+		fprintf(stderr, "binder protocol version mismatch\n");
+		close(fd);
+		return -1;
+	}
+
+	if (mmap(NULL, BINDER_MAP_SIZE, PROT_READ, MAP_PRIVATE, fd, 0) ==
+	    MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static int binder_write(int fd, const void *data, size_t len)
+{
+	struct binder_write_read bwr;
+	int ret;
+
+	memset(&bwr, 0, sizeof(bwr));
+	bwr.write_size = len;
+	bwr.write_buffer = (unsigned long)data;
+
+	do {
+		ret = ioctl(fd, BINDER_WRITE_READ, &bwr);
+	} while (ret < 0 && errno == EINTR);
+
+	return ret;
+}
+
+static int binder_cmd_ptr(int fd, uint32_t cmd, const void *ptr)
+{
+	struct {
+		uint32_t cmd;
+		const void *ptr;
+	} __attribute__((packed)) wr = { cmd, ptr };
+
+	return binder_write(fd, &wr, sizeof(wr));
+}
+
+static int binder_cmd_int(int fd, uint32_t cmd, uint32_t arg)
+{
+	struct {
+		uint32_t cmd;
+		uint32_t arg;
+	} __attribute__((packed)) wr = { cmd, arg };
+
+	return binder_write(fd, &wr, sizeof(wr));
+}
+
+/* Answer the reference count requests the driver makes on our objects */
+static int binder_ref_done(int fd, uint32_t cmd, const uint8_t *p)
+{
+	struct {
+		uint32_t cmd;
+		struct binder_ptr_cookie pc;
+	} __attribute__((packed)) wr;
+
+	wr.cmd = cmd;
+	memcpy(&wr.pc, p, sizeof(wr.pc));
+
+	return binder_write(fd, &wr, sizeof(wr));
+}
+
+/*
+ * Read from the driver until 'want' (BR_TRANSACTION or BR_REPLY) comes
+ * in and copy it out. A transaction is always the last command of a
+ * read, so nothing after it is lost.
+ */
+static int binder_wait(int fd, uint32_t want,
+		       struct binder_transaction_data *txn)
+{
+	uint32_t buf[BINDER_READ_SIZE / sizeof(uint32_t)];
+	struct binder_write_read bwr;
+	uint8_t *p, *end;
+	uint32_t cmd;
+	int ret;
+
+	for (;;) {
+		memset(&bwr, 0, sizeof(bwr));
+		bwr.read_size = sizeof(buf);
+		bwr.read_buffer = (unsigned long)buf;
+
+		ret = ioctl(fd, BINDER_WRITE_READ, &bwr);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		p = (uint8_t *)buf;
+		end = p + bwr.read_consumed;
+		while (p < end) {
+			memcpy(&cmd, p, sizeof(cmd));
+			p += sizeof(cmd);
+
+			switch (cmd) {
+			case BR_NOOP:
+			case BR_TRANSACTION_COMPLETE:
+			case BR_SPAWN_LOOPER:
+				break;
+			case BR_INCREFS:
+				if (binder_ref_done(fd, BC_INCREFS_DONE, p))
+					return -1;
+				p += sizeof(struct binder_ptr_cookie);
+				break;
+			case BR_ACQUIRE:
+				if (binder_ref_done(fd, BC_ACQUIRE_DONE, p))
+					return -1;
+				p += sizeof(struct binder_ptr_cookie);
+				break;
+			case BR_RELEASE:
+			case BR_DECREFS:
+				p += sizeof(struct binder_ptr_cookie);
+				break;
+			case BR_TRANSACTION:
+			case BR_REPLY:
+				memcpy(txn, p, sizeof(*txn));
+				p += sizeof(*txn);
+				if (cmd != want)
+					return -1;
+				return 0;
+			default:
+				/* BR_DEAD_REPLY, BR_FAILED_REPLY, BR_ERROR */
+				return -1;
+			}
+		}
+	}
+}
+
+static int binder_send(int fd, uint32_t cmd, uint32_t handle, uint32_t code,
+		       const void *data, size_t size,
+		       const size_t *offs, size_t nr_offs)
+{
+	struct {
+		uint32_t cmd;
+		struct binder_transaction_data txn;
+	} __attribute__((packed)) wr;
+
+	memset(&wr, 0, sizeof(wr));
+	wr.cmd = cmd;
+	wr.txn.target.handle = handle;
+	wr.txn.code = code;
+	wr.txn.flags = TF_ACCEPT_FDS;
+	wr.txn.data_size = size;
+	wr.txn.offsets_size = nr_offs * sizeof(size_t);
+	wr.txn.data.ptr.buffer = data;
+	wr.txn.data.ptr.offsets = offs;
+
+	return binder_write(fd, &wr, sizeof(wr));
+}
+
+static int binder_call(int fd, uint32_t handle, uint32_t code,
+		       struct parcel *msg, struct binder_transaction_data *reply)
+{
+	if (binder_send(fd, BC_TRANSACTION, handle, code, msg->data, msg->len,
+			msg->offs, msg->nr_offs))
+		return -1;
+
+	return binder_wait(fd, BR_REPLY, reply);
+}
+
+/*
+ * Parcels, laid out as libbinder does: 32 bit words, UTF-16 strings
+ * with a length in front and a terminator, padded to 4 bytes.
+ */
+
+static void parcel_put(struct parcel *pc, const void *p, size_t len)
+{
+	size_t padded = (len + 3) & ~3;
+
+	if (pc->len + padded > sizeof(pc->data))
+		die("parcel overflow\n");
+
+	memset(pc->data + pc->len, 0, padded);
+	memcpy(pc->data + pc->len, p, len);
+	pc->len += padded;
+}
+
+static void parcel_put_u32(struct parcel *pc, uint32_t v)
+{
+	parcel_put(pc, &v, sizeof(v));
+}
+
+static void parcel_put_string16(struct parcel *pc, const char *s)
+{
+	uint16_t str[64];
+	size_t i, len = strlen(s);
+
+	if (len >= ARRAY_SIZE(str))
+		die("string too long\n");
+
+	for (i = 0; i <= len; i++)
+		str[i] = s[i];
+
+	parcel_put_u32(pc, len);
+	parcel_put(pc, str, (len + 1) * sizeof(uint16_t));
+}
+
+static void parcel_put_obj(struct parcel *pc, struct flat_binder_object *obj)
+{
+	if (pc->nr_offs >= ARRAY_SIZE(pc->offs))
+		die("parcel overflow\n");
+
+	pc->offs[pc->nr_offs++] = pc->len;
+	parcel_put(pc, obj, sizeof(*obj));
+}
+
+static void parcel_init(struct parcel *pc, const void *data, size_t len)
+{
+	memset(pc, 0, sizeof(*pc));
+	if (len > sizeof(pc->data))
+		len = sizeof(pc->data);
+	memcpy(pc->data, data, len);
+	pc->len = len;
+}
+
+static int parcel_get(struct parcel *pc, void *p, size_t len)
+{
+	size_t padded = (len + 3) & ~3;
+
+	if (pc->pos + padded > pc->len)
+		return -1;
+
+	memcpy(p, pc->data + pc->pos, len);
+	pc->pos += padded;
+	return 0;
+}
+
+static int parcel_get_u32(struct parcel *pc, uint32_t *v)
+{
+	return parcel_get(pc, v, sizeof(*v));
+}
+
+/* Gets a string16 of ASCII characters into s */
+static int parcel_get_string16(struct parcel *pc, char *s, size_t size)
+{
+	uint16_t str[64];
+	uint32_t i, len;
+
+	if (parcel_get_u32(pc, &len) || len >= size || len >= ARRAY_SIZE(str))
+		return -1;
+	if (parcel_get(pc, str, (len + 1) * sizeof(uint16_t)))
+		return -1;
+
+	for (i = 0; i <= len; i++)
+		s[i] = str[i];
+	return 0;
+}
+
+static void parcel_put_svc_header(struct parcel *pc)
+{
+	parcel_put_u32(pc, 0);		/* strict mode policy */
+	parcel_put_string16(pc, SVC_MGR_NAME);
+}
+
+/* The handle in the first object of a received transaction */
+static int txn_get_handle(struct binder_transaction_data *txn,
+			  uint32_t *handle)
+{
+	const struct flat_binder_object *obj;
+	size_t off;
+
+	if (txn->offsets_size < sizeof(size_t))
+		return -1;
+
+	memcpy(&off, txn->data.ptr.offsets, sizeof(off));
+	if (off + sizeof(*obj) > txn->data_size)
+		return -1;
+
+	obj = (const void *)((const uint8_t *)txn->data.ptr.buffer + off);
+	if (obj->type != BINDER_TYPE_HANDLE)
+		return -1;
+
+	*handle = obj->handle;
+	return 0;
+}
+
+static void report(int fd, char status)
+{
+	if (write(fd, &status, 1) != 1)
+		exit(1);
+}
+
+/*
+ * Minimal context manager, only used if no service manager is running.
+ * It holds on to the handles it is given and passes them back out.
+ */
+static void NORETURN run_context_manager(int ready_fd)
+{
+	struct {
+		char name[64];
+		uint32_t handle;
+	} services[MAX_SERVICES];
+	struct binder_transaction_data txn;
+	struct flat_binder_object obj;
+	struct parcel msg, reply;
+	char iface[64], name[64];
+	uint32_t policy, handle;
+	int fd, i, nr_services = 0;
+
+	fd = binder_open();
+	if (fd < 0) {
+		report(ready_fd, 'e');
+		exit(1);
+	}
+	/* Fails with EBUSY if the service manager is running */
+	if (ioctl(fd, BINDER_SET_CONTEXT_MGR, 0) < 0 ||
+	    binder_cmd_int(fd, BC_ENTER_LOOPER, 0) < 0) {
+		report(ready_fd, 'n');
+		exit(0);
+	}
+	report(ready_fd, 'c');
+
+	for (;;) {
+		if (binder_wait(fd, BR_TRANSACTION, &txn))
+			exit(1);
+
+		parcel_init(&msg, txn.data.ptr.buffer, txn.data_size);
+		memset(&reply, 0, sizeof(reply));
+		i = nr_services;
+
+		if (parcel_get_u32(&msg, &policy) ||
+		    parcel_get_string16(&msg, iface, sizeof(iface)) ||
+		    strcmp(iface, SVC_MGR_NAME) ||
+		    parcel_get_string16(&msg, name, sizeof(name)))
+			goto reply;
+
+		for (i = 0; i < nr_services; i++)
+			if (!strcmp(services[i].name, name))
+				break;
+
+		if (txn.code == SVC_MGR_ADD_SERVICE && i == nr_services &&
+		    nr_services < MAX_SERVICES && !txn_get_handle(&txn, &handle)) {
+			/* Keep the reference once the buffer is freed */
+			if (binder_cmd_int(fd, BC_ACQUIRE, handle))
+				exit(1);
+			strcpy(services[i].name, name);
+			services[i].handle = handle;
+			nr_services++;
+		} else if (txn.code == SVC_MGR_CHECK_SERVICE &&
+			   i < nr_services) {
+			memset(&obj, 0, sizeof(obj));
+			obj.type = BINDER_TYPE_HANDLE;
+			obj.flags = 0x7f | FLAT_BINDER_FLAG_ACCEPTS_FDS;
+			obj.handle = services[i].handle;
+			parcel_put_obj(&reply, &obj);
+		}
+reply:
+		if (!reply.len)
+			parcel_put_u32(&reply, 0);
+
+		if (binder_cmd_ptr(fd, BC_FREE_BUFFER, txn.data.ptr.buffer) ||
+		    binder_send(fd, BC_REPLY, 0, 0, reply.data, reply.len,
+				reply.offs, reply.nr_offs))
+			exit(1);
+	}
+}
+
+static int add_service(int fd, const char *name, void *ptr)
+{
+	struct binder_transaction_data reply;
+	struct flat_binder_object obj;
+	struct parcel msg;
+
+	memset(&msg, 0, sizeof(msg));
+	parcel_put_svc_header(&msg);
+	parcel_put_string16(&msg, name);
+
+	memset(&obj, 0, sizeof(obj));
+	obj.type = BINDER_TYPE_BINDER;
+	obj.flags = 0x7f | FLAT_BINDER_FLAG_ACCEPTS_FDS;
+	obj.binder = ptr;
+	parcel_put_obj(&msg, &obj);
+	parcel_put_u32(&msg, 0);	/* allow isolated */
+
+	if (binder_call(fd, 0, SVC_MGR_ADD_SERVICE, &msg, &reply))
+		return -1;
+
+	return binder_cmd_ptr(fd, BC_FREE_BUFFER, reply.data.ptr.buffer);
+}
+
+static int check_service(int fd, const char *name, uint32_t *handle)
+{
+	struct binder_transaction_data reply;
+	struct parcel msg;
+	int ret;
+
+	memset(&msg, 0, sizeof(msg));
+	parcel_put_svc_header(&msg);
+	parcel_put_string16(&msg, name);
+
+	if (binder_call(fd, 0, SVC_MGR_CHECK_SERVICE, &msg, &reply))
+		return -1;
+
+	ret = txn_get_handle(&reply, handle);
+	/* Keep the reference once the reply is freed */
+	if (!ret)
+		ret = binder_cmd_int(fd, BC_ACQUIRE, *handle);
+	if (binder_cmd_ptr(fd, BC_FREE_BUFFER, reply.data.ptr.buffer))
+		ret = -1;
+
+	return ret;
+}
+
+static void service_name(char *name, size_t size, int pair)
+{
+	snprintf(name, size, "perf.bench.binder.%d.%d", (int)getppid(), pair);
+}
+
+/* Replies to every transaction with an empty reply */
+static void NORETURN run_server(int pair, int ready_fd)
+{
+	struct binder_transaction_data txn;
+	char name[64];
+	int fd;
+
+	fd = binder_open();
+	service_name(name, sizeof(name), pair);
+	if (fd < 0 || add_service(fd, name, &txn) ||
+	    binder_cmd_int(fd, BC_ENTER_LOOPER, 0) < 0) {
+		report(ready_fd, 0);
+		exit(1);
+	}
+	report(ready_fd, 1);
+
+	for (;;) {
+		if (binder_wait(fd, BR_TRANSACTION, &txn))
+			exit(1);
+		if (binder_cmd_ptr(fd, BC_FREE_BUFFER, txn.data.ptr.buffer) ||
+		    binder_send(fd, BC_REPLY, 0, 0, NULL, 0, NULL, 0))
+			exit(1);
+	}
+}
+
+static void NORETURN run_client(int pair, int ready_fd, int start_fd,
+				int result_fd, void *buf, size_t size)
+{
+	struct binder_transaction_data reply;
+	struct pair_result result;
+	struct timespec start, end;
+	uint32_t handle;
+	char name[64];
+	char go;
+	int fd, i;
+
+	fd = binder_open();
+	service_name(name, sizeof(name), pair);
+	if (fd < 0 || check_service(fd, name, &handle)) {
+		report(ready_fd, 0);
+		exit(1);
+	}
+	report(ready_fd, 1);
+
+	if (read(start_fd, &go, 1) != 1)
+		exit(1);
+
+	memset(&result, 0, sizeof(result));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < loops; i++) {
+		if (binder_send(fd, BC_TRANSACTION, handle, PINGPONG_CODE,
+				buf, size, NULL, 0) ||
+		    binder_wait(fd, BR_REPLY, &reply) ||
+		    binder_cmd_ptr(fd, BC_FREE_BUFFER,
+				   reply.data.ptr.buffer)) {
+			result.failed = 1;
+			break;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	result.nsecs = (end.tv_sec - start.tv_sec) * 1000000000ULL +
+		end.tv_nsec - start.tv_nsec;
+	if (write(result_fd, &result, sizeof(result)) != sizeof(result))
+		exit(1);
+	exit(0);
+}
+
+static int wait_ready(int fd, int count)
+{
+	char status;
+
+	while (count--) {
+		if (read(fd, &status, 1) != 1 || !status)
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Runs the pairs and returns the mean time per transaction and the
+ * total number of transactions per second over all pairs.
+ */
+static int run_pingpong(int pairs, size_t size, double *usecs, double *ops)
+{
+	pid_t pids[2 * MAX_PAIRS + 1];
+	int ready[2], start[2], result[2];
+	struct pair_result res;
+	int i, nr_pids = 0, ret = -1;
+	char status;
+	void *buf;
+
+	buf = calloc(1, size ? size : 1);
+	if (!buf)
+		die("calloc");
+	if (pipe(ready) || pipe(start) || pipe(result))
+		die("pipe");
+
+	/* Take over as context manager if nothing else is one */
+	pids[nr_pids] = fork();
+	if (pids[nr_pids] < 0)
+		die("fork");
+	if (!pids[nr_pids])
+		run_context_manager(ready[1]);
+	nr_pids++;
+	if (read(ready[0], &status, 1) != 1 || status == 'e') {
+		fprintf(stderr, "cannot open %s\n", BINDER_DEV);
+		goto out;
+	}
+
+	for (i = 0; i < pairs; i++) {
+		pids[nr_pids] = fork();
+		if (pids[nr_pids] < 0)
+			die("fork");
+		if (!pids[nr_pids])
+			run_server(i, ready[1]);
+		nr_pids++;
+	}
+	if (wait_ready(ready[0], pairs)) {
+		fprintf(stderr, "binder servers failed to start\n");
+		goto out;
+	}
+
+	for (i = 0; i < pairs; i++) {
+		pids[nr_pids] = fork();
+		if (pids[nr_pids] < 0)
+			die("fork");
+		if (!pids[nr_pids])
+			run_client(i, ready[1], start[0], result[1], buf, size);
+		nr_pids++;
+	}
+	if (wait_ready(ready[0], pairs)) {
+		fprintf(stderr, "binder clients failed to find servers\n");
+		goto out;
+	}
+
+	for (i = 0; i < pairs; i++)
+		if (write(start[1], "g", 1) != 1)
+			die("write");
+
+	*usecs = 0;
+	*ops = 0;
+	for (i = 0; i < pairs; i++) {
+		if (read(result[0], &res, sizeof(res)) != sizeof(res) ||
+		    res.failed || !res.nsecs) {
+			fprintf(stderr, "binder transactions failed\n");
+			goto out;
+		}
+		*usecs += res.nsecs / 1000.0 / loops / pairs;
+		*ops += loops * 1000000000.0 / res.nsecs;
+	}
+	ret = 0;
+
+out:
+	for (i = 0; i < nr_pids; i++) {
+		kill(pids[i], SIGKILL);
+		waitpid(pids[i], NULL, 0);
+	}
+	close(ready[0]);
+	close(ready[1]);
+	close(start[0]);
+	close(start[1]);
+	close(result[0]);
+	close(result[1]);
+	free(buf);
+
+	return ret;
+}
+
+int bench_binder_pingpong(int argc, const char **argv,
+			  const char *prefix __used)
+{
+	double usecs, ops;
+
+	argc = parse_options(argc, argv, options,
+			     bench_binder_pingpong_usage, 0);
+
+	if (nr_pairs <= 0 || nr_pairs > MAX_PAIRS || loops <= 0 ||
+	    payload < 0 || payload > BINDER_MAP_SIZE / 2)
+		usage_with_options(bench_binder_pingpong_usage, options);
+
+	if (run_pingpong(nr_pairs, payload, &usecs, &ops))
+		return 1;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %d client/server pairs, %d transactions of %d bytes each\n\n",
+		       nr_pairs, loops, payload);
+		printf(" %14lf usecs/op\n", usecs);
+		printf(" %14.0lf ops/sec\n", ops);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%.0lf\n", ops);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
+
+/*
+ * Runs pingpong with payloads from 0 bytes up to the maximum, each size
+ * four times the one before, to show where copying the payload starts
+ * to dominate the cost of a transaction.
+ */
+int bench_binder_payload(int argc, const char **argv,
+			 const char *prefix __used)
+{
+	double usecs, ops;
+	int size;
+
+	argc = parse_options(argc, argv, payload_options,
+			     bench_binder_payload_usage, 0);
+
+	if (nr_pairs <= 0 || nr_pairs > MAX_PAIRS || loops <= 0 ||
+	    max_payload < 0 || max_payload > BINDER_MAP_SIZE / 2)
+		usage_with_options(bench_binder_payload_usage,
+				   payload_options);
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# %d client/server pairs, %d transactions per size\n\n"
+		       "%10s %14s %14s %14s\n", nr_pairs, loops,
+		       "bytes", "usecs/op", "ops/sec", "MB/sec");
+
+	for (size = 0; size <= max_payload; size = size ? size * 4 : 16) {
+		if (run_pingpong(nr_pairs, size, &usecs, &ops))
+			return 1;
+
+		switch (bench_format) {
+		case BENCH_FORMAT_DEFAULT:
+			printf("%10d %14lf %14.0lf %14.2lf\n", size, usecs,
+			       ops, ops * size / (1024 * 1024));
+			break;
+
+		case BENCH_FORMAT_SIMPLE:
+			printf("%d %.0lf\n", size, ops);
+			break;
+
+		default:
+			/* reaching here is something disaster */
+			fprintf(stderr, "Unknown format:%d\n", bench_format);
+			exit(1);
+			break;
+		}
+	}
+
+	return 0;
+}
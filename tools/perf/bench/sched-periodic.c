@@ -0,0 +1,244 @@
+/*
+ *
+ * sched-periodic.c
+ *
+ * periodic: Benchmark for wakeup placement of small periodic tasks
+ *
+ * A number of tasks each wake up once per period, run for a short while
+ * and sleep again, with their wakeups spread evenly over the period.
+ * Nothing is pinned, so where the scheduler wakes them decides how often
+ * each CPU leaves idle and how deep it gets to sleep in between. The
+ * cpuidle statistics of every CPU are sampled around the run and the
+ * number of idle state entries (that is, wakeups) and the residency of
+ * each state are reported.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/types.h>
+
+#define MAX_CPUS		64
+#define MAX_STATES		8	/* CPUIDLE_STATE_MAX */
+
+static int nr_tasks = 4;
+static int period_us = 16000;
+static int run_us = 500;
+static int seconds = 10;
+
+static const struct option options[] = {
+	OPT_INTEGER('t', "tasks", &nr_tasks,
+		    "Specify number of periodic tasks"),
+	OPT_INTEGER('p', "period", &period_us,
+		    "Specify period in usecs"),
+	OPT_INTEGER('r', "run", &run_us,
+		    "Specify run time per period in usecs"),
+	OPT_INTEGER('s', "seconds", &seconds,
+		    "Specify duration in seconds"),
+	OPT_END()
+};
+
+static const char * const bench_sched_periodic_usage[] = {
+	"perf bench sched periodic <options>",
+	NULL
+};
+
+struct idle_state {
+	char name[16];
+	unsigned long long usage;
+	unsigned long long time;	/* usecs */
+};
+
+struct idle_stat {
+	int nr_states;
+	struct idle_state state[MAX_STATES];
+};
+
+static struct idle_stat before[MAX_CPUS], after[MAX_CPUS];
+
+static int read_idle_attr(int cpu, int state, const char *attr,
+			  char *buf, int len)
+{
+	char path[96];
+	FILE *f;
+	int ret = -1;
+
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/cpu/cpu%d/cpuidle/state%d/%s",
+		 cpu, state, attr);
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	if (fgets(buf, len, f)) {
+		buf[strcspn(buf, "\n")] = '\0';
+		ret = 0;
+	}
+	fclose(f);
+	return ret;
+}
+
+static void read_idle_stats(struct idle_stat *stat, int nr_cpus)
+{
+	struct idle_state *s;
+	char buf[32];
+	int cpu, i;
+
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		stat[cpu].nr_states = 0;
+		for (i = 0; i < MAX_STATES; i++) {
+			s = &stat[cpu].state[i];
+			if (read_idle_attr(cpu, i, "name", s->name,
+					   sizeof(s->name)))
+				break;
+			if (read_idle_attr(cpu, i, "usage", buf, sizeof(buf)))
+				break;
+			s->usage = strtoull(buf, NULL, 10);
+			if (read_idle_attr(cpu, i, "time", buf, sizeof(buf)))
+				break;
+			s->time = strtoull(buf, NULL, 10);
+			stat[cpu].nr_states = i + 1;
+		}
+	}
+}
+
+static void timespec_add_us(struct timespec *ts, long us)
+{
+	ts->tv_nsec += us * 1000;
+	while (ts->tv_nsec >= 1000000000) {
+		ts->tv_nsec -= 1000000000;
+		ts->tv_sec++;
+	}
+}
+
+static int timespec_before(struct timespec *a, struct timespec *b)
+{
+	return a->tv_sec < b->tv_sec ||
+		(a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static void NORETURN run_task(struct timespec *start, long offset_us)
+{
+	struct timespec next = *start, end = *start, spin, now;
+
+	end.tv_sec += seconds;
+	timespec_add_us(&next, offset_us);
+
+	while (timespec_before(&next, &end)) {
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+		clock_gettime(CLOCK_MONOTONIC, &spin);
+		timespec_add_us(&spin, run_us);
+		do {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+		} while (timespec_before(&now, &spin));
+
+		timespec_add_us(&next, period_us);
+	}
+	exit(0);
+}
+
+int bench_sched_periodic(int argc, const char **argv,
+			 const char *prefix __used)
+{
+	struct timespec start;
+	unsigned long long usage, time, total_usage = 0;
+	unsigned long long wall_us;
+	struct idle_state *s;
+	pid_t *pids;
+	int nr_cpus, cpu, i;
+
+	argc = parse_options(argc, argv, options,
+			     bench_sched_periodic_usage, 0);
+
+	if (nr_tasks <= 0 || period_us <= 0 || run_us < 0 ||
+	    run_us >= period_us || seconds <= 0)
+		usage_with_options(bench_sched_periodic_usage, options);
+
+	nr_cpus = sysconf(_SC_NPROCESSORS_CONF);
+	if (nr_cpus > MAX_CPUS)
+		nr_cpus = MAX_CPUS;
+
+	pids = calloc(nr_tasks, sizeof(pid_t));
+	if (!pids)
+		die("calloc");
+
+	/* Give the forks time to settle before the first period */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	timespec_add_us(&start, 100000);
+
+	read_idle_stats(before, nr_cpus);
+
+	for (i = 0; i < nr_tasks; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0)
+			die("fork");
+		if (!pids[i])
+			run_task(&start, (long)period_us * i / nr_tasks);
+	}
+
+	for (i = 0; i < nr_tasks; i++)
+		waitpid(pids[i], NULL, 0);
+	free(pids);
+
+	read_idle_stats(after, nr_cpus);
+
+	wall_us = (unsigned long long)seconds * 1000000;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %d tasks running %d usecs every %d usecs for %d secs\n\n",
+		       nr_tasks, run_us, period_us, seconds);
+
+		for (cpu = 0; cpu < nr_cpus; cpu++) {
+			if (!after[cpu].nr_states)
+				continue;
+			printf(" cpu%d:\n", cpu);
+			for (i = 0; i < after[cpu].nr_states; i++) {
+				s = &after[cpu].state[i];
+				usage = s->usage - before[cpu].state[i].usage;
+				time = s->time - before[cpu].state[i].time;
+				total_usage += usage;
+				printf(" %14s: %10llu entries %10llu [usec] %5.1f%%\n",
+				       s->name, usage, time,
+				       100.0 * time / wall_us);
+			}
+		}
+		if (!total_usage)
+			printf(" no cpuidle statistics available\n");
+		else
+			printf("\n %14s: %10llu entries, %.1f per second\n",
+			       "total", total_usage,
+			       (double)total_usage / seconds);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		for (cpu = 0; cpu < nr_cpus; cpu++) {
+			for (i = 0; i < after[cpu].nr_states; i++) {
+				s = &after[cpu].state[i];
+				printf("%d %s %llu %llu\n", cpu, s->name,
+				       s->usage - before[cpu].state[i].usage,
+				       s->time - before[cpu].state[i].time);
+			}
+		}
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
@@ -0,0 +1,232 @@
+/*
+ *
+ * sched-wakeup.c
+ *
+ * wakeup: Benchmark for wakeup latency under background load
+ *
+ * A periodic task sleeps until an absolute deadline and measures how
+ * late it gets to run, while CPU hogs keep its CPU busy. Everything is
+ * pinned to one CPU, so the latency measured is that of wakeup
+ * preemption rather than of wakeup placement. Latency nice values for
+ * the periodic task and the hogs can be set through
+ * /proc/<pid>/task/<tid>/latency_nice to compare wakeup classes.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <sched.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <sys/types.h>
+#include <sys/syscall.h>
+
+#define LOOPS_DEFAULT		10000
+#define HIST_USECS		10000	/* 1us buckets up to 10ms */
+
+static int loops = LOOPS_DEFAULT;
+static int period_us = 1000;
+static int nr_hogs = 2;
+static int cpu;
+static int latency_nice;
+static int hog_latency_nice;
+static bool show_hist;
+
+static const struct option options[] = {
+	OPT_INTEGER('l', "loop", &loops,
+		    "Specify number of wakeups"),
+	OPT_INTEGER('p', "period", &period_us,
+		    "Specify sleep period in usecs"),
+	OPT_INTEGER('b', "hogs", &nr_hogs,
+		    "Specify number of background CPU hogs"),
+	OPT_INTEGER('c', "cpu", &cpu,
+		    "Specify CPU to run everything on"),
+	OPT_INTEGER('L', "latency-nice", &latency_nice,
+		    "Specify latency nice of the periodic task"),
+	OPT_INTEGER('B', "hog-latency-nice", &hog_latency_nice,
+		    "Specify latency nice of the hogs"),
+	OPT_BOOLEAN('H', "histogram", &show_hist,
+		    "Print the latency histogram"),
+	OPT_END()
+};
+
+static const char * const bench_sched_wakeup_usage[] = {
+	"perf bench sched wakeup <options>",
+	NULL
+};
+
+static unsigned long hist[HIST_USECS + 1];
+
+static void pin_self(void)
+{
+	cpu_set_t mask;
+
+	CPU_ZERO(&mask);
+	CPU_SET(cpu, &mask);
+	if (sched_setaffinity(0, sizeof(mask), &mask)) {
+		fprintf(stderr, "cannot pin to cpu%d: %s\n",
+			cpu, strerror(errno));
+		exit(1);
+	}
+}
+
+static void set_latency_nice(int value)
+{
+	char path[64];
+	FILE *f;
+
+	if (!value)
+		return;
+
+	snprintf(path, sizeof(path), "/proc/self/task/%d/latency_nice",
+		 (int)syscall(__NR_gettid));
+	f = fopen(path, "w");
+	if (!f || fprintf(f, "%d\n", value) < 0 || fclose(f)) {
+		fprintf(stderr, "cannot set latency nice %d: %s\n",
+			value, strerror(errno));
+		exit(1);
+	}
+}
+
+static void NORETURN run_hog(void)
+{
+	volatile unsigned long spin = 0;
+
+	pin_self();
+	set_latency_nice(hog_latency_nice);
+	for (;;)
+		spin++;
+}
+
+static void timespec_add_us(struct timespec *ts, long us)
+{
+	ts->tv_nsec += us * 1000;
+	while (ts->tv_nsec >= 1000000000) {
+		ts->tv_nsec -= 1000000000;
+		ts->tv_sec++;
+	}
+}
+
+static long timespec_diff_us(struct timespec *a, struct timespec *b)
+{
+	return (a->tv_sec - b->tv_sec) * 1000000 +
+		(a->tv_nsec - b->tv_nsec) / 1000;
+}
+
+static long hist_percentile(int percent)
+{
+	unsigned long want = ((unsigned long)loops * percent + 99) / 100;
+	unsigned long seen = 0;
+	int i;
+
+	for (i = 0; i <= HIST_USECS; i++) {
+		seen += hist[i];
+		if (seen >= want)
+			return i;
+	}
+	return HIST_USECS;
+}
+
+int bench_sched_wakeup(int argc, const char **argv,
+		       const char *prefix __used)
+{
+	struct timespec next, now;
+	long lat, min = -1, max = 0;
+	unsigned long long sum = 0;
+	pid_t *hogs;
+	int i;
+
+	argc = parse_options(argc, argv, options,
+			     bench_sched_wakeup_usage, 0);
+
+	if (loops <= 0 || period_us <= 0 || nr_hogs < 0)
+		usage_with_options(bench_sched_wakeup_usage, options);
+
+	hogs = calloc(nr_hogs, sizeof(pid_t));
+	if (nr_hogs && !hogs)
+		die("calloc");
+
+	for (i = 0; i < nr_hogs; i++) {
+		hogs[i] = fork();
+		if (hogs[i] < 0)
+			die("fork");
+		if (!hogs[i])
+			run_hog();
+	}
+
+	pin_self();
+	set_latency_nice(latency_nice);
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (i = 0; i < loops; i++) {
+		timespec_add_us(&next, period_us);
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		lat = timespec_diff_us(&now, &next);
+		if (lat < 0)
+			lat = 0;
+		hist[lat < HIST_USECS ? lat : HIST_USECS]++;
+		sum += lat;
+		if (min < 0 || lat < min)
+			min = lat;
+		if (lat > max)
+			max = lat;
+	}
+
+	for (i = 0; i < nr_hogs; i++) {
+		kill(hogs[i], SIGKILL);
+		waitpid(hogs[i], NULL, 0);
+	}
+	free(hogs);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %d wakeups every %d usecs on cpu%d against %d hogs\n",
+		       loops, period_us, cpu, nr_hogs);
+		printf("# latency nice %d, hogs latency nice %d\n\n",
+		       latency_nice, hog_latency_nice);
+
+		printf(" %14s: %ld [usec]\n", "min", min);
+		printf(" %14s: %llu [usec]\n", "avg", sum / loops);
+		printf(" %14s: %ld [usec]\n", "50%", hist_percentile(50));
+		printf(" %14s: %ld [usec]\n", "90%", hist_percentile(90));
+		printf(" %14s: %ld [usec]\n", "99%", hist_percentile(99));
+		printf(" %14s: %ld [usec]\n", "max", max);
+
+		if (show_hist) {
+			printf("\n# usec  count\n");
+			for (i = 0; i < HIST_USECS; i++)
+				if (hist[i])
+					printf(" %5d  %lu\n", i, hist[i]);
+			if (hist[HIST_USECS])
+				printf(">%5d  %lu\n", HIST_USECS,
+				       hist[HIST_USECS]);
+		}
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%ld %llu %ld %ld %ld %ld\n", min, sum / loops,
+		       hist_percentile(50), hist_percentile(90),
+		       hist_percentile(99), max);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
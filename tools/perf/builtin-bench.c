@@ -11,8 +11,9 @@
 /*
  *
  * Available subsystem list:
- *  sched ... scheduler and IPC mechanism
- *  mem   ... memory access performance
+ *  sched  ... scheduler and IPC mechanism
+ *  mem    ... memory access performance
+ *  binder ... binder IPC
  *
  */
 
@@ -42,6 +43,12 @@ static struct bench_suite sched_suites[] = {
 	{ "pipe",
 	  "Flood of communication over pipe() between two processes",
 	  bench_sched_pipe      },
+	{ "wakeup",
+	  "Wakeup latency of a periodic task against CPU hogs",
+	  bench_sched_wakeup    },
+	{ "periodic",
+	  "Idle state entries and residency under small periodic tasks",
+	  bench_sched_periodic  },
 	suite_all,
 	{ NULL,
 	  NULL,
@@ -58,6 +65,19 @@ static struct bench_suite mem_suites[] = {
 	  NULL             }
 };
 
+static struct bench_suite binder_suites[] = {
+	{ "pingpong",
+	  "Transactions between client/server process pairs",
+	  bench_binder_pingpong },
+	{ "payload",
+	  "Transaction throughput against the payload size",
+	  bench_binder_payload  },
+	suite_all,
+	{ NULL,
+	  NULL,
+	  NULL                  }
+};
+
 struct bench_subsys {
 	const char *name;
 	const char *summary;
@@ -71,6 +91,9 @@ static struct bench_subsys subsystems[] = {
 	{ "mem",
 	  "memory access performance",
 	  mem_suites },
+	{ "binder",
+	  "binder IPC",
+	  binder_suites },
 	{ "all",		/* sentinel: easy for help */
 	  "test all subsystem (pseudo subsystem)",
 	  NULL },